@@ -0,0 +1,1040 @@
+/*
+ * Microbenchmarks of the encoders and validators.
+ *
+ * Every case runs in calibrated loops: the iteration count doubles until a run takes
+ * BENCH_CALIBRATE_NS, is then scaled to BENCH_TARGET_NS and the best of BENCH_SAMPLES runs is
+ * reported. Cycles come from perf_event_open when the kernel allows it, allocations from the
+ * malloc wrappers below (the bench binary links with -Wl,--wrap=malloc,...).
+ *
+ * usage: pcmm_cops_api_bench [results.json]
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cops.h"
+#include "cops_admit.h"
+#include "cops_batch.h"
+#include "cops_builder.h"
+#include "cops_decoder.h"
+#include "cops_gate.h"
+#include "cops_integrity.h"
+#include "cops_metrics.h"
+#include "cops_pool.h"
+#include "cops_radix.h"
+#include "cops_server.h"
+#include "cops_snap.h"
+#include "cops_sync.h"
+#include "cops_template.h"
+#include "cops_trace.h"
+#include "cops_txn.h"
+#include "cops_validate.h"
+#include "pcmm.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_CALIBRATE_NS 20000000ULL
+#define BENCH_TARGET_NS    200000000ULL
+#define BENCH_SAMPLES      5
+#define BENCH_MAX_CASES    48
+#define BENCH_BATCH        64
+
+/* Keep the compiler from discarding results or hoisting work out of the loop. */
+#define bench_clobber(p) __asm__ volatile("" : : "g"(p) : "memory")
+
+/*
+ * A benchmark case. fn performs iters iterations of ops_per_iter operations each (e.g. a
+ * batch encode of 64 messages counts 64 operations).
+ */
+struct bench_case {
+        const char* name;
+        void (*fn)(uint64_t iters);
+        uint32_t ops_per_iter;
+};
+
+struct bench_result {
+        const char* name;
+        uint64_t ops;
+        double ns_per_op;
+        double ops_per_sec;
+        double cycles_per_op; /* < 0 when no cycle counter is available. */
+        double allocs_per_op;
+};
+
+/* Allocation accounting, the bench binary is linked with --wrap for these symbols. */
+static uint64_t bench_allocs;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __real_aligned_alloc(size_t align, size_t size);
+void* __wrap_malloc(size_t size);
+void* __wrap_calloc(size_t n, size_t size);
+void* __wrap_realloc(void* ptr, size_t size);
+void* __wrap_aligned_alloc(size_t align, size_t size);
+
+void*
+__wrap_malloc(size_t size) {
+        bench_allocs++;
+        return __real_malloc(size);
+}
+
+void*
+__wrap_calloc(size_t n, size_t size) {
+        bench_allocs++;
+        return __real_calloc(n, size);
+}
+
+void*
+__wrap_realloc(void* ptr, size_t size) {
+        bench_allocs++;
+        return __real_realloc(ptr, size);
+}
+
+void*
+__wrap_aligned_alloc(size_t align, size_t size) {
+        bench_allocs++;
+        return __real_aligned_alloc(align, size);
+}
+
+static uint64_t
+bench_now_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* User space CPU cycle counter of the calling thread, -1 when unavailable. */
+static int
+bench_cycles_open(void) {
+#ifdef __linux__
+        struct perf_event_attr attr = {0};
+
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+        return -1;
+#endif
+}
+
+static void
+bench_cycles_start(int fd) {
+#ifdef __linux__
+        if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+}
+
+static int64_t
+bench_cycles_stop(int fd) {
+#ifdef __linux__
+        uint64_t cycles;
+
+        if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd, &cycles, sizeof(cycles)) == sizeof(cycles))
+                        return (int64_t)cycles;
+        }
+#endif
+        return -1;
+}
+
+static void
+bench_run(const struct bench_case* c, int perf_fd, struct bench_result* r) {
+        uint64_t iters = 1;
+        uint64_t elapsed;
+
+        /* Calibrate, then scale the iteration count to the target run time. */
+        for (;;) {
+                uint64_t start = bench_now_ns();
+                c->fn(iters);
+                elapsed = bench_now_ns() - start;
+
+                if (elapsed >= BENCH_CALIBRATE_NS || iters >= (1ULL << 40))
+                        break;
+                iters *= 2;
+        }
+        iters = (uint64_t)((double)iters * BENCH_TARGET_NS / (double)(elapsed ? elapsed : 1));
+        if (iters == 0)
+                iters = 1;
+
+        r->name = c->name;
+        r->ops = iters * c->ops_per_iter;
+        r->ns_per_op = -1;
+        r->cycles_per_op = -1;
+
+        for (int s = 0; s < BENCH_SAMPLES; s++) {
+                uint64_t allocs = bench_allocs;
+
+                bench_cycles_start(perf_fd);
+                uint64_t start = bench_now_ns();
+                c->fn(iters);
+                elapsed = bench_now_ns() - start;
+                int64_t cycles = bench_cycles_stop(perf_fd);
+
+                double ns = (double)elapsed / (double)r->ops;
+                if (r->ns_per_op < 0 || ns < r->ns_per_op) {
+                        r->ns_per_op = ns;
+                        r->cycles_per_op = (cycles >= 0) ? (double)cycles / (double)r->ops : -1;
+                        r->allocs_per_op = (double)(bench_allocs - allocs) / (double)r->ops;
+                }
+        }
+
+        r->ops_per_sec = 1e9 / r->ns_per_op;
+}
+
+/*
+ * Cases. Inputs live in static storage and are varied by the loop counter where that is cheap
+ * so the compiler cannot fold the calls.
+ */
+
+static uint8_t bench_buf[BENCH_BATCH * 128];
+
+static const uint8_t bench_gate_spec[PCMM_GATE_SPEC_LEN] = {0, 0, 0, 0, 0, 200, 0, 0, 0, 0, 0, 0};
+static const uint8_t bench_profile[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t bench_profile_words[1] = {1};
+
+static void
+bench_layout(struct cops_dec_layout* l) {
+        memset(l, 0, sizeof(*l));
+        l->command = PCMM_GATE_SET;
+        l->am_tag = 0x1234;
+        l->app_type = 0x0001;
+        l->family = AF_INET;
+        l->gate_id = true;
+        l->gate_spec = bench_gate_spec;
+        l->profile = bench_profile;
+        l->profile_len = sizeof(bench_profile);
+        l->profile_stype = PCMM_STYPE_BEST_EFFORT;
+        l->profile_words = bench_profile_words;
+        l->nprofile_words = 1;
+}
+
+static void
+bench_header_ok(uint64_t iters) {
+        static const uint8_t opcodes[8] = {1, 2, 3, 4, 6, 7, 8, 9};
+        unsigned ok = 0;
+
+        for (uint64_t i = 0; i < iters; i++) {
+                uint8_t op = opcodes[i & 7];
+                ok += cops_header_ok(op, op == 9 ? 0 : PCMM_CLIENT_TYPE, 8 + (i & 0xFC));
+        }
+        bench_clobber(ok);
+}
+
+static void
+bench_keepalive(uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++) {
+                cops_keepalive(bench_buf);
+                bench_clobber(bench_buf);
+        }
+}
+
+static void
+bench_client_accept(uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++) {
+                cops_client_accept(bench_buf, 30 + (i & 7), 15);
+                bench_clobber(bench_buf);
+        }
+}
+
+static void
+bench_new_message(uint64_t iters) {
+        uint8_t objs[16];
+
+        cops_handle(objs, "abcd");
+        cops_context(objs + 8);
+        for (uint64_t i = 0; i < iters; i++) {
+                new_cops_message(bench_buf, 2, objs, 24);
+                bench_clobber(bench_buf);
+        }
+}
+
+/* The inline header store the builders share, no call and no body copy. */
+static void
+bench_put_header(uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++) {
+                cops_put_header(bench_buf, 2, 24 + (i & 0xFC));
+                bench_clobber(bench_buf);
+        }
+}
+
+static void
+bench_pack_ctl_objs(uint64_t iters) {
+        uint8_t handle[8], context[8], decision[8], command[8] = {0}, application[8] = {0};
+        uint8_t subscriber[4] = {10, 0, 0, 1};
+        size_t len = 0;
+
+        cops_handle(handle, "abcd");
+        cops_context(context);
+        cops_decision(decision);
+        for (uint64_t i = 0; i < iters; i++) {
+                len += pack_ctl_objs(bench_buf, handle, context, decision, command, application, subscriber, 36, 4);
+                bench_clobber(bench_buf);
+        }
+        bench_clobber(len);
+}
+
+static void
+bench_template_render(uint64_t iters) {
+        static struct cops_dec_template t;
+        struct cops_dec_layout l;
+        const uint8_t addr[4] = {10, 0, 0, 1};
+        uint32_t word = 0;
+        struct cops_dec_fields f = {"hdl1", 0, 0, addr, &word};
+
+        bench_layout(&l);
+        cops_dec_template_init(&t, &l);
+        for (uint64_t i = 0; i < iters; i++) {
+                f.trans_id = (uint16_t)i;
+                f.gate_id = (uint32_t)i;
+                word = (uint32_t)i;
+                cops_dec_template_render(&t, bench_buf, &f);
+                bench_clobber(bench_buf);
+        }
+}
+
+static void
+bench_builder(uint64_t iters) {
+        const uint8_t subscriber[8] = {0, 8, 3, 1, 10, 0, 0, 1};
+        struct cops_builder b;
+        struct cops_builder_mark mark;
+        uint8_t body[4] = {0};
+        size_t len = 0;
+
+        for (uint64_t i = 0; i < iters; i++) {
+                cops_builder_init(&b, bench_buf, sizeof(bench_buf), 2);
+                cops_builder_object(&b, 1, 1, "hdl1", 4);
+                cops_builder_object(&b, 2, 1, body, 4);
+                cops_builder_object(&b, 6, 1, body, 4);
+                cops_builder_begin(&b, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI, &mark);
+                cops_builder_object(&b, PCMM_SNUM_TRANSACTION_ID, 1, body, 4);
+                cops_builder_append(&b, subscriber, sizeof(subscriber));
+                cops_builder_object(&b, PCMM_SNUM_GATE_SPEC, 1, bench_gate_spec, PCMM_GATE_SPEC_LEN);
+                cops_builder_end(&b, &mark);
+                len += cops_builder_finish(&b);
+        }
+        bench_clobber(len);
+}
+
+/* The PCMM objects of one Gate-Set, written with the typed encoders. */
+static void
+bench_pcmm_objects(uint64_t iters) {
+        const uint8_t addr[4] = {10, 0, 0, 1};
+        struct pcmm_gate_spec spec = {0, 0, 0, 1, 200, 300, 400, 500};
+        struct pcmm_classifier c = {17, 0, 0, {10, 0, 0, 1}, {10, 0, 0, 2}, 5060, 5061, 64};
+        struct pcmm_best_effort be = {PCMM_ENVELOPE_AUTHORIZED, 3, 0, 1000000, 3044, 0, 0, 0};
+
+        for (uint64_t i = 0; i < iters; i++) {
+                uint8_t* p = bench_buf;
+
+                p += pcmm_transaction_id(p, (uint16_t)i, PCMM_GATE_SET);
+                p += pcmm_amid(p, 0x1234, 1);
+                p += pcmm_subscriber_v4(p, addr);
+                p += pcmm_gate_id(p, (uint32_t)i);
+                p += pcmm_gate_spec(p, &spec);
+                p += pcmm_best_effort(p, &be);
+                p += pcmm_classifier(p, &c);
+                bench_clobber(p);
+        }
+}
+
+static void
+bench_batch_encode(uint64_t iters) {
+        static struct cops_gate_op ops[BENCH_BATCH];
+        static uint32_t offsets[BENCH_BATCH + 1];
+        size_t len = 0;
+
+        for (int i = 0; i < BENCH_BATCH; i++) {
+                memcpy(ops[i].handle, "hdl1", 4);
+                ops[i].trans_id = i;
+                ops[i].command = PCMM_GATE_SET;
+                ops[i].am_tag = 0x1234;
+                ops[i].app_type = 1;
+                ops[i].gate_id = i;
+                ops[i].has_gate_id = true;
+                ops[i].family = AF_INET;
+                memcpy(ops[i].subscriber, (uint8_t[4]){10, 0, 0, 1}, 4);
+                memcpy(ops[i].gate_spec, bench_gate_spec, PCMM_GATE_SPEC_LEN);
+        }
+
+        for (uint64_t i = 0; i < iters; i++) {
+                len += cops_batch_encode(bench_buf, sizeof(bench_buf), ops, BENCH_BATCH, bench_profile,
+                                         sizeof(bench_profile), PCMM_STYPE_BEST_EFFORT, offsets);
+                bench_clobber(bench_buf);
+        }
+        bench_clobber(len);
+}
+
+static void
+bench_decode(uint64_t iters) {
+        static struct cops_dec_template t;
+        struct cops_dec_layout l;
+        struct cops_decoder dec;
+        const struct cops_msg* msg;
+        const uint8_t addr[4] = {10, 0, 0, 1};
+        uint32_t word = 0;
+        struct cops_dec_fields f = {"hdl1", 1, 2, addr, &word};
+        uint8_t in[COPS_TEMPLATE_MAX];
+        size_t n = 0;
+
+        bench_layout(&l);
+        cops_dec_template_init(&t, &l);
+        size_t len = cops_dec_template_render(&t, in, &f);
+
+        cops_decoder_init(&dec);
+        for (uint64_t i = 0; i < iters; i++) {
+                n += cops_decode(&dec, in, len, &msg);
+                bench_clobber(msg);
+        }
+        bench_clobber(n);
+}
+
+static void
+bench_validate(uint64_t iters) {
+        static struct cops_dec_template t;
+        struct cops_dec_layout l;
+        const uint8_t addr[4] = {10, 0, 0, 1};
+        uint32_t word = 0;
+        struct cops_dec_fields f = {"hdl1", 1, 2, addr, &word};
+        uint8_t in[COPS_TEMPLATE_MAX];
+        unsigned bad = 0;
+
+        bench_layout(&l);
+        cops_dec_template_init(&t, &l);
+        size_t len = cops_dec_template_render(&t, in, &f);
+
+        for (uint64_t i = 0; i < iters; i++) {
+                bad += cops_validate(in, len, 0, NULL);
+                bench_clobber(in);
+        }
+        bench_clobber(bad);
+}
+
+/* Sign a rendered Gate-Set DEC, the way the server does before queueing it. */
+static void
+bench_integrity_sign(uint64_t iters) {
+        static struct cops_dec_template t;
+        static uint8_t msg[COPS_TEMPLATE_MAX + COPS_INTEGRITY_LEN];
+        struct cops_dec_layout l;
+        struct cops_integrity_key key;
+        struct cops_integrity s;
+        const uint8_t addr[4] = {10, 0, 0, 1};
+        uint32_t word = 0;
+        struct cops_dec_fields f = {"hdl1", 1, 2, addr, &word};
+
+        bench_layout(&l);
+        cops_dec_template_init(&t, &l);
+        size_t len = cops_dec_template_render(&t, msg, &f);
+        cops_integrity_key_init(&key, 1, "secret", 6);
+        cops_integrity_init(&s, &key, 0);
+
+        for (uint64_t i = 0; i < iters; i++) {
+                bench_clobber(cops_integrity_sign(&s, msg, len));
+                bench_clobber(msg);
+        }
+}
+
+static void
+bench_integrity_verify(uint64_t iters) {
+        static struct cops_dec_template t;
+        static uint8_t msg[COPS_TEMPLATE_MAX + COPS_INTEGRITY_LEN];
+        struct cops_dec_layout l;
+        struct cops_integrity_key key;
+        struct cops_integrity s;
+        const uint8_t addr[4] = {10, 0, 0, 1};
+        uint32_t word = 0;
+        struct cops_dec_fields f = {"hdl1", 1, 2, addr, &word};
+        unsigned bad = 0;
+
+        bench_layout(&l);
+        cops_dec_template_init(&t, &l);
+        cops_integrity_key_init(&key, 1, "secret", 6);
+        cops_integrity_init(&s, &key, 0);
+        size_t len = cops_integrity_sign(&s, msg, cops_dec_template_render(&t, msg, &f));
+
+        for (uint64_t i = 0; i < iters; i++) {
+                s.rx_synced = false;
+                bad += cops_integrity_verify(&s, msg, len);
+                bench_clobber(msg);
+        }
+        bench_clobber(bad);
+}
+
+/* What a per-message HMAC pays on top: hashing the key pads. */
+static void
+bench_integrity_key_init(uint64_t iters) {
+        struct cops_integrity_key key;
+
+        for (uint64_t i = 0; i < iters; i++) {
+                cops_integrity_key_init(&key, 1, "secret", 6);
+                bench_clobber(&key);
+        }
+}
+
+#define BENCH_GATES 65536
+
+static void
+bench_gate_find(uint64_t iters) {
+        static struct cops_gate_table t;
+        size_t hits = 0;
+
+        if (t.cur.slots == NULL) {
+                cops_gate_table_init(&t, BENCH_GATES);
+                for (uint32_t k = 0; k < BENCH_GATES; k++)
+                        cops_gate_insert(&t, k);
+        }
+
+        for (uint64_t i = 0; i < iters; i++)
+                hits += cops_gate_find(&t, (uint32_t)(i * 40503) & (BENCH_GATES - 1)) != NULL;
+        bench_clobber(hits);
+}
+
+static void
+bench_gate_churn(uint64_t iters) {
+        static struct cops_gate_table t;
+        static uint32_t next;
+
+        /* Steady state at half the preloaded size: one insert and one remove per operation. */
+        if (t.cur.slots == NULL) {
+                cops_gate_table_init(&t, BENCH_GATES);
+                for (next = 0; next < BENCH_GATES / 2; next++)
+                        cops_gate_insert(&t, next);
+        }
+
+        for (uint64_t i = 0; i < iters; i++, next++) {
+                cops_gate_insert(&t, next);
+                cops_gate_remove(&t, next - BENCH_GATES / 2);
+        }
+}
+
+/*
+ * A million IPv4 subscribers, one gate each, 16 addresses apart over 10.0.0.0/8: every /16
+ * holds BENCH_RADIX_PER16 gates. They are inserted in scrambled address order, so a subtree's
+ * nodes are spread over the whole node array as they would be after real churn.
+ */
+#define BENCH_RADIX_GATES (1 << 20)
+#define BENCH_RADIX_PER16 4096
+
+static struct cops_radix bench_radix;
+static struct cops_gate_table bench_radix_gates;
+static uint32_t bench_radix_handles[BENCH_RADIX_GATES];
+
+static void
+bench_radix_addr(uint8_t* addr, uint32_t k) {
+        cops_store32(addr, 0x0A000000 | ((k * 2654435761u) & (BENCH_RADIX_GATES - 1)) << 4);
+}
+
+static void
+bench_radix_setup(void) {
+        if (bench_radix.nodes != NULL)
+                return;
+
+        cops_radix_init(&bench_radix, BENCH_RADIX_GATES);
+        cops_gate_table_init(&bench_radix_gates, BENCH_RADIX_GATES);
+        for (uint32_t k = 0; k < BENCH_RADIX_GATES; k++) {
+                struct cops_gate* g = cops_gate_insert(&bench_radix_gates, k);
+
+                g->gate_id = k;
+                g->family = AF_INET;
+                bench_radix_addr(g->subscriber, k);
+                cops_radix_insert(&bench_radix, AF_INET, g->subscriber, k);
+        }
+}
+
+static void
+bench_radix_exact(uint64_t iters) {
+        size_t hits = 0;
+        uint32_t h;
+
+        bench_radix_setup();
+        for (uint64_t i = 0; i < iters; i++) {
+                uint8_t addr[4];
+
+                bench_radix_addr(addr, (uint32_t)(i * 40503));
+                hits += cops_radix_find(&bench_radix, AF_INET, addr, 32, &h, 1);
+        }
+        bench_clobber(hits);
+}
+
+/* Per gate found: all the gates of a /16. */
+static void
+bench_radix_prefix(uint64_t iters) {
+        size_t hits = 0;
+
+        bench_radix_setup();
+        for (uint64_t i = 0; i < iters; i++) {
+                const uint8_t addr[4] = {10, (uint8_t)i, 0, 0};
+
+                hits += cops_radix_find(&bench_radix, AF_INET, addr, 16, bench_radix_handles, BENCH_RADIX_GATES);
+        }
+        bench_clobber(hits);
+}
+
+/* Per gate: the whole /8, every gate of the index. */
+static void
+bench_radix_all(uint64_t iters) {
+        const uint8_t addr[4] = {10, 0, 0, 0};
+        size_t hits = 0;
+
+        bench_radix_setup();
+        for (uint64_t i = 0; i < iters; i++)
+                hits += cops_radix_find(&bench_radix, AF_INET, addr, 8, bench_radix_handles, BENCH_RADIX_GATES);
+        bench_clobber(hits);
+}
+
+/* Per message: Gate-Delete Decisions for the first gates of a /16. */
+static void
+bench_batch_control(uint64_t iters) {
+        static uint32_t offsets[BENCH_BATCH + 1];
+        const uint8_t addr[4] = {10, 1, 0, 0};
+        size_t n = 0;
+
+        bench_radix_setup();
+        cops_radix_find(&bench_radix, AF_INET, addr, 16, bench_radix_handles, BENCH_RADIX_GATES);
+        for (uint64_t i = 0; i < iters; i++) {
+                n += cops_batch_control(bench_buf, sizeof(bench_buf), &bench_radix_gates, bench_radix_handles,
+                                        BENCH_BATCH, PCMM_GATE_DELETE, (uint16_t)i, offsets);
+                bench_clobber(bench_buf);
+        }
+        bench_clobber(n);
+}
+
+#ifdef __linux__
+#define BENCH_SNAP_PATH "/tmp/pcmm_cops_api_bench.gates"
+
+/* One journaled gate change, the checkpoint every COPS_SNAP_DEFAULT_JOURNAL changes included. */
+static void
+bench_snap_put(uint64_t iters) {
+        static struct cops_snap s;
+        static struct cops_gate_table t;
+
+        if (s.map == NULL) {
+                cops_snap_create(&s, BENCH_SNAP_PATH ".put", 0);
+                unlink(BENCH_SNAP_PATH ".put");
+                cops_gate_table_init(&t, BENCH_GATES);
+                for (uint32_t k = 0; k < BENCH_GATES; k++)
+                        cops_gate_insert(&t, k)->family = AF_INET;
+        }
+
+        for (uint64_t i = 0; i < iters; i++) {
+                struct cops_gate* g = cops_gate_find(&t, (uint32_t)i & (BENCH_GATES - 1));
+
+                g->gate_id = (uint32_t)i;
+                cops_snap_put(&s, &t, g);
+        }
+}
+
+/* Per gate: a restart, mapping the checkpoint of the million gates of the radix cases into a new table. */
+static void
+bench_snap_open(uint64_t iters) {
+        static char path[32];
+        static struct cops_snap w;
+
+        /* The writer keeps the unlinked file open, the restarts reach it through /proc. */
+        bench_radix_setup();
+        if (w.map == NULL) {
+                cops_snap_create(&w, BENCH_SNAP_PATH, 0);
+                unlink(BENCH_SNAP_PATH);
+                cops_snap_checkpoint(&w, &bench_radix_gates);
+                snprintf(path, sizeof(path), "/proc/self/fd/%d", w.fd);
+        }
+
+        for (uint64_t i = 0; i < iters; i++) {
+                struct cops_gate_table t;
+                struct cops_snap s;
+
+                cops_snap_open(&s, path, &t);
+                bench_clobber(cops_gate_count(&t));
+                cops_snap_close(&s);
+                cops_gate_table_free(&t);
+        }
+}
+#endif
+
+/* One event: a counter and a histogram sample, without the cost of reading the clock. */
+static void
+bench_metrics(uint64_t iters) {
+        static struct cops_metrics m;
+        static struct cops_metrics_slot* slot;
+
+        if (slot == NULL) {
+                cops_metrics_init(&m, 1);
+                slot = cops_metrics_slot(&m);
+        }
+
+        for (uint64_t i = 0; i < iters; i++) {
+                cops_metrics_add(&slot->rx_ops[9], 1);
+                cops_hist_record(&slot->hist[COPS_HIST_DECODE], (i * 2654435761u) & 0xFFFF);
+        }
+}
+
+static void
+bench_metrics_ticks(uint64_t iters) {
+        uint64_t sum = 0;
+
+        for (uint64_t i = 0; i < iters; i++)
+                sum += cops_metrics_ticks();
+        bench_clobber(sum);
+}
+
+/* Admission of one message against a session and the global bucket, the clock ticks every 64. */
+static void
+bench_admit_take(uint64_t iters) {
+        struct cops_admit_config cfg = {.session_rate = 40000, .global_rate = 1000000};
+        struct cops_admit a;
+        struct cops_bucket s;
+        uint64_t refused = 0;
+
+        cops_admit_init(&a, &cfg, 0);
+        cops_admit_session(&a, &s, 0);
+        for (uint64_t i = 0; i < iters; i++)
+                refused += cops_admit_take(&a, &s, i >> 6) != 0;
+        bench_clobber(refused);
+}
+
+#ifdef __linux__
+/* Capture of a 24 byte REQ with the default snaplen into a 64k record ring, mostly page cache hits. */
+static void
+bench_trace(uint64_t iters) {
+        static struct cops_trace t;
+        static struct cops_trace_ring* r;
+        static uint8_t msg[24];
+
+        if (r == NULL) {
+                uint8_t objs[16];
+
+                cops_trace_create(&t, "/tmp/pcmm_cops_api_bench.trace", 1, 65536, 0);
+                unlink("/tmp/pcmm_cops_api_bench.trace");
+                r = cops_trace_ring(&t);
+                cops_handle(objs, "abcd");
+                cops_context(objs + 8);
+                new_cops_message(msg, 1, objs, 24);
+        }
+
+        for (uint64_t i = 0; i < iters; i++)
+                cops_trace_record(r, COPS_TRACE_RX, (uint32_t)i, msg, sizeof(msg));
+}
+#endif
+
+#define BENCH_SYNC_GATES 500000
+
+/* A full resync per iteration: SSQ, one RPT per gate streamed through the decoder, SSC. */
+static void
+bench_sync(uint64_t iters) {
+        static struct cops_gate_table t;
+        static struct cops_sync sync;
+        static uint8_t* stream;
+        static size_t len;
+        struct cops_decoder dec;
+        const struct cops_msg* msg;
+        uint8_t ssq[16];
+
+        if (stream == NULL) {
+                uint8_t objs[16];
+
+                cops_gate_table_init(&t, BENCH_SYNC_GATES);
+                cops_sync_init(&sync, &t, NULL, NULL, NULL);
+                stream = malloc((size_t)BENCH_SYNC_GATES * 24 + 8);
+                memcpy(objs + 8, "\0\10\14\1\0\1\0\0", 8);
+                for (uint32_t k = 0; k < BENCH_SYNC_GATES; k++) {
+                        uint32_t key = k * 2654435761u;
+
+                        cops_gate_insert(&t, key);
+                        cops_handle(objs, (const char*)&key);
+                        new_cops_message(stream + len, 3, objs, 24);
+                        len += 24;
+                }
+                len += cops_sync_complete(stream + len, NULL);
+        }
+
+        for (uint64_t i = 0; i < iters; i++) {
+                cops_sync_begin(&sync, ssq, NULL);
+                cops_decoder_init(&dec);
+                dec.sync = true;
+                for (size_t off = 0; off < len;) {
+                        off += cops_decode(&dec, stream + off, len - off, &msg);
+                        cops_sync_input(&sync, msg);
+                }
+        }
+        bench_clobber(sync.reported);
+}
+
+static void
+bench_buf_alloc(uint64_t iters) {
+        static struct cops_pool pool;
+
+        if (pool.slabs == NULL)
+                cops_pool_init(&pool);
+        cops_pool_bind(&pool);
+
+        /* A Keep-Alive encoded into a pooled buffer and dropped again. */
+        for (uint64_t i = 0; i < iters; i++) {
+                struct cops_buf* b = cops_buf_alloc(&pool, COPS_HEADER_LEN);
+                cops_keepalive(b->data);
+                b->len = COPS_HEADER_LEN;
+                bench_clobber(b->data);
+                cops_buf_release(b);
+        }
+}
+
+static void
+bench_arena_alloc(uint64_t iters) {
+        static struct cops_pool pool;
+        static struct cops_arena arena;
+
+        if (pool.slabs == NULL) {
+                cops_pool_init(&pool);
+                cops_arena_init(&arena, &pool);
+        }
+        cops_pool_bind(&pool);
+
+        /* Session-sized allocations, the arena is reset as if the session closed every 64. */
+        for (uint64_t i = 0; i < iters; i++) {
+                bench_clobber(cops_arena_alloc(&arena, 48));
+                if ((i & 63) == 63)
+                        cops_arena_reset(&arena);
+        }
+}
+
+static void
+bench_txn_done(struct cops_txn* txn, enum cops_txn_status status, const struct cops_msg* msg) {
+        bench_clobber(txn);
+}
+
+static void
+bench_txn(uint64_t iters) {
+        static struct cops_timer_wheel wheel;
+        static struct cops_txn_table t;
+        static struct cops_decoder dec;
+        static const struct cops_msg* ack;
+        static uint8_t buf[64];
+
+        /* 256 Gate-Sets kept in flight, each iteration answers the oldest and sends a new one. */
+        if (t.txns == NULL) {
+                struct cops_builder b;
+                struct cops_builder_mark csi;
+                uint8_t obj[8];
+
+                cops_timer_wheel_init(&wheel, 10, 0);
+                cops_txn_table_init(&t, 1024, &wheel);
+                for (int i = 0; i < 256; i++)
+                        cops_txn_begin(&t, 1, cops_txn_id(&t), PCMM_GATE_SET, 1000, bench_txn_done, NULL);
+
+                cops_builder_init(&b, buf, sizeof(buf), 3);
+                cops_builder_object(&b, 1, 1, "hdl1", 4);
+                cops_builder_begin(&b, COPS_CNUM_CLIENT_SI, 1, &csi);
+                cops_builder_append(&b, obj, pcmm_transaction_id(obj, 0, PCMM_GATE_SET_ACK));
+                cops_builder_end(&b, &csi);
+                cops_decoder_init(&dec);
+                cops_decode(&dec, buf, cops_builder_finish(&b), &ack);
+        }
+
+        for (uint64_t i = 0; i < iters; i++) {
+                uint16_t id = (uint16_t)(t.next_id - 256);
+
+                /* Patch the Transaction ID of the decoded Gate-Set-Ack in place. */
+                buf[24] = id >> 8;
+                buf[25] = id & 0xFF;
+                cops_txn_complete(&t, 1, ack);
+                cops_txn_begin(&t, 1, cops_txn_id(&t), PCMM_GATE_SET, 1000, bench_txn_done, NULL);
+        }
+}
+
+#ifdef __linux__
+
+/* One PEP session over loopback, the PEP side runs in the same thread as the server loop. */
+struct bench_session {
+        struct cops_server srv;
+        int fd;
+};
+
+static int
+bench_session_open(struct bench_session* s, enum cops_backend backend) {
+        struct cops_server_config cfg = {0};
+        struct sockaddr_in sa = {0};
+        struct cops_builder b;
+        uint8_t buf[64];
+        int one = 1;
+
+        cfg.addr = "127.0.0.1";
+        cfg.backend = backend;
+        if (cops_server_init(&s->srv, &cfg) < 0)
+                return -1;
+
+        s->fd = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(cops_server_port(&s->srv));
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(s->fd, (struct sockaddr*)&sa, sizeof(sa)) < 0)
+                return -1;
+
+        cops_builder_init(&b, buf, sizeof(buf), 6);
+        cops_builder_object(&b, 11, 1, "cmts-1", 6);
+        size_t len = cops_builder_finish(&b);
+        if (send(s->fd, buf, len, 0) != (ssize_t)len)
+                return -1;
+
+        /* Wait for the Client-Accept. */
+        while (recv(s->fd, buf, sizeof(buf), MSG_DONTWAIT) <= 0)
+                cops_server_poll(&s->srv, 1);
+
+        return 0;
+}
+
+/* BENCH_BATCH Keep-Alives written by the PEP in one send, echoed by the server and read back. */
+static void
+bench_session_ka(struct bench_session* s, uint64_t iters) {
+        uint8_t out[BENCH_BATCH * 8];
+        uint8_t in[BENCH_BATCH * 8];
+
+        for (int i = 0; i < BENCH_BATCH; i++) {
+                cops_keepalive(out + i * 8);
+                out[i * 8 + 2] = out[i * 8 + 3] = 0;
+        }
+
+        for (uint64_t i = 0; i < iters; i++) {
+                if (send(s->fd, out, sizeof(out), 0) != (ssize_t)sizeof(out))
+                        return;
+
+                for (size_t got = 0; got < sizeof(in);) {
+                        cops_server_poll(&s->srv, 0);
+
+                        ssize_t n = recv(s->fd, in, sizeof(in) - got, MSG_DONTWAIT);
+                        if (n > 0)
+                                got += n;
+                }
+        }
+}
+
+static void
+bench_server_epoll(uint64_t iters) {
+        static struct bench_session s;
+        static bool open;
+
+        if (!open && bench_session_open(&s, COPS_BACKEND_EPOLL) == 0)
+                open = true;
+        bench_session_ka(&s, iters);
+}
+
+static void
+bench_server_uring(uint64_t iters) {
+        static struct bench_session s;
+        static bool open;
+
+        if (!open && bench_session_open(&s, COPS_BACKEND_URING) == 0)
+                open = true;
+        bench_session_ka(&s, iters);
+}
+
+#endif
+
+static const struct bench_case bench_cases[] = {
+        {"cops_header_ok", bench_header_ok, 1},
+        {"cops_keepalive", bench_keepalive, 1},
+        {"cops_client_accept", bench_client_accept, 1},
+        {"new_cops_message", bench_new_message, 1},
+        {"cops_put_header", bench_put_header, 1},
+        {"pack_ctl_objs", bench_pack_ctl_objs, 1},
+        {"cops_dec_template_render", bench_template_render, 1},
+        {"cops_builder", bench_builder, 1},
+        {"pcmm_gate_set_objects", bench_pcmm_objects, 1},
+        {"cops_batch_encode", bench_batch_encode, BENCH_BATCH},
+        {"cops_decode", bench_decode, 1},
+        {"cops_validate", bench_validate, 1},
+        {"cops_integrity_sign", bench_integrity_sign, 1},
+        {"cops_integrity_verify", bench_integrity_verify, 1},
+        {"cops_integrity_key_init", bench_integrity_key_init, 1},
+        {"cops_gate_find", bench_gate_find, 1},
+        {"cops_gate_insert_remove", bench_gate_churn, 1},
+        {"cops_radix_find_exact", bench_radix_exact, 1},
+        {"cops_radix_find_prefix16", bench_radix_prefix, BENCH_RADIX_PER16},
+        {"cops_radix_find_all", bench_radix_all, BENCH_RADIX_GATES},
+        {"cops_batch_control", bench_batch_control, BENCH_BATCH},
+        {"cops_buf_alloc_release", bench_buf_alloc, 1},
+        {"cops_arena_alloc", bench_arena_alloc, 1},
+        {"cops_txn_complete_begin", bench_txn, 1},
+        {"cops_sync_resync", bench_sync, BENCH_SYNC_GATES},
+        {"cops_metrics_record", bench_metrics, 1},
+        {"cops_metrics_ticks", bench_metrics_ticks, 1},
+        {"cops_admit_take", bench_admit_take, 1},
+#ifdef __linux__
+        {"cops_trace_record", bench_trace, 1},
+        {"cops_snap_put", bench_snap_put, 1},
+        {"cops_snap_open", bench_snap_open, BENCH_RADIX_GATES},
+        {"cops_server_ka_epoll", bench_server_epoll, BENCH_BATCH},
+        {"cops_server_ka_uring", bench_server_uring, BENCH_BATCH},
+#endif
+};
+
+static int
+bench_write_json(const char* path, const struct bench_result* r, size_t n, bool cycles) {
+        FILE* f = fopen(path, "w");
+
+        if (f == NULL)
+                return -1;
+
+        fprintf(f, "{\n  \"compiler\": \"%s\",\n  \"cycles\": %s,\n  \"results\": [\n", __VERSION__,
+                cycles ? "true" : "false");
+        for (size_t i = 0; i < n; i++) {
+                fprintf(f, "    {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f, ",
+                        r[i].name, (unsigned long long)r[i].ops, r[i].ns_per_op, r[i].ops_per_sec);
+                if (r[i].cycles_per_op >= 0)
+                        fprintf(f, "\"cycles_per_op\": %.2f, ", r[i].cycles_per_op);
+                else
+                        fprintf(f, "\"cycles_per_op\": null, ");
+                fprintf(f, "\"allocs_per_op\": %.4f}%s\n", r[i].allocs_per_op, (i + 1 < n) ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+
+        return fclose(f);
+}
+
+int
+main(int argc, char const** argv) {
+        const char* out = (argc > 1) ? argv[1] : "bench_output.json";
+        size_t n = sizeof(bench_cases) / sizeof(bench_cases[0]);
+        struct bench_result results[BENCH_MAX_CASES];
+        int perf_fd = bench_cycles_open();
+
+        _Static_assert(sizeof(bench_cases) / sizeof(bench_cases[0]) <= BENCH_MAX_CASES, "too many bench cases");
+
+        printf("%-26s %12s %14s %12s %12s\n", "benchmark", "ns/op", "msgs/sec", "cycles/op", "allocs/op");
+        for (size_t i = 0; i < n; i++) {
+                bench_run(&bench_cases[i], perf_fd, &results[i]);
+
+                printf("%-26s %12.2f %14.0f ", results[i].name, results[i].ns_per_op, results[i].ops_per_sec);
+                if (results[i].cycles_per_op >= 0)
+                        printf("%12.1f ", results[i].cycles_per_op);
+                else
+                        printf("%12s ", "n/a");
+                printf("%12.4f\n", results[i].allocs_per_op);
+        }
+
+        if (bench_write_json(out, results, n, perf_fd >= 0) < 0) {
+                fprintf(stderr, "failed to write %s: %s\n", out, strerror(errno));
+                return 1;
+        }
+        printf("results written to %s\n", out);
+
+        return 0;
+}
@@ -1,45 +1,10 @@
 #include "cops.h"
+#include "pcmm.h"
 
-/*
- * COPS Common Object format utility - Populate the given destination buffer (uint8_t) with the
- * provided S-Num and S-Type OR C-Num and C-Type values. The buffer should expect the first two
- * bytes be populated by a default length of 8, while the next two bytes are reserved for the
- * unique object ID S/C ID values.
- */
-static void cops_oid(uint8_t* dst, uint8_t num, uint8_t type);
-
-static void
-concat(uint8_t* dst, size_t* sz_ptr, uint8_t* src, size_t n) {
-        size_t i;
-        size_t j = 0;
-
-        /* Append the source bytes to the dst starting at the pointer. */
-        for (i = *sz_ptr; i < (*sz_ptr + n); i++) {
-                *(dst + i) = *(src + (j++));
-        }
-        dst[i] = '\0';
-
-        *sz_ptr += (int)n;
-}
-
-static void
-cops_packlen(uint8_t* dest, uint16_t val) {
-        uint8_t* ptr = (uint8_t*)dest;
-
-        /* Store the most significant byte. */
-        *(ptr) = (val >> 8) & 0xFF;
-
-        /* Store the least significant byte. */
-        *(ptr + 1) = val & 0xFF;
-}
-
+/* A whole 8-byte object of the given C-Num and C-Type with a 32-bit body. */
 static inline void
-cops_oid(uint8_t* dst, uint8_t num, uint8_t type) {
-        cops_packlen(dst, COPS_COMMON_OBJ_LEN);
-
-        /* Store identifiers. */
-        *(dst + 2) = num;
-        *(dst + 3) = type;
+cops_obj32(uint8_t* dst, uint8_t num, uint8_t type, uint32_t body) {
+        cops_store64(dst, (uint64_t)COPS_OBJ_WORD(COPS_COMMON_OBJ_LEN, num, type) << 32 | body);
 }
 
 bool
@@ -58,11 +23,26 @@ cops_opcode_ok(uint8_t opcode) {
 }
 
 bool
-cops_header_ok(uint8_t opcode, uint16_t client_type, uint32_t message_len) {
-        return (cops_opcode_ok(opcode) && client_type == 32778 && message_len != 0 && message_len < 1000) ||
+cops_header_check(uint8_t opcode, uint16_t client_type, uint32_t message_len, uint32_t max_len) {
+        return (cops_opcode_ok(opcode) && client_type == 32778 && message_len != 0 && message_len <= max_len) ||
                (opcode == 9 && client_type == 0);
 }
 
+bool
+cops_header_ok(uint8_t opcode, uint16_t client_type, uint32_t message_len) {
+        return cops_header_check(opcode, client_type, message_len, COPS_MSG_MAX_LEN);
+}
+
+bool
+cops_sync_header_check(uint8_t opcode, uint16_t client_type, uint32_t message_len, uint32_t max_len) {
+        return (opcode == 5 || opcode == 10) && client_type == 32778 && message_len != 0 && message_len <= max_len;
+}
+
+bool
+cops_sync_header_ok(uint8_t opcode, uint16_t client_type, uint32_t message_len) {
+        return cops_sync_header_check(opcode, client_type, message_len, COPS_MSG_MAX_LEN);
+}
+
 bool
 cops_class_ok(uint8_t cnum, uint8_t ctype) {
         switch (cnum) {
@@ -126,7 +106,7 @@ cops_otos(unsigned char opcode) {
 
 void
 cops_handle(uint8_t* dst, const char* handle) {
-        cops_oid(dst, 1, 1);
+        cops_put_objhdr(dst, COPS_COMMON_OBJ_LEN, 1, 1);
 
         /* Client handle used to uniquely identify a particular
          * PEP's request for a client-type. */
@@ -135,23 +115,14 @@ cops_handle(uint8_t* dst, const char* handle) {
 
 void
 cops_context(uint8_t* dst) {
-        cops_oid(dst, 2, 1);
-        uint16_t enc_rt = htons(8); /* Context request-type. */
-        uint16_t enc_mt = htons(0); /* Context message-type. */
-
-        /* Combine flags. */
-        char combo[4];
-        memcpy(combo, &enc_rt, 2);
-        memcpy(combo + 2, &enc_mt, 2);
-        memcpy(dst + 4, &combo, 4);
+        /* R-Type 8 (Configuration request), M-Type 0. */
+        cops_obj32(dst, 2, 1, 8 << 16);
 }
 
 void
 cops_decision(uint8_t* dst) {
-        cops_oid(dst, 6, 1);
-
-        uint16_t values[2] = {htons(1), htons(1)};
-        memcpy(dst + 4, values, 4);
+        /* Command-Code 1 (Install), Flags 1 (Trigger Error). */
+        cops_obj32(dst, 6, 1, 1 << 16 | 1);
 }
 
 size_t
@@ -160,107 +131,64 @@ pack_ctl_objs(uint8_t* dst, uint8_t* handle, uint8_t* context, uint8_t* decision
         size_t i = 0;
 
         /* Client Specific objects */
-        concat(dst, &i, handle, 8);
-        concat(dst, &i, context, 8);
-        concat(dst, &i, decision, 8);
+        memcpy(dst + i, handle, 8);
+        memcpy(dst + i + 8, context, 8);
+        memcpy(dst + i + 16, decision, 8);
+        i += 24;
 
         /* Decision headers. */
-        cops_packlen((uint8_t*)dst + i, decision_length);
-        i += 2;
-
-        dst[i++] = 6; /* opcode */
-        dst[i++] = 4; /* client_type */
+        cops_put_objhdr(dst + i, (uint16_t)decision_length, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI);
+        i += 4;
 
-        concat(dst, &i, command, 8);
-        concat(dst, &i, application, 8);
-        concat(dst, &i, subscriber, ip_length);
+        memcpy(dst + i, command, 8);
+        memcpy(dst + i + 8, application, 8);
+        memcpy(dst + i + 16, subscriber, ip_length);
+        i += 16 + ip_length;
 
         return i;
 }
 
 void
 cops_client_accept(uint8_t* dst, const uint32_t ka_timer, const uint32_t acct_timer) {
-        uint8_t* ptr = (uint8_t*)dst;
-
-        uint8_t v = 1;
-        uint8_t f = 0;
-
-        int len = (acct_timer == 0) ? 16 : 24;
-        int header_v = (v << 4) | f;
-
-        unsigned int client_type = 32778;
-
-        /* Header. */
-        *(ptr) = header_v;
-        *(ptr + 1) = 7; /* Client-Accept Opcode. */
-        *(ptr + 2) = (uint32_t)(client_type >> 8) & 0xFF;
-        *(ptr + 3) = client_type & 0xFF;
-
-        /* Pack length in network byte order. */
-        *(ptr + 4) = (len >> 24) & 0xFF;
-        *(ptr + 5) = (len >> 16) & 0xFF;
-        *(ptr + 6) = (len >> 8) & 0xFF;
-        *(ptr + 7) = len & 0xFF;
+        cops_put_header(dst, 7, (acct_timer == 0) ? 16 : 24);
 
-        /* KA Object length. */
-        *(ptr + 8) = (8 >> 8) & 0xFF;
-        *(ptr + 9) = 8 & 0xFF;
-        *(ptr + 10) = 10; /* Keep-Alive timer C-Num. */
-        *(ptr + 11) = 1;  /* Keep-Alive timer C-Type. */
-
-        /* Pack KA Timer in network byte order. */
-        *(ptr + 12) = (ka_timer >> 24) & 0xFF;
-        *(ptr + 13) = (ka_timer >> 16) & 0xFF;
-        *(ptr + 14) = (ka_timer >> 8) & 0xFF;
-        *(ptr + 15) = ka_timer & 0xFF;
+        /* Keep-Alive timer object (C-Num 10, C-Type 1). */
+        cops_obj32(dst + 8, 10, 1, ka_timer);
 
         if (acct_timer == 0)
                 return;
 
-        /* Acct. Object length. */
-        *(ptr + 16) = (8 >> 8) & 0xFF;
-        *(ptr + 17) = 8 & 0xFF;
-        *(ptr + 18) = 15; /* Accounting timer C-Num. */
-        *(ptr + 19) = 1;  /* Accounting timer C-Type. */
-
-        /* Pack length in network byte order. */
-        *(ptr + 20) = (acct_timer >> 24) & 0xFF;
-        *(ptr + 21) = (acct_timer >> 16) & 0xFF;
-        *(ptr + 22) = (acct_timer >> 8) & 0xFF;
-        *(ptr + 23) = acct_timer & 0xFF;
+        /* Accounting timer object (C-Num 15, C-Type 1). */
+        cops_obj32(dst + 16, 15, 1, acct_timer);
 }
 
 void
 cops_keepalive(uint8_t* dst) {
-        int header_v = (1 << 4) | 0;
-        int offset = 0;
-        dst[offset++] = header_v;
-        dst[offset++] = 9; /* Keep-Alive Opcode. */
-        dst[offset++] = (uint32_t)(0 >> 8) & 0xFF;
-        dst[offset++] = 0 & 0xFF;
+        cops_store64(dst, COPS_KA_MESSAGE);
+}
+
+void
+cops_client_close(uint8_t* dst, uint16_t code, uint16_t subcode) {
+        cops_put_header(dst, 8, COPS_ERROR_MSG_LEN);
+        cops_obj32(dst + 8, 8, 1, (uint32_t)code << 16 | subcode);
+}
+
+size_t
+cops_decision_error(uint8_t* dst, const uint8_t* handle, uint16_t code, uint16_t subcode) {
+        size_t hlen = COPS_ALIGN4(cops_load16(handle));
+        size_t len = COPS_ERROR_MSG_LEN + hlen;
 
-        /* Pack length in network byte order. */
-        dst[offset++] = (8 >> 24) & 0xFF;
-        dst[offset++] = (8 >> 16) & 0xFF;
-        dst[offset++] = (8 >> 8) & 0xFF;
-        dst[offset++] = 8 & 0xFF;
+        cops_put_header(dst, 2, (uint32_t)len);
+        dst[0] |= 1; /* Solicited. */
+        memcpy(dst + 8, handle, hlen);
+        cops_obj32(dst + 8 + hlen, 8, 1, (uint32_t)code << 16 | subcode);
+
+        return len;
 }
 
 void
 new_cops_message(uint8_t* dst, uint16_t opcode, uint8_t* data, int length) {
-        int offset = 0;
-        uint8_t flags = 0;
-        uint32_t client_type = 32778;
-
-        int version = (1 << 4) | flags;
-        dst[offset++] = version;
-        dst[offset++] = opcode;
-        dst[offset++] = (uint32_t)(client_type >> 8) & 0xFF;
-        dst[offset++] = client_type & 0xFF;
-        dst[offset++] = (length >> 24) & 0xFF;
-        dst[offset++] = (length >> 16) & 0xFF;
-        dst[offset++] = (length >> 8) & 0xFF;
-        dst[offset++] = length & 0xFF;
+        cops_put_header(dst, (uint8_t)opcode, (uint32_t)length);
         if (data)
-                memcpy(dst + offset, data, length - 8);
+                memcpy(dst + COPS_HEADER_LEN, data, length - 8);
 }
@@ -8,10 +8,23 @@
 
 #include <arpa/inet.h>
 
+#include "cops_wire.h"
+
 #define COPS_COMMON_OBJ_LEN 8
+#define COPS_HEADER_LEN     8
+#define COPS_OBJ_HEADER_LEN 4
+
+/* Round an object length up to the next 32-bit word boundary. */
+#define COPS_ALIGN4(n) (((n) + 3u) & ~3u)
+
+/* Longest message cops_header_ok accepts, every PCMM message without an Integrity object fits. */
+#define COPS_MSG_MAX_LEN 999
 
 bool cops_header_ok(uint8_t opcode, uint16_t client_type, uint32_t message_len);
 
+/* cops_header_ok with the longest acceptable message length given by the caller. */
+bool cops_header_check(uint8_t opcode, uint16_t client_type, uint32_t message_len, uint32_t max_len);
+
 /* 
  * Accepts a Op Code value and returns the corresponding COPS Common object name
  * @1 .........Handle Object (Handle)
@@ -69,6 +82,15 @@ char* cops_otoa(unsigned char opcode);
  */
 bool cops_opcode_ok(uint8_t opcode);
 
+/*
+ * Header check for Synchronize State Req (5) and Synchronize Complete (10), which cops_header_ok
+ * rejects. Only used where a synchronization was enabled, see cops_sync.h.
+ */
+bool cops_sync_header_ok(uint8_t opcode, uint16_t client_type, uint32_t message_len);
+
+/* cops_sync_header_ok with the longest acceptable message length given by the caller. */
+bool cops_sync_header_check(uint8_t opcode, uint16_t client_type, uint32_t message_len, uint32_t max_len);
+
 /*
  * C-Num identifies the class of information contained in the object, and the C-Type identifies
  * the subtype or version of the information contained in the object.  Standard COPS objects (as
@@ -156,6 +178,31 @@ void cops_client_accept(uint8_t* dst, const uint32_t ka_timer, const uint32_t ac
 /* Build the keep-alive object. */
 void cops_keepalive(uint8_t* dst);
 
+/* Error-Codes of the COPS Error object (C-Num 8) sent by the PDP, RFC 2748 2.2.8. */
+#define COPS_ERROR_UNABLE  4  /* Unable to process, the server gives up on the query. */
+#define COPS_ERROR_MSG_LEN 16 /* Client-Close carrying only the Error object. */
+
+/*
+ * Pack a Client-Close Message (16 bytes) for the PEP (CMTS), telling it why the PDP ends the
+ * session with an Error object (C-Num 8, C-Type 1).
+ *
+ * @code        Error-Code
+ * @subcode     Error Sub-code, 0 unless the code defines one
+ */
+void cops_client_close(uint8_t* dst, uint16_t code, uint16_t subcode);
+
+/*
+ * Pack a solicited Decision Message that answers a request with an Error object in place of
+ * decisions. The destination MUST hold COPS_ERROR_MSG_LEN + the aligned handle length bytes.
+ *
+ * @handle      Client Handle object of the request, including its object header
+ * @code        Error-Code
+ * @subcode     Error Sub-code
+ *
+ * Returns the message length.
+ */
+size_t cops_decision_error(uint8_t* dst, const uint8_t* handle, uint16_t code, uint16_t subcode);
+
 /* 
  * Finalzie a COPS message with the correct headers. 
  *
@@ -196,6 +243,9 @@ void new_cops_message(uint8_t* dst, uint16_t opcode, uint8_t* data, int length);
  * is independent of the top-level COPS object number space. For this reason, the object
  * numbers and types are given as S-Num and S-Type, respectively. S-Num and S-Type MUST
  * be one octet. The COPS Length field MUST be two octets.
+ *
+ * The destination MUST hold 40 + ip_length bytes. New code should use the bounds-checked
+ * struct cops_builder (cops_builder.h), which also supports zero-copy iovec output.
  */
 size_t pack_ctl_objs(uint8_t* dst, uint8_t* handle, uint8_t* context, uint8_t* decision, uint8_t* command,
                      uint8_t* application, uint8_t* subscriber, size_t decision_length, size_t ip_length);
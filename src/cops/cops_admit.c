@@ -0,0 +1,36 @@
+#include "cops_admit.h"
+
+void
+cops_bucket_init(struct cops_bucket* b, uint32_t rate, uint32_t burst, uint64_t now_ms) {
+        if (burst == 0)
+                burst = (rate >= 20) ? rate / 10 : 1;
+
+        b->rate = rate;
+        b->cap = (uint64_t)burst * COPS_BUCKET_SCALE;
+        b->tokens = b->cap;
+        b->last = now_ms;
+}
+
+void
+cops_admit_init(struct cops_admit* a, const struct cops_admit_config* cfg, uint64_t now_ms) {
+        a->cfg = *cfg;
+        cops_bucket_init(&a->global, cfg->global_rate, cfg->global_burst, now_ms);
+}
+
+void
+cops_admit_session(const struct cops_admit* a, struct cops_bucket* session, uint64_t now_ms) {
+        cops_bucket_init(session, a->cfg.session_rate, a->cfg.session_burst, now_ms);
+}
+
+uint64_t
+cops_admit_take(struct cops_admit* a, struct cops_bucket* session, uint64_t now_ms) {
+        uint64_t wait = cops_bucket_wait(session, now_ms);
+        uint64_t global = cops_bucket_wait(&a->global, now_ms);
+
+        if (wait || global)
+                return (wait > global) ? wait : global;
+
+        cops_bucket_take(session);
+        cops_bucket_take(&a->global);
+        return 0;
+}
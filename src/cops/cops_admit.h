@@ -0,0 +1,108 @@
+#ifndef COPS_ADMIT_H
+#define COPS_ADMIT_H
+
+#include <stdint.h>
+
+/* Token counts are kept in thousandths, a rate of r per second then adds r of them per millisecond. */
+#define COPS_BUCKET_SCALE 1000
+
+/* What happens to a REQ or RPT that finds no token. */
+enum cops_admit_policy {
+        COPS_ADMIT_DELAY = 0, /* Left in the receive buffer until a token is due, see max_delay_ms. */
+        COPS_ADMIT_SHED,      /* Dropped, a REQ is answered with a DEC carrying an Error object. */
+        COPS_ADMIT_CLOSE,     /* The session is ended with a Client-Close. */
+};
+
+/*
+ * Admission control of the decision path. Only REQ and RPT messages take a token, Client-Open,
+ * Keep-Alive, DRQ and SSC are always admitted: they keep sessions alive or release state.
+ *
+ * @session_rate        Messages per second of each session, 0 for no limit
+ * @session_burst       Tokens a session can save up, 0 selects session_rate / 10 (at least 1)
+ * @global_rate         Messages per second over every session of the server, 0 for no limit
+ * @global_burst        Tokens the server can save up, 0 selects global_rate / 10 (at least 1)
+ * @max_delay_ms        COPS_ADMIT_DELAY: longest a message is held back, 0 behaves like
+ *                      COPS_ADMIT_SHED. One whose token is due later is shed instead, which bounds
+ *                      the latency added by the delay. Keep it well below the Keep-Alive timer,
+ *                      nothing is read from a session while it waits
+ * @policy              Overload policy
+ */
+struct cops_admit_config {
+        uint32_t session_rate;
+        uint32_t session_burst;
+        uint32_t global_rate;
+        uint32_t global_burst;
+        uint32_t max_delay_ms;
+        enum cops_admit_policy policy;
+};
+
+/*
+ * Token bucket. Nothing runs in the background: every check first adds the tokens earned since
+ * the last one, a multiplication and a compare, so a bucket costs O(1) no matter how long it
+ * stayed idle.
+ */
+struct cops_bucket {
+        uint64_t tokens; /* In 1/COPS_BUCKET_SCALE of a token. */
+        uint64_t last;   /* Monotonic time of the last refill in milliseconds. */
+        uint64_t cap;    /* burst * COPS_BUCKET_SCALE */
+        uint32_t rate;   /* Tokens per second, 0 when unlimited. */
+};
+
+/* Start a bucket full. A zero burst selects rate / 10, at least one token. */
+void cops_bucket_init(struct cops_bucket* b, uint32_t rate, uint32_t burst, uint64_t now_ms);
+
+static inline void
+cops_bucket_refill(struct cops_bucket* b, uint64_t now_ms) {
+        if (now_ms <= b->last)
+                return;
+
+        uint64_t elapsed = now_ms - b->last;
+
+        /* rate is at least 1, an interval longer than the capacity fills the bucket anyway. */
+        b->tokens = (elapsed >= b->cap || elapsed >> 32) ? b->cap : b->tokens + elapsed * b->rate;
+        if (b->tokens > b->cap)
+                b->tokens = b->cap;
+        b->last = now_ms;
+}
+
+/* Milliseconds until the bucket holds a whole token, 0 when it does now. */
+static inline uint64_t
+cops_bucket_wait(struct cops_bucket* b, uint64_t now_ms) {
+        if (b->rate == 0)
+                return 0;
+
+        cops_bucket_refill(b, now_ms);
+        if (b->tokens >= COPS_BUCKET_SCALE)
+                return 0;
+
+        return (COPS_BUCKET_SCALE - b->tokens + b->rate - 1) / b->rate;
+}
+
+/* Take a token that cops_bucket_wait reported available. */
+static inline void
+cops_bucket_take(struct cops_bucket* b) {
+        if (b->rate)
+                b->tokens -= COPS_BUCKET_SCALE;
+}
+
+/* Admission state of a server: its configuration and the bucket every session shares. */
+struct cops_admit {
+        struct cops_admit_config cfg;
+        struct cops_bucket global;
+};
+
+void cops_admit_init(struct cops_admit* a, const struct cops_admit_config* cfg, uint64_t now_ms);
+
+/* Initialise the bucket of a new session. */
+void cops_admit_session(const struct cops_admit* a, struct cops_bucket* session, uint64_t now_ms);
+
+/*
+ * Admit one message of a session: a token is taken from the session's bucket and from the
+ * global one only when both hold one, so a refused message costs neither.
+ *
+ * Returns 0 when the message was admitted, otherwise the milliseconds until both buckets hold
+ * a token again.
+ */
+uint64_t cops_admit_take(struct cops_admit* a, struct cops_bucket* session, uint64_t now_ms);
+
+#endif
@@ -0,0 +1,175 @@
+#include "cops_batch.h"
+
+/* Bytes of every message up to and including the Decision Flags object. */
+#define COPS_BATCH_PREFIX (COPS_HEADER_LEN + 3 * COPS_COMMON_OBJ_LEN)
+
+/* Message length for an IPv4 subscriber without a Gate ID, excluding the Traffic Profile body. */
+#define COPS_BATCH_BASE (COPS_BATCH_PREFIX + 4 + 8 + 8 + 8 + 4 + PCMM_GATE_SPEC_LEN + 4)
+
+/* Message length of a Gate-Info or Gate-Delete for an IPv4 subscriber. */
+#define COPS_BATCH_CTL_LEN (COPS_BATCH_PREFIX + 4 + 8 + 8 + 8 + 8)
+
+/* Store a word that is already in network byte order. */
+static inline void
+cops_batch_word(uint8_t* dst, uint32_t be) {
+        memcpy(dst, &be, 4);
+}
+
+/* Constant prefix shared by every message: header, Handle, Context and Decision Flags. */
+static void
+cops_batch_prefix(uint8_t* prefix) {
+        cops_put_header(prefix, 2, 0);
+        cops_handle(prefix + COPS_HEADER_LEN, "\0\0\0\0");
+        cops_context(prefix + COPS_HEADER_LEN + COPS_COMMON_OBJ_LEN);
+        cops_decision(prefix + COPS_HEADER_LEN + 2 * COPS_COMMON_OBJ_LEN);
+}
+
+size_t
+cops_batch_encode(uint8_t* dst, size_t cap, const struct cops_gate_op* ops, size_t n, const uint8_t* profile,
+                  size_t profile_len, uint8_t profile_stype, uint32_t* offsets) {
+        uint8_t prefix[COPS_BATCH_PREFIX];
+        size_t total = 0;
+        size_t i;
+
+        if ((profile_len & 3) != 0 || profile_len > UINT16_MAX - 4 || (profile_len != 0 && profile == NULL))
+                return 0;
+
+        /* Pass 1: lengths and offsets. The whole batch is validated before any byte is written. */
+        for (i = 0; i < n; i++) {
+                if (ops[i].family != AF_INET && ops[i].family != AF_INET6)
+                        return 0;
+
+                offsets[i] = (uint32_t)total;
+                total += COPS_BATCH_BASE + profile_len + (ops[i].family == AF_INET6 ? 12 : 0) +
+                         (ops[i].has_gate_id ? 8 : 0);
+                if (total > cap || total > UINT32_MAX)
+                        return 0;
+        }
+        offsets[n] = (uint32_t)total;
+
+        cops_batch_prefix(prefix);
+
+        const uint32_t tid_hdr = COPS_BE32(COPS_OBJ_WORD(8, PCMM_SNUM_TRANSACTION_ID, 1));
+        const uint32_t amid_hdr = COPS_BE32(COPS_OBJ_WORD(8, PCMM_SNUM_AMID, 1));
+        const uint32_t gid_hdr = COPS_BE32(COPS_OBJ_WORD(8, PCMM_SNUM_GATE_ID, 1));
+        const uint32_t spec_hdr = COPS_BE32(COPS_OBJ_WORD(4 + PCMM_GATE_SPEC_LEN, PCMM_SNUM_GATE_SPEC, 1));
+        const uint32_t prof_hdr = COPS_BE32(COPS_OBJ_WORD(4 + profile_len, PCMM_SNUM_TRAFFIC_PROFILE, profile_stype));
+
+        for (size_t c = 0; c < n; c += COPS_BATCH_CHUNK) {
+                const struct cops_gate_op* op = ops + c;
+                const uint32_t* off = offsets + c;
+                size_t m = (n - c < COPS_BATCH_CHUNK) ? n - c : COPS_BATCH_CHUNK;
+
+                uint32_t w_len[COPS_BATCH_CHUNK];
+                uint32_t w_csi[COPS_BATCH_CHUNK];
+                uint32_t w_tid[COPS_BATCH_CHUNK];
+                uint32_t w_amid[COPS_BATCH_CHUNK];
+                uint32_t w_sub[COPS_BATCH_CHUNK];
+                uint32_t w_gid[COPS_BATCH_CHUNK];
+
+                /* Pass 2: byte order conversion, one word per variable field. */
+                for (i = 0; i < m; i++) {
+                        uint32_t len = off[i + 1] - off[i];
+                        uint32_t v6 = op[i].family == AF_INET6;
+
+                        w_len[i] = COPS_BE32(len);
+                        w_csi[i] = COPS_BE32(
+                                COPS_OBJ_WORD(len - COPS_BATCH_PREFIX, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI));
+                        w_tid[i] = COPS_BE32((uint32_t)op[i].trans_id << 16 | op[i].command);
+                        w_amid[i] = COPS_BE32((uint32_t)op[i].am_tag << 16 | op[i].app_type);
+                        w_sub[i] = COPS_BE32(COPS_OBJ_WORD(8 + 12 * v6, PCMM_SNUM_SUBSCRIBER_ID, 1 + v6));
+                        w_gid[i] = COPS_BE32(op[i].gate_id);
+                }
+
+                /* Pass 3: fixed-size copy of the constant prefix. */
+                for (i = 0; i < m; i++)
+                        memcpy(dst + off[i], prefix, COPS_BATCH_PREFIX);
+
+                /*
+                 * Pass 4: field stores. Optional and variable length objects are written
+                 * unconditionally and the cursor only advances past them when present, the
+                 * next object then overwrites any bytes that do not belong to the message.
+                 */
+                for (i = 0; i < m; i++) {
+                        uint8_t* p = dst + off[i];
+
+                        cops_batch_word(p + 4, w_len[i]);
+                        memcpy(p + 12, op[i].handle, 4);
+                        p += COPS_BATCH_PREFIX;
+
+                        cops_batch_word(p, w_csi[i]);
+                        cops_batch_word(p + 4, tid_hdr);
+                        cops_batch_word(p + 8, w_tid[i]);
+                        cops_batch_word(p + 12, amid_hdr);
+                        cops_batch_word(p + 16, w_amid[i]);
+                        p += 20;
+
+                        cops_batch_word(p, w_sub[i]);
+                        memcpy(p + 4, op[i].subscriber, 16);
+                        p += 8 + 12 * (op[i].family == AF_INET6);
+
+                        cops_batch_word(p, gid_hdr);
+                        cops_batch_word(p + 4, w_gid[i]);
+                        p += 8 * op[i].has_gate_id;
+
+                        cops_batch_word(p, spec_hdr);
+                        memcpy(p + 4, op[i].gate_spec, PCMM_GATE_SPEC_LEN);
+                        p += 4 + PCMM_GATE_SPEC_LEN;
+
+                        cops_batch_word(p, prof_hdr);
+                        if (profile_len)
+                                memcpy(p + 4, profile, profile_len);
+                }
+        }
+
+        return total;
+}
+
+size_t
+cops_batch_control(uint8_t* dst, size_t cap, const struct cops_gate_table* gates, const uint32_t* handles,
+                   size_t n, uint16_t command, uint16_t trans_id, uint32_t* offsets) {
+        uint8_t prefix[COPS_BATCH_PREFIX];
+        size_t total = 0;
+        size_t i;
+
+        cops_batch_prefix(prefix);
+
+        const uint32_t tid_hdr = COPS_BE32(COPS_OBJ_WORD(8, PCMM_SNUM_TRANSACTION_ID, 1));
+        const uint32_t amid_hdr = COPS_BE32(COPS_OBJ_WORD(8, PCMM_SNUM_AMID, 1));
+        const uint32_t gid_hdr = COPS_BE32(COPS_OBJ_WORD(8, PCMM_SNUM_GATE_ID, 1));
+
+        for (i = 0; i < n; i++) {
+                const struct cops_gate* g = cops_gate_find(gates, handles[i]);
+
+                offsets[i] = (uint32_t)total;
+                if (g == NULL || (g->family != AF_INET && g->family != AF_INET6))
+                        continue;
+
+                uint32_t v6 = g->family == AF_INET6;
+                uint32_t len = COPS_BATCH_CTL_LEN + 12 * v6;
+                if (total + len > cap || total + len > UINT32_MAX)
+                        break;
+
+                uint8_t* p = dst + total;
+                memcpy(p, prefix, COPS_BATCH_PREFIX);
+                cops_store32(p + 4, len);
+                memcpy(p + 12, &g->handle, 4);
+                p += COPS_BATCH_PREFIX;
+
+                cops_store32(p, COPS_OBJ_WORD(len - COPS_BATCH_PREFIX, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI));
+                cops_batch_word(p + 4, tid_hdr);
+                cops_store32(p + 8, (uint32_t)(uint16_t)(trans_id + i) << 16 | command);
+                cops_batch_word(p + 12, amid_hdr);
+                cops_store32(p + 16, (uint32_t)g->am_tag << 16 | g->app_type);
+                cops_store32(p + 20, COPS_OBJ_WORD(8 + 12 * v6, PCMM_SNUM_SUBSCRIBER_ID, 1 + v6));
+                memcpy(p + 24, g->subscriber, 4 + 12 * v6);
+                p += 28 + 12 * v6;
+
+                cops_batch_word(p, gid_hdr);
+                cops_store32(p + 4, g->gate_id);
+                total += len;
+        }
+        offsets[i] = (uint32_t)total;
+
+        return i;
+}
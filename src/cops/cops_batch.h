@@ -0,0 +1,85 @@
+#ifndef COPS_BATCH_H
+#define COPS_BATCH_H
+
+#include "cops.h"
+#include "cops_gate.h"
+#include "pcmm.h"
+
+/* Number of operations converted per pass, bounds the on-stack scratch arrays. */
+#define COPS_BATCH_CHUNK 64
+
+/*
+ * A single gate operation encoded by cops_batch_encode. Host byte order unless noted.
+ *
+ * @handle      4-byte PEP client handle
+ * @trans_id    Transaction ID
+ * @command     Gate Command Type (e.g. PCMM_GATE_SET)
+ * @am_tag      Application Manager Tag (AMID)
+ * @app_type    Application Type (AMID)
+ * @gate_id     Gate ID, only encoded when has_gate_id is set
+ * @has_gate_id Include a Gate ID object (modification of an installed gate)
+ * @family      Subscriber address family, AF_INET or AF_INET6
+ * @subscriber  Subscriber address, network byte order (first 4 bytes for AF_INET)
+ * @gate_spec   Gate Spec body, network byte order
+ */
+struct cops_gate_op {
+        char handle[4];
+        uint16_t trans_id;
+        uint16_t command;
+        uint16_t am_tag;
+        uint16_t app_type;
+        uint32_t gate_id;
+        bool has_gate_id;
+        uint8_t family;
+        uint8_t subscriber[16];
+        uint8_t gate_spec[PCMM_GATE_SPEC_LEN];
+};
+
+/*
+ * Encode N gate Decisions back to back into one contiguous buffer, ready for a single write.
+ *
+ * Each message carries Handle, Context, Decision Flags and Client Specific Decision Data with
+ * Transaction ID, AMID, Subscriber ID, optional Gate ID, Gate Spec and the batch-wide Traffic
+ * Profile, in the same object order as pack_ctl_objs and cops_dec_template_render. The work is
+ * split in passes (lengths, constant prefix copies, byte order conversion, field stores) over
+ * chunks of COPS_BATCH_CHUNK operations so every pass is a branch-free loop.
+ *
+ * @dst             Destination buffer
+ * @cap             Capacity of dst in bytes
+ * @ops             Gate operations
+ * @n               Number of gate operations
+ * @profile         Traffic Profile body shared by every operation, network byte order
+ * @profile_len     Traffic Profile body length, MUST be a multiple of four
+ * @profile_stype   Traffic Profile S-Type
+ * @offsets         Receives n + 1 entries, the start of every message and the total length
+ *
+ * Returns the number of bytes written, or 0 when the batch does not fit or an operation is
+ * invalid (nothing is written in that case).
+ */
+size_t cops_batch_encode(uint8_t* dst, size_t cap, const struct cops_gate_op* ops, size_t n, const uint8_t* profile,
+                         size_t profile_len, uint8_t profile_stype, uint32_t* offsets);
+
+/*
+ * Encode Gate-Info or Gate-Delete Decisions for installed gates back to back, e.g. for the
+ * handles returned by cops_radix_find. Each message carries Handle, Context, Decision Flags and
+ * Client Specific Decision Data with Transaction ID, AMID, Subscriber ID and Gate ID, all taken
+ * from the gate's entry in the table. Messages are written until the next one does not fit, so
+ * a large set of gates goes out as a sequence of full buffers.
+ *
+ * @dst         Destination buffer
+ * @cap         Capacity of dst in bytes
+ * @gates       Gate table
+ * @handles     Client handles of the gates
+ * @n           Number of handles
+ * @command     Gate Command Type, PCMM_GATE_INFO or PCMM_GATE_DELETE
+ * @trans_id    Transaction ID of handles[0], handles[i] gets trans_id + i
+ * @offsets     Receives an entry per handle consumed, the start of its message, then the
+ *              total length. A handle with no gate, or whose gate has no subscriber address,
+ *              gets no message.
+ *
+ * Returns the number of handles consumed, offsets[returned] is the number of bytes written.
+ */
+size_t cops_batch_control(uint8_t* dst, size_t cap, const struct cops_gate_table* gates, const uint32_t* handles,
+                          size_t n, uint16_t command, uint16_t trans_id, uint32_t* offsets);
+
+#endif
@@ -0,0 +1,187 @@
+#include "cops_builder.h"
+
+static const uint8_t cops_pad[4] = {0, 0, 0, 0};
+
+static inline bool
+cops_builder_room(struct cops_builder* b, size_t n) {
+        if (b->overflow || b->cap - b->len < n) {
+                b->overflow = true;
+                return false;
+        }
+
+        return true;
+}
+
+/* Close the pending buf segment [seg_start, len) into the iovec list. */
+static bool
+cops_builder_flush_seg(struct cops_builder* b) {
+        if (b->len == b->seg_start)
+                return true;
+
+        if (b->iovcnt == COPS_BUILDER_MAX_IOV) {
+                b->overflow = true;
+                return false;
+        }
+
+        b->iov[b->iovcnt].iov_base = b->buf + b->seg_start;
+        b->iov[b->iovcnt].iov_len = b->len - b->seg_start;
+        b->iovcnt++;
+        b->seg_start = b->len;
+
+        return true;
+}
+
+static void
+cops_builder_pad(struct cops_builder* b, size_t len) {
+        size_t pad = COPS_ALIGN4(len) - len;
+
+        memcpy(b->buf + b->len, cops_pad, pad);
+        b->len += pad;
+        b->msg_len += pad;
+}
+
+void
+cops_builder_init(struct cops_builder* b, uint8_t* buf, size_t cap, uint8_t opcode) {
+        memset(b, 0, sizeof(*b));
+        b->buf = buf;
+        b->cap = cap;
+
+        if (!cops_builder_room(b, COPS_HEADER_LEN))
+                return;
+
+        cops_put_header(buf, opcode, 0);
+        b->len = COPS_HEADER_LEN;
+        b->msg_len = COPS_HEADER_LEN;
+}
+
+int
+cops_builder_append(struct cops_builder* b, const void* obj, size_t len) {
+        if (!cops_builder_room(b, COPS_ALIGN4(len)))
+                return -1;
+
+        memcpy(b->buf + b->len, obj, len);
+        b->len += len;
+        b->msg_len += len;
+        cops_builder_pad(b, len);
+
+        return 0;
+}
+
+int
+cops_builder_object(struct cops_builder* b, uint8_t cnum, uint8_t ctype, const void* body, size_t body_len) {
+        size_t len = COPS_OBJ_HEADER_LEN + body_len;
+
+        if (len > UINT16_MAX || !cops_builder_room(b, COPS_ALIGN4(len))) {
+                b->overflow = true;
+                return -1;
+        }
+
+        uint8_t* dst = b->buf + b->len;
+        cops_put_objhdr(dst, (uint16_t)len, cnum, ctype);
+        if (body_len)
+                memcpy(dst + COPS_OBJ_HEADER_LEN, body, body_len);
+
+        b->len += len;
+        b->msg_len += len;
+        cops_builder_pad(b, len);
+
+        return 0;
+}
+
+int
+cops_builder_ref(struct cops_builder* b, const void* obj, size_t len) {
+        if (b->overflow || !cops_builder_flush_seg(b))
+                return -1;
+
+        /* One slot for the reference plus, at worst, one for the segment that follows it. */
+        if (b->iovcnt + 2 > COPS_BUILDER_MAX_IOV || !cops_builder_room(b, COPS_ALIGN4(len) - len)) {
+                b->overflow = true;
+                return -1;
+        }
+
+        b->iov[b->iovcnt].iov_base = (void*)obj;
+        b->iov[b->iovcnt].iov_len = len;
+        b->iovcnt++;
+        b->msg_len += len;
+
+        /* Padding is copied, it starts the next buf segment. */
+        cops_builder_pad(b, len);
+
+        return 0;
+}
+
+int
+cops_builder_begin(struct cops_builder* b, uint8_t cnum, uint8_t ctype, struct cops_builder_mark* mark) {
+        mark->buf_off = b->len;
+        mark->msg_off = b->msg_len;
+
+        return cops_builder_object(b, cnum, ctype, NULL, 0);
+}
+
+void
+cops_builder_end(struct cops_builder* b, const struct cops_builder_mark* mark) {
+        size_t len = b->msg_len - mark->msg_off;
+
+        if (b->overflow)
+                return;
+        if (len > UINT16_MAX) {
+                b->overflow = true;
+                return;
+        }
+
+        cops_store16(b->buf + mark->buf_off, (uint16_t)len);
+}
+
+size_t
+cops_builder_finish(struct cops_builder* b) {
+        if (b->overflow || !cops_builder_flush_seg(b))
+                return 0;
+
+        cops_store32(b->buf + 4, (uint32_t)b->msg_len);
+
+        return b->msg_len;
+}
+
+size_t
+cops_builder_seal(struct cops_builder* b, struct cops_integrity* s) {
+        struct cops_hmac h;
+
+        /* The object becomes a segment of its own, behind every byte it signs. */
+        if (!cops_builder_room(b, COPS_INTEGRITY_LEN) || !cops_builder_flush_seg(b) ||
+            b->iovcnt == COPS_BUILDER_MAX_IOV) {
+                b->overflow = true;
+                return 0;
+        }
+
+        b->msg_len += COPS_INTEGRITY_LEN;
+        cops_store32(b->buf + 4, (uint32_t)b->msg_len);
+
+        cops_hmac_init(&h, s->key);
+        for (int i = 0; i < b->iovcnt; i++)
+                cops_hmac_update(&h, b->iov[i].iov_base, b->iov[i].iov_len);
+        cops_integrity_seal(&h, b->buf + b->len, s->tx_seq++);
+        b->len += COPS_INTEGRITY_LEN;
+
+        return cops_builder_finish(b);
+}
+
+const struct iovec*
+cops_builder_iov(const struct cops_builder* b, int* iovcnt) {
+        *iovcnt = b->iovcnt;
+        return b->iov;
+}
+
+size_t
+cops_builder_copy(const struct cops_builder* b, uint8_t* dst, size_t cap) {
+        size_t n = 0;
+
+        if (b->overflow || b->msg_len > cap)
+                return 0;
+
+        for (int i = 0; i < b->iovcnt; i++) {
+                memcpy(dst + n, b->iov[i].iov_base, b->iov[i].iov_len);
+                n += b->iov[i].iov_len;
+        }
+
+        return n;
+}
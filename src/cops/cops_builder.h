@@ -0,0 +1,97 @@
+#ifndef COPS_BUILDER_H
+#define COPS_BUILDER_H
+
+#include <sys/uio.h>
+
+#include "cops.h"
+#include "cops_integrity.h"
+
+/* Maximum number of iovec segments a single message may be split into. */
+#define COPS_BUILDER_MAX_IOV 16
+
+/*
+ * Bounds-checked COPS message builder.
+ *
+ * The builder writes the COPS common header and every copied object into a caller-owned buffer
+ * of known capacity. Objects that are constant or owned by the caller may instead be referenced,
+ * in which case they are emitted as their own iovec segment and never copied. Every object is
+ * padded to a 4-byte boundary and the header length is fixed up by cops_builder_finish().
+ *
+ * Any append that does not fit sets a sticky overflow flag; nothing is written past cap.
+ */
+struct cops_builder {
+        uint8_t* buf;
+        size_t cap;
+        size_t len;       /* Bytes used in buf. */
+        size_t msg_len;   /* Logical message length, copied and referenced bytes. */
+        size_t seg_start; /* Start in buf of the segment not yet added to iov. */
+        struct iovec iov[COPS_BUILDER_MAX_IOV];
+        int iovcnt;
+        bool overflow;
+};
+
+/*
+ * Start a new message in the given buffer. The COPS common header is written immediately with
+ * a placeholder length.
+ *
+ * @b           Builder
+ * @buf         Destination buffer for the header and copied objects
+ * @cap         Capacity of buf in bytes
+ * @opcode      COPS Op-Code of the message
+ */
+void cops_builder_init(struct cops_builder* b, uint8_t* buf, size_t cap, uint8_t opcode);
+
+/* Copy a complete object (header included) into the message, padding it to a word boundary. */
+int cops_builder_append(struct cops_builder* b, const void* obj, size_t len);
+
+/* Write an object header followed by a copy of the body, padding it to a word boundary. */
+int cops_builder_object(struct cops_builder* b, uint8_t cnum, uint8_t ctype, const void* body, size_t body_len);
+
+/*
+ * Reference a complete object (header included) owned by the caller. The bytes are emitted as
+ * their own iovec segment and MUST remain valid until the message has been sent.
+ */
+int cops_builder_ref(struct cops_builder* b, const void* obj, size_t len);
+
+/* Position of an open container object, see cops_builder_begin(). */
+struct cops_builder_mark {
+        size_t buf_off; /* Object header offset in buf. */
+        size_t msg_off; /* Object header offset in the message. */
+};
+
+/*
+ * Open an object that contains other objects (e.g. Client Specific Decision Data). The mark is
+ * passed to cops_builder_end() once the nested objects have been added, which fills in the
+ * object length. Returns -1 on overflow.
+ */
+int cops_builder_begin(struct cops_builder* b, uint8_t cnum, uint8_t ctype, struct cops_builder_mark* mark);
+
+void cops_builder_end(struct cops_builder* b, const struct cops_builder_mark* mark);
+
+/*
+ * Fix up the COPS header length and close the iovec list.
+ *
+ * Returns the total message length, or 0 when any append overflowed.
+ */
+size_t cops_builder_finish(struct cops_builder* b);
+
+/*
+ * Finish the message with an Integrity object carrying the next sequence number of s, the last
+ * object, which takes COPS_INTEGRITY_LEN bytes of buf. The digest is taken over the iovec
+ * segments as they are, referenced objects are hashed in place and never copied.
+ *
+ * Returns the total message length, or 0 when any append overflowed or the object does not fit.
+ */
+size_t cops_builder_seal(struct cops_builder* b, struct cops_integrity* s);
+
+/* Return the iovec list of a finished message, suitable for writev()/sendmsg(). */
+const struct iovec* cops_builder_iov(const struct cops_builder* b, int* iovcnt);
+
+/*
+ * Gather a finished message into one contiguous buffer.
+ *
+ * Returns the number of bytes written, or 0 when dst is too small.
+ */
+size_t cops_builder_copy(const struct cops_builder* b, uint8_t* dst, size_t cap);
+
+#endif
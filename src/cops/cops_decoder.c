@@ -0,0 +1,117 @@
+#include "cops_decoder.h"
+
+static int
+cops_decode_fail(struct cops_decoder* dec, enum cops_decode_err err) {
+        dec->err = err;
+        return -1;
+}
+
+void
+cops_decoder_init(struct cops_decoder* dec) {
+        memset(dec, 0, sizeof(*dec));
+}
+
+int
+cops_decode(struct cops_decoder* dec, const uint8_t* buf, size_t len, const struct cops_msg** msg) {
+        struct cops_msg* m = &dec->msg;
+
+        if (dec->err != COPS_DECODE_ERR_NONE)
+                return -1;
+
+        /* Parse and validate the common header once per message. */
+        if (dec->scan == 0) {
+                if (len < COPS_HEADER_LEN)
+                        return 0;
+
+                m->version = buf[0] >> 4;
+                m->flags = buf[0] & 0x0F;
+                m->opcode = buf[1];
+                m->client_type = cops_load16(buf + 2);
+                m->length = cops_load32(buf + 4);
+                m->nobjs = 0;
+
+                uint32_t max_len = cops_decoder_max_len(dec);
+
+                if (m->version != 1)
+                        return cops_decode_fail(dec, COPS_DECODE_ERR_VERSION);
+                if (!cops_header_check(m->opcode, m->client_type, m->length, max_len) &&
+                    !(dec->sync && cops_sync_header_check(m->opcode, m->client_type, m->length, max_len)))
+                        return cops_decode_fail(dec, COPS_DECODE_ERR_HEADER);
+                if (m->length < COPS_HEADER_LEN || (m->length & 3) != 0)
+                        return cops_decode_fail(dec, COPS_DECODE_ERR_LENGTH);
+
+                dec->scan = COPS_HEADER_LEN;
+                dec->hashed = 0;
+                if (dec->key)
+                        cops_hmac_init(&dec->hmac, dec->key);
+        }
+
+        m->data = buf;
+
+        /* Walk every object header that has arrived since the last call. */
+        while (dec->scan < m->length && dec->scan + COPS_OBJ_HEADER_LEN <= len) {
+                uint32_t off = dec->scan;
+                uint16_t olen = cops_load16(buf + off);
+
+                if (olen < COPS_OBJ_HEADER_LEN || off + COPS_ALIGN4(olen) > m->length)
+                        return cops_decode_fail(dec, COPS_DECODE_ERR_OBJ_LEN);
+                if (m->nobjs == COPS_MAX_OBJS)
+                        return cops_decode_fail(dec, COPS_DECODE_ERR_OBJ_COUNT);
+
+                struct cops_obj* obj = &m->objs[m->nobjs++];
+                obj->length = olen;
+                obj->cnum = buf[off + 2];
+                obj->ctype = buf[off + 3];
+                obj->offset = off;
+
+                dec->scan = off + COPS_ALIGN4(olen);
+        }
+
+        /* Digest what arrived of the signed part (all but the Integrity object) while it is hot. */
+        if (dec->key && m->length >= COPS_HEADER_LEN + COPS_INTEGRITY_LEN) {
+                size_t end = m->length - COPS_INTEGRITY_LEN;
+
+                if (end > len)
+                        end = len;
+                if (end > dec->hashed) {
+                        cops_hmac_update(&dec->hmac, buf + dec->hashed, end - dec->hashed);
+                        dec->hashed = (uint32_t)end;
+                }
+        }
+
+        if (len < m->length)
+                return 0;
+
+        *msg = m;
+        dec->scan = 0;
+
+        return (int)m->length;
+}
+
+enum cops_ierr
+cops_decoder_verify(struct cops_decoder* dec, struct cops_integrity* s) {
+        const struct cops_msg* m = &dec->msg;
+
+        if (m->length < COPS_HEADER_LEN + COPS_INTEGRITY_LEN)
+                return COPS_IERR_MISSING;
+
+        return cops_integrity_check(s, &dec->hmac, m->data + m->length - COPS_INTEGRITY_LEN);
+}
+
+size_t
+cops_decoder_want(const struct cops_decoder* dec, size_t len) {
+        if (dec->scan == 0)
+                return (len < COPS_HEADER_LEN) ? COPS_HEADER_LEN - len : 0;
+
+        return (len < dec->msg.length) ? dec->msg.length - len : 0;
+}
+
+const struct cops_obj*
+cops_msg_find(const struct cops_msg* msg, uint8_t cnum, uint8_t ctype) {
+        for (uint16_t i = 0; i < msg->nobjs; i++) {
+                if (msg->objs[i].cnum == cnum && msg->objs[i].ctype == ctype)
+                        return &msg->objs[i];
+        }
+
+        return NULL;
+}
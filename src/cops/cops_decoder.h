@@ -0,0 +1,120 @@
+#ifndef COPS_DECODER_H
+#define COPS_DECODER_H
+
+#include "cops.h"
+#include "cops_integrity.h"
+
+/* Upper bound on the number of top-level objects tracked for a single message. */
+#define COPS_MAX_OBJS 32
+
+/*
+ * A top-level object inside a decoded message. The object is not copied, the offset
+ * is relative to the first byte of the message (the COPS common header).
+ *
+ * +-----------------------------------+------------------+----------------------------+
+ * | Length  (2-bytes)                 | C-Num (1-byte)   | C-Type (1-byte)            |
+ * +-----------------------------------+------------------+----------------------------+
+ */
+struct cops_obj {
+        uint8_t cnum;
+        uint8_t ctype;
+        uint16_t length; /* Object length including the 4-byte object header. */
+        uint32_t offset; /* Offset of the object header from the start of the message. */
+};
+
+/*
+ * Read-only view of a complete COPS message inside the caller's receive buffer. The
+ * view is valid until the caller discards or overwrites the bytes it references.
+ */
+struct cops_msg {
+        const uint8_t* data; /* First byte of the COPS common header. */
+        uint8_t version;
+        uint8_t flags;
+        uint8_t opcode;
+        uint16_t client_type;
+        uint32_t length;
+        uint16_t nobjs;
+        struct cops_obj objs[COPS_MAX_OBJS];
+};
+
+/* Reasons a stream was rejected by the decoder. */
+enum cops_decode_err {
+        COPS_DECODE_ERR_NONE = 0,
+        COPS_DECODE_ERR_VERSION,   /* Version field is not 1. */
+        COPS_DECODE_ERR_HEADER,    /* Rejected by cops_header_check() with the decoder's max_len. */
+        COPS_DECODE_ERR_LENGTH,    /* Message length shorter than a header or not word aligned. */
+        COPS_DECODE_ERR_OBJ_LEN,   /* Object length shorter than its header or overruns the message. */
+        COPS_DECODE_ERR_OBJ_COUNT, /* More than COPS_MAX_OBJS objects. */
+};
+
+/*
+ * Resumable framing state for a single inbound TCP stream. The decoder never allocates and
+ * never copies message bytes, all progress is kept as offsets relative to the start of the
+ * message currently being framed.
+ *
+ * With a key, every byte the Integrity object of a message signs is fed to hmac while the
+ * message is framed, as it arrives, so cops_decoder_verify only has to finish the digest.
+ *
+ * A message longer than max_len is rejected from its header. The default is COPS_MSG_MAX_LEN,
+ * plus COPS_INTEGRITY_LEN with a key since the Integrity object comes on top of the message.
+ */
+struct cops_decoder {
+        struct cops_msg msg;
+        uint32_t scan; /* Bytes of the pending message already examined. */
+        enum cops_decode_err err;
+        bool sync;                            /* Also frame SSQ and SSC (cops_sync_header_ok), set after init. */
+        const struct cops_integrity_key* key; /* Digest messages with this key, set after init. */
+        uint32_t max_len;                     /* Longest message accepted, set after init, 0 for the default. */
+        uint32_t hashed;                      /* Bytes of the pending message fed to hmac. */
+        struct cops_hmac hmac;
+};
+
+void cops_decoder_init(struct cops_decoder* dec);
+
+/*
+ * Frame the next message from the caller's receive buffer.
+ *
+ * The buffer MUST start at a message boundary, i.e. at the first byte that was not consumed by
+ * a previous call. When a call returns 0 the caller keeps the bytes it passed in, appends the
+ * next chunk read from the socket and calls again with the same starting byte (the bytes may be
+ * moved, only their order matters). Already examined headers and objects are not scanned again.
+ *
+ * @dec         Decoder state for this stream
+ * @buf         Unconsumed bytes, starting at a message boundary
+ * @len         Number of bytes available at buf
+ * @msg         Set to a view of the complete message when one is returned, the view is
+ *              owned by the decoder and valid until the next call
+ *
+ * Returns the number of bytes consumed by the framed message, 0 when more bytes are needed and
+ * -1 when the stream is malformed (see dec->err). A malformed stream cannot be resynchronised.
+ */
+int cops_decode(struct cops_decoder* dec, const uint8_t* buf, size_t len, const struct cops_msg** msg);
+
+/*
+ * Check the Integrity object of the message the last cops_decode call returned, its last
+ * object, against the digest taken while framing it (dec->key MUST be set). Call once per
+ * message, like cops_integrity_verify it advances the expected sequence number of s.
+ */
+enum cops_ierr cops_decoder_verify(struct cops_decoder* dec, struct cops_integrity* s);
+
+/* Number of additional bytes needed before the pending message can be completed. */
+size_t cops_decoder_want(const struct cops_decoder* dec, size_t len);
+
+/* Longest message the decoder accepts, max_len or its default. */
+static inline uint32_t
+cops_decoder_max_len(const struct cops_decoder* dec) {
+        if (dec->max_len)
+                return dec->max_len;
+        return COPS_MSG_MAX_LEN + (dec->key ? COPS_INTEGRITY_LEN : 0);
+}
+
+/* Return the first object with the given C-Num and C-Type, or NULL if it is not present. */
+const struct cops_obj* cops_msg_find(const struct cops_msg* msg, uint8_t cnum, uint8_t ctype);
+
+/* Return a pointer to the object contents, immediately following the 4-byte object header. */
+static inline const uint8_t*
+cops_obj_data(const struct cops_msg* msg, const struct cops_obj* obj) {
+        return msg->data + obj->offset + COPS_OBJ_HEADER_LEN;
+}
+
+#endif
@@ -0,0 +1,287 @@
+#include "cops_gate.h"
+
+/* Minimum capacity, and the number of old slots migrated per mutation during a resize. */
+#define COPS_GATE_MIN_CAP      16
+#define COPS_GATE_MIGRATE_STEP 32
+
+/* Finalizer of MurmurHash3, spreads sequential handles over the whole table. */
+static inline uint32_t
+cops_gate_hash(uint32_t key) {
+        key ^= key >> 16;
+        key *= 0x85EBCA6B;
+        key ^= key >> 13;
+        key *= 0xC2B2AE35;
+        key ^= key >> 16;
+        return key;
+}
+
+static int
+cops_gate_slots_alloc(struct cops_gate_slots* s, size_t cap) {
+        s->slots = aligned_alloc(64, cap * sizeof(struct cops_gate));
+        if (s->slots == NULL)
+                return -1;
+
+        memset(s->slots, 0, cap * sizeof(struct cops_gate));
+        s->mask = cap - 1;
+        s->count = 0;
+
+        return 0;
+}
+
+static struct cops_gate*
+cops_gate_lookup(const struct cops_gate_slots* s, uint32_t key) {
+        if (s->slots == NULL)
+                return NULL;
+
+        size_t i = cops_gate_hash(key) & s->mask;
+
+        /* An entry closer to its home than our probe distance ends the search. */
+        for (uint8_t d = 1;; i = (i + 1) & s->mask) {
+                struct cops_gate* e = &s->slots[i];
+
+                if (e->dist < d)
+                        return NULL;
+                if (e->handle == key)
+                        return e;
+                if (d < UINT8_MAX)
+                        d++;
+        }
+}
+
+/*
+ * Robin Hood insertion of an entry known not to be present. Distances saturate at UINT8_MAX:
+ * saturated entries never end a lookup early, which keeps pathological clusters correct.
+ */
+static void
+cops_gate_place(struct cops_gate_slots* s, struct cops_gate* entry) {
+        struct cops_gate cur = *entry;
+        size_t i = cops_gate_hash(cur.handle) & s->mask;
+
+        cur.dist = 1;
+        for (;; i = (i + 1) & s->mask) {
+                struct cops_gate* e = &s->slots[i];
+
+                if (e->dist == 0) {
+                        *e = cur;
+                        s->count++;
+                        return;
+                }
+
+                /* Take the slot from an entry that is closer to home, carry that one forward. */
+                if (e->dist < cur.dist) {
+                        struct cops_gate tmp = *e;
+                        *e = cur;
+                        cur = tmp;
+                }
+
+                if (cur.dist < UINT8_MAX)
+                        cur.dist++;
+        }
+}
+
+/* Recompute the (saturated) distance of a key stored at slot i. */
+static inline uint8_t
+cops_gate_dist(const struct cops_gate_slots* s, size_t i, uint32_t key) {
+        size_t d = ((i - (cops_gate_hash(key) & s->mask)) & s->mask) + 1;
+
+        return (d < UINT8_MAX) ? (uint8_t)d : UINT8_MAX;
+}
+
+/* Remove the entry at slot i, shifting the rest of its cluster back by one. */
+static void
+cops_gate_erase(struct cops_gate_slots* s, size_t i) {
+        for (;;) {
+                size_t next = (i + 1) & s->mask;
+                struct cops_gate* n = &s->slots[next];
+
+                if (n->dist <= 1)
+                        break;
+
+                s->slots[i] = *n;
+                if (n->dist == UINT8_MAX)
+                        s->slots[i].dist = cops_gate_dist(s, i, n->handle);
+                else
+                        s->slots[i].dist--;
+                i = next;
+        }
+
+        memset(&s->slots[i], 0, sizeof(struct cops_gate));
+        s->count--;
+}
+
+/* Move a bounded number of old slots into the current table. */
+static void
+cops_gate_migrate(struct cops_gate_table* t, size_t steps) {
+        struct cops_gate_slots* old = &t->old;
+
+        while (old->slots && steps--) {
+                /* Erasing may shift a later entry into this slot, drain it before moving on. */
+                while (old->slots[t->migrate].dist != 0) {
+                        struct cops_gate e = old->slots[t->migrate];
+
+                        cops_gate_erase(old, t->migrate);
+                        cops_gate_place(&t->cur, &e);
+                }
+
+                if (++t->migrate > old->mask || old->count == 0) {
+                        free(old->slots);
+                        memset(old, 0, sizeof(*old));
+                        t->migrate = 0;
+                }
+        }
+}
+
+/* Start a resize into a table twice the current size. */
+static int
+cops_gate_grow(struct cops_gate_table* t) {
+        struct cops_gate_slots next;
+
+        /* A previous resize must complete first. */
+        cops_gate_migrate(t, SIZE_MAX);
+
+        if (cops_gate_slots_alloc(&next, (t->cur.mask + 1) * 2) < 0)
+                return -1;
+
+        t->old = t->cur;
+        t->cur = next;
+        t->migrate = 0;
+
+        return 0;
+}
+
+int
+cops_gate_table_init(struct cops_gate_table* t, size_t entries) {
+        size_t cap = COPS_GATE_MIN_CAP;
+
+        memset(t, 0, sizeof(*t));
+        while (cap - cap / 8 < entries)
+                cap *= 2;
+
+        return cops_gate_slots_alloc(&t->cur, cap);
+}
+
+void
+cops_gate_table_free(struct cops_gate_table* t) {
+        free(t->cur.slots);
+        free(t->old.slots);
+        memset(t, 0, sizeof(*t));
+}
+
+struct cops_gate*
+cops_gate_find(const struct cops_gate_table* t, uint32_t handle) {
+        struct cops_gate* e = cops_gate_lookup(&t->cur, handle);
+
+        if (e == NULL && t->old.slots)
+                e = cops_gate_lookup(&t->old, handle);
+
+        return e;
+}
+
+struct cops_gate*
+cops_gate_insert(struct cops_gate_table* t, uint32_t handle) {
+        struct cops_gate* e;
+
+        cops_gate_migrate(t, COPS_GATE_MIGRATE_STEP);
+
+        if ((e = cops_gate_find(t, handle)) != NULL)
+                return e;
+
+        if (t->cur.count + 1 > (t->cur.mask + 1) - (t->cur.mask + 1) / 8 && cops_gate_grow(t) < 0)
+                return NULL;
+
+        struct cops_gate entry = {0};
+        entry.handle = handle;
+        entry.gen = t->gen;
+
+        cops_gate_place(&t->cur, &entry);
+
+        /* Entries may have been displaced, look up where the new key landed. */
+        return cops_gate_find(t, handle);
+}
+
+bool
+cops_gate_remove(struct cops_gate_table* t, uint32_t handle) {
+        cops_gate_migrate(t, COPS_GATE_MIGRATE_STEP);
+
+        struct cops_gate_slots* tables[2] = {&t->cur, &t->old};
+        for (int k = 0; k < 2; k++) {
+                struct cops_gate* e = cops_gate_lookup(tables[k], handle);
+
+                if (e) {
+                        cops_gate_erase(tables[k], e - tables[k]->slots);
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+int
+cops_gate_mark_begin(struct cops_gate_table* t) {
+        if (t->marking)
+                return -1;
+
+        /* Flipping the live bit unmarks every gate at once. */
+        t->gen ^= 1;
+        t->marking = true;
+
+        return 0;
+}
+
+size_t
+cops_gate_sweep(struct cops_gate_table* t, cops_gate_sweep_fn fn, void* arg) {
+        struct cops_gate_slots* s = &t->cur;
+        size_t removed = 0;
+
+        if (!t->marking)
+                return 0;
+
+        cops_gate_migrate(t, SIZE_MAX);
+
+        /*
+         * Erasing shifts the rest of the cluster back into slot i, so i is examined again. Entries
+         * that wrap around past the end only ever move between slots already visited.
+         */
+        for (size_t i = 0; i <= s->mask;) {
+                struct cops_gate* e = &s->slots[i];
+
+                if (e->dist == 0 || e->gen == t->gen) {
+                        i++;
+                } else if (fn == NULL || fn(e, arg)) {
+                        cops_gate_erase(s, i);
+                        removed++;
+                } else {
+                        e->gen = t->gen;
+                        i++;
+                }
+        }
+
+        t->marking = false;
+        return removed;
+}
+
+void
+cops_gate_mark_abort(struct cops_gate_table* t) {
+        size_t iter = 0;
+        struct cops_gate* e;
+
+        while ((e = cops_gate_next(t, &iter)) != NULL)
+                e->gen = t->gen;
+        t->marking = false;
+}
+
+struct cops_gate*
+cops_gate_next(const struct cops_gate_table* t, size_t* iter) {
+        size_t cur_cap = t->cur.mask + 1;
+        size_t old_cap = t->old.slots ? t->old.mask + 1 : 0;
+
+        while (*iter < cur_cap + old_cap) {
+                size_t i = (*iter)++;
+                struct cops_gate* e = (i < cur_cap) ? &t->cur.slots[i] : &t->old.slots[i - cur_cap];
+
+                if (e->dist != 0)
+                        return e;
+        }
+
+        return NULL;
+}
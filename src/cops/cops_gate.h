@@ -0,0 +1,112 @@
+#ifndef COPS_GATE_H
+#define COPS_GATE_H
+
+#include "cops.h"
+
+/*
+ * Per-handle gate state. Two entries share a 64-byte cache line and the key is stored inline,
+ * so a lookup that hits on its home slot costs a single cache miss.
+ */
+struct cops_gate {
+        uint32_t handle; /* COPS client handle, the 4 handle bytes as a native word. */
+        uint32_t gate_id;
+        uint16_t am_tag;
+        uint16_t app_type;
+        uint8_t dist;       /* Internal: probe distance + 1, 0 marks an empty slot. */
+        uint8_t family : 7; /* AF_INET or AF_INET6. */
+        uint8_t gen : 1;    /* Internal: mark bit of a synchronization, see cops_gate_mark_begin. */
+        uint8_t decision;   /* Last Gate Command Type sent (e.g. PCMM_GATE_SET). */
+        uint8_t flags;      /* Application defined. */
+        uint8_t subscriber[16];
+};
+
+_Static_assert(sizeof(struct cops_gate) == 32, "struct cops_gate must stay half a cache line");
+
+struct cops_gate_slots {
+        struct cops_gate* slots;
+        size_t mask; /* Capacity - 1, capacity is a power of two. */
+        size_t count;
+};
+
+/*
+ * Open-addressing hash table of gate state keyed by client handle.
+ *
+ * Robin Hood linear probing keeps probe sequences short, deletion shifts the following entries
+ * back so no tombstones are ever left behind. When the load factor reaches 7/8 a table of twice
+ * the size is allocated and entries are migrated a few slots at a time on every insert and
+ * remove, so no single operation pays for a full rehash.
+ */
+struct cops_gate_table {
+        struct cops_gate_slots cur;
+        struct cops_gate_slots old; /* Table being drained during a resize, slots is NULL otherwise. */
+        size_t migrate;             /* Next old slot to migrate. */
+        uint8_t gen;                /* Mark bit of live gates, new gates are born marked. */
+        bool marking;               /* Between cops_gate_mark_begin and cops_gate_sweep. */
+};
+
+/* Convert a 4-byte client handle (as passed to cops_handle) to a table key. */
+static inline uint32_t
+cops_handle_key(const char* handle) {
+        uint32_t key;
+
+        memcpy(&key, handle, 4);
+        return key;
+}
+
+/* Initialise a table sized for at least the given number of entries. Returns -1 on ENOMEM. */
+int cops_gate_table_init(struct cops_gate_table* t, size_t entries);
+
+void cops_gate_table_free(struct cops_gate_table* t);
+
+/*
+ * Return the gate stored for a handle, or NULL. Pointers returned by the table are only valid
+ * until the next insert or remove.
+ */
+struct cops_gate* cops_gate_find(const struct cops_gate_table* t, uint32_t handle);
+
+/*
+ * Return the gate for a handle, creating a zeroed entry when it does not exist. Returns NULL
+ * when the table could not grow.
+ */
+struct cops_gate* cops_gate_insert(struct cops_gate_table* t, uint32_t handle);
+
+/* Remove the gate for a handle. Returns false when no such gate exists. */
+bool cops_gate_remove(struct cops_gate_table* t, uint32_t handle);
+
+static inline size_t
+cops_gate_count(const struct cops_gate_table* t) {
+        return t->cur.count + t->old.count;
+}
+
+/*
+ * Start a mark phase: every gate becomes unmarked, gates inserted from now on are marked.
+ * Returns -1 when a mark phase is already running.
+ */
+int cops_gate_mark_begin(struct cops_gate_table* t);
+
+/* Mark a gate as still present. */
+static inline void
+cops_gate_mark(const struct cops_gate_table* t, struct cops_gate* gate) {
+        gate->gen = t->gen;
+}
+
+/* Called by cops_gate_sweep for every unmarked gate. Return true to remove the gate. */
+typedef bool (*cops_gate_sweep_fn)(struct cops_gate* gate, void* arg);
+
+/*
+ * End the mark phase, passing every unmarked gate to fn (which may be NULL to remove them all).
+ * Gates that are kept count as marked again. One pass over the slots, O(capacity). Returns the
+ * number of gates removed.
+ */
+size_t cops_gate_sweep(struct cops_gate_table* t, cops_gate_sweep_fn fn, void* arg);
+
+/* End the mark phase without a sweep, every gate is kept. */
+void cops_gate_mark_abort(struct cops_gate_table* t);
+
+/*
+ * Iterate over every gate. Start with *iter = 0, returns NULL once all gates were visited.
+ * The table MUST NOT be modified during the iteration.
+ */
+struct cops_gate* cops_gate_next(const struct cops_gate_table* t, size_t* iter);
+
+#endif
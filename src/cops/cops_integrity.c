@@ -0,0 +1,267 @@
+#include "cops_integrity.h"
+
+static const uint32_t cops_md5_init[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+
+static const uint32_t cops_md5_k[64] = {
+        0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+        0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+        0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+        0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+        0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+        0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+        0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+        0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391,
+};
+
+static inline uint32_t
+cops_md5_rol(uint32_t x, uint32_t n) {
+        return (x << n) | (x >> (32 - n));
+}
+
+/* MD5 words are little-endian, unlike everything else on the wire. */
+static inline uint32_t
+cops_md5_word(const uint8_t* p) {
+        return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void
+cops_md5_put(uint8_t* p, uint32_t v) {
+        p[0] = (uint8_t)v;
+        p[1] = (uint8_t)(v >> 8);
+        p[2] = (uint8_t)(v >> 16);
+        p[3] = (uint8_t)(v >> 24);
+}
+
+/* The four round functions, F and G in the forms with one operation less (RFC 1321 section 3.4). */
+#define COPS_MD5_F(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define COPS_MD5_G(b, c, d) ((c) ^ ((d) & ((b) ^ (c))))
+#define COPS_MD5_H(b, c, d) ((b) ^ (c) ^ (d))
+#define COPS_MD5_I(b, c, d) ((c) ^ ((b) | ~(d)))
+
+#define COPS_MD5_STEP(fn, a, b, c, d, i, g, r) (a) = (b) + cops_md5_rol((a) + fn(b, c, d) + cops_md5_k[i] + m[g], r)
+
+/* Four steps rotating the roles of a, b, c and d, as the rounds of RFC 1321 are written. */
+#define COPS_MD5_STEPS(fn, i, g0, g1, g2, g3, r0, r1, r2, r3)                                                          \
+        COPS_MD5_STEP(fn, a, b, c, d, i, g0, r0);                                                                      \
+        COPS_MD5_STEP(fn, d, a, b, c, i + 1, g1, r1);                                                                  \
+        COPS_MD5_STEP(fn, c, d, a, b, i + 2, g2, r2);                                                                  \
+        COPS_MD5_STEP(fn, b, c, d, a, i + 3, g3, r3)
+
+/* One 64-byte block. Written out step by step, the 64 steps then run with no branches at all. */
+static void
+cops_md5_block(uint32_t* h, const uint8_t* block) {
+        uint32_t m[16];
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+
+        for (int i = 0; i < 16; i++)
+                m[i] = cops_md5_word(block + 4 * i);
+
+        COPS_MD5_STEPS(COPS_MD5_F, 0, 0, 1, 2, 3, 7, 12, 17, 22);
+        COPS_MD5_STEPS(COPS_MD5_F, 4, 4, 5, 6, 7, 7, 12, 17, 22);
+        COPS_MD5_STEPS(COPS_MD5_F, 8, 8, 9, 10, 11, 7, 12, 17, 22);
+        COPS_MD5_STEPS(COPS_MD5_F, 12, 12, 13, 14, 15, 7, 12, 17, 22);
+
+        COPS_MD5_STEPS(COPS_MD5_G, 16, 1, 6, 11, 0, 5, 9, 14, 20);
+        COPS_MD5_STEPS(COPS_MD5_G, 20, 5, 10, 15, 4, 5, 9, 14, 20);
+        COPS_MD5_STEPS(COPS_MD5_G, 24, 9, 14, 3, 8, 5, 9, 14, 20);
+        COPS_MD5_STEPS(COPS_MD5_G, 28, 13, 2, 7, 12, 5, 9, 14, 20);
+
+        COPS_MD5_STEPS(COPS_MD5_H, 32, 5, 8, 11, 14, 4, 11, 16, 23);
+        COPS_MD5_STEPS(COPS_MD5_H, 36, 1, 4, 7, 10, 4, 11, 16, 23);
+        COPS_MD5_STEPS(COPS_MD5_H, 40, 13, 0, 3, 6, 4, 11, 16, 23);
+        COPS_MD5_STEPS(COPS_MD5_H, 44, 9, 12, 15, 2, 4, 11, 16, 23);
+
+        COPS_MD5_STEPS(COPS_MD5_I, 48, 0, 7, 14, 5, 6, 10, 15, 21);
+        COPS_MD5_STEPS(COPS_MD5_I, 52, 12, 3, 10, 1, 6, 10, 15, 21);
+        COPS_MD5_STEPS(COPS_MD5_I, 56, 8, 15, 6, 13, 6, 10, 15, 21);
+        COPS_MD5_STEPS(COPS_MD5_I, 60, 4, 11, 2, 9, 6, 10, 15, 21);
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+}
+
+/* Pad and finish a digest: the 0x80 byte, zeros and the bit length, then the state as bytes. */
+static void
+cops_md5_final(uint32_t* h, uint8_t* block, uint32_t fill, uint64_t len, uint8_t* out) {
+        block[fill++] = 0x80;
+        if (fill > 56) {
+                memset(block + fill, 0, 64 - fill);
+                cops_md5_block(h, block);
+                fill = 0;
+        }
+        memset(block + fill, 0, 56 - fill);
+        cops_md5_put(block + 56, (uint32_t)(len << 3));
+        cops_md5_put(block + 60, (uint32_t)(len >> 29));
+        cops_md5_block(h, block);
+
+        for (int i = 0; i < 4; i++)
+                cops_md5_put(out + 4 * i, h[i]);
+}
+
+void
+cops_integrity_key_init(struct cops_integrity_key* key, uint32_t key_id, const void* secret, size_t len) {
+        uint8_t k[64] = {0};
+        uint8_t pad[64];
+
+        if (len > COPS_INTEGRITY_MAX_KEY_LEN) {
+                /* Keys longer than a block are replaced by their MD5 digest. */
+                uint32_t h[4];
+                const uint8_t* p = secret;
+                size_t n = len;
+
+                memcpy(h, cops_md5_init, sizeof(h));
+                for (; n >= 64; p += 64, n -= 64)
+                        cops_md5_block(h, p);
+                memcpy(pad, p, n);
+                cops_md5_final(h, pad, (uint32_t)n, len, k);
+        } else if (len) {
+                memcpy(k, secret, len);
+        }
+
+        key->key_id = key_id;
+        for (int i = 0; i < 64; i++)
+                pad[i] = k[i] ^ 0x36;
+        memcpy(key->inner, cops_md5_init, sizeof(key->inner));
+        cops_md5_block(key->inner, pad);
+
+        for (int i = 0; i < 64; i++)
+                pad[i] = k[i] ^ 0x5C;
+        memcpy(key->outer, cops_md5_init, sizeof(key->outer));
+        cops_md5_block(key->outer, pad);
+}
+
+void
+cops_integrity_init(struct cops_integrity* s, const struct cops_integrity_key* key, uint32_t tx_seq) {
+        s->key = key;
+        s->tx_seq = tx_seq;
+        s->rx_seq = 0;
+        s->rx_synced = false;
+}
+
+void
+cops_hmac_init(struct cops_hmac* h, const struct cops_integrity_key* key) {
+        h->key = key;
+        memcpy(h->h, key->inner, sizeof(h->h));
+        h->len = 64;
+        h->fill = 0;
+}
+
+void
+cops_hmac_update(struct cops_hmac* h, const void* data, size_t len) {
+        const uint8_t* p = data;
+
+        h->len += len;
+        if (h->fill) {
+                size_t n = 64 - h->fill;
+
+                if (len < n) {
+                        memcpy(h->block + h->fill, p, len);
+                        h->fill += (uint32_t)len;
+                        return;
+                }
+                memcpy(h->block + h->fill, p, n);
+                cops_md5_block(h->h, h->block);
+                p += n;
+                len -= n;
+                h->fill = 0;
+        }
+
+        /* Whole blocks straight from the message, only the tail is buffered. */
+        for (; len >= 64; p += 64, len -= 64)
+                cops_md5_block(h->h, p);
+
+        memcpy(h->block, p, len);
+        h->fill = (uint32_t)len;
+}
+
+void
+cops_hmac_final(struct cops_hmac* h, uint8_t* digest) {
+        uint8_t inner[16];
+        uint8_t full[16];
+
+        cops_md5_final(h->h, h->block, h->fill, h->len, inner);
+
+        memcpy(h->h, h->key->outer, sizeof(h->h));
+        memcpy(h->block, inner, sizeof(inner));
+        cops_md5_final(h->h, h->block, sizeof(inner), 64 + sizeof(inner), full);
+
+        memcpy(digest, full, COPS_INTEGRITY_DIGEST_LEN);
+}
+
+void
+cops_integrity_seal(struct cops_hmac* h, uint8_t* dst, uint32_t seq) {
+        cops_put_objhdr(dst, COPS_INTEGRITY_LEN, COPS_CNUM_INTEGRITY, COPS_CTYPE_INTEGRITY_HMAC);
+        cops_store32(dst + 4, h->key->key_id);
+        cops_store32(dst + 8, seq);
+
+        /* The digest covers the whole message but itself. */
+        cops_hmac_update(h, dst, COPS_INTEGRITY_LEN - COPS_INTEGRITY_DIGEST_LEN);
+        cops_hmac_final(h, dst + COPS_INTEGRITY_LEN - COPS_INTEGRITY_DIGEST_LEN);
+}
+
+enum cops_ierr
+cops_integrity_check(struct cops_integrity* s, struct cops_hmac* h, const uint8_t* obj) {
+        uint8_t digest[COPS_INTEGRITY_DIGEST_LEN];
+        uint32_t seq = cops_load32(obj + 8);
+
+        if (cops_load32(obj) != COPS_OBJ_WORD(COPS_INTEGRITY_LEN, COPS_CNUM_INTEGRITY, COPS_CTYPE_INTEGRITY_HMAC))
+                return COPS_IERR_MISSING;
+        if (cops_load32(obj + 4) != s->key->key_id)
+                return COPS_IERR_KEY_ID;
+        if (s->rx_synced && seq != s->rx_seq)
+                return COPS_IERR_SEQUENCE;
+
+        cops_hmac_update(h, obj, COPS_INTEGRITY_LEN - COPS_INTEGRITY_DIGEST_LEN);
+        cops_hmac_final(h, digest);
+
+        /* Constant time, the position of the first differing byte must not leak. */
+        uint8_t diff = 0;
+        for (int i = 0; i < COPS_INTEGRITY_DIGEST_LEN; i++)
+                diff |= digest[i] ^ obj[COPS_INTEGRITY_LEN - COPS_INTEGRITY_DIGEST_LEN + i];
+        if (diff)
+                return COPS_IERR_DIGEST;
+
+        s->rx_seq = seq + 1;
+        s->rx_synced = true;
+        return COPS_IERR_NONE;
+}
+
+size_t
+cops_integrity_sign(struct cops_integrity* s, uint8_t* msg, size_t len) {
+        struct cops_hmac h;
+
+        cops_store32(msg + 4, (uint32_t)(len + COPS_INTEGRITY_LEN));
+        cops_hmac_init(&h, s->key);
+        cops_hmac_update(&h, msg, len);
+        cops_integrity_seal(&h, msg + len, s->tx_seq++);
+
+        return len + COPS_INTEGRITY_LEN;
+}
+
+enum cops_ierr
+cops_integrity_verify(struct cops_integrity* s, const uint8_t* msg, size_t len) {
+        struct cops_hmac h;
+
+        if (len < COPS_HEADER_LEN + COPS_INTEGRITY_LEN || cops_load32(msg + 4) != len)
+                return COPS_IERR_MISSING;
+
+        size_t body = len - COPS_INTEGRITY_LEN;
+
+        cops_hmac_init(&h, s->key);
+        cops_hmac_update(&h, msg, body);
+        return cops_integrity_check(s, &h, msg + body);
+}
+
+const char*
+cops_ierr_str(enum cops_ierr err) {
+        switch (err) {
+                case COPS_IERR_NONE:     return "ok";
+                case COPS_IERR_MISSING:  return "integrity object missing";
+                case COPS_IERR_KEY_ID:   return "unknown key id";
+                case COPS_IERR_SEQUENCE: return "sequence number out of order";
+                case COPS_IERR_DIGEST:   return "digest mismatch";
+                default:                 return "unknown error";
+        }
+}
@@ -0,0 +1,106 @@
+#ifndef COPS_INTEGRITY_H
+#define COPS_INTEGRITY_H
+
+#include "cops.h"
+
+/* Message Integrity object, HMAC digest (RFC 2748 section 2.2.16). */
+#define COPS_CNUM_INTEGRITY        16
+#define COPS_CTYPE_INTEGRITY_HMAC  1
+#define COPS_INTEGRITY_DIGEST_LEN  12 /* HMAC-MD5-96 */
+#define COPS_INTEGRITY_LEN         (COPS_OBJ_HEADER_LEN + 8 + COPS_INTEGRITY_DIGEST_LEN)
+#define COPS_INTEGRITY_MAX_KEY_LEN 64
+
+/* Reasons cops_integrity_verify rejects a message. */
+enum cops_ierr {
+        COPS_IERR_NONE = 0,
+        COPS_IERR_MISSING,  /* The last object is not a well formed HMAC Integrity object. */
+        COPS_IERR_KEY_ID,   /* Signed with another key. */
+        COPS_IERR_SEQUENCE, /* Not the sequence number that follows the previous message. */
+        COPS_IERR_DIGEST,   /* Keyed digest mismatch, the message was altered or the key differs. */
+};
+
+/*
+ * HMAC-MD5 key with its pads already absorbed: inner and outer are the MD5 states after the
+ * (key ^ ipad) and (key ^ opad) blocks. Every digest starts from copies of them, so a message
+ * costs the MD5 blocks of its own bytes plus one for the outer hash, not four.
+ */
+struct cops_integrity_key {
+        uint32_t key_id;
+        uint32_t inner[4];
+        uint32_t outer[4];
+};
+
+/* Streaming HMAC over a message, fed in any number of pieces as the bytes are written or read. */
+struct cops_hmac {
+        const struct cops_integrity_key* key;
+        uint32_t h[4];
+        uint64_t len; /* Bytes absorbed, the pad block included. */
+        uint32_t fill;
+        uint8_t block[64];
+};
+
+/* Integrity state of one session: the key and the sequence numbers in both directions. */
+struct cops_integrity {
+        const struct cops_integrity_key* key;
+        uint32_t tx_seq; /* Sequence number of the next message sent. */
+        uint32_t rx_seq; /* Sequence number expected next, once rx_synced. */
+        bool rx_synced;  /* The peer's initial sequence number has been received. */
+};
+
+/*
+ * Derive the pad states of a shared secret.
+ *
+ * @key         Key to initialize
+ * @key_id      Key ID carried in every Integrity object
+ * @secret      Shared secret, longer ones are first hashed to 16 bytes as HMAC requires
+ * @len         Length of the secret
+ */
+void cops_integrity_key_init(struct cops_integrity_key* key, uint32_t key_id, const void* secret, size_t len);
+
+/* Start a session: nothing received yet, tx_seq is the initial sequence number sent. */
+void cops_integrity_init(struct cops_integrity* s, const struct cops_integrity_key* key, uint32_t tx_seq);
+
+void cops_hmac_init(struct cops_hmac* h, const struct cops_integrity_key* key);
+
+void cops_hmac_update(struct cops_hmac* h, const void* data, size_t len);
+
+/* Finish the digest and write its first COPS_INTEGRITY_DIGEST_LEN bytes. */
+void cops_hmac_final(struct cops_hmac* h, uint8_t* digest);
+
+/*
+ * Streaming signature: h has absorbed every byte of the message before dst, whose header
+ * already carries the final length. Writes the Integrity object with the given sequence number
+ * at dst, COPS_INTEGRITY_LEN bytes.
+ */
+void cops_integrity_seal(struct cops_hmac* h, uint8_t* dst, uint32_t seq);
+
+/*
+ * Streaming verification: h has absorbed every byte of the message before obj, the last
+ * object of the message. Checks the Key ID, the sequence number and the digest, and advances
+ * the expected sequence number of s on success.
+ */
+enum cops_ierr cops_integrity_check(struct cops_integrity* s, struct cops_hmac* h, const uint8_t* obj);
+
+/*
+ * Sign a complete message in place: append the Integrity object with the next sequence number
+ * and patch the message length. msg must have room for COPS_INTEGRITY_LEN more bytes.
+ *
+ * Returns the new message length.
+ */
+size_t cops_integrity_sign(struct cops_integrity* s, uint8_t* msg, size_t len);
+
+/*
+ * Verify a complete message whose last object must be the Integrity object. The first
+ * message received sets the peer's initial sequence number, every later one must carry the
+ * next (RFC 2748 section 4.1).
+ *
+ * @s           Session
+ * @msg         Message, starting at the common header
+ * @len         Message length
+ */
+enum cops_ierr cops_integrity_verify(struct cops_integrity* s, const uint8_t* msg, size_t len);
+
+/* Return a short description of an integrity error. */
+const char* cops_ierr_str(enum cops_ierr err);
+
+#endif
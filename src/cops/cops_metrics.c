@@ -0,0 +1,205 @@
+#include "cops_metrics.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cops.h"
+
+_Static_assert(sizeof(struct cops_metrics_slot) % sizeof(uint64_t) == 0, "slots are summed as arrays of counters");
+
+static const char* const cops_hist_names[COPS_HIST_COUNT] = {"encode", "decode", "decision"};
+
+int
+cops_metrics_init(struct cops_metrics* m, uint32_t nslots) {
+        memset(m, 0, sizeof(*m));
+
+        m->slots = aligned_alloc(64, nslots * sizeof(struct cops_metrics_slot));
+        if (m->slots == NULL)
+                return -1;
+
+        memset(m->slots, 0, nslots * sizeof(struct cops_metrics_slot));
+        m->nslots = nslots;
+        m->ticks0 = cops_metrics_ticks();
+        m->ns0 = cops_metrics_ns();
+
+        return 0;
+}
+
+void
+cops_metrics_free(struct cops_metrics* m) {
+        free(m->slots);
+        memset(m, 0, sizeof(*m));
+}
+
+struct cops_metrics_slot*
+cops_metrics_slot(struct cops_metrics* m) {
+        unsigned int i = atomic_fetch_add(&m->used, 1);
+
+        return (i < m->nslots) ? &m->slots[i] : NULL;
+}
+
+uint64_t
+cops_hist_bucket_min(uint32_t bucket) {
+        if (bucket < COPS_HIST_SUB)
+                return bucket;
+
+        uint32_t seg = bucket / COPS_HIST_SUB;
+        return (uint64_t)(COPS_HIST_SUB + bucket % COPS_HIST_SUB) << (seg - 1);
+}
+
+uint64_t
+cops_hist_quantile(const struct cops_hist* h, double q) {
+        if (h->count == 0)
+                return 0;
+
+        uint64_t rank = (uint64_t)(q * (double)h->count + 0.5);
+        uint64_t seen = 0;
+
+        if (rank == 0)
+                rank = 1;
+        for (uint32_t i = 0; i < COPS_HIST_BUCKETS; i++) {
+                seen += h->buckets[i];
+                if (seen >= rank) {
+                        uint64_t hi = (i + 1 < COPS_HIST_BUCKETS) ? cops_hist_bucket_min(i + 1) - 1 : h->max;
+                        return (hi < h->max) ? hi : h->max;
+                }
+        }
+
+        return h->max;
+}
+
+void
+cops_metrics_snapshot(struct cops_metrics* m, struct cops_metrics_snapshot* snap) {
+        uint64_t* dst = (uint64_t*)&snap->total;
+        size_t n = sizeof(struct cops_metrics_slot) / sizeof(uint64_t);
+        unsigned int used = atomic_load(&m->used);
+
+        memset(snap, 0, sizeof(*snap));
+        if (used > m->nslots)
+                used = m->nslots;
+
+        for (unsigned int s = 0; s < used; s++) {
+                uint64_t* src = (uint64_t*)&m->slots[s];
+
+                for (size_t i = 0; i < n; i++)
+                        dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+
+        /* Maxima do not add up. */
+        for (int h = 0; h < COPS_HIST_COUNT; h++) {
+                snap->total.hist[h].max = 0;
+                for (unsigned int s = 0; s < used; s++) {
+                        uint64_t max = __atomic_load_n(&m->slots[s].hist[h].max, __ATOMIC_RELAXED);
+                        if (max > snap->total.hist[h].max)
+                                snap->total.hist[h].max = max;
+                }
+        }
+
+        /* The TSC rate follows from the time elapsed since init, the longer the better. */
+#if defined(__x86_64__) || defined(__i386__)
+        uint64_t ticks = cops_metrics_ticks() - m->ticks0;
+        snap->ns_per_tick = (ticks) ? (double)(cops_metrics_ns() - m->ns0) / (double)ticks : 0;
+#else
+        snap->ns_per_tick = 1;
+#endif
+}
+
+/* Summary of one histogram in nanoseconds. */
+struct cops_hist_summary {
+        uint64_t count;
+        double mean;
+        double p50;
+        double p99;
+        double p999;
+        double max;
+};
+
+static void
+cops_hist_summarize(const struct cops_metrics_snapshot* snap, const struct cops_hist* h, struct cops_hist_summary* s) {
+        double k = snap->ns_per_tick;
+
+        s->count = h->count;
+        s->mean = (h->count) ? (double)h->sum / (double)h->count * k : 0;
+        s->p50 = (double)cops_hist_quantile(h, 0.5) * k;
+        s->p99 = (double)cops_hist_quantile(h, 0.99) * k;
+        s->p999 = (double)cops_hist_quantile(h, 0.999) * k;
+        s->max = (double)h->max * k;
+}
+
+int
+cops_metrics_write_text(const struct cops_metrics_snapshot* snap, FILE* out) {
+        const struct cops_metrics_slot* t = &snap->total;
+
+        for (int i = 0; i < COPS_METRICS_OPS; i++)
+                if (t->rx_ops[i])
+                        fprintf(out, "cops_rx_messages{op=\"%s\"} %" PRIu64 "\n", cops_otoa(i), t->rx_ops[i]);
+        for (int i = 0; i < COPS_METRICS_OPS; i++)
+                if (t->tx_ops[i])
+                        fprintf(out, "cops_tx_messages{op=\"%s\"} %" PRIu64 "\n", cops_otoa(i), t->tx_ops[i]);
+        for (int i = 0; i < COPS_METRICS_OBJS; i++)
+                if (t->rx_objs[i])
+                        fprintf(out, "cops_rx_objects{object=\"%s\"} %" PRIu64 "\n", cops_otos(i), t->rx_objs[i]);
+
+        fprintf(out, "cops_rx_bytes %" PRIu64 "\n", t->rx_bytes);
+        fprintf(out, "cops_tx_bytes %" PRIu64 "\n", t->tx_bytes);
+        fprintf(out, "cops_connections_opened %" PRIu64 "\n", t->opened);
+        fprintf(out, "cops_connections_closed %" PRIu64 "\n", t->closed);
+        fprintf(out, "cops_admit_delayed %" PRIu64 "\n", t->delayed);
+        fprintf(out, "cops_admit_shed %" PRIu64 "\n", t->shed);
+
+        for (int h = 0; h < COPS_HIST_COUNT; h++) {
+                struct cops_hist_summary s;
+                const char* name = cops_hist_names[h];
+
+                cops_hist_summarize(snap, &t->hist[h], &s);
+                fprintf(out, "cops_%s_ns_count %" PRIu64 "\n", name, s.count);
+                fprintf(out, "cops_%s_ns_mean %.1f\n", name, s.mean);
+                fprintf(out, "cops_%s_ns{quantile=\"0.5\"} %.1f\n", name, s.p50);
+                fprintf(out, "cops_%s_ns{quantile=\"0.99\"} %.1f\n", name, s.p99);
+                fprintf(out, "cops_%s_ns{quantile=\"0.999\"} %.1f\n", name, s.p999);
+                fprintf(out, "cops_%s_ns_max %.1f\n", name, s.max);
+        }
+
+        return ferror(out) ? -1 : 0;
+}
+
+static void
+cops_metrics_json_counters(FILE* out, const char* key, const uint64_t* v, int n, char* (*label)(unsigned char)) {
+        const char* sep = "";
+
+        fprintf(out, "\"%s\":{", key);
+        for (int i = 0; i < n; i++) {
+                if (v[i] == 0)
+                        continue;
+                fprintf(out, "%s\"%s\":%" PRIu64, sep, label(i), v[i]);
+                sep = ",";
+        }
+        fputs("},", out);
+}
+
+int
+cops_metrics_write_json(const struct cops_metrics_snapshot* snap, FILE* out) {
+        const struct cops_metrics_slot* t = &snap->total;
+
+        fputc('{', out);
+        cops_metrics_json_counters(out, "rx_messages", t->rx_ops, COPS_METRICS_OPS, cops_otoa);
+        cops_metrics_json_counters(out, "tx_messages", t->tx_ops, COPS_METRICS_OPS, cops_otoa);
+        cops_metrics_json_counters(out, "rx_objects", t->rx_objs, COPS_METRICS_OBJS, cops_otos);
+        fprintf(out, "\"rx_bytes\":%" PRIu64 ",\"tx_bytes\":%" PRIu64 ",", t->rx_bytes, t->tx_bytes);
+        fprintf(out, "\"connections_opened\":%" PRIu64 ",\"connections_closed\":%" PRIu64 ",", t->opened, t->closed);
+        fprintf(out, "\"admit_delayed\":%" PRIu64 ",\"admit_shed\":%" PRIu64 ",", t->delayed, t->shed);
+
+        fputs("\"latency_ns\":{", out);
+        for (int h = 0; h < COPS_HIST_COUNT; h++) {
+                struct cops_hist_summary s;
+
+                cops_hist_summarize(snap, &t->hist[h], &s);
+                fprintf(out, "%s\"%s\":{\"count\":%" PRIu64 ",\"mean\":%.1f,", (h) ? "," : "", cops_hist_names[h],
+                        s.count, s.mean);
+                fprintf(out, "\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}", s.p50, s.p99, s.p999, s.max);
+        }
+        fputs("}}\n", out);
+
+        return ferror(out) ? -1 : 0;
+}
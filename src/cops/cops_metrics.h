@@ -0,0 +1,158 @@
+#ifndef COPS_METRICS_H
+#define COPS_METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Counter rows: Op Codes 0-10 and C-Nums 0-16, row 0 collects anything out of range. */
+#define COPS_METRICS_OPS  11
+#define COPS_METRICS_OBJS 17
+
+/*
+ * Log-linear histogram layout: values below COPS_HIST_SUB get a bucket each, above that every
+ * power of two is split into COPS_HIST_SUB linear buckets (at most 1/16 = 6.25% relative error).
+ * Values from 2^COPS_HIST_MAX_EXP up land in the last bucket.
+ */
+#define COPS_HIST_SUB_BITS 4
+#define COPS_HIST_SUB      (1u << COPS_HIST_SUB_BITS)
+#define COPS_HIST_MAX_EXP  40
+#define COPS_HIST_BUCKETS  ((COPS_HIST_MAX_EXP - COPS_HIST_SUB_BITS + 1) * COPS_HIST_SUB)
+
+/* Latencies recorded by the server, in ticks of cops_metrics_ticks. */
+enum cops_hist_id {
+        COPS_HIST_ENCODE = 0, /* cops_server_reserve to cops_server_commit, the in-place encode. */
+        COPS_HIST_DECODE,     /* Framing of one inbound message. */
+        COPS_HIST_DECISION,   /* Oldest unanswered REQ of a session to the next DEC queued on it. */
+        COPS_HIST_COUNT,
+};
+
+struct cops_hist {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t buckets[COPS_HIST_BUCKETS];
+};
+
+/*
+ * Counters of one thread. Only the owning thread writes to a slot, with plain relaxed stores
+ * (no locked instructions), readers load every field atomically and sum the slots on demand.
+ * Slots are cache line aligned so two writers never share a line.
+ */
+struct cops_metrics_slot {
+        _Alignas(64) uint64_t rx_ops[COPS_METRICS_OPS];
+        uint64_t tx_ops[COPS_METRICS_OPS];
+        uint64_t rx_objs[COPS_METRICS_OBJS];
+        uint64_t rx_bytes;
+        uint64_t tx_bytes;
+        uint64_t opened;
+        uint64_t closed;
+        uint64_t delayed; /* REQ and RPT held back by admission control. */
+        uint64_t shed;    /* REQ and RPT refused by admission control. */
+        struct cops_hist hist[COPS_HIST_COUNT];
+};
+
+/* Registry of a fixed number of slots, one per writing thread (e.g. one per shard). */
+struct cops_metrics {
+        struct cops_metrics_slot* slots;
+        uint32_t nslots;
+        atomic_uint used;
+        uint64_t ticks0; /* Calibration point, see cops_metrics_snapshot. */
+        uint64_t ns0;
+};
+
+/* Totals over every slot. Latencies are in ticks, multiply by ns_per_tick for nanoseconds. */
+struct cops_metrics_snapshot {
+        struct cops_metrics_slot total;
+        double ns_per_tick;
+};
+
+static inline uint64_t
+cops_metrics_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Timestamp for latency measurements. The invariant TSC on x86 (a few ns per read against
+ * ~20 ns for clock_gettime), the monotonic clock in nanoseconds elsewhere.
+ */
+static inline uint64_t
+cops_metrics_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#else
+        return cops_metrics_ns();
+#endif
+}
+
+/* Allocate nslots zeroed slots. Returns -1 on ENOMEM. */
+int cops_metrics_init(struct cops_metrics* m, uint32_t nslots);
+
+void cops_metrics_free(struct cops_metrics* m);
+
+/* Claim a slot for the calling thread. Safe from any thread, returns NULL once all are taken. */
+struct cops_metrics_slot* cops_metrics_slot(struct cops_metrics* m);
+
+/* Add to a counter of the caller's own slot. */
+static inline void
+cops_metrics_add(uint64_t* counter, uint64_t n) {
+        __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/* Bucket of a value, see COPS_HIST_SUB_BITS. */
+static inline uint32_t
+cops_hist_bucket(uint64_t v) {
+        if (v < COPS_HIST_SUB)
+                return (uint32_t)v;
+        if (v >> COPS_HIST_MAX_EXP)
+                return COPS_HIST_BUCKETS - 1;
+
+        uint32_t exp = 63 - (uint32_t)__builtin_clzll(v);
+        uint32_t sub = (uint32_t)(v >> (exp - COPS_HIST_SUB_BITS)) & (COPS_HIST_SUB - 1);
+
+        return (exp - COPS_HIST_SUB_BITS + 1) * COPS_HIST_SUB + sub;
+}
+
+/* Record a value into a histogram of the caller's own slot. */
+static inline void
+cops_hist_record(struct cops_hist* h, uint64_t v) {
+        uint64_t* b = &h->buckets[cops_hist_bucket(v)];
+
+        __atomic_store_n(b, *b + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->sum, h->sum + v, __ATOMIC_RELAXED);
+        if (v > h->max)
+                __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+/* Smallest value that falls into a bucket. */
+uint64_t cops_hist_bucket_min(uint32_t bucket);
+
+/*
+ * Value at quantile q (0 to 1), reported as the highest value of its bucket and capped at the
+ * recorded maximum. Returns 0 for an empty histogram.
+ */
+uint64_t cops_hist_quantile(const struct cops_hist* h, double q);
+
+/*
+ * Sum every slot into snap. Counters are read while writers keep running, so a snapshot is not
+ * an atomic cut, but each counter is exact at the moment it is read.
+ */
+void cops_metrics_snapshot(struct cops_metrics* m, struct cops_metrics_snapshot* snap);
+
+/*
+ * Write a snapshot as text, one "name{label} value" line per non-zero counter and count, mean,
+ * p50, p99, p999 and max in nanoseconds per histogram. Op Codes and objects are labeled with
+ * cops_otoa and cops_otos. Returns -1 on an output error.
+ */
+int cops_metrics_write_text(const struct cops_metrics_snapshot* snap, FILE* out);
+
+/* Write a snapshot as one JSON object with the same content as the text form. */
+int cops_metrics_write_json(const struct cops_metrics_snapshot* snap, FILE* out);
+
+#endif
@@ -0,0 +1,673 @@
+#ifdef __linux__
+
+#include "cops_pepsim.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cops_builder.h"
+#include "pcmm.h"
+
+/* COPS objects of the PEP side messages. */
+#define COPS_CNUM_REASON      5
+#define COPS_CNUM_KA_TIMER    10
+#define COPS_CNUM_PEPID       11
+#define COPS_CNUM_REPORT_TYPE 12
+
+/* Report-Type values. */
+#define COPS_REPORT_SUCCESS    1
+#define COPS_REPORT_FAILURE    2
+#define COPS_REPORT_ACCOUNTING 3
+
+/* Reason-Code of the DRQs: Management. */
+#define COPS_REASON_MANAGEMENT 4
+
+static void
+cops_pepsim_queue(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        if (s->queued)
+                return;
+
+        s->queued = true;
+        s->txq_next = sim->txq;
+        sim->txq = s;
+}
+
+/*
+ * Room for a message of up to len bytes at the end of the transmit buffer, and its Integrity
+ * object when signing, NULL when full.
+ */
+static uint8_t*
+cops_pepsim_reserve(struct cops_pepsim_session* s, size_t len) {
+        if (s->state == COPS_PEPSIM_CLOSED)
+                return NULL;
+        if (s->integrity.key)
+                len += COPS_INTEGRITY_LEN;
+        if (s->wlen + len > sizeof(s->wbuf) && s->woff) {
+                memmove(s->wbuf, s->wbuf + s->woff, s->wlen - s->woff);
+                s->wlen -= s->woff;
+                s->woff = 0;
+        }
+        if (s->wlen + len > sizeof(s->wbuf)) {
+                s->sim->stats.overflow++;
+                return NULL;
+        }
+
+        return s->wbuf + s->wlen;
+}
+
+/* Queue len bytes written at the reservation, already signed when signing. */
+static void
+cops_pepsim_commit(struct cops_pepsim_session* s, size_t len) {
+        s->wlen += len;
+        s->sim->stats.tx_bytes += len;
+        cops_pepsim_queue(s->sim, s);
+}
+
+/* Queue a message built with a cops_builder over the transmit buffer, signed as it is finished. */
+static bool
+cops_pepsim_finish(struct cops_pepsim_session* s, struct cops_builder* b) {
+        size_t len = (s->integrity.key) ? cops_builder_seal(b, &s->integrity) : cops_builder_finish(b);
+
+        if (len == 0) {
+                s->sim->stats.overflow++;
+                return false;
+        }
+
+        cops_pepsim_commit(s, len);
+        return true;
+}
+
+static bool
+cops_pepsim_builder(struct cops_pepsim_session* s, struct cops_builder* b, uint8_t opcode, uint32_t handle) {
+        uint8_t body[4];
+        size_t room = (s->state == COPS_PEPSIM_CLOSED) ? 0 : sizeof(s->wbuf) - (s->wlen - s->woff);
+        size_t sig = (s->integrity.key) ? COPS_INTEGRITY_LEN : 0;
+        uint8_t* dst = cops_pepsim_reserve(s, (room > sig) ? room - sig : 0);
+
+        if (dst == NULL)
+                return false;
+
+        /* The Integrity object is part of the message, cops_builder_seal takes its room from the builder. */
+        cops_builder_init(b, dst, room, opcode);
+        if (handle) {
+                cops_store32(body, handle);
+                cops_builder_object(b, 1, 1, body, 4);
+        }
+
+        return true;
+}
+
+static void
+cops_pepsim_close(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        if (s->state == COPS_PEPSIM_CLOSED)
+                return;
+
+        cops_timer_cancel(&sim->wheel, &s->ka);
+        cops_timer_cancel(&sim->wheel, &s->pace);
+        close(s->fd);
+        s->fd = -1;
+        s->state = COPS_PEPSIM_CLOSED;
+        sim->stats.closed++;
+}
+
+static void
+cops_pepsim_send_req(struct cops_pepsim* sim, struct cops_pepsim_session* s, uint64_t t0) {
+        struct cops_builder b;
+        uint32_t handle = ++s->next_handle;
+        uint8_t context[4] = {0, 1, 0, 0}; /* Incoming-Message/Admission Control. */
+
+        if (handle == 0)
+                handle = s->next_handle = 1;
+        if (!cops_pepsim_builder(s, &b, 1, handle))
+                return;
+
+        cops_builder_object(&b, 2, 1, context, sizeof(context));
+        if (!cops_pepsim_finish(s, &b))
+                return;
+
+        s->pending[s->inflight++] = (struct cops_pepsim_req){handle, t0};
+        sim->stats.req++;
+}
+
+/* Closed loop: keep the window full. */
+static void
+cops_pepsim_fill(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        while (s->inflight < sim->cfg.window && s->state == COPS_PEPSIM_ACCEPTED) {
+                uint64_t n = sim->stats.req;
+
+                cops_pepsim_send_req(sim, s, sim->now_ns);
+                if (sim->stats.req == n)
+                        break;
+        }
+}
+
+static void
+cops_pepsim_send_rpt(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        struct cops_builder b;
+        uint8_t type[4] = {0, COPS_REPORT_ACCOUNTING, 0, 0};
+
+        if (s->last_handle == 0 || !cops_pepsim_builder(s, &b, 3, s->last_handle))
+                return;
+
+        cops_builder_object(&b, COPS_CNUM_REPORT_TYPE, 1, type, sizeof(type));
+        if (cops_pepsim_finish(s, &b))
+                sim->stats.rpt++;
+}
+
+static void
+cops_pepsim_send_drq(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        struct cops_builder b;
+        uint8_t reason[4] = {0, COPS_REASON_MANAGEMENT, 0, 0};
+
+        if (s->last_handle == 0 || !cops_pepsim_builder(s, &b, 4, s->last_handle))
+                return;
+
+        cops_builder_object(&b, COPS_CNUM_REASON, 1, reason, sizeof(reason));
+        if (cops_pepsim_finish(s, &b)) {
+                sim->stats.drq++;
+                s->last_handle = 0;
+        }
+}
+
+static void
+cops_pepsim_send_ka(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        uint8_t* dst = cops_pepsim_reserve(s, 8);
+
+        if (dst == NULL)
+                return;
+
+        cops_store64(dst, COPS_KA_MESSAGE);
+        cops_pepsim_commit(s, (s->integrity.key) ? cops_integrity_sign(&s->integrity, dst, 8) : 8);
+        sim->stats.ka_tx++;
+}
+
+static void
+cops_pepsim_ka_timer(struct cops_timer* timer, void* arg) {
+        struct cops_pepsim_session* s = arg;
+        struct cops_pepsim* sim = s->sim;
+
+        cops_pepsim_send_ka(sim, s);
+        cops_timer_arm(&sim->wheel, timer, s->ka_ms);
+}
+
+/* Time the n-th message of a rate is due, counted from the Client-Accept. */
+static inline uint64_t
+cops_pepsim_due(const struct cops_pepsim_session* s, uint32_t rate, uint64_t n) {
+        return (rate) ? s->t_open + n * 1000000000 / rate : UINT64_MAX;
+}
+
+/* Send every paced message that is due and arm the timer for the next one. */
+static void
+cops_pepsim_pace(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        const struct cops_pepsim_config* cfg = &sim->cfg;
+        uint64_t next;
+
+        /* A REQ counts from the time it was due, a full window delays it but does not hide that. */
+        while (s->inflight < cfg->window && (next = cops_pepsim_due(s, cfg->req_rate, s->nreq)) <= sim->now_ns) {
+                uint64_t reqs = sim->stats.req;
+
+                cops_pepsim_send_req(sim, s, next);
+                if (sim->stats.req == reqs)
+                        break;
+                s->nreq++;
+        }
+        for (; cops_pepsim_due(s, cfg->rpt_rate, s->nrpt) <= sim->now_ns; s->nrpt++)
+                cops_pepsim_send_rpt(sim, s);
+        for (; cops_pepsim_due(s, cfg->drq_rate, s->ndrq) <= sim->now_ns; s->ndrq++)
+                cops_pepsim_send_drq(sim, s);
+        if (s->state != COPS_PEPSIM_ACCEPTED)
+                return;
+
+        /* With a full window the next DEC resumes the REQs. */
+        next = (s->inflight < cfg->window) ? cops_pepsim_due(s, cfg->req_rate, s->nreq) : UINT64_MAX;
+        if (cops_pepsim_due(s, cfg->rpt_rate, s->nrpt) < next)
+                next = cops_pepsim_due(s, cfg->rpt_rate, s->nrpt);
+        if (cops_pepsim_due(s, cfg->drq_rate, s->ndrq) < next)
+                next = cops_pepsim_due(s, cfg->drq_rate, s->ndrq);
+        if (next != UINT64_MAX)
+                cops_timer_arm(&sim->wheel, &s->pace, (next - sim->now_ns + 999999) / 1000000);
+}
+
+static void
+cops_pepsim_pace_timer(struct cops_timer* timer, void* arg) {
+        struct cops_pepsim_session* s = arg;
+
+        cops_pepsim_pace(s->sim, s);
+}
+
+static void
+cops_pepsim_accepted(struct cops_pepsim* sim, struct cops_pepsim_session* s, const struct cops_msg* msg) {
+        const struct cops_obj* ka = cops_msg_find(msg, COPS_CNUM_KA_TIMER, 1);
+        uint32_t ka_ms = (ka && ka->length >= 8) ? cops_load16(cops_obj_data(msg, ka) + 2) * 1000u : 0;
+
+        s->state = COPS_PEPSIM_ACCEPTED;
+        cops_hist_record(&sim->stats.open_ns, sim->now_ns - s->t_open);
+        s->t_open = sim->now_ns;
+        if (++sim->stats.accepted == sim->cfg.sessions)
+                sim->t_ready = sim->now_ns;
+
+        /* Well within the negotiated timer, the PDP closes a session silent for all of it. */
+        s->ka_ms = ka_ms / 2;
+        if (s->ka_ms)
+                cops_timer_arm(&sim->wheel, &s->ka, s->ka_ms);
+        if (sim->cfg.req_rate == 0)
+                cops_pepsim_fill(sim, s);
+        cops_pepsim_pace(sim, s);
+}
+
+/* Complete the REQ a DEC answers, if it is one of the session's. */
+static void
+cops_pepsim_decided(struct cops_pepsim* sim, struct cops_pepsim_session* s, uint32_t handle) {
+        for (uint32_t i = 0; i < s->inflight; i++) {
+                if (s->pending[i].handle != handle)
+                        continue;
+
+                cops_hist_record(&sim->stats.req_ns, sim->now_ns - s->pending[i].t0);
+                s->pending[i] = s->pending[--s->inflight];
+                s->last_handle = handle;
+                sim->stats.dec++;
+                if (sim->cfg.req_rate == 0)
+                        cops_pepsim_fill(sim, s);
+                else if (s->inflight + 1 == sim->cfg.window)
+                        cops_pepsim_pace(sim, s);
+                return;
+        }
+}
+
+/* Answer a PCMM gate command with the Report-State a CMTS would send. */
+static void
+cops_pepsim_gate_report(struct cops_pepsim* sim, struct cops_pepsim_session* s, const struct cops_msg* msg,
+                        uint32_t handle) {
+        const struct cops_obj* csdd = cops_msg_find(msg, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI);
+        const uint8_t* trans = NULL;
+        const uint8_t* amid = NULL;
+        const uint8_t* subscriber = NULL;
+        const uint8_t* gate = NULL;
+
+        if (csdd == NULL)
+                return;
+
+        const uint8_t* p = cops_obj_data(msg, csdd);
+        const uint8_t* end = p + csdd->length - COPS_OBJ_HEADER_LEN;
+
+        while (p + 4 <= end) {
+                uint16_t len = cops_load16(p);
+
+                if (len < 4 || p + len > end)
+                        return;
+                switch (p[2]) {
+                        case PCMM_SNUM_TRANSACTION_ID: trans = (len == 8) ? p : NULL; break;
+                        case PCMM_SNUM_AMID:           amid = (len == 8) ? p : NULL; break;
+                        case PCMM_SNUM_SUBSCRIBER_ID:  subscriber = p; break;
+                        case PCMM_SNUM_GATE_ID:        gate = (len == 8) ? p : NULL; break;
+                }
+                p += (len + 3) & ~3u;
+        }
+        if (trans == NULL)
+                return;
+
+        uint16_t trans_id = cops_load16(trans + 4);
+        uint16_t command = cops_load16(trans + 6);
+        uint16_t reply;
+        uint32_t gate_id = (gate) ? cops_load32(gate + 4) : 0;
+        uint8_t type[4] = {0, COPS_REPORT_SUCCESS, 0, 0};
+        uint8_t obj[8];
+
+        switch (command) {
+                case PCMM_GATE_SET:
+                        sim->stats.gate_set++;
+                        reply = PCMM_GATE_SET_ACK;
+                        if (sim->cfg.err_every && ++s->gate_sets % sim->cfg.err_every == 0) {
+                                reply = PCMM_GATE_SET_ERR;
+                                type[1] = COPS_REPORT_FAILURE;
+                                sim->stats.gate_err++;
+                        } else if (gate_id == 0) {
+                                gate_id = (s->index << 20) | (++s->next_gate & 0xFFFFF);
+                        }
+                        break;
+                case PCMM_GATE_INFO:   reply = PCMM_GATE_INFO_ACK; sim->stats.gate_other++; break;
+                case PCMM_GATE_DELETE: reply = PCMM_GATE_DELETE_ACK; sim->stats.gate_other++; break;
+                default:               return;
+        }
+
+        struct cops_builder b;
+        struct cops_builder_mark mark;
+
+        if (!cops_pepsim_builder(s, &b, 3, handle))
+                return;
+
+        cops_builder_object(&b, COPS_CNUM_REPORT_TYPE, 1, type, sizeof(type));
+        cops_builder_begin(&b, COPS_CNUM_CLIENT_SI, 1, &mark); /* Signaled ClientSI */
+        cops_builder_append(&b, obj, pcmm_transaction_id(obj, trans_id, reply));
+        if (amid)
+                cops_builder_append(&b, amid, 8);
+        if (subscriber)
+                cops_builder_append(&b, subscriber, cops_load16(subscriber));
+        if (reply == PCMM_GATE_SET_ERR)
+                cops_builder_append(&b, obj, pcmm_error(obj, PCMM_ERROR_RESOURCES, 0));
+        else if (gate_id)
+                cops_builder_append(&b, obj, pcmm_gate_id(obj, gate_id));
+        cops_builder_end(&b, &mark);
+        if (cops_pepsim_finish(s, &b))
+                sim->stats.rpt++;
+}
+
+/* Returns -1 when the session must be closed. */
+static int
+cops_pepsim_dispatch(struct cops_pepsim* sim, struct cops_pepsim_session* s, const struct cops_msg* msg) {
+        if (s->integrity.key && cops_decoder_verify(&s->dec, &s->integrity) != COPS_IERR_NONE) {
+                sim->stats.integrity_err++;
+                return -1;
+        }
+
+        switch (msg->opcode) {
+                case 7: /* Client-Accept */
+                        if (s->state != COPS_PEPSIM_OPENING)
+                                return -1;
+                        cops_pepsim_accepted(sim, s, msg);
+                        return 0;
+
+                case 2: { /* Decision */
+                        const struct cops_obj* h = cops_msg_find(msg, 1, 1);
+
+                        if (s->state != COPS_PEPSIM_ACCEPTED || h == NULL || h->length != 8)
+                                return -1;
+
+                        uint32_t handle = cops_load32(cops_obj_data(msg, h));
+                        cops_pepsim_gate_report(sim, s, msg, handle);
+                        cops_pepsim_decided(sim, s, handle);
+                        return 0;
+                }
+
+                case 9: /* Keep-Alive, an echo or sent by the PDP. */
+                        sim->stats.ka_rx++;
+                        return 0;
+
+                case 5: /* Synchronize State Req, report nothing. */
+                        if (s->state != COPS_PEPSIM_ACCEPTED)
+                                return -1;
+                        return 0;
+
+                case 8:  /* Client-Close */
+                default: return -1;
+        }
+}
+
+static int
+cops_pepsim_read(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        for (;;) {
+                ssize_t n = recv(s->fd, s->rbuf + s->rlen, sizeof(s->rbuf) - s->rlen, 0);
+
+                if (n == 0)
+                        return -1;
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+                }
+                s->rlen += n;
+                sim->stats.rx_bytes += n;
+
+                const struct cops_msg* msg;
+                size_t off = 0;
+                int ret;
+
+                while ((ret = cops_decode(&s->dec, s->rbuf + off, s->rlen - off, &msg)) > 0) {
+                        off += ret;
+                        if (cops_pepsim_dispatch(sim, s, msg) < 0)
+                                return -1;
+                }
+                if (ret < 0 || (off == 0 && s->rlen == sizeof(s->rbuf)))
+                        return -1;
+
+                memmove(s->rbuf, s->rbuf + off, s->rlen - off);
+                s->rlen -= off;
+        }
+}
+
+/* Send what is queued. Returns -1 when the session must be closed. */
+static int
+cops_pepsim_flush(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        while (s->woff < s->wlen) {
+                ssize_t n = send(s->fd, s->wbuf + s->woff, s->wlen - s->woff, MSG_NOSIGNAL);
+
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                return -1;
+                        if (!s->wblocked) {
+                                struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.ptr = s};
+
+                                s->wblocked = true;
+                                epoll_ctl(sim->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+                        }
+                        return 0;
+                }
+                s->woff += n;
+        }
+
+        s->woff = s->wlen = 0;
+        if (s->wblocked) {
+                struct epoll_event ev = {.events = EPOLLIN, .data.ptr = s};
+
+                s->wblocked = false;
+                epoll_ctl(sim->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+        }
+        return 0;
+}
+
+/* The non-blocking connect completed, send the Client-Open. */
+static int
+cops_pepsim_connected(struct cops_pepsim* sim, struct cops_pepsim_session* s) {
+        struct cops_builder b;
+        char pepid[16];
+        int err = 0;
+        socklen_t len = sizeof(err);
+
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = s};
+
+        if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err ||
+            epoll_ctl(sim->epfd, EPOLL_CTL_MOD, s->fd, &ev) < 0)
+                return -1;
+
+        int n = snprintf(pepid, sizeof(pepid), "cmts-%u", s->index);
+        s->state = COPS_PEPSIM_OPENING;
+        s->wblocked = false;
+        if (!cops_pepsim_builder(s, &b, 6, 0))
+                return -1;
+        cops_builder_object(&b, COPS_CNUM_PEPID, 1, pepid, (size_t)n + 1);
+
+        return cops_pepsim_finish(s, &b) ? 0 : -1;
+}
+
+static int
+cops_pepsim_connect(struct cops_pepsim* sim, struct cops_pepsim_session* s, const struct sockaddr_in* sa) {
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.ptr = s};
+        int one = 1;
+
+        s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (s->fd < 0)
+                return -1;
+
+        setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        s->t_open = sim->now_ns;
+        s->wblocked = true; /* Until the connect completes. */
+        if ((connect(s->fd, (const struct sockaddr*)sa, sizeof(*sa)) < 0 && errno != EINPROGRESS) ||
+            epoll_ctl(sim->epfd, EPOLL_CTL_ADD, s->fd, &ev) < 0) {
+                close(s->fd);
+                s->fd = -1;
+                return -1;
+        }
+
+        return 0;
+}
+
+int
+cops_pepsim_start(struct cops_pepsim* sim, const struct cops_pepsim_config* cfg) {
+        struct sockaddr_in sa = {0};
+
+        memset(sim, 0, sizeof(*sim));
+        sim->cfg = *cfg;
+        sim->epfd = -1;
+        if (sim->cfg.window == 0)
+                sim->cfg.window = 1;
+        if (sim->cfg.sessions == 0 || sim->cfg.window > COPS_PEPSIM_MAX_WINDOW) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(cfg->port);
+        if (inet_pton(AF_INET, (cfg->addr) ? cfg->addr : "127.0.0.1", &sa.sin_addr) != 1) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        sim->sessions = calloc(sim->cfg.sessions, sizeof(*sim->sessions));
+        sim->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (sim->sessions == NULL || sim->epfd < 0) {
+                cops_pepsim_stop(sim);
+                return -1;
+        }
+
+        sim->now_ns = cops_metrics_ns();
+        cops_timer_wheel_init(&sim->wheel, 1, sim->now_ns / 1000000);
+        for (uint32_t i = 0; i < sim->cfg.sessions; i++) {
+                struct cops_pepsim_session* s = &sim->sessions[i];
+
+                s->sim = sim;
+                s->index = i;
+                s->fd = -1;
+                cops_decoder_init(&s->dec);
+                s->dec.key = cfg->integrity;
+                cops_integrity_init(&s->integrity, cfg->integrity, (uint32_t)sim->now_ns ^ i << 16);
+                cops_timer_init(&s->ka, cops_pepsim_ka_timer, s);
+                cops_timer_init(&s->pace, cops_pepsim_pace_timer, s);
+                if (cops_pepsim_connect(sim, s, &sa) < 0) {
+                        cops_pepsim_stop(sim);
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+int
+cops_pepsim_poll(struct cops_pepsim* sim, int timeout_ms) {
+        struct epoll_event events[256];
+        int next = cops_timer_next_ms(&sim->wheel, sim->now_ns / 1000000);
+
+        if (next >= 0 && (timeout_ms < 0 || next < timeout_ms))
+                timeout_ms = next;
+
+        int n = epoll_wait(sim->epfd, events, 256, timeout_ms);
+        if (n < 0)
+                return (errno == EINTR) ? 0 : -1;
+
+        sim->now_ns = cops_metrics_ns();
+        for (int i = 0; i < n; i++) {
+                struct cops_pepsim_session* s = events[i].data.ptr;
+                int ret = 0;
+
+                if (s->state == COPS_PEPSIM_CLOSED)
+                        continue;
+                if (s->state == COPS_PEPSIM_CONNECTING) {
+                        ret = cops_pepsim_connected(sim, s);
+                } else {
+                        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                                ret = cops_pepsim_read(sim, s);
+                        if (ret == 0 && (events[i].events & EPOLLOUT))
+                                ret = cops_pepsim_flush(sim, s);
+                }
+                if (ret < 0)
+                        cops_pepsim_close(sim, s);
+        }
+
+        cops_timer_advance(&sim->wheel, sim->now_ns / 1000000);
+
+        /* Everything queued during the batch goes out in one send per session. */
+        while (sim->txq) {
+                struct cops_pepsim_session* s = sim->txq;
+
+                sim->txq = s->txq_next;
+                s->queued = false;
+                if (s->state != COPS_PEPSIM_CLOSED && !s->wblocked && cops_pepsim_flush(sim, s) < 0)
+                        cops_pepsim_close(sim, s);
+        }
+
+        return n;
+}
+
+void
+cops_pepsim_stop(struct cops_pepsim* sim) {
+        if (sim->sessions)
+                for (uint32_t i = 0; i < sim->cfg.sessions; i++)
+                        if (sim->sessions[i].fd >= 0)
+                                close(sim->sessions[i].fd);
+        if (sim->epfd >= 0)
+                close(sim->epfd);
+        free(sim->sessions);
+        sim->sessions = NULL;
+        sim->epfd = -1;
+}
+
+static void
+cops_hist_merge(struct cops_hist* dst, const struct cops_hist* src) {
+        dst->count += src->count;
+        dst->sum += src->sum;
+        if (src->max > dst->max)
+                dst->max = src->max;
+        for (uint32_t i = 0; i < COPS_HIST_BUCKETS; i++)
+                dst->buckets[i] += src->buckets[i];
+}
+
+void
+cops_pepsim_merge(struct cops_pepsim_stats* dst, const struct cops_pepsim_stats* src) {
+        uint64_t* d = &dst->accepted;
+        const uint64_t* s = &src->accepted;
+
+        for (size_t i = 0; i < offsetof(struct cops_pepsim_stats, open_ns) / sizeof(uint64_t); i++)
+                d[i] += s[i];
+        cops_hist_merge(&dst->open_ns, &src->open_ns);
+        cops_hist_merge(&dst->req_ns, &src->req_ns);
+}
+
+static void
+cops_pepsim_latency(FILE* out, const char* name, const struct cops_hist* h) {
+        fprintf(out, "%-8s n=%" PRIu64 " mean=%.1fus p50=%.1fus p99=%.1fus p999=%.1fus max=%.1fus\n", name, h->count,
+                (h->count) ? (double)h->sum / (double)h->count / 1000 : 0, cops_hist_quantile(h, 0.5) / 1000.0,
+                cops_hist_quantile(h, 0.99) / 1000.0, cops_hist_quantile(h, 0.999) / 1000.0, h->max / 1000.0);
+}
+
+void
+cops_pepsim_report(const struct cops_pepsim_stats* stats, uint64_t elapsed_ns, FILE* out) {
+        double secs = (elapsed_ns) ? (double)elapsed_ns / 1e9 : 1;
+
+        fprintf(out, "sessions accepted=%" PRIu64 " closed=%" PRIu64 "\n", stats->accepted, stats->closed);
+        fprintf(out, "REQ      %" PRIu64 " (%.0f/s)\n", stats->req, (double)stats->req / secs);
+        fprintf(out, "DEC      %" PRIu64 " (%.0f/s)\n", stats->dec, (double)stats->dec / secs);
+        fprintf(out, "RPT      %" PRIu64 " (%.0f/s)\n", stats->rpt, (double)stats->rpt / secs);
+        fprintf(out, "DRQ      %" PRIu64 " (%.0f/s)\n", stats->drq, (double)stats->drq / secs);
+        fprintf(out, "gate-set %" PRIu64 " (%" PRIu64 " errors), gate-info/delete %" PRIu64 "\n", stats->gate_set,
+                stats->gate_err, stats->gate_other);
+        fprintf(out, "KA       %" PRIu64 " sent, %" PRIu64 " received\n", stats->ka_tx, stats->ka_rx);
+        fprintf(out, "bytes    %.1f MB/s in, %.1f MB/s out\n", (double)stats->rx_bytes / secs / 1e6,
+                (double)stats->tx_bytes / secs / 1e6);
+        if (stats->overflow)
+                fprintf(out, "overflow %" PRIu64 " messages not sent\n", stats->overflow);
+        if (stats->integrity_err)
+                fprintf(out, "integrity %" PRIu64 " messages failed verification\n", stats->integrity_err);
+        cops_pepsim_latency(out, "open", &stats->open_ns);
+        cops_pepsim_latency(out, "req-dec", &stats->req_ns);
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef COPS_PEPSIM_H
+#define COPS_PEPSIM_H
+
+#include <stdio.h>
+
+#include "cops_decoder.h"
+#include "cops_integrity.h"
+#include "cops_metrics.h"
+#include "cops_timer.h"
+
+/* Requests in flight per session at most. */
+#define COPS_PEPSIM_MAX_WINDOW 256
+
+/* Receive and transmit buffer of every simulated session. */
+#define COPS_PEPSIM_BUF 16384
+
+struct cops_pepsim;
+
+/*
+ * Simulator configuration. Rates are per session, in messages per second.
+ *
+ * @addr        IPv4 address of the PDP, NULL for the loopback address
+ * @port        PDP port
+ * @sessions    Concurrent sessions (simulated CMTSs), each on its own TCP connection
+ * @window      REQs a session keeps in flight, 0 selects 1. Without req_rate every DEC that
+ *              answers a REQ is followed by the next REQ right away (closed loop)
+ * @req_rate    Pace REQs at this rate instead, still bounded by window. Latencies are then
+ *              measured from the time a REQ was due, not the time it could be sent
+ * @rpt_rate    Unsolicited accounting RPTs on the last decided handle
+ * @drq_rate    DRQs deleting the last decided handle
+ * @err_every   Answer every n-th Gate-Set with Gate-Set-Err instead of Gate-Set-Ack, 0 never
+ * @integrity   Sign every message with this key and require the PDP to sign its own, NULL
+ *              to disable
+ */
+struct cops_pepsim_config {
+        const char* addr;
+        uint16_t port;
+        uint32_t sessions;
+        uint32_t window;
+        uint32_t req_rate;
+        uint32_t rpt_rate;
+        uint32_t drq_rate;
+        uint32_t err_every;
+        const struct cops_integrity_key* integrity;
+};
+
+/* Totals of a run. Latencies are in nanoseconds. */
+struct cops_pepsim_stats {
+        uint64_t accepted; /* Client-Accepts received. */
+        uint64_t closed;   /* Sessions closed by the PDP or on error. */
+        uint64_t req;
+        uint64_t dec;      /* DECs answering a REQ of the session. */
+        uint64_t gate_set; /* Gate-Set decisions, answered with an Ack or Err RPT. */
+        uint64_t gate_err;
+        uint64_t gate_other; /* Gate-Info and Gate-Delete decisions, acknowledged. */
+        uint64_t rpt;        /* Every RPT sent, acknowledgements included. */
+        uint64_t drq;
+        uint64_t ka_tx;
+        uint64_t ka_rx;
+        uint64_t overflow;      /* Messages not sent because the transmit buffer was full. */
+        uint64_t integrity_err; /* Messages from the PDP that failed verification. */
+        uint64_t rx_bytes;
+        uint64_t tx_bytes;
+        struct cops_hist open_ns; /* TCP connect to Client-Accept. */
+        struct cops_hist req_ns;  /* REQ to the DEC answering it. */
+};
+
+enum cops_pepsim_state {
+        COPS_PEPSIM_CONNECTING = 0,
+        COPS_PEPSIM_OPENING, /* Client-Open sent. */
+        COPS_PEPSIM_ACCEPTED,
+        COPS_PEPSIM_CLOSED,
+};
+
+/* A REQ waiting for its DEC. */
+struct cops_pepsim_req {
+        uint32_t handle;
+        uint64_t t0;
+};
+
+/* One simulated CMTS. */
+struct cops_pepsim_session {
+        struct cops_pepsim* sim;
+        int fd;
+        uint32_t index;
+        enum cops_pepsim_state state;
+        struct cops_decoder dec;
+        struct cops_integrity integrity;
+        uint8_t rbuf[COPS_PEPSIM_BUF];
+        size_t rlen;
+        uint8_t wbuf[COPS_PEPSIM_BUF];
+        size_t woff;
+        size_t wlen;
+        bool wblocked; /* The socket returned EAGAIN, wait for EPOLLOUT. */
+        bool queued;   /* On the transmit queue of the current poll. */
+        struct cops_pepsim_session* txq_next;
+        struct cops_timer ka;   /* Keep-Alive every ka_ms. */
+        struct cops_timer pace; /* Rate driven messages. */
+        uint32_t ka_ms;         /* Half the negotiated Keep-Alive timer. */
+        uint64_t t_open;        /* TCP connect, then Client-Accept. */
+        uint64_t nreq;          /* Paced REQs sent, RPTs and DRQs below. */
+        uint64_t nrpt;
+        uint64_t ndrq;
+        uint32_t next_handle;
+        uint32_t last_handle; /* Most recently decided handle, 0 when none. */
+        uint32_t next_gate;
+        uint32_t gate_sets;
+        uint32_t inflight;
+        struct cops_pepsim_req pending[COPS_PEPSIM_MAX_WINDOW];
+};
+
+/*
+ * PEP (CMTS) simulator and load generator.
+ *
+ * Opens every session to a PDP, runs the Client-Open/Client-Accept exchange, sends Keep-Alives
+ * as negotiated, answers Gate-Set, Gate-Info and Gate-Delete decisions with the matching
+ * Report-State and generates REQ, RPT and DRQ traffic. All sessions of a simulator are driven
+ * by one thread, run one simulator per thread for more load and merge their stats.
+ */
+struct cops_pepsim {
+        struct cops_pepsim_config cfg;
+        int epfd;
+        uint64_t now_ns;
+        uint64_t t_ready; /* Every session accepted, 0 until then. */
+        struct cops_timer_wheel wheel;
+        struct cops_pepsim_session* sessions;
+        struct cops_pepsim_session* txq;
+        struct cops_pepsim_stats stats;
+};
+
+/* Start connecting every session. Returns 0 on success and -1 on error (errno set). */
+int cops_pepsim_start(struct cops_pepsim* sim, const struct cops_pepsim_config* cfg);
+
+/*
+ * Process one batch of socket events and expired timers, waiting at most timeout_ms. Returns
+ * the number of events handled or -1 on error.
+ */
+int cops_pepsim_poll(struct cops_pepsim* sim, int timeout_ms);
+
+/* Every session has been accepted, the load is running. */
+static inline bool
+cops_pepsim_ready(const struct cops_pepsim* sim) {
+        return sim->t_ready != 0;
+}
+
+/* Close every session and release the simulator. */
+void cops_pepsim_stop(struct cops_pepsim* sim);
+
+/* Add the totals of src to dst, e.g. the stats of one simulator per thread. */
+void cops_pepsim_merge(struct cops_pepsim_stats* dst, const struct cops_pepsim_stats* src);
+
+/* Write the totals, message rates over elapsed_ns and p50/p99/p999 latencies as text. */
+void cops_pepsim_report(const struct cops_pepsim_stats* stats, uint64_t elapsed_ns, FILE* out);
+
+#endif
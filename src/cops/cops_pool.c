@@ -0,0 +1,172 @@
+#include "cops_pool.h"
+
+static const uint32_t cops_pool_sizes[COPS_POOL_CLASSES] = {32, 128, 256, 1024, COPS_ARENA_CHUNK, COPS_POOL_MAX_SIZE};
+
+/* Pool owned by the calling thread, releases to any other pool take the remote path. */
+static _Thread_local struct cops_pool* cops_pool_owned;
+
+static inline int
+cops_pool_class(size_t size) {
+        for (int i = 0; i < COPS_POOL_CLASSES; i++)
+                if (size <= cops_pool_sizes[i])
+                        return i;
+        return -1;
+}
+
+static inline void
+cops_pool_push(struct cops_pool* p, struct cops_buf* b) {
+        struct cops_pool_class* c = &p->cls[b->cls];
+
+        b->next = c->free;
+        c->free = b;
+        c->nfree++;
+}
+
+/* Move buffers released by other threads onto the local free lists. */
+static void
+cops_pool_drain(struct cops_pool* p) {
+        struct cops_buf* b = atomic_exchange_explicit(&p->remote, NULL, memory_order_acquire);
+
+        while (b) {
+                struct cops_buf* next = b->next;
+                cops_pool_push(p, b);
+                b = next;
+        }
+}
+
+/* Carve a new slab into buffers of one class. */
+static int
+cops_pool_grow(struct cops_pool* p, int cls) {
+        size_t stride = sizeof(struct cops_buf) + cops_pool_sizes[cls];
+        size_t head = (sizeof(struct cops_slab) + 15) & ~(size_t)15;
+        size_t n = (COPS_POOL_SLAB_SIZE - head) / stride;
+        struct cops_slab* slab = aligned_alloc(64, COPS_POOL_SLAB_SIZE);
+
+        if (slab == NULL)
+                return -1;
+
+        slab->next = p->slabs;
+        p->slabs = slab;
+        p->nslabs++;
+
+        for (size_t i = 0; i < n; i++) {
+                struct cops_buf* b = (struct cops_buf*)((uint8_t*)slab + head + i * stride);
+
+                b->pool = p;
+                b->cap = cops_pool_sizes[cls];
+                b->cls = (uint8_t)cls;
+                cops_pool_push(p, b);
+        }
+        p->cls[cls].total += (uint32_t)n;
+
+        return 0;
+}
+
+void
+cops_pool_init(struct cops_pool* p) {
+        memset(p, 0, sizeof(*p));
+        atomic_init(&p->remote, NULL);
+}
+
+void
+cops_pool_bind(struct cops_pool* p) {
+        cops_pool_owned = p;
+}
+
+void
+cops_pool_destroy(struct cops_pool* p) {
+        while (p->slabs) {
+                struct cops_slab* slab = p->slabs;
+                p->slabs = slab->next;
+                free(slab);
+        }
+
+        if (cops_pool_owned == p)
+                cops_pool_owned = NULL;
+        memset(p->cls, 0, sizeof(p->cls));
+        p->nslabs = 0;
+}
+
+struct cops_buf*
+cops_buf_alloc(struct cops_pool* p, size_t size) {
+        int cls = cops_pool_class(size);
+
+        if (cls < 0)
+                return NULL;
+
+        struct cops_pool_class* c = &p->cls[cls];
+        if (c->free == NULL) {
+                cops_pool_drain(p);
+                if (c->free == NULL && cops_pool_grow(p, cls) < 0)
+                        return NULL;
+        }
+
+        struct cops_buf* b = c->free;
+        c->free = b->next;
+        c->nfree--;
+
+        b->next = NULL;
+        b->len = 0;
+        atomic_store_explicit(&b->refs, 1, memory_order_relaxed);
+
+        return b;
+}
+
+void
+cops_buf_release(struct cops_buf* b) {
+        if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_release) != 1)
+                return;
+        atomic_thread_fence(memory_order_acquire);
+
+        struct cops_pool* p = b->pool;
+        if (p == cops_pool_owned) {
+                cops_pool_push(p, b);
+                return;
+        }
+
+        /* Another thread owns the pool, hand the buffer over through the remote list. */
+        b->next = atomic_load_explicit(&p->remote, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&p->remote, &b->next, b, memory_order_release,
+                                                      memory_order_relaxed))
+                ;
+}
+
+void
+cops_arena_init(struct cops_arena* a, struct cops_pool* pool) {
+        a->pool = pool;
+        a->chunks = NULL;
+        a->used = 0;
+}
+
+void*
+cops_arena_alloc(struct cops_arena* a, size_t size) {
+        size = (size + 7) & ~(size_t)7;
+        if (size > COPS_ARENA_CHUNK)
+                return NULL;
+
+        if (a->chunks == NULL || a->used + size > COPS_ARENA_CHUNK) {
+                struct cops_buf* chunk = cops_buf_alloc(a->pool, COPS_ARENA_CHUNK);
+
+                if (chunk == NULL)
+                        return NULL;
+
+                chunk->next = a->chunks;
+                a->chunks = chunk;
+                a->used = 0;
+        }
+
+        void* ptr = a->chunks->data + a->used;
+        a->used += size;
+
+        return ptr;
+}
+
+void
+cops_arena_reset(struct cops_arena* a) {
+        while (a->chunks) {
+                struct cops_buf* chunk = a->chunks;
+                a->chunks = chunk->next;
+                cops_buf_release(chunk);
+        }
+        a->used = 0;
+}
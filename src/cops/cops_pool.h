@@ -0,0 +1,112 @@
+#ifndef COPS_POOL_H
+#define COPS_POOL_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+
+#include "cops.h"
+
+/*
+ * Buffer size classes. The smallest holds Keep-Alive and Client-Accept messages, the next two
+ * typical Gate-Set Decisions with and without classifiers, the largest a full receive buffer.
+ */
+#define COPS_POOL_CLASSES   6
+#define COPS_POOL_MAX_SIZE  16384
+#define COPS_POOL_SLAB_SIZE 65536
+
+/* Chunk size of a connection arena, taken from the pool's 4096 byte class. */
+#define COPS_ARENA_CHUNK 4096
+
+struct cops_pool;
+
+/*
+ * A reference counted message buffer. A buffer is handed out with one reference, every path
+ * the encoded message is queued on takes its own with cops_buf_ref and the buffer returns to
+ * its pool when the last one is dropped.
+ */
+struct cops_buf {
+        struct cops_pool* pool;
+        struct cops_buf* next; /* Free list link, owner defined while the buffer is in use. */
+        atomic_uint refs;
+        uint32_t cap;
+        uint32_t len;
+        uint8_t cls;
+        alignas(16) uint8_t data[];
+};
+
+struct cops_pool_class {
+        struct cops_buf* free;
+        uint32_t nfree;
+        uint32_t total;
+};
+
+struct cops_slab {
+        struct cops_slab* next;
+};
+
+/*
+ * Slab allocator of fixed size message buffers.
+ *
+ * A pool belongs to one thread (see cops_pool_bind) and its free lists are plain singly linked
+ * lists, allocation and release on that thread never lock or use atomics beyond the reference
+ * count. A buffer released by any other thread is pushed on a lock-free remote list that the
+ * owner drains the next time a class runs dry. Memory is taken from the system in slabs of
+ * COPS_POOL_SLAB_SIZE bytes and only returned by cops_pool_destroy.
+ */
+struct cops_pool {
+        struct cops_pool_class cls[COPS_POOL_CLASSES];
+        _Atomic(struct cops_buf*) remote;
+        struct cops_slab* slabs;
+        uint32_t nslabs;
+};
+
+/*
+ * A per-connection bump allocator over pool chunks. Allocations are never freed one by one,
+ * cops_arena_reset hands every chunk back to the pool at once (e.g. on disconnect).
+ */
+struct cops_arena {
+        struct cops_pool* pool;
+        struct cops_buf* chunks; /* Chunk list, the current chunk first. */
+        size_t used;             /* Bytes used in the current chunk. */
+};
+
+/* Initialise an empty pool. It has no owner until a thread calls cops_pool_bind. */
+void cops_pool_init(struct cops_pool* p);
+
+/*
+ * Make the calling thread the owner of a pool, e.g. at the start of a worker that was handed a
+ * pool initialised elsewhere. Releases on the owner go straight to the free lists, a thread
+ * owns one pool at a time.
+ */
+void cops_pool_bind(struct cops_pool* p);
+
+/* Free every slab. All buffers MUST have been released. */
+void cops_pool_destroy(struct cops_pool* p);
+
+/*
+ * Take a buffer of at least size bytes with a reference count of one and len 0. MUST be called
+ * on the owning thread. Returns NULL when size exceeds COPS_POOL_MAX_SIZE or on ENOMEM.
+ */
+struct cops_buf* cops_buf_alloc(struct cops_pool* p, size_t size);
+
+static inline struct cops_buf*
+cops_buf_ref(struct cops_buf* b) {
+        atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+        return b;
+}
+
+/* Drop a reference, the last one returns the buffer to its pool. Safe from any thread. */
+void cops_buf_release(struct cops_buf* b);
+
+void cops_arena_init(struct cops_arena* a, struct cops_pool* pool);
+
+/*
+ * Allocate size bytes aligned to 8 from the arena. Returns NULL when size exceeds
+ * COPS_ARENA_CHUNK or the pool is out of memory.
+ */
+void* cops_arena_alloc(struct cops_arena* a, size_t size);
+
+/* Release every chunk of the arena back to the pool. */
+void cops_arena_reset(struct cops_arena* a);
+
+#endif
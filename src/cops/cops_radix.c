@@ -0,0 +1,256 @@
+#include <errno.h>
+
+#include "cops_radix.h"
+
+#define COPS_RADIX_LEAF    0x80000000u
+#define COPS_RADIX_NIL     UINT32_MAX
+#define COPS_RADIX_MIN_CAP 64
+
+/* Longest path from a root to a leaf: one internal node per key bit. */
+#define COPS_RADIX_DEPTH (COPS_RADIX_KEY_LEN * 8)
+
+static inline size_t
+cops_radix_addr_len(uint8_t family) {
+        return (family == AF_INET) ? 4 : (family == AF_INET6) ? 16 : 0;
+}
+
+/* Bit b of a key, most significant bit of the first byte first. */
+static inline unsigned
+cops_radix_bit(const uint8_t* key, uint32_t b) {
+        return key[b >> 3] >> (7 - (b & 7)) & 1;
+}
+
+/* Address followed by the handle, the rest zeroed. */
+static inline void
+cops_radix_key(uint8_t* key, const uint8_t* addr, size_t alen, uint32_t handle) {
+        memset(key, 0, COPS_RADIX_KEY_LEN);
+        memcpy(key, addr, alen);
+        memcpy(key + alen, &handle, 4);
+}
+
+static uint32_t
+cops_radix_alloc(struct cops_radix* r) {
+        if (r->free != COPS_RADIX_NIL) {
+                uint32_t i = r->free;
+
+                r->free = r->nodes[i].in.child[0];
+                return i;
+        }
+
+        if (r->used == r->cap) {
+                uint32_t cap = r->cap * 2;
+                struct cops_radix_node* nodes;
+
+                if (cap >= COPS_RADIX_LEAF || (nodes = realloc(r->nodes, cap * sizeof(*nodes))) == NULL)
+                        return COPS_RADIX_NIL;
+                r->nodes = nodes;
+                r->cap = cap;
+        }
+
+        return r->used++;
+}
+
+static inline void
+cops_radix_release(struct cops_radix* r, uint32_t i) {
+        r->nodes[i].in.child[0] = r->free;
+        r->free = i;
+}
+
+int
+cops_radix_init(struct cops_radix* r, size_t gates) {
+        size_t cap = COPS_RADIX_MIN_CAP;
+
+        while (cap < 2 * gates && cap < COPS_RADIX_LEAF / 2)
+                cap *= 2;
+
+        r->nodes = malloc(cap * sizeof(*r->nodes));
+        if (r->nodes == NULL)
+                return -1;
+
+        r->used = 0;
+        r->cap = (uint32_t)cap;
+        r->free = COPS_RADIX_NIL;
+        r->root[0] = COPS_RADIX_NIL;
+        r->root[1] = COPS_RADIX_NIL;
+        r->count = 0;
+
+        return 0;
+}
+
+void
+cops_radix_free(struct cops_radix* r) {
+        free(r->nodes);
+        r->nodes = NULL;
+        r->used = r->cap = 0;
+}
+
+int
+cops_radix_insert(struct cops_radix* r, uint8_t family, const uint8_t* addr, uint32_t handle) {
+        size_t alen = cops_radix_addr_len(family);
+        uint8_t key[COPS_RADIX_KEY_LEN];
+
+        if (alen == 0) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        cops_radix_key(key, addr, alen, handle);
+        uint32_t* root = &r->root[alen == 16];
+
+        if (*root == COPS_RADIX_NIL) {
+                uint32_t leaf = cops_radix_alloc(r);
+
+                if (leaf == COPS_RADIX_NIL)
+                        goto nomem;
+                memcpy(r->nodes[leaf].key, key, COPS_RADIX_KEY_LEN);
+                *root = leaf | COPS_RADIX_LEAF;
+                r->count++;
+                return 0;
+        }
+
+        /* The leaf the key leads to shares the longest prefix with it of all leaves. */
+        uint32_t ref = *root;
+        while (!(ref & COPS_RADIX_LEAF))
+                ref = r->nodes[ref].in.child[cops_radix_bit(key, r->nodes[ref].in.bit)];
+
+        const uint8_t* near = r->nodes[ref & ~COPS_RADIX_LEAF].key;
+        size_t i = 0;
+        while (i < alen + 4 && key[i] == near[i])
+                i++;
+        if (i == alen + 4)
+                return 0;
+        uint32_t diff = (uint32_t)(i * 8) + (uint32_t)__builtin_clz((uint32_t)(key[i] ^ near[i])) - 24;
+
+        uint32_t leaf = cops_radix_alloc(r);
+        if (leaf == COPS_RADIX_NIL)
+                goto nomem;
+        uint32_t inner = cops_radix_alloc(r);
+        if (inner == COPS_RADIX_NIL) {
+                cops_radix_release(r, leaf);
+                goto nomem;
+        }
+        memcpy(r->nodes[leaf].key, key, COPS_RADIX_KEY_LEN);
+
+        /* The new internal node goes above the first node that tests a later bit. */
+        uint32_t* slot = root;
+        while (!(*slot & COPS_RADIX_LEAF) && r->nodes[*slot].in.bit < diff)
+                slot = &r->nodes[*slot].in.child[cops_radix_bit(key, r->nodes[*slot].in.bit)];
+
+        unsigned dir = cops_radix_bit(key, diff);
+        struct cops_radix_node* n = &r->nodes[inner];
+
+        n->in.bit = diff;
+        n->in.child[dir] = leaf | COPS_RADIX_LEAF;
+        n->in.child[!dir] = *slot;
+        *slot = inner;
+        r->count++;
+
+        return 0;
+
+nomem:
+        errno = ENOMEM;
+        return -1;
+}
+
+bool
+cops_radix_remove(struct cops_radix* r, uint8_t family, const uint8_t* addr, uint32_t handle) {
+        size_t alen = cops_radix_addr_len(family);
+        uint8_t key[COPS_RADIX_KEY_LEN];
+
+        if (alen == 0)
+                return false;
+
+        cops_radix_key(key, addr, alen, handle);
+        uint32_t* slot = &r->root[alen == 16];
+        uint32_t* parent = NULL;
+
+        if (*slot == COPS_RADIX_NIL)
+                return false;
+
+        while (!(*slot & COPS_RADIX_LEAF)) {
+                parent = slot;
+                slot = &r->nodes[*slot].in.child[cops_radix_bit(key, r->nodes[*slot].in.bit)];
+        }
+
+        uint32_t leaf = *slot & ~COPS_RADIX_LEAF;
+        if (memcmp(r->nodes[leaf].key, key, alen + 4) != 0)
+                return false;
+
+        /* The sibling takes the place of the parent. */
+        if (parent == NULL) {
+                *slot = COPS_RADIX_NIL;
+        } else {
+                uint32_t inner = *parent;
+                const uint32_t* child = r->nodes[inner].in.child;
+
+                *parent = child[child[0] == (leaf | COPS_RADIX_LEAF)];
+                cops_radix_release(r, inner);
+        }
+        cops_radix_release(r, leaf);
+        r->count--;
+
+        return true;
+}
+
+/* Whether the first len bits of a and b are equal. */
+static inline bool
+cops_radix_prefix_eq(const uint8_t* a, const uint8_t* b, unsigned len) {
+        unsigned bytes = len >> 3;
+
+        if (memcmp(a, b, bytes) != 0)
+                return false;
+        if ((len & 7) == 0)
+                return true;
+
+        uint8_t mask = (uint8_t)(0xFF00 >> (len & 7));
+        return ((a[bytes] ^ b[bytes]) & mask) == 0;
+}
+
+size_t
+cops_radix_find(const struct cops_radix* r, uint8_t family, const uint8_t* addr, unsigned prefix_len,
+                uint32_t* handles, size_t max) {
+        size_t alen = cops_radix_addr_len(family);
+        uint32_t stack[COPS_RADIX_DEPTH];
+        size_t depth = 0;
+        size_t count = 0;
+
+        if (alen == 0 || prefix_len > alen * 8)
+                return 0;
+
+        /* Skip the nodes that test bits within the prefix, what is left is the candidate subtree. */
+        uint32_t ref = r->root[alen == 16];
+        if (ref == COPS_RADIX_NIL)
+                return 0;
+        while (!(ref & COPS_RADIX_LEAF) && r->nodes[ref].in.bit < prefix_len)
+                ref = r->nodes[ref].in.child[cops_radix_bit(addr, r->nodes[ref].in.bit)];
+
+        /* Bits within the prefix were skipped, not compared: any leaf below tells whether they match. */
+        uint32_t any = ref;
+        while (!(any & COPS_RADIX_LEAF))
+                any = r->nodes[any].in.child[0];
+        if (!cops_radix_prefix_eq(r->nodes[any & ~COPS_RADIX_LEAF].key, addr, prefix_len))
+                return 0;
+
+        /*
+         * Every leaf of the subtree, left to right. The nodes are scattered over the array, so
+         * the right child is fetched while the left one is being walked: near the leaves, where
+         * most nodes are, the two misses then overlap.
+         */
+        for (;;) {
+                while (!(ref & COPS_RADIX_LEAF)) {
+                        uint32_t right = r->nodes[ref].in.child[1];
+
+                        __builtin_prefetch(&r->nodes[right & ~COPS_RADIX_LEAF]);
+                        stack[depth++] = right;
+                        ref = r->nodes[ref].in.child[0];
+                }
+
+                if (count < max)
+                        memcpy(&handles[count], r->nodes[ref & ~COPS_RADIX_LEAF].key + alen, 4);
+                count++;
+
+                if (depth == 0)
+                        return count;
+                ref = stack[--depth];
+        }
+}
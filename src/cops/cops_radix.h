@@ -0,0 +1,84 @@
+#ifndef COPS_RADIX_H
+#define COPS_RADIX_H
+
+#include "cops.h"
+
+/* Key of a gate in the index: the subscriber address followed by the 4 client handle bytes. */
+#define COPS_RADIX_KEY_LEN (16 + 4)
+
+/*
+ * A node is either an internal node, the bit at which its two subtrees first differ, or a leaf
+ * holding a whole key. Free nodes are chained through child[0].
+ */
+struct cops_radix_node {
+        union {
+                struct {
+                        uint32_t child[2]; /* Node references, COPS_RADIX_LEAF set for leaves. */
+                        uint32_t bit;      /* First key bit that differs between the two subtrees. */
+                } in;
+                uint8_t key[COPS_RADIX_KEY_LEN];
+        };
+};
+
+/*
+ * Subscriber address index: a path-compressed binary (crit-bit) trie per address family over
+ * the subscriber address of every gate, mapping it to client handles.
+ *
+ * Each gate is a leaf keyed by its address and handle, so any number of gates can share a
+ * subscriber and the internal nodes only exist where two keys diverge: n gates take 2n - 1
+ * nodes and a lookup visits at most one node per key bit. Every gate below an address prefix
+ * lives in a single subtree, which a prefix lookup walks without touching any other gate.
+ * Nodes live in one array addressed by 32-bit index rather than by pointer.
+ */
+struct cops_radix {
+        struct cops_radix_node* nodes;
+        uint32_t used; /* Nodes ever handed out, the free list holds those released. */
+        uint32_t cap;
+        uint32_t free;
+        uint32_t root[2]; /* AF_INET and AF_INET6 trees. */
+        size_t count;
+};
+
+/* Initialise an index sized for the given number of gates. Returns -1 on ENOMEM. */
+int cops_radix_init(struct cops_radix* r, size_t gates);
+
+void cops_radix_free(struct cops_radix* r);
+
+/*
+ * Index a gate under its subscriber address. Adding a gate that is already indexed under the
+ * same address does nothing.
+ *
+ * @r           Index
+ * @family      AF_INET or AF_INET6
+ * @addr        Subscriber address, network byte order (4 or 16 bytes)
+ * @handle      Client handle, as returned by cops_handle_key
+ *
+ * Returns 0, or -1 with errno set to EINVAL (unknown family) or ENOMEM.
+ */
+int cops_radix_insert(struct cops_radix* r, uint8_t family, const uint8_t* addr, uint32_t handle);
+
+/* Remove a gate indexed under an address. Returns false when it is not in the index. */
+bool cops_radix_remove(struct cops_radix* r, uint8_t family, const uint8_t* addr, uint32_t handle);
+
+/*
+ * Find the gates of every subscriber within a prefix, a prefix of the full address length
+ * being an exact match. Handles are returned in address order.
+ *
+ * @r           Index
+ * @family      AF_INET or AF_INET6
+ * @addr        Prefix, network byte order, bits past prefix_len are ignored
+ * @prefix_len  Prefix length in bits, up to 32 (AF_INET) or 128 (AF_INET6)
+ * @handles     Receives up to max handles
+ * @max         Capacity of handles
+ *
+ * Returns the number of gates within the prefix, which may exceed max.
+ */
+size_t cops_radix_find(const struct cops_radix* r, uint8_t family, const uint8_t* addr, unsigned prefix_len,
+                       uint32_t* handles, size_t max);
+
+static inline size_t
+cops_radix_count(const struct cops_radix* r) {
+        return r->count;
+}
+
+#endif
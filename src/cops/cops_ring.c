@@ -0,0 +1,74 @@
+#include <stdlib.h>
+
+#include "cops_ring.h"
+
+int
+cops_ring_init(struct cops_ring* r, size_t size) {
+        size_t cap = 2;
+
+        while (cap < size)
+                cap *= 2;
+
+        r->cells = aligned_alloc(64, ((cap * sizeof(struct cops_ring_cell) + 63) / 64) * 64);
+        if (r->cells == NULL)
+                return -1;
+
+        /* A cell is free for the producer whose position equals its sequence. */
+        for (size_t i = 0; i < cap; i++)
+                atomic_init(&r->cells[i].seq, i);
+
+        r->mask = cap - 1;
+        atomic_init(&r->head, 0);
+        atomic_init(&r->tail, 0);
+
+        return 0;
+}
+
+void
+cops_ring_free(struct cops_ring* r) {
+        free(r->cells);
+        r->cells = NULL;
+}
+
+bool
+cops_ring_push(struct cops_ring* r, const struct cops_work* work) {
+        size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+        for (;;) {
+                struct cops_ring_cell* cell = &r->cells[pos & r->mask];
+                size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+                if (diff == 0) {
+                        /* Claim the slot, on failure pos is reloaded with the current head. */
+                        if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1, memory_order_relaxed,
+                                                                  memory_order_relaxed)) {
+                                cell->work = *work;
+                                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                                return true;
+                        }
+                } else if (diff < 0) {
+                        return false; /* The consumer has not freed this cell yet. */
+                } else {
+                        pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+                }
+        }
+}
+
+bool
+cops_ring_pop(struct cops_ring* r, struct cops_work* work) {
+        size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        struct cops_ring_cell* cell = &r->cells[pos & r->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+
+        if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+                return false;
+
+        *work = cell->work;
+        atomic_store_explicit(&r->tail, pos + 1, memory_order_relaxed);
+
+        /* Hand the cell back to producers one lap ahead. */
+        atomic_store_explicit(&cell->seq, pos + r->mask + 1, memory_order_release);
+
+        return true;
+}
@@ -0,0 +1,47 @@
+#ifndef COPS_RING_H
+#define COPS_RING_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A unit of work handed to another thread. The ring does not interpret it, the consumer casts
+ * fn back to the type the producer stored and calls it with arg.
+ */
+struct cops_work {
+        void (*fn)(void);
+        void* arg;
+};
+
+struct cops_ring_cell {
+        atomic_size_t seq;
+        struct cops_work work;
+};
+
+/*
+ * Bounded lock-free queue of work items (Vyukov's sequence-numbered ring). Any number of
+ * producer threads may push concurrently, a single consumer pops. Producer and consumer
+ * indices live on separate cache lines so the two sides never share a line.
+ */
+struct cops_ring {
+        struct cops_ring_cell* cells;
+        size_t mask;
+        alignas(64) atomic_size_t head; /* Next slot to push. */
+        alignas(64) atomic_size_t tail; /* Next slot to pop. */
+};
+
+/* Allocate a ring of at least size entries (rounded up to a power of two). Returns -1 on ENOMEM. */
+int cops_ring_init(struct cops_ring* r, size_t size);
+
+void cops_ring_free(struct cops_ring* r);
+
+/* Push one item. Returns false when the ring is full, the caller decides whether to retry. */
+bool cops_ring_push(struct cops_ring* r, const struct cops_work* work);
+
+/* Pop one item (single consumer). Returns false when the ring is empty. */
+bool cops_ring_pop(struct cops_ring* r, struct cops_work* work);
+
+#endif
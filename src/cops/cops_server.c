@@ -0,0 +1,1306 @@
+#ifdef __linux__
+
+#define _GNU_SOURCE /* accept4 */
+
+#include "cops_server.h"
+#include "cops_validate.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Marker stored in epoll_event.data.ptr for the listening socket. */
+#define COPS_LISTENER NULL
+
+/* io_uring user_data: the connection (or NULL) in the upper bits, the request in the low bits. */
+enum cops_uring_req {
+        COPS_URING_ACCEPT = 1,
+        COPS_URING_WATCH,
+        COPS_URING_RECV,
+        COPS_URING_SEND,
+        COPS_URING_CANCEL,
+};
+
+#define COPS_URING_REQ_MASK      7ULL
+#define COPS_URING_TAG(ptr, req) ((uint64_t)(uintptr_t)(ptr) | (req))
+
+static void
+cops_conn_unlink(struct cops_conn** head, struct cops_conn* conn) {
+        if (conn->prev)
+                conn->prev->next = conn->next;
+        else
+                *head = conn->next;
+        if (conn->next)
+                conn->next->prev = conn->prev;
+        conn->prev = conn->next = NULL;
+}
+
+static void
+cops_conn_push(struct cops_conn** head, struct cops_conn* conn) {
+        conn->prev = NULL;
+        conn->next = *head;
+        if (*head)
+                (*head)->prev = conn;
+        *head = conn;
+}
+
+static struct cops_conn*
+cops_conn_get(struct cops_server* srv) {
+        struct cops_conn* conn = srv->free;
+
+        if (conn) {
+                cops_conn_unlink(&srv->free, conn);
+                return conn;
+        }
+
+        /* One allocation per connection: the struct followed by both buffers. */
+        conn = calloc(1, sizeof(*conn) + srv->cfg.rbuf_size + srv->cfg.wbuf_size);
+        if (conn == NULL)
+                return NULL;
+
+        conn->rbuf = (uint8_t*)(conn + 1);
+        conn->wbuf = conn->rbuf + srv->cfg.rbuf_size;
+        conn->wfixed = -1;
+
+        /* Connections are never freed before the server, their transmit buffer keeps its slot. */
+        if (srv->nfixed < srv->maxfixed) {
+                if (cops_uring_fixed_set(&srv->uring, srv->nfixed, conn->wbuf, srv->cfg.wbuf_size) == 0)
+                        conn->wfixed = (int32_t)srv->nfixed++;
+                else
+                        srv->maxfixed = srv->nfixed; /* Out of locked memory, send the rest unregistered. */
+        }
+
+        return conn;
+}
+
+/* Write as much of the transmit buffer as the socket accepts. */
+static int
+cops_conn_flush(struct cops_conn* conn) {
+        while (conn->woff < conn->wlen) {
+                ssize_t n = send(conn->fd, conn->wbuf + conn->woff, conn->wlen - conn->woff, MSG_NOSIGNAL);
+
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                conn->wblocked = true;
+                                return 0;
+                        }
+                        return -1;
+                }
+                conn->woff += n;
+        }
+
+        conn->woff = conn->wlen = 0;
+        return 0;
+}
+
+/*
+ * Keep-Alive supervision of the peer. Reads only store a timestamp, the timer re-arms itself
+ * for the remaining interval and closes the connection once a full interval passed in silence.
+ */
+static void
+cops_conn_ka_rx(struct cops_timer* timer, void* arg) {
+        struct cops_conn* conn = arg;
+        struct cops_server* srv = conn->srv;
+        uint64_t ka_ms = (uint64_t)srv->cfg.ka_timer * 1000;
+        uint64_t idle = srv->now_ms - conn->last_rx;
+
+        if (idle < ka_ms) {
+                cops_timer_arm(&srv->wheel, timer, ka_ms - idle);
+                return;
+        }
+
+        cops_server_close(srv, conn);
+}
+
+/* PDP originated Keep-Alive, only sent when nothing else went out during the interval. */
+static void
+cops_conn_ka_tx(struct cops_timer* timer, void* arg) {
+        struct cops_conn* conn = arg;
+        struct cops_server* srv = conn->srv;
+        uint64_t idle = srv->now_ms - conn->last_tx;
+        uint8_t ka[8];
+
+        if (idle < srv->cfg.ka_send_ms) {
+                cops_timer_arm(&srv->wheel, timer, srv->cfg.ka_send_ms - idle);
+                return;
+        }
+
+        cops_store64(ka, COPS_KA_MESSAGE);
+        cops_server_send(srv, conn, ka, sizeof(ka));
+        if (conn->state != COPS_CONN_CLOSING)
+                cops_timer_arm(&srv->wheel, timer, srv->cfg.ka_send_ms);
+}
+
+static void
+cops_conn_acct(struct cops_timer* timer, void* arg) {
+        struct cops_conn* conn = arg;
+        struct cops_server* srv = conn->srv;
+
+        cops_timer_arm(&srv->wheel, timer, (uint64_t)srv->cfg.acct_timer * 1000);
+        srv->cfg.cb.on_acct(srv, conn);
+}
+
+static void cops_conn_queue(struct cops_server* srv, struct cops_conn* conn);
+static void cops_conn_admit_timer(struct cops_timer* timer, void* arg);
+static void cops_conn_resume(struct cops_server* srv, struct cops_conn* conn);
+
+/* flush_ms after the first message was queued, the batch ends with a flush anyway. */
+static void
+cops_conn_flush_timer(struct cops_timer* timer, void* arg) {
+        struct cops_conn* conn = arg;
+
+        cops_conn_queue(conn->srv, conn);
+}
+
+static void
+cops_conn_reset(struct cops_server* srv, struct cops_conn* conn, int fd) {
+        conn->srv = srv;
+        conn->fd = fd;
+        do
+                srv->next_id = (srv->next_id + 1) & srv->id_mask;
+        while (srv->next_id == 0);
+        conn->id = srv->id_base | srv->next_id;
+        conn->state = COPS_CONN_OPENING;
+        conn->rlen = 0;
+        conn->woff = 0;
+        conn->wlen = 0;
+        conn->wbusy = 0;
+        conn->wblocked = false;
+        conn->congested = false;
+        conn->delayed = false;
+        conn->rx_armed = conn->rx_cancel = false;
+        conn->last_rx = srv->now_ms;
+        conn->last_tx = srv->now_ms;
+        conn->rx_bytes = conn->tx_bytes = 0;
+        conn->rx_msgs = conn->tx_msgs = 0;
+        conn->req_ticks = conn->enc_ticks = 0;
+        conn->user = NULL;
+        cops_arena_init(&conn->arena, &srv->pool);
+        /* The initial sequence number differs per session, old sessions cannot be replayed. */
+        cops_integrity_init(&conn->integrity, srv->cfg.integrity, (uint32_t)cops_metrics_ticks() ^ conn->id << 16);
+        cops_decoder_init(&conn->dec);
+        conn->dec.sync = srv->cfg.sync;
+        conn->dec.key = srv->cfg.integrity;
+        conn->dec.max_len = srv->cfg.max_msg_len;
+        cops_timer_init(&conn->ka_rx, cops_conn_ka_rx, conn);
+        cops_timer_init(&conn->ka_tx, cops_conn_ka_tx, conn);
+        cops_timer_init(&conn->acct, cops_conn_acct, conn);
+        cops_timer_init(&conn->flush, cops_conn_flush_timer, conn);
+        cops_timer_init(&conn->admit, cops_conn_admit_timer, conn);
+        if (srv->cfg.admit)
+                cops_admit_session(&srv->admit, &conn->bucket, srv->now_ms);
+}
+
+/* Multishot receive into the provided buffer group, one request serves the whole session. */
+static int
+cops_conn_uring_recv(struct cops_server* srv, struct cops_conn* conn) {
+        struct io_uring_sqe* sqe = cops_uring_sqe(&srv->uring);
+
+        if (sqe == NULL)
+                return -1;
+
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn->fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = COPS_URING_BGID;
+        sqe->user_data = COPS_URING_TAG(conn, COPS_URING_RECV);
+        conn->inflight++;
+        conn->rx_armed = true;
+
+        return 0;
+}
+
+/* Cancel the multishot receive, it ends with -ECANCELED. The completion of the cancel names no connection. */
+static int
+cops_conn_uring_cancel(struct cops_server* srv, struct cops_conn* conn) {
+        struct io_uring_sqe* sqe = cops_uring_sqe(&srv->uring);
+
+        if (sqe == NULL)
+                return -1;
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = COPS_URING_TAG(conn, COPS_URING_RECV);
+        sqe->user_data = COPS_URING_TAG(NULL, COPS_URING_CANCEL);
+        conn->rx_cancel = true;
+
+        return 0;
+}
+
+/*
+ * io_uring: nothing is received while a message is held back, like epoll leaves the socket
+ * alone, so TCP pushes back on the PEP. A receive is armed again once framing goes on.
+ */
+static int
+cops_conn_uring_pace(struct cops_server* srv, struct cops_conn* conn) {
+        if (srv->backend != COPS_BACKEND_URING || conn->state == COPS_CONN_CLOSING)
+                return 0;
+        if (conn->delayed)
+                return (conn->rx_armed && !conn->rx_cancel) ? cops_conn_uring_cancel(srv, conn) : 0;
+
+        return conn->rx_armed ? 0 : cops_conn_uring_recv(srv, conn);
+}
+
+/*
+ * Send everything queued behind woff. Large batches go zero-copy from the registered transmit
+ * buffer, the bytes then stay reserved until the kernel's notification releases them.
+ */
+static int
+cops_conn_uring_send(struct cops_server* srv, struct cops_conn* conn) {
+        struct io_uring_sqe* sqe = cops_uring_sqe(&srv->uring);
+
+        if (sqe == NULL)
+                return -1;
+
+        conn->wbusy = conn->wlen - conn->woff;
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->fd;
+        sqe->addr = (uintptr_t)(conn->wbuf + conn->woff);
+        sqe->len = (uint32_t)conn->wbusy;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = COPS_URING_TAG(conn, COPS_URING_SEND);
+        if (conn->wfixed >= 0 && conn->wbusy >= COPS_SERVER_URING_ZC_MIN) {
+                sqe->opcode = IORING_OP_SEND_ZC;
+                sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+                sqe->buf_index = (uint16_t)conn->wfixed;
+        }
+        conn->inflight++;
+
+        return 0;
+}
+
+static void
+cops_conn_queue(struct cops_server* srv, struct cops_conn* conn) {
+        if (conn->queued)
+                return;
+
+        conn->queued = true;
+        conn->txq_next = srv->txq;
+        srv->txq = conn;
+}
+
+/*
+ * Backpressure release: a congested connection fell below half of its watermark. Messages held
+ * back because of the congestion are admitted right away instead of with the next admit tick.
+ */
+static void
+cops_conn_drained(struct cops_server* srv, struct cops_conn* conn) {
+        if (conn->congested && cops_server_pending(conn) < srv->cfg.wbuf_high / 2) {
+                conn->congested = false;
+                if (srv->cfg.cb.on_drain)
+                        srv->cfg.cb.on_drain(srv, conn);
+                if (conn->delayed && conn->state != COPS_CONN_CLOSING)
+                        cops_conn_resume(srv, conn);
+        }
+}
+
+/* epoll: write what the socket takes now, the rest follows on EPOLLOUT. */
+static int
+cops_conn_send(struct cops_server* srv, struct cops_conn* conn) {
+        if (!conn->wblocked && cops_conn_flush(conn) < 0) {
+                cops_server_close(srv, conn);
+                return -1;
+        }
+
+        cops_conn_drained(srv, conn);
+        return 0;
+}
+
+/*
+ * Send every connection queued during the batch, one send per connection. io_uring sends are
+ * only prepared, they reach the kernel with the next submission.
+ */
+static void
+cops_server_flush_txq(struct cops_server* srv) {
+        while (srv->txq) {
+                struct cops_conn* conn = srv->txq;
+
+                srv->txq = conn->txq_next;
+                conn->queued = false;
+                if (conn->state == COPS_CONN_CLOSING)
+                        continue;
+
+                if (srv->backend == COPS_BACKEND_EPOLL)
+                        cops_conn_send(srv, conn);
+                else if (!conn->wbusy && conn->woff != conn->wlen && cops_conn_uring_send(srv, conn) < 0)
+                        cops_server_close(srv, conn);
+        }
+}
+
+/* Register an accepted socket with the backend and start supervising it. */
+static void
+cops_server_adopt(struct cops_server* srv, int fd) {
+        struct cops_conn* conn = (srv->nconns < srv->cfg.max_conns) ? cops_conn_get(srv) : NULL;
+
+        if (conn == NULL) {
+                close(fd);
+                return;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        cops_conn_reset(srv, conn, fd);
+
+        int ret;
+        if (srv->backend == COPS_BACKEND_URING) {
+                ret = cops_conn_uring_recv(srv, conn);
+        } else {
+                struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+                ret = epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev);
+        }
+        if (ret < 0) {
+                close(fd);
+                cops_conn_push(&srv->free, conn);
+                return;
+        }
+
+        cops_conn_push(&srv->active, conn);
+        srv->nconns++;
+        if (srv->metrics)
+                cops_metrics_add(&srv->metrics->opened, 1);
+
+        /* A PEP that never sends Client-Open is dropped after one Keep-Alive interval. */
+        if (srv->cfg.ka_timer)
+                cops_timer_arm(&srv->wheel, &conn->ka_rx, (uint64_t)srv->cfg.ka_timer * 1000);
+}
+
+static void
+cops_server_accept(struct cops_server* srv) {
+        for (;;) {
+                int fd = accept4(srv->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+                if (fd < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED)
+                                continue;
+                        return; /* EAGAIN, or out of descriptors until the next event. */
+                }
+
+                cops_server_adopt(srv, fd);
+        }
+}
+
+/* Count an inbound message by Op Code and by the C-Num of each object. */
+static void
+cops_metrics_rx(struct cops_metrics_slot* m, const struct cops_msg* msg) {
+        cops_metrics_add(&m->rx_ops[(msg->opcode < COPS_METRICS_OPS) ? msg->opcode : 0], 1);
+        for (uint16_t i = 0; i < msg->nobjs; i++) {
+                uint8_t cnum = msg->objs[i].cnum;
+
+                cops_metrics_add(&m->rx_objs[(cnum < COPS_METRICS_OBJS) ? cnum : 0], 1);
+        }
+}
+
+/* Handle a single framed message. Returns -1 when the connection must be closed. */
+static int
+cops_server_dispatch(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* msg) {
+        uint8_t reply[24];
+
+        conn->rx_msgs++;
+        if (srv->trace)
+                cops_trace_record(srv->trace, COPS_TRACE_RX, conn->id, msg->data, msg->length);
+        if (srv->metrics) {
+                cops_metrics_rx(srv->metrics, msg);
+                if (msg->opcode == 1 && conn->req_ticks == 0)
+                        conn->req_ticks = cops_metrics_ticks();
+        }
+
+        if (conn->integrity.key && cops_decoder_verify(&conn->dec, &conn->integrity) != COPS_IERR_NONE)
+                return -1;
+
+        /* cops_validate knows no SSC, the decoder only lets it through when synchronization is enabled. */
+        if (srv->cfg.validate && msg->opcode != 10 &&
+            cops_validate(msg->data, msg->length, srv->cfg.max_msg_len, NULL) != COPS_VERR_NONE)
+                return -1;
+
+        switch (msg->opcode) {
+                case 6: /* Client-Open */
+                        if (conn->state != COPS_CONN_OPENING || msg->client_type != 32778)
+                                return -1;
+
+                        cops_client_accept(reply, srv->cfg.ka_timer, srv->cfg.acct_timer);
+                        if (cops_server_send(srv, conn, reply, srv->cfg.acct_timer ? 24 : 16) < 0)
+                                return -1;
+
+                        conn->state = COPS_CONN_ACCEPTED;
+                        if (srv->cfg.ka_send_ms)
+                                cops_timer_arm(&srv->wheel, &conn->ka_tx, srv->cfg.ka_send_ms);
+                        if (srv->cfg.acct_timer && srv->cfg.cb.on_acct)
+                                cops_timer_arm(&srv->wheel, &conn->acct, (uint64_t)srv->cfg.acct_timer * 1000);
+                        if (srv->cfg.cb.on_open)
+                                srv->cfg.cb.on_open(srv, conn, msg);
+                        return 0;
+
+                case 9: /* Keep-Alive, echoed back to the PEP. */
+                        if (conn->state != COPS_CONN_ACCEPTED)
+                                return -1;
+
+                        cops_store64(reply, COPS_KA_MESSAGE);
+                        return cops_server_send(srv, conn, reply, 8);
+
+                case 1:  /* Request */
+                case 3:  /* Report-State */
+                case 4:  /* Delete Request State */
+                case 10: /* Synchronize Complete */
+                        if (conn->state != COPS_CONN_ACCEPTED)
+                                return -1;
+
+                        if (srv->cfg.cb.on_message)
+                                srv->cfg.cb.on_message(srv, conn, msg);
+                        return 0;
+
+                case 8:  /* Client-Close */
+                default: return -1;
+        }
+}
+
+/* What admission control made of a framed message. */
+enum cops_conn_verdict {
+        COPS_CONN_ADMIT = 0, /* Dispatch it. */
+        COPS_CONN_HOLD,      /* Leave it in the receive buffer, the admit timer frames it again. */
+        COPS_CONN_SHED,      /* Consumed without being dispatched. */
+        COPS_CONN_FAIL,      /* The connection must be closed. */
+};
+
+/* Refuse a message: a REQ is answered with a Decision carrying an Error object, an RPT is dropped. */
+static enum cops_conn_verdict
+cops_conn_shed(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* msg) {
+        const struct cops_obj* handle = cops_msg_find(msg, 1, 1);
+
+        if (srv->metrics)
+                cops_metrics_add(&srv->metrics->shed, 1);
+
+        /* The PEP numbers every message it signs, a dropped one still has to be accounted for. */
+        if (conn->integrity.key && cops_decoder_verify(&conn->dec, &conn->integrity) != COPS_IERR_NONE)
+                return COPS_CONN_FAIL;
+        if (msg->opcode != 1 || handle == NULL)
+                return COPS_CONN_SHED;
+
+        uint8_t* dst = cops_server_reserve(srv, conn, COPS_ERROR_MSG_LEN + COPS_ALIGN4(handle->length));
+        if (dst == NULL)
+                return COPS_CONN_FAIL;
+
+        size_t len = cops_decision_error(dst, msg->data + handle->offset, COPS_ERROR_UNABLE, 0);
+        return (cops_server_commit(srv, conn, len) < 0) ? COPS_CONN_FAIL : COPS_CONN_SHED;
+}
+
+/*
+ * Admission control, run on every message framed behind the cops_header_check of the
+ * decoder and before any other work is spent on it. Only REQ and RPT messages of accepted
+ * sessions take a token. A message that finds none, or finds the transmit buffer congested, is
+ * held back, shed or ends the session as cfg.admit->policy says.
+ */
+static enum cops_conn_verdict
+cops_conn_admit(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* msg) {
+        const struct cops_admit_config* cfg = &srv->admit.cfg;
+
+        if ((msg->opcode != 1 && msg->opcode != 3) || conn->state != COPS_CONN_ACCEPTED)
+                return COPS_CONN_ADMIT;
+
+        /* Decisions would only pile up behind a congested queue, look again after a tick. */
+        uint64_t wait = (conn->congested) ? srv->cfg.tick_ms : cops_admit_take(&srv->admit, &conn->bucket, srv->now_ms);
+        bool held = conn->delayed;
+
+        conn->delayed = false;
+        if (wait == 0)
+                return COPS_CONN_ADMIT;
+
+        switch (cfg->policy) {
+                case COPS_ADMIT_DELAY:
+                        if (!held)
+                                conn->held_since = srv->now_ms;
+                        if (srv->now_ms - conn->held_since + wait > cfg->max_delay_ms)
+                                return cops_conn_shed(srv, conn, msg);
+
+                        conn->delayed = true;
+                        cops_timer_arm(&srv->wheel, &conn->admit, wait);
+                        if (srv->metrics && !held)
+                                cops_metrics_add(&srv->metrics->delayed, 1);
+                        return COPS_CONN_HOLD;
+
+                case COPS_ADMIT_SHED: return cops_conn_shed(srv, conn, msg);
+
+                case COPS_ADMIT_CLOSE:
+                default: {
+                        uint8_t cc[COPS_ERROR_MSG_LEN];
+
+                        if (srv->metrics)
+                                cops_metrics_add(&srv->metrics->shed, 1);
+                        cops_client_close(cc, COPS_ERROR_UNABLE, 0);
+                        if (cops_server_send(srv, conn, cc, sizeof(cc)) == 0)
+                                cops_server_flush(srv, conn);
+                        return COPS_CONN_FAIL;
+                }
+        }
+}
+
+/*
+ * Frame and dispatch every complete message in data. Returns the number of bytes consumed, the
+ * remainder is the start of a partial message or of one held back by admission control, or -1
+ * when the connection must be closed.
+ */
+static ssize_t
+cops_conn_frame(struct cops_server* srv, struct cops_conn* conn, const uint8_t* data, size_t len) {
+        const struct cops_msg* msg;
+        size_t off = 0;
+        int ret;
+        uint64_t t0 = (srv->metrics) ? cops_metrics_ticks() : 0;
+
+        while ((ret = cops_decode(&conn->dec, data + off, len - off, &msg)) > 0) {
+                enum cops_conn_verdict verdict = (srv->cfg.admit) ? cops_conn_admit(srv, conn, msg) : COPS_CONN_ADMIT;
+
+                /* The decoder starts over at the held message, it is framed again once admitted. */
+                if (verdict == COPS_CONN_HOLD)
+                        break;
+                if (verdict == COPS_CONN_FAIL)
+                        return -1;
+
+                off += ret;
+                if (srv->metrics)
+                        cops_hist_record(&srv->metrics->hist[COPS_HIST_DECODE], cops_metrics_ticks() - t0);
+                if (verdict == COPS_CONN_ADMIT && cops_server_dispatch(srv, conn, msg) < 0)
+                        return -1;
+                if (conn->state == COPS_CONN_CLOSING)
+                        break;
+                if (srv->metrics)
+                        t0 = cops_metrics_ticks();
+        }
+
+        return (ret < 0) ? -1 : (ssize_t)off;
+}
+
+/* Frame the receive buffer and keep only the partial message at its front. */
+static int
+cops_conn_frame_rbuf(struct cops_server* srv, struct cops_conn* conn) {
+        ssize_t off = cops_conn_frame(srv, conn, conn->rbuf, conn->rlen);
+
+        if (off < 0)
+                return -1;
+        if (off && conn->state != COPS_CONN_CLOSING) {
+                memmove(conn->rbuf, conn->rbuf + off, conn->rlen - off);
+                conn->rlen -= off;
+        }
+
+        return 0;
+}
+
+static inline void
+cops_conn_rx(struct cops_server* srv, struct cops_conn* conn, size_t n) {
+        conn->last_rx = srv->now_ms;
+        conn->rx_bytes += n;
+        if (srv->metrics)
+                cops_metrics_add(&srv->metrics->rx_bytes, n);
+}
+
+/* Drain the socket and frame every complete message. Returns -1 when the connection must close. */
+static int
+cops_conn_read(struct cops_server* srv, struct cops_conn* conn) {
+        for (;;) {
+                if (conn->rlen == srv->cfg.rbuf_size)
+                        return -1; /* A single message larger than the receive buffer. */
+
+                ssize_t n = recv(conn->fd, conn->rbuf + conn->rlen, srv->cfg.rbuf_size - conn->rlen, 0);
+
+                if (n == 0)
+                        return -1;
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+                }
+                conn->rlen += n;
+                cops_conn_rx(srv, conn, n);
+
+                if (cops_conn_frame_rbuf(srv, conn) < 0)
+                        return -1;
+                /* A held back message leaves the rest in the socket, TCP pushes back on the PEP. */
+                if (conn->state == COPS_CONN_CLOSING || conn->delayed)
+                        return 0;
+        }
+}
+
+/*
+ * io_uring: bytes received before the receive was cancelled fill the buffer behind a held back
+ * message. The held message is shed to make room, then framing goes on behind it.
+ */
+static int
+cops_conn_overrun(struct cops_server* srv, struct cops_conn* conn) {
+        const struct cops_msg* msg;
+        int ret = cops_decode(&conn->dec, conn->rbuf, conn->rlen, &msg);
+
+        if (ret <= 0 || cops_conn_shed(srv, conn, msg) == COPS_CONN_FAIL)
+                return -1;
+
+        memmove(conn->rbuf, conn->rbuf + ret, conn->rlen - ret);
+        conn->rlen -= ret;
+        conn->delayed = false;
+        cops_timer_cancel(&srv->wheel, &conn->admit);
+
+        return cops_conn_frame_rbuf(srv, conn);
+}
+
+/*
+ * Frame bytes the kernel placed in a provided buffer. Complete messages are dispatched in place,
+ * only a trailing partial message is copied to the receive buffer to wait for the rest.
+ */
+static int
+cops_conn_input(struct cops_server* srv, struct cops_conn* conn, const uint8_t* data, size_t len) {
+        cops_conn_rx(srv, conn, len);
+
+        while (len && conn->state != COPS_CONN_CLOSING) {
+                if (conn->rlen == 0 && !conn->delayed) {
+                        ssize_t off = cops_conn_frame(srv, conn, data, len);
+
+                        if (off < 0)
+                                return -1;
+                        if (conn->state == COPS_CONN_CLOSING)
+                                return 0;
+
+                        /* A held back message waits in the receive buffer with what follows it. */
+                        data += off;
+                        len -= off;
+                        if (conn->delayed)
+                                continue;
+                        if (len > srv->cfg.rbuf_size)
+                                return -1; /* A single message larger than the receive buffer. */
+
+                        memcpy(conn->rbuf, data, len);
+                        conn->rlen = len;
+                        return 0;
+                }
+
+                size_t n = srv->cfg.rbuf_size - conn->rlen;
+                if (n == 0) {
+                        if (!conn->delayed || cops_conn_overrun(srv, conn) < 0)
+                                return -1;
+                        continue;
+                }
+                if (n > len)
+                        n = len;
+
+                memcpy(conn->rbuf + conn->rlen, data, n);
+                conn->rlen += n;
+                data += n;
+                len -= n;
+                if (!conn->delayed && cops_conn_frame_rbuf(srv, conn) < 0)
+                        return -1;
+        }
+
+        return 0;
+}
+
+/*
+ * Frame the receive buffer again, starting with the message admission control held back, and
+ * with epoll read what arrived behind it in the meantime.
+ */
+static void
+cops_conn_resume(struct cops_server* srv, struct cops_conn* conn) {
+        cops_timer_cancel(&srv->wheel, &conn->admit);
+        if (cops_conn_frame_rbuf(srv, conn) < 0 ||
+            (srv->backend == COPS_BACKEND_EPOLL && !conn->delayed && conn->state != COPS_CONN_CLOSING &&
+             cops_conn_read(srv, conn) < 0) ||
+            cops_conn_uring_pace(srv, conn) < 0)
+                cops_server_close(srv, conn);
+}
+
+static void
+cops_conn_admit_timer(struct cops_timer* timer, void* arg) {
+        struct cops_conn* conn = arg;
+
+        cops_conn_resume(conn->srv, conn);
+}
+
+/* Multishot accept, every new connection arrives as a completion carrying its descriptor. */
+static int
+cops_server_uring_accept(struct cops_server* srv) {
+        struct io_uring_sqe* sqe = cops_uring_sqe(&srv->uring);
+
+        if (sqe == NULL)
+                return -1;
+
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = srv->lfd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = COPS_URING_TAG(NULL, COPS_URING_ACCEPT);
+
+        return 0;
+}
+
+static int
+cops_server_uring_watch(struct cops_server* srv) {
+        struct io_uring_sqe* sqe = cops_uring_sqe(&srv->uring);
+
+        if (sqe == NULL)
+                return -1;
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = srv->watch.fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = COPS_URING_TAG(NULL, COPS_URING_WATCH);
+
+        return 0;
+}
+
+static int
+cops_server_uring_init(struct cops_server* srv) {
+        if (cops_uring_init(&srv->uring, COPS_SERVER_MAX_EVENTS, COPS_SERVER_MAX_EVENTS * 16) < 0)
+                return -1;
+
+        if (cops_uring_bufs_init(&srv->uring, COPS_SERVER_URING_BUFS, COPS_SERVER_URING_BUF_SIZE) < 0)
+                goto fail;
+
+        /* Transmit buffers are registered as connections are allocated, the table may stay sparse. */
+        srv->maxfixed = (srv->cfg.max_conns < COPS_SERVER_URING_FIXED) ? srv->cfg.max_conns : COPS_SERVER_URING_FIXED;
+        if (cops_uring_fixed_init(&srv->uring, srv->maxfixed) < 0)
+                srv->maxfixed = 0;
+
+        srv->backend = COPS_BACKEND_URING;
+        if (cops_server_uring_accept(srv) < 0)
+                goto fail;
+
+        return 0;
+
+fail:
+        cops_uring_free(&srv->uring);
+        srv->backend = COPS_BACKEND_EPOLL;
+        srv->maxfixed = 0;
+        return -1;
+}
+
+int
+cops_server_init(struct cops_server* srv, const struct cops_server_config* cfg) {
+        struct sockaddr_in sa = {0};
+        int one = 1;
+
+        memset(srv, 0, sizeof(*srv));
+        srv->cfg = *cfg;
+        srv->lfd = srv->epfd = -1;
+        srv->uring.fd = -1;
+        srv->watch.fd = -1;
+        srv->id_mask = UINT32_MAX;
+
+        if (srv->cfg.rbuf_size == 0)
+                srv->cfg.rbuf_size = COPS_SERVER_DEFAULT_BUF;
+        if (srv->cfg.max_msg_len > srv->cfg.rbuf_size) {
+                errno = EINVAL;
+                return -1;
+        }
+        if (srv->cfg.max_msg_len == 0) {
+                srv->cfg.max_msg_len = COPS_MSG_MAX_LEN + (cfg->integrity ? COPS_INTEGRITY_LEN : 0);
+                if (srv->cfg.max_msg_len > srv->cfg.rbuf_size)
+                        srv->cfg.max_msg_len = (uint32_t)srv->cfg.rbuf_size;
+        }
+        if (srv->cfg.wbuf_size == 0)
+                srv->cfg.wbuf_size = COPS_SERVER_DEFAULT_BUF;
+        if (srv->cfg.wbuf_high == 0)
+                srv->cfg.wbuf_high = srv->cfg.wbuf_size / 4 * 3;
+        if (srv->cfg.flush_bytes == 0)
+                srv->cfg.flush_bytes = COPS_SERVER_DEFAULT_FLUSH;
+        if (srv->cfg.max_conns == 0)
+                srv->cfg.max_conns = COPS_SERVER_DEFAULT_CONNS;
+        if (srv->cfg.tick_ms == 0)
+                srv->cfg.tick_ms = COPS_SERVER_DEFAULT_TICK;
+        if (cfg->metrics && (srv->metrics = cops_metrics_slot(cfg->metrics)) == NULL) {
+                errno = ENOSPC;
+                return -1;
+        }
+        if (cfg->trace && (srv->trace = cops_trace_ring(cfg->trace)) == NULL) {
+                errno = ENOSPC;
+                return -1;
+        }
+
+        srv->now_ms = cops_monotonic_ms();
+        cops_timer_wheel_init(&srv->wheel, srv->cfg.tick_ms, srv->now_ms);
+        cops_pool_init(&srv->pool);
+        if (cfg->admit)
+                cops_admit_init(&srv->admit, cfg->admit, srv->now_ms);
+
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(cfg->port);
+        sa.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (cfg->addr && inet_pton(AF_INET, cfg->addr, &sa.sin_addr) != 1) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        srv->lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (srv->lfd < 0)
+                return -1;
+
+        setsockopt(srv->lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (cfg->reuseport && setsockopt(srv->lfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+                goto fail;
+
+        if (bind(srv->lfd, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(srv->lfd, SOMAXCONN) < 0)
+                goto fail;
+
+        /* A committed span fits the transmit buffer and every message has at least a header. */
+        if (cfg->integrity && (srv->sign_off = malloc(srv->cfg.wbuf_size / COPS_HEADER_LEN * sizeof(uint32_t))) == NULL)
+                goto fail;
+
+        /* Kernels without io_uring (or with it disabled) quietly get the epoll loop. */
+        if (cfg->backend == COPS_BACKEND_URING && cops_server_uring_init(srv) == 0)
+                return 0;
+
+        srv->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (srv->epfd < 0)
+                goto fail;
+
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.ptr = COPS_LISTENER};
+        if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->lfd, &ev) < 0)
+                goto fail;
+
+        return 0;
+
+fail:
+        cops_server_destroy(srv);
+        return -1;
+}
+
+uint16_t
+cops_server_port(const struct cops_server* srv) {
+        struct sockaddr_in sa;
+        socklen_t len = sizeof(sa);
+
+        if (getsockname(srv->lfd, (struct sockaddr*)&sa, &len) < 0)
+                return 0;
+
+        return ntohs(sa.sin_port);
+}
+
+int
+cops_server_watch(struct cops_server* srv, int fd, void (*fn)(struct cops_server* srv, void* arg), void* arg) {
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.ptr = &srv->watch};
+
+        if (srv->watch.fd >= 0) {
+                errno = EBUSY;
+                return -1;
+        }
+        if (srv->backend == COPS_BACKEND_EPOLL && epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+                return -1;
+
+        srv->watch.fd = fd;
+        srv->watch.fn = fn;
+        srv->watch.arg = arg;
+
+        if (srv->backend == COPS_BACKEND_URING && cops_server_uring_watch(srv) < 0) {
+                srv->watch.fd = -1;
+                return -1;
+        }
+
+        return 0;
+}
+
+uint8_t*
+cops_server_reserve_span(struct cops_server* srv, struct cops_conn* conn, size_t len, size_t nmsgs) {
+        if (conn->state == COPS_CONN_CLOSING)
+                return NULL;
+        if (conn->integrity.key)
+                len += nmsgs * COPS_INTEGRITY_LEN;
+
+        /* Compact once the unsent tail no longer leaves room at the end, unless the kernel reads it. */
+        if (srv->cfg.wbuf_size - conn->wlen < len && conn->woff && conn->wbusy == 0) {
+                memmove(conn->wbuf, conn->wbuf + conn->woff, conn->wlen - conn->woff);
+                conn->wlen -= conn->woff;
+                conn->woff = 0;
+        }
+        if (srv->cfg.wbuf_size - conn->wlen < len)
+                return NULL;
+
+        if (srv->metrics)
+                conn->enc_ticks = cops_metrics_ticks();
+        return conn->wbuf + conn->wlen;
+}
+
+/* Count (and trace) the messages of a committed span, one commit may carry several. */
+static void
+cops_conn_tx(struct cops_server* srv, struct cops_conn* conn, const uint8_t* p, size_t len) {
+        struct cops_metrics_slot* m = srv->metrics;
+        uint64_t now = 0;
+
+        conn->tx_bytes += len;
+        if (m) {
+                now = cops_metrics_ticks();
+                cops_metrics_add(&m->tx_bytes, len);
+                if (conn->enc_ticks)
+                        cops_hist_record(&m->hist[COPS_HIST_ENCODE], now - conn->enc_ticks);
+                conn->enc_ticks = 0;
+        }
+
+        for (size_t off = 0; off + COPS_HEADER_LEN <= len;) {
+                uint8_t opcode = p[off + 1];
+                uint32_t mlen = cops_load32(p + off + 4);
+
+                conn->tx_msgs++;
+                if (srv->trace)
+                        cops_trace_record(srv->trace, COPS_TRACE_TX, conn->id, p + off,
+                                          (mlen < len - off) ? mlen : len - off);
+                if (m) {
+                        cops_metrics_add(&m->tx_ops[(opcode < COPS_METRICS_OPS) ? opcode : 0], 1);
+                        if (opcode == 2 && conn->req_ticks) {
+                                cops_hist_record(&m->hist[COPS_HIST_DECISION], now - conn->req_ticks);
+                                conn->req_ticks = 0;
+                        }
+                }
+                if (mlen < COPS_HEADER_LEN)
+                        break;
+                off += mlen;
+        }
+}
+
+/*
+ * Sign every message of a committed span in place. Each one grows by an Integrity object, so
+ * message k ends up k objects further up: the messages are placed from the last one down, none
+ * is moved more than once (the first one not at all) and each is hashed right after it reached
+ * its final offset. Returns the new span length, 0 when it is not a sequence of complete
+ * messages or no longer fits.
+ */
+static size_t
+cops_conn_sign(struct cops_server* srv, struct cops_conn* conn, size_t len) {
+        uint8_t* p = conn->wbuf + conn->wlen;
+        uint32_t* offs = srv->sign_off;
+        size_t off = 0;
+        size_t n = 0;
+
+        while (off + COPS_HEADER_LEN <= len) {
+                uint32_t mlen = cops_load32(p + off + 4);
+
+                if (mlen < COPS_HEADER_LEN || mlen > len - off)
+                        return 0;
+                offs[n++] = (uint32_t)off;
+                off += mlen;
+        }
+
+        size_t grow = n * COPS_INTEGRITY_LEN;
+        if (n == 0 || off != len || srv->cfg.wbuf_size - conn->wlen < len + grow)
+                return 0;
+
+        uint32_t seq = conn->integrity.tx_seq;
+        size_t end = len;
+
+        for (size_t k = n; k-- > 0; end = offs[k]) {
+                uint8_t* dst = p + offs[k] + k * COPS_INTEGRITY_LEN;
+                size_t mlen = end - offs[k];
+                struct cops_hmac h;
+
+                if (k)
+                        memmove(dst, p + offs[k], mlen);
+                cops_store32(dst + 4, (uint32_t)(mlen + COPS_INTEGRITY_LEN));
+                cops_hmac_init(&h, conn->integrity.key);
+                cops_hmac_update(&h, dst, mlen);
+                cops_integrity_seal(&h, dst + mlen, seq + (uint32_t)k);
+        }
+        conn->integrity.tx_seq = seq + (uint32_t)n;
+
+        return len + grow;
+}
+
+int
+cops_server_commit(struct cops_server* srv, struct cops_conn* conn, size_t len) {
+        if (conn->state == COPS_CONN_CLOSING)
+                return -1;
+        if (conn->integrity.key && (len = cops_conn_sign(srv, conn, len)) == 0)
+                return -1;
+
+        cops_conn_tx(srv, conn, conn->wbuf + conn->wlen, len);
+        conn->wlen += len;
+        conn->last_tx = srv->now_ms;
+
+        size_t pending = cops_server_pending(conn);
+        if (pending >= srv->cfg.wbuf_high)
+                conn->congested = true;
+        if (pending >= srv->cfg.flush_bytes)
+                return cops_server_flush(srv, conn);
+
+        /* Wait for more messages, at most until the end of the batch or flush_ms. */
+        if (srv->cfg.flush_ms == 0)
+                cops_conn_queue(srv, conn);
+        else if (!cops_timer_pending(&conn->flush))
+                cops_timer_arm(&srv->wheel, &conn->flush, srv->cfg.flush_ms);
+
+        return 0;
+}
+
+int
+cops_server_send(struct cops_server* srv, struct cops_conn* conn, const void* msg, size_t len) {
+        uint8_t* dst = cops_server_reserve(srv, conn, len);
+
+        if (dst == NULL)
+                return -1;
+
+        memcpy(dst, msg, len);
+        return cops_server_commit(srv, conn, len);
+}
+
+int
+cops_server_flush(struct cops_server* srv, struct cops_conn* conn) {
+        if (conn->state == COPS_CONN_CLOSING)
+                return -1;
+
+        cops_timer_cancel(&srv->wheel, &conn->flush);
+        if (srv->backend == COPS_BACKEND_EPOLL)
+                return cops_conn_send(srv, conn);
+
+        /* Submit right away instead of with the next wait. */
+        cops_conn_queue(srv, conn);
+        cops_server_flush_txq(srv);
+        if (cops_uring_wait(&srv->uring, 0) < 0)
+                return -1;
+
+        return (conn->state == COPS_CONN_CLOSING) ? -1 : 0;
+}
+
+void
+cops_server_close(struct cops_server* srv, struct cops_conn* conn) {
+        if (conn->state == COPS_CONN_CLOSING)
+                return;
+
+        if (srv->cfg.cb.on_close)
+                srv->cfg.cb.on_close(srv, conn);
+
+        conn->state = COPS_CONN_CLOSING;
+        cops_timer_cancel(&srv->wheel, &conn->ka_rx);
+        cops_timer_cancel(&srv->wheel, &conn->ka_tx);
+        cops_timer_cancel(&srv->wheel, &conn->acct);
+        cops_timer_cancel(&srv->wheel, &conn->flush);
+        cops_timer_cancel(&srv->wheel, &conn->admit);
+        /* Shutting the socket down completes the receive and any send still in flight. */
+        if (srv->backend == COPS_BACKEND_URING)
+                shutdown(conn->fd, SHUT_RDWR);
+        else
+                epoll_ctl(srv->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->fd = -1;
+
+        /* Events for this connection may still be pending in the current batch. */
+        cops_conn_unlink(&srv->active, conn);
+        cops_conn_push(&srv->released, conn);
+        srv->nconns--;
+        if (srv->metrics)
+                cops_metrics_add(&srv->metrics->closed, 1);
+}
+
+static void
+cops_server_recv_done(struct cops_server* srv, struct cops_conn* conn, int32_t res, uint32_t flags) {
+        bool more = flags & IORING_CQE_F_MORE;
+
+        if (!more) {
+                conn->inflight--;
+                conn->rx_armed = conn->rx_cancel = false;
+        }
+
+        if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+                uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+                if (conn->state != COPS_CONN_CLOSING &&
+                    cops_conn_input(srv, conn, cops_uring_buf(&srv->uring, bid), (size_t)res) < 0)
+                        cops_server_close(srv, conn);
+                cops_uring_buf_put(&srv->uring, bid);
+        } else if (res != -ENOBUFS && res != -ECANCELED) {
+                cops_server_close(srv, conn); /* Peer closed, error, or the shutdown of a closed connection. */
+        }
+
+        /* The kernel ends a multishot receive when it runs out of provided buffers, admission control when it holds. */
+        if (cops_conn_uring_pace(srv, conn) < 0)
+                cops_server_close(srv, conn);
+}
+
+/*
+ * A send completed. A zero-copy send posts its result with IORING_CQE_F_MORE and a second,
+ * IORING_CQE_F_NOTIF completion once the kernel no longer references the transmit buffer.
+ */
+static void
+cops_server_send_done(struct cops_server* srv, struct cops_conn* conn, int32_t res, uint32_t flags) {
+        if (!(flags & IORING_CQE_F_MORE)) {
+                conn->inflight--;
+                conn->wbusy = 0;
+        }
+
+        if (conn->state == COPS_CONN_CLOSING)
+                return;
+
+        if (!(flags & IORING_CQE_F_NOTIF)) {
+                if (res < 0) {
+                        cops_server_close(srv, conn);
+                        return;
+                }
+                conn->woff += (size_t)res;
+        }
+
+        if (conn->wbusy)
+                return;
+        if (conn->woff == conn->wlen)
+                conn->woff = conn->wlen = 0;
+        else
+                cops_conn_queue(srv, conn);
+        cops_conn_drained(srv, conn);
+}
+
+static int
+cops_server_poll_uring(struct cops_server* srv, int timeout_ms) {
+        struct io_uring_cqe* cqe;
+        int n = 0;
+
+        if (cops_uring_wait(&srv->uring, timeout_ms) < 0)
+                return -1;
+        srv->now_ms = cops_monotonic_ms();
+
+        while ((cqe = cops_uring_cqe_peek(&srv->uring)) != NULL) {
+                uint64_t data = cqe->user_data;
+                int32_t res = cqe->res;
+                uint32_t flags = cqe->flags;
+                struct cops_conn* conn = (struct cops_conn*)(uintptr_t)(data & ~COPS_URING_REQ_MASK);
+
+                cops_uring_cqe_seen(&srv->uring);
+                n++;
+
+                switch (data & COPS_URING_REQ_MASK) {
+                        case COPS_URING_ACCEPT:
+                                if (res >= 0)
+                                        cops_server_adopt(srv, res);
+                                if (!(flags & IORING_CQE_F_MORE))
+                                        cops_server_uring_accept(srv);
+                                break;
+
+                        case COPS_URING_WATCH:
+                                srv->watch.fn(srv, srv->watch.arg);
+                                if (!(flags & IORING_CQE_F_MORE))
+                                        cops_server_uring_watch(srv);
+                                break;
+
+                        case COPS_URING_RECV: cops_server_recv_done(srv, conn, res, flags); break;
+                        case COPS_URING_SEND: cops_server_send_done(srv, conn, res, flags); break;
+                        case COPS_URING_CANCEL: break;
+                }
+        }
+
+        return n;
+}
+
+static int
+cops_server_poll_epoll(struct cops_server* srv, int timeout_ms) {
+        struct epoll_event events[COPS_SERVER_MAX_EVENTS];
+
+        int n = epoll_wait(srv->epfd, events, COPS_SERVER_MAX_EVENTS, timeout_ms);
+        if (n < 0 && errno != EINTR)
+                return -1;
+        srv->now_ms = cops_monotonic_ms();
+
+        for (int i = 0; i < n; i++) {
+                struct cops_conn* conn = events[i].data.ptr;
+
+                if (conn == COPS_LISTENER) {
+                        cops_server_accept(srv);
+                        continue;
+                }
+                if (conn == (void*)&srv->watch) {
+                        srv->watch.fn(srv, srv->watch.arg);
+                        continue;
+                }
+                if (conn->state == COPS_CONN_CLOSING)
+                        continue;
+
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        cops_server_close(srv, conn);
+                        continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                        conn->wblocked = false;
+                        if (cops_conn_send(srv, conn) < 0)
+                                continue;
+                }
+                if ((events[i].events & (EPOLLIN | EPOLLRDHUP)) && !conn->delayed && cops_conn_read(srv, conn) < 0)
+                        cops_server_close(srv, conn);
+        }
+
+        return (n < 0) ? 0 : n;
+}
+
+int
+cops_server_poll(struct cops_server* srv, int timeout_ms) {
+        int next = cops_timer_next_ms(&srv->wheel, cops_monotonic_ms());
+
+        /* The thread running the event loop owns the buffers, whichever one initialised the server. */
+        cops_pool_bind(&srv->pool);
+
+        if (next >= 0 && (timeout_ms < 0 || next < timeout_ms))
+                timeout_ms = next;
+
+        /* Messages queued since the last batch, e.g. by another event source of the application. */
+        cops_server_flush_txq(srv);
+
+        int n = (srv->backend == COPS_BACKEND_URING) ? cops_server_poll_uring(srv, timeout_ms)
+                                                     : cops_server_poll_epoll(srv, timeout_ms);
+        if (n < 0)
+                return -1;
+
+        cops_timer_advance(&srv->wheel, srv->now_ms);
+
+        /* Replies and Keep-Alives produced by this batch leave before the caller gets control back. */
+        cops_server_flush_txq(srv);
+        if (srv->backend == COPS_BACKEND_URING && cops_uring_wait(&srv->uring, 0) < 0)
+                return -1;
+
+        /*
+         * Connections closed in this batch can now be reused, with io_uring only once the kernel
+         * completed every request that references them.
+         */
+        struct cops_conn* conn = srv->released;
+        while (conn) {
+                struct cops_conn* next_conn = conn->next;
+
+                if (conn->inflight == 0 && !conn->queued) {
+                        cops_conn_unlink(&srv->released, conn);
+                        cops_arena_reset(&conn->arena);
+                        cops_conn_push(&srv->free, conn);
+                }
+                conn = next_conn;
+        }
+
+        return n;
+}
+
+static void
+cops_conn_free_all(struct cops_conn** head) {
+        while (*head) {
+                struct cops_conn* conn = *head;
+                cops_conn_unlink(head, conn);
+                cops_arena_reset(&conn->arena);
+                free(conn);
+        }
+}
+
+void
+cops_server_destroy(struct cops_server* srv) {
+        while (srv->active)
+                cops_server_close(srv, srv->active);
+
+        /* Closing the ring cancels what is still in flight before the buffers go away. */
+        if (srv->backend == COPS_BACKEND_URING)
+                cops_uring_free(&srv->uring);
+        srv->txq = NULL;
+
+        cops_conn_free_all(&srv->released);
+        cops_conn_free_all(&srv->free);
+
+        cops_pool_destroy(&srv->pool);
+        free(srv->sign_off);
+        srv->sign_off = NULL;
+
+        if (srv->epfd >= 0)
+                close(srv->epfd);
+        if (srv->lfd >= 0)
+                close(srv->lfd);
+        srv->epfd = srv->lfd = -1;
+}
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef COPS_SERVER_H
+#define COPS_SERVER_H
+
+#include "cops.h"
+#include "cops_admit.h"
+#include "cops_decoder.h"
+#include "cops_integrity.h"
+#include "cops_metrics.h"
+#include "cops_pool.h"
+#include "cops_timer.h"
+#include "cops_trace.h"
+#include "cops_uring.h"
+
+/* IANA assigned COPS port. */
+#define COPS_PORT 3918
+
+#define COPS_SERVER_DEFAULT_BUF   16384
+#define COPS_SERVER_DEFAULT_CONNS 16384
+#define COPS_SERVER_MAX_EVENTS    256
+#define COPS_SERVER_DEFAULT_TICK  100
+#define COPS_SERVER_DEFAULT_FLUSH 4096
+
+/* io_uring backend: provided receive buffers and the registered transmit buffer table. */
+#define COPS_SERVER_URING_BUFS     512
+#define COPS_SERVER_URING_BUF_SIZE 4096
+#define COPS_SERVER_URING_FIXED    16384
+
+/* Smallest batch sent zero-copy from a registered transmit buffer, smaller ones are copied. */
+#define COPS_SERVER_URING_ZC_MIN 4096
+
+struct cops_server;
+struct cops_conn;
+
+enum cops_backend {
+        COPS_BACKEND_EPOLL = 0, /* Readiness notification, non-blocking send/recv per event. */
+        COPS_BACKEND_URING,     /* Completion based io_uring with multishot accept and receive. */
+};
+
+/*
+ * Application callbacks, any may be NULL. Messages are read-only views into the connection's
+ * receive buffer and are only valid for the duration of the callback.
+ *
+ * @on_open     A PEP completed the Client-Open/Client-Accept exchange
+ * @on_message  A REQ, RPT or DRQ message was received on an accepted connection
+ * @on_close    The connection is about to be closed (peer close, Client-Close, missed
+ *              Keep-Alive or error)
+ * @on_acct     The accounting timer of an accepted connection expired
+ * @on_drain    A congested connection (see cops_server_congested) drained below half of
+ *              wbuf_high, more messages can be queued
+ */
+struct cops_server_callbacks {
+        void (*on_open)(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* opn);
+        void (*on_message)(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* msg);
+        void (*on_close)(struct cops_server* srv, struct cops_conn* conn);
+        void (*on_acct)(struct cops_server* srv, struct cops_conn* conn);
+        void (*on_drain)(struct cops_server* srv, struct cops_conn* conn);
+};
+
+/*
+ * Server configuration. Zero valued sizes select the defaults above.
+ *
+ * @addr        IPv4 listen address in dotted notation, NULL for INADDR_ANY
+ * @port        Listen port, 0 selects an ephemeral port (see cops_server_port)
+ * @ka_timer    Keep-Alive timer (seconds) sent in every Client-Accept. A connection that is
+ *              silent for this long is closed, 0 disables supervision
+ * @acct_timer  Accounting timer (seconds) sent in every Client-Accept, 0 to omit. When set,
+ *              on_acct runs once per interval for every accepted connection
+ * @ka_send_ms  Interval of PDP originated Keep-Alives on an idle transmit path, 0 to disable
+ * @tick_ms     Timer wheel resolution in milliseconds
+ * @max_conns   Maximum number of concurrent PEP connections
+ * @rbuf_size   Per-connection receive buffer, the input queue of a session
+ * @max_msg_len Largest inbound message, a longer one closes the connection. 0 selects
+ *              COPS_MSG_MAX_LEN, plus COPS_INTEGRITY_LEN with integrity, or rbuf_size when that
+ *              is smaller. A larger value than rbuf_size fails with EINVAL
+ * @wbuf_size   Per-connection transmit buffer
+ * @wbuf_high   Queued bytes at which a connection counts as congested, 0 selects 3/4 of
+ *              wbuf_size
+ * @flush_bytes Queued bytes that are sent right away instead of waiting for more
+ * @flush_ms    Longest a queued message waits for more, 0 sends at the end of the current
+ *              event batch
+ * @reuseport   Set SO_REUSEPORT on the listener
+ * @validate    Run cops_validate on every inbound message, a malformed message closes the
+ *              connection
+ * @sync        Accept Synchronize Complete from PEPs and pass it to on_message, see cops_sync.h
+ * @metrics     Registry the server claims a slot of for its counters and latencies, NULL to
+ *              disable. Every server needs a slot of its own
+ * @trace       Wire tracer the server claims a ring of, every message in and out is captured up
+ *              to the trace's snaplen. NULL to disable
+ * @integrity   Key of the Message Integrity object. Every message in must carry one that
+ *              verifies, otherwise the connection is closed, and every message out is signed
+ *              with it. NULL to disable
+ * @admit       Rate limits of REQ and RPT messages and the overload policy, copied at init.
+ *              The receive buffer is the input queue of a session, with COPS_ADMIT_DELAY the
+ *              server stops reading while a message is held back and lets TCP push back on the
+ *              PEP: epoll leaves the socket alone, io_uring cancels the multishot receive. Bytes
+ *              it had already taken that do not fit the receive buffer shed the held message to
+ *              make room (drop-head). A session whose transmit buffer is congested admits no new
+ *              work either. NULL to disable
+ * @backend     Requested event backend. COPS_BACKEND_URING falls back to epoll when the kernel
+ *              lacks io_uring or multishot receive, srv->backend holds the one in use
+ */
+struct cops_server_config {
+        const char* addr;
+        uint16_t port;
+        uint32_t ka_timer;
+        uint32_t acct_timer;
+        uint32_t ka_send_ms;
+        uint32_t tick_ms;
+        uint32_t max_conns;
+        size_t rbuf_size;
+        uint32_t max_msg_len;
+        size_t wbuf_size;
+        size_t wbuf_high;
+        size_t flush_bytes;
+        uint32_t flush_ms;
+        bool reuseport;
+        bool validate;
+        bool sync;
+        enum cops_backend backend;
+        struct cops_metrics* metrics;
+        struct cops_trace* trace;
+        const struct cops_integrity_key* integrity;
+        const struct cops_admit_config* admit;
+        struct cops_server_callbacks cb;
+        void* user;
+};
+
+enum cops_conn_state {
+        COPS_CONN_OPENING = 0, /* TCP established, waiting for Client-Open. */
+        COPS_CONN_ACCEPTED,    /* Client-Accept sent. */
+        COPS_CONN_CLOSING,     /* Closed, released at the end of the current event batch. */
+};
+
+/*
+ * A single PEP (CMTS) connection. The buffers are allocated once when the connection is
+ * accepted and recycled through a free list, nothing is allocated per message. Per-session
+ * state can be carved from arena, it is released in bulk once the connection is closed.
+ */
+struct cops_conn {
+        struct cops_server* srv;
+        int fd;
+        uint32_t id;
+        enum cops_conn_state state;
+        struct cops_decoder dec;
+        uint8_t* rbuf;
+        size_t rlen;
+        uint8_t* wbuf;
+        size_t woff;      /* First unsent byte in wbuf. */
+        size_t wlen;      /* End of queued bytes in wbuf. */
+        uint64_t last_rx; /* Time of the last read, checked lazily by ka_rx. */
+        uint64_t last_tx; /* Time of the last queued message, checked lazily by ka_tx. */
+        struct cops_timer ka_rx;
+        struct cops_timer ka_tx;
+        struct cops_timer acct;
+        struct cops_timer flush;   /* Latency bound of queued messages, see flush_ms. */
+        struct cops_timer admit;   /* Resumes framing once a held back message may be admitted. */
+        struct cops_bucket bucket; /* Admission tokens of the session, see cfg.admit. */
+        uint64_t held_since;       /* Time the first message of the receive buffer was held back. */
+        struct cops_arena arena;
+        struct cops_integrity integrity; /* Sequence numbers, the key is NULL unless cfg.integrity. */
+        uint64_t rx_bytes;
+        uint64_t tx_bytes; /* Queued for sending. */
+        uint64_t rx_msgs;
+        uint64_t tx_msgs;
+        uint64_t req_ticks; /* metrics: arrival of the oldest REQ not answered by a DEC yet. */
+        uint64_t enc_ticks; /* metrics: time of the last cops_server_reserve. */
+        size_t wbusy;       /* io_uring: bytes from woff handed to a send still in flight. */
+        int32_t wfixed;     /* io_uring: registered buffer index of wbuf, -1 when unregistered. */
+        uint16_t inflight;  /* io_uring: requests that still reference the connection. */
+        bool queued;        /* On the transmit queue of the current batch. */
+        bool wblocked;      /* epoll: the socket returned EAGAIN, wait for EPOLLOUT. */
+        bool congested;     /* Queued bytes reached wbuf_high, on_drain follows. */
+        bool delayed;       /* Framing stopped at a message held back by admission control. */
+        bool rx_armed;      /* io_uring: a multishot receive is in flight. */
+        bool rx_cancel;     /* io_uring: and its cancellation, while delayed. */
+        struct cops_conn* txq_next;
+        struct cops_conn* prev;
+        struct cops_conn* next;
+        void* user;
+};
+
+/* An extra descriptor polled by the server, see cops_server_watch. */
+struct cops_watch {
+        int fd;
+        void (*fn)(struct cops_server* srv, void* arg);
+        void* arg;
+};
+
+struct cops_server {
+        int lfd;
+        int epfd;
+        enum cops_backend backend;
+        struct cops_uring uring;
+        struct cops_server_config cfg;
+        struct cops_watch watch;
+        uint32_t nconns;
+        uint32_t id_base; /* Fixed high bits of every connection id, see cops_shard. */
+        uint32_t id_mask; /* Bits below id_base that number the connections. */
+        uint32_t next_id; /* Last number handed out, wraps within id_mask and skips 0. */
+        uint64_t now_ms;  /* Monotonic time sampled once per poll. */
+        struct cops_timer_wheel wheel;
+        struct cops_pool pool;      /* Message buffers and connection arenas. */
+        struct cops_conn* active;   /* List of open connections. */
+        struct cops_conn* free;     /* Recycled connections, buffers attached. */
+        struct cops_conn* released; /* Closed during the current event batch. */
+        struct cops_conn* txq;      /* Connections to flush at the end of the batch. */
+        uint32_t nfixed;            /* io_uring: registered transmit buffers. */
+        uint32_t maxfixed;
+        uint32_t* sign_off;         /* cfg.integrity: message offsets of the span being signed. */
+
+        struct cops_metrics_slot* metrics; /* NULL unless cfg.metrics is set. */
+        struct cops_trace_ring* trace;     /* NULL unless cfg.trace is set. */
+        struct cops_admit admit;           /* Global bucket, unused unless cfg.admit is set. */
+};
+
+/*
+ * Create the listening socket and the epoll or io_uring instance. Returns 0 on success and -1
+ * on error (errno is set).
+ */
+int cops_server_init(struct cops_server* srv, const struct cops_server_config* cfg);
+
+/* Return the bound listen port (useful when the configured port was 0). */
+uint16_t cops_server_port(const struct cops_server* srv);
+
+/*
+ * Poll an additional descriptor (e.g. an eventfd used to wake the loop from other threads).
+ * fn runs from cops_server_poll whenever fd becomes readable, edge-triggered, so it must drain
+ * the descriptor. A server watches at most one descriptor. Returns -1 on error.
+ */
+int cops_server_watch(struct cops_server* srv, int fd, void (*fn)(struct cops_server* srv, void* arg), void* arg);
+
+/*
+ * Wait for and process one batch of events: accepts, reads (Client-Open, Keep-Alive and
+ * application messages), pending writes and expired timers. The wait is shortened to the next
+ * timer expiry. Returns the number of events handled or -1 on error.
+ */
+int cops_server_poll(struct cops_server* srv, int timeout_ms);
+
+/*
+ * Queue a complete message on a connection. Messages are coalesced in the transmit buffer and
+ * sent together once flush_bytes are queued, after flush_ms or at the end of the current event
+ * batch, whichever comes first. Bytes the socket does not take are sent when it becomes
+ * writable again.
+ *
+ * Returns 0 on success and -1 when the message does not fit the transmit buffer.
+ */
+int cops_server_send(struct cops_server* srv, struct cops_conn* conn, const void* msg, size_t len);
+
+/*
+ * Reserve len bytes at the end of the transmit buffer to encode up to nmsgs messages in place
+ * (e.g. with cops_batch_control), then queue them with cops_server_commit. With cfg.integrity
+ * the commit appends an Integrity object to every message, the reservation also covers
+ * nmsgs * COPS_INTEGRITY_LEN bytes for them. Returns NULL when the connection is closing or
+ * the buffer is too full.
+ */
+uint8_t* cops_server_reserve_span(struct cops_server* srv, struct cops_conn* conn, size_t len, size_t nmsgs);
+
+/*
+ * Reserve len bytes at the end of the transmit buffer to encode a single message in place (e.g.
+ * with new_cops_message or a cops_builder), see cops_server_reserve_span.
+ */
+static inline uint8_t*
+cops_server_reserve(struct cops_server* srv, struct cops_conn* conn, size_t len) {
+        return cops_server_reserve_span(srv, conn, len, 1);
+}
+
+/*
+ * Queue len bytes encoded at the pointer returned by cops_server_reserve, one or more complete
+ * messages. With cfg.integrity every message is signed where it lies, behind one another, so a
+ * span of n messages needs n * COPS_INTEGRITY_LEN bytes of room beyond it. Returns -1 on error.
+ */
+int cops_server_commit(struct cops_server* srv, struct cops_conn* conn, size_t len);
+
+/*
+ * Send everything queued on a connection now, for latency sensitive messages. Returns -1 when
+ * the connection failed and was closed.
+ */
+int cops_server_flush(struct cops_server* srv, struct cops_conn* conn);
+
+/* Bytes queued on a connection and not yet written to the socket. */
+static inline size_t
+cops_server_pending(const struct cops_conn* conn) {
+        return conn->wlen - conn->woff;
+}
+
+/*
+ * The peer reads slower than messages are queued. Producers should hold further messages back
+ * until on_drain runs for the connection.
+ */
+static inline bool
+cops_server_congested(const struct cops_conn* conn) {
+        return conn->congested;
+}
+
+/* Close a connection. The on_close callback runs before the socket is closed. */
+void cops_server_close(struct cops_server* srv, struct cops_conn* conn);
+
+/* Close every connection, the listener and free all buffers. */
+void cops_server_destroy(struct cops_server* srv);
+
+#endif
@@ -0,0 +1,225 @@
+#ifdef __linux__
+
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+
+#include "cops_shard.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+_Static_assert(offsetof(struct cops_shard, srv) == 0, "cops_shard_of requires srv to be the first member");
+
+typedef void (*cops_shard_fn)(struct cops_shard* shard, void* arg);
+
+static void
+cops_shard_run(struct cops_shard* shard) {
+        struct cops_work work;
+
+        while (cops_ring_pop(&shard->ring, &work))
+                ((cops_shard_fn)work.fn)(shard, work.arg);
+}
+
+/*
+ * eventfd readable. The wake flag is cleared before the ring is drained: a producer pushing
+ * after that point either has its item picked up below or sees the flag clear and signals again.
+ */
+static void
+cops_shard_wake(struct cops_server* srv, void* arg) {
+        struct cops_shard* shard = arg;
+        uint64_t n;
+
+        while (read(shard->efd, &n, sizeof(n)) == sizeof(n))
+                ;
+
+        atomic_store(&shard->wake, false);
+        cops_shard_run(shard);
+}
+
+static void
+cops_shard_signal(struct cops_shard* shard) {
+        uint64_t one = 1;
+
+        if (write(shard->efd, &one, sizeof(one)) < 0)
+                return; /* EAGAIN: the counter is saturated, the loop is awake anyway. */
+}
+
+static void*
+cops_shard_main(void* arg) {
+        struct cops_shard* shard = arg;
+        struct cops_runtime* rt = shard->rt;
+
+        if (rt->cfg.pin_cpus) {
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                cpu_set_t set;
+
+                CPU_ZERO(&set);
+                CPU_SET(shard->index % (ncpu > 0 ? ncpu : 1), &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        /* The shard was initialised on the starting thread, its buffers are released here. */
+        cops_pool_bind(&shard->srv.pool);
+
+        if (rt->cfg.on_start)
+                rt->cfg.on_start(shard);
+
+        while (!atomic_load_explicit(&rt->stop, memory_order_acquire))
+                if (cops_server_poll(&shard->srv, -1) < 0)
+                        break;
+
+        /* Work queued while stopping still runs, it may own resources passed through arg. */
+        cops_shard_run(shard);
+
+        return NULL;
+}
+
+static void
+cops_shard_free(struct cops_shard* shard) {
+        cops_server_destroy(&shard->srv);
+        cops_gate_table_free(&shard->gates);
+        cops_ring_free(&shard->ring);
+        if (shard->efd >= 0)
+                close(shard->efd);
+        shard->efd = -1;
+}
+
+static int
+cops_shard_init(struct cops_runtime* rt, struct cops_shard* shard, uint16_t index, uint16_t port) {
+        struct cops_server_config cfg = rt->cfg.server;
+
+        shard->rt = rt;
+        shard->index = index;
+        shard->efd = -1;
+        shard->srv.lfd = shard->srv.epfd = -1;
+        atomic_init(&shard->wake, false);
+
+        cfg.reuseport = true;
+        cfg.port = port;
+        if (cops_server_init(&shard->srv, &cfg) < 0)
+                return -1;
+
+        /* Connection ids are unique across the runtime and name their shard, the number wraps below it. */
+        shard->srv.id_base = (uint32_t)index << COPS_SHARD_ID_SHIFT;
+        shard->srv.id_mask = (1u << COPS_SHARD_ID_SHIFT) - 1;
+
+        if (cops_ring_init(&shard->ring, rt->cfg.ring_size) < 0 ||
+            cops_gate_table_init(&shard->gates, rt->cfg.gate_hint) < 0)
+                goto fail;
+
+        shard->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->efd < 0 || cops_server_watch(&shard->srv, shard->efd, cops_shard_wake, shard) < 0)
+                goto fail;
+
+        return 0;
+
+fail:
+        cops_shard_free(shard);
+        return -1;
+}
+
+/* Stop the first nthreads shard threads and release the first rt->nshards shards. */
+static void
+cops_runtime_release(struct cops_runtime* rt, uint16_t nthreads) {
+        atomic_store_explicit(&rt->stop, true, memory_order_release);
+
+        for (uint16_t i = 0; i < nthreads; i++)
+                cops_shard_signal(&rt->shards[i]);
+        for (uint16_t i = 0; i < nthreads; i++)
+                pthread_join(rt->shards[i].thread, NULL);
+
+        for (uint16_t i = 0; i < rt->nshards; i++)
+                cops_shard_free(&rt->shards[i]);
+
+        free(rt->shards);
+        rt->shards = NULL;
+        rt->nshards = 0;
+}
+
+int
+cops_runtime_start(struct cops_runtime* rt, const struct cops_runtime_config* cfg) {
+        uint16_t n = cfg->nshards;
+        int err;
+
+        memset(rt, 0, sizeof(*rt));
+        rt->cfg = *cfg;
+        atomic_init(&rt->stop, false);
+
+        if (n == 0) {
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                n = (ncpu > 0) ? (uint16_t)((ncpu < COPS_SHARD_MAX) ? ncpu : COPS_SHARD_MAX) : 1;
+        }
+        if (n > COPS_SHARD_MAX) {
+                errno = EINVAL;
+                return -1;
+        }
+        if (rt->cfg.ring_size == 0)
+                rt->cfg.ring_size = COPS_SHARD_DEFAULT_RING;
+
+        /* Shards hold cache line aligned ring indices. */
+        rt->shards = aligned_alloc(64, n * sizeof(struct cops_shard));
+        if (rt->shards == NULL)
+                return -1;
+        memset(rt->shards, 0, n * sizeof(struct cops_shard));
+
+        /* The first listener fixes the port, the others join its SO_REUSEPORT group. */
+        uint16_t port = cfg->server.port;
+        for (uint16_t i = 0; i < n; i++) {
+                if (cops_shard_init(rt, &rt->shards[i], i, port) < 0) {
+                        err = errno;
+                        goto fail;
+                }
+                rt->nshards++;
+                port = cops_server_port(&rt->shards[0].srv);
+        }
+
+        for (uint16_t i = 0; i < n; i++) {
+                if ((err = pthread_create(&rt->shards[i].thread, NULL, cops_shard_main, &rt->shards[i])) != 0) {
+                        cops_runtime_release(rt, i);
+                        errno = err;
+                        return -1;
+                }
+        }
+
+        return 0;
+
+fail:
+        cops_runtime_release(rt, 0);
+        errno = err;
+        return -1;
+}
+
+uint16_t
+cops_runtime_port(const struct cops_runtime* rt) {
+        return cops_server_port(&rt->shards[0].srv);
+}
+
+int
+cops_runtime_submit(struct cops_runtime* rt, uint16_t index, void (*fn)(struct cops_shard* shard, void* arg),
+                    void* arg) {
+        struct cops_work work = {(void (*)(void))fn, arg};
+        struct cops_shard* shard;
+
+        if (index >= rt->nshards)
+                return -1;
+
+        shard = &rt->shards[index];
+        if (!cops_ring_push(&shard->ring, &work))
+                return -1;
+
+        /* Only the first producer since the last drain pays for the wake-up. */
+        if (!atomic_exchange(&shard->wake, true))
+                cops_shard_signal(shard);
+
+        return 0;
+}
+
+void
+cops_runtime_stop(struct cops_runtime* rt) {
+        if (rt->shards)
+                cops_runtime_release(rt, rt->nshards);
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef COPS_SHARD_H
+#define COPS_SHARD_H
+
+#include <pthread.h>
+
+#include "cops_gate.h"
+#include "cops_ring.h"
+#include "cops_server.h"
+
+#define COPS_SHARD_MAX          64
+#define COPS_SHARD_DEFAULT_RING 4096
+
+/* Connection ids carry the owning shard in their top bits. */
+#define COPS_SHARD_ID_SHIFT 24
+
+struct cops_runtime;
+
+/*
+ * One shard: a thread with its own listener (SO_REUSEPORT), event loop, timer wheel and gate
+ * table. The kernel spreads PEP connections over the listeners, a session then stays on the
+ * shard that accepted it, so none of the per-session state is ever shared between threads.
+ * Other threads (e.g. the Application Manager side) reach a shard through its work ring only.
+ */
+struct cops_shard {
+        struct cops_server srv; /* First member, see cops_shard_of. */
+        struct cops_runtime* rt;
+        uint16_t index;
+        int efd; /* eventfd waking the loop when work is queued. */
+        atomic_bool wake;
+        struct cops_ring ring;
+        struct cops_gate_table gates;
+        pthread_t thread;
+        void* user;
+};
+
+/*
+ * Runtime configuration.
+ *
+ * @server      Configuration of every shard's server, reuseport is forced on. With port 0 the
+ *              first shard picks an ephemeral port and the others bind to the same one
+ * @nshards     Number of shard threads, 0 selects one per online CPU (up to COPS_SHARD_MAX)
+ * @ring_size   Capacity of each shard's work ring
+ * @gate_hint   Initial capacity of each shard's gate table
+ * @pin_cpus    Pin shard i to CPU i modulo the number of online CPUs
+ * @on_start    Called on the shard thread before its loop starts, may be NULL
+ */
+struct cops_runtime_config {
+        struct cops_server_config server;
+        uint16_t nshards;
+        size_t ring_size;
+        size_t gate_hint;
+        bool pin_cpus;
+        void (*on_start)(struct cops_shard* shard);
+};
+
+struct cops_runtime {
+        struct cops_runtime_config cfg;
+        struct cops_shard* shards;
+        uint16_t nshards;
+        atomic_bool stop;
+};
+
+/*
+ * A connection as seen from another thread. Connections are recycled, not freed, while the
+ * runtime runs, so the pointer stays dereferenceable on the owning shard. The id tells whether
+ * it still refers to the same session.
+ */
+struct cops_conn_ref {
+        struct cops_conn* conn;
+        uint32_t id;
+};
+
+/* Shard owning a server, valid inside server callbacks of a sharded runtime. */
+static inline struct cops_shard*
+cops_shard_of(struct cops_server* srv) {
+        return (struct cops_shard*)srv;
+}
+
+/* Shard index of a connection id. */
+static inline uint16_t
+cops_shard_index(uint32_t conn_id) {
+        return conn_id >> COPS_SHARD_ID_SHIFT;
+}
+
+static inline struct cops_conn_ref
+cops_conn_ref(const struct cops_conn* conn) {
+        return (struct cops_conn_ref){(struct cops_conn*)conn, conn->id};
+}
+
+/*
+ * Resolve a reference on the owning shard. Returns NULL when the session closed (or the
+ * connection was reused) since the reference was taken.
+ */
+static inline struct cops_conn*
+cops_conn_deref(struct cops_conn_ref ref) {
+        if (ref.conn->id != ref.id || ref.conn->state != COPS_CONN_ACCEPTED)
+                return NULL;
+        return ref.conn;
+}
+
+/* Create every shard and start its thread. Returns 0 on success and -1 on error (errno set). */
+int cops_runtime_start(struct cops_runtime* rt, const struct cops_runtime_config* cfg);
+
+/* Listen port shared by all shards. */
+uint16_t cops_runtime_port(const struct cops_runtime* rt);
+
+/*
+ * Run fn(shard, arg) on a shard's thread. Safe from any thread. Returns -1 when the shard's
+ * ring is full, the caller owns arg in that case.
+ */
+int cops_runtime_submit(struct cops_runtime* rt, uint16_t shard, void (*fn)(struct cops_shard* shard, void* arg),
+                        void* arg);
+
+/*
+ * Run fn on the shard owning a connection, e.g. to send a Gate-Set built by an Application
+ * Manager thread. fn should resolve ref with cops_conn_deref.
+ */
+static inline int
+cops_runtime_submit_conn(struct cops_runtime* rt, struct cops_conn_ref ref,
+                         void (*fn)(struct cops_shard* shard, void* arg), void* arg) {
+        return cops_runtime_submit(rt, cops_shard_index(ref.id), fn, arg);
+}
+
+/* Stop and join every shard, then release all servers, rings and gate tables. */
+void cops_runtime_stop(struct cops_runtime* rt);
+
+#endif
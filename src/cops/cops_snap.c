@@ -0,0 +1,440 @@
+#include "cops_snap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COPS_SNAP_PAGE        4096
+#define COPS_SNAP_MAX_JOURNAL (1u << 26)
+
+/*
+ * 64-bit checksum of whole 32-byte blocks: four independent multiply-rotate lanes over the
+ * four words of a block, as in the core loop of xxHash64. A record is exactly one block, so
+ * the records of a checkpoint are summed in the same pass that loads them.
+ */
+#define COPS_SNAP_P1 0x9E3779B185EBCA87ull
+#define COPS_SNAP_P2 0xC2B2AE3D27D4EB4Full
+#define COPS_SNAP_P3 0x165667B19E3779F9ull
+
+struct cops_snap_sum {
+        uint64_t v[4];
+};
+
+static inline uint64_t
+cops_snap_rol(uint64_t x, int n) {
+        return (x << n) | (x >> (64 - n));
+}
+
+static inline void
+cops_snap_sum_init(struct cops_snap_sum* c) {
+        c->v[0] = COPS_SNAP_P1 + COPS_SNAP_P2;
+        c->v[1] = COPS_SNAP_P2;
+        c->v[2] = 0;
+        c->v[3] = -COPS_SNAP_P1;
+}
+
+static inline void
+cops_snap_sum_block(struct cops_snap_sum* c, const void* block) {
+        for (int k = 0; k < 4; k++) {
+                uint64_t w;
+
+                memcpy(&w, (const uint8_t*)block + 8 * k, 8);
+                c->v[k] = cops_snap_rol(c->v[k] + w * COPS_SNAP_P2, 31) * COPS_SNAP_P1;
+        }
+}
+
+static inline uint64_t
+cops_snap_sum_final(const struct cops_snap_sum* c, uint64_t len) {
+        uint64_t h = cops_snap_rol(c->v[0], 1) + cops_snap_rol(c->v[1], 7) + cops_snap_rol(c->v[2], 12) +
+                     cops_snap_rol(c->v[3], 18) + len;
+
+        h ^= h >> 33;
+        h *= COPS_SNAP_P2;
+        h ^= h >> 29;
+        h *= COPS_SNAP_P3;
+        h ^= h >> 32;
+        return h;
+}
+
+static uint64_t
+cops_snap_sum(const void* data, size_t len) {
+        struct cops_snap_sum c;
+
+        cops_snap_sum_init(&c);
+        for (size_t i = 0; i < len; i += 32)
+                cops_snap_sum_block(&c, (const uint8_t*)data + i);
+        return cops_snap_sum_final(&c, len);
+}
+
+static uint64_t
+cops_snap_hdr_sum(const struct cops_snap_hdr* h) {
+        struct cops_snap_hdr c = *h;
+
+        c.sum = 0;
+        return cops_snap_sum(&c, sizeof(c));
+}
+
+static uint64_t
+cops_snap_entry_sum(const struct cops_snap_entry* e) {
+        struct cops_snap_entry c = *e;
+
+        c.sum = 0;
+        return cops_snap_sum(&c, sizeof(c));
+}
+
+static inline size_t
+cops_snap_page(size_t off) {
+        return (off + COPS_SNAP_PAGE - 1) & ~(size_t)(COPS_SNAP_PAGE - 1);
+}
+
+/* First byte past the journal, where checkpoint records may go. */
+static inline size_t
+cops_snap_data_start(const struct cops_snap_hdr* h) {
+        return COPS_SNAP_HDR_SPACE + (size_t)h->journal * sizeof(struct cops_snap_entry);
+}
+
+static int
+cops_snap_map(struct cops_snap* s, size_t size) {
+        if (s->map)
+                munmap(s->map, s->size);
+
+        s->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+        if (s->map == MAP_FAILED) {
+                s->map = NULL;
+                return -1;
+        }
+        s->size = size;
+        s->journal = (struct cops_snap_entry*)(s->map + COPS_SNAP_HDR_SPACE);
+
+        return 0;
+}
+
+/* Write a header to the copy its generation selects and flush it. */
+static int
+cops_snap_write_hdr(struct cops_snap* s, struct cops_snap_hdr* h) {
+        h->sum = cops_snap_hdr_sum(h);
+        memcpy(s->map + (h->gen & 1) * COPS_SNAP_HDR_STRIDE, h, sizeof(*h));
+
+        return msync(s->map, COPS_SNAP_HDR_SPACE, MS_SYNC);
+}
+
+static bool
+cops_snap_hdr_ok(const struct cops_snap_hdr* h, size_t size) {
+        if (h->magic != COPS_SNAP_MAGIC || h->version != COPS_SNAP_VERSION || h->sum != cops_snap_hdr_sum(h))
+                return false;
+        if (h->journal == 0 || h->journal > COPS_SNAP_MAX_JOURNAL || (h->journal & 63) != 0)
+                return false;
+
+        return h->region_off >= cops_snap_data_start(h) && h->region_off <= size &&
+               h->count <= (size - h->region_off) / sizeof(struct cops_snap_rec);
+}
+
+static inline void
+cops_snap_to_rec(struct cops_snap_rec* rec, const struct cops_gate* g) {
+        rec->handle = g->handle;
+        rec->gate_id = g->gate_id;
+        rec->am_tag = g->am_tag;
+        rec->app_type = g->app_type;
+        rec->family = g->family;
+        rec->decision = g->decision;
+        rec->flags = g->flags;
+        rec->reserved = 0;
+        memcpy(rec->subscriber, g->subscriber, sizeof(rec->subscriber));
+}
+
+/* Install a record in the table. Returns false on ENOMEM. */
+static inline bool
+cops_snap_apply(struct cops_gate_table* t, const struct cops_snap_rec* rec) {
+        struct cops_gate* g = cops_gate_insert(t, rec->handle);
+
+        if (g == NULL)
+                return false;
+
+        g->gate_id = rec->gate_id;
+        g->am_tag = rec->am_tag;
+        g->app_type = rec->app_type;
+        g->family = rec->family & 0x7F;
+        g->decision = rec->decision;
+        g->flags = rec->flags;
+        memcpy(g->subscriber, rec->subscriber, sizeof(g->subscriber));
+
+        return true;
+}
+
+/*
+ * Load the records of a checkpoint into a new table, summing them on the way. Checkpoints are
+ * written in slot order, so consecutive records land in neighbouring slots of the new table.
+ */
+static int
+cops_snap_load(const struct cops_snap* s, const struct cops_snap_hdr* h, struct cops_gate_table* t) {
+        const struct cops_snap_rec* rec = (const struct cops_snap_rec*)(s->map + h->region_off);
+        struct cops_snap_sum c;
+
+        if (cops_gate_table_init(t, h->count) < 0)
+                return -1;
+
+        cops_snap_sum_init(&c);
+        for (uint64_t i = 0; i < h->count; i++) {
+                cops_snap_sum_block(&c, &rec[i]);
+                if (!cops_snap_apply(t, &rec[i])) {
+                        cops_gate_table_free(t);
+                        errno = ENOMEM;
+                        return -1;
+                }
+        }
+
+        if (cops_snap_sum_final(&c, h->count * sizeof(*rec)) != h->region_sum) {
+                cops_gate_table_free(t);
+                errno = EINVAL;
+                return -1;
+        }
+
+        return 0;
+}
+
+int
+cops_snap_create(struct cops_snap* s, const char* path, uint32_t journal) {
+        struct cops_snap_hdr hdr = {0};
+
+        memset(s, 0, sizeof(*s));
+        s->fd = -1;
+        if (journal == 0)
+                journal = COPS_SNAP_DEFAULT_JOURNAL;
+        if (journal > COPS_SNAP_MAX_JOURNAL) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        hdr.magic = COPS_SNAP_MAGIC;
+        hdr.version = COPS_SNAP_VERSION;
+        hdr.journal = (journal + 63) & ~63u;
+        hdr.region_off = cops_snap_data_start(&hdr);
+        hdr.region_sum = cops_snap_sum(NULL, 0);
+
+        s->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (s->fd < 0)
+                return -1;
+
+        /* A zeroed journal: sequence number 0 never follows a checkpoint. */
+        if (ftruncate(s->fd, (off_t)hdr.region_off) < 0 || cops_snap_map(s, hdr.region_off) < 0 ||
+            cops_snap_write_hdr(s, &hdr) < 0) {
+                int err = errno;
+
+                cops_snap_close(s);
+                errno = err;
+                return -1;
+        }
+        s->hdr = hdr;
+
+        return 0;
+}
+
+int
+cops_snap_open(struct cops_snap* s, const char* path, struct cops_gate_table* t) {
+        struct cops_snap_hdr cand[2];
+        struct stat st;
+        int err = EINVAL;
+        int n = 0;
+
+        memset(s, 0, sizeof(*s));
+        s->fd = open(path, O_RDWR | O_CLOEXEC);
+        if (s->fd < 0)
+                return -1;
+
+        if (fstat(s->fd, &st) < 0) {
+                err = errno;
+                goto fail;
+        }
+        if ((size_t)st.st_size < COPS_SNAP_HDR_SPACE)
+                goto fail;
+        if (cops_snap_map(s, (size_t)st.st_size) < 0) {
+                err = errno;
+                goto fail;
+        }
+
+        /* Valid header copies, newest first. */
+        for (int k = 0; k < 2; k++) {
+                memcpy(&cand[n], s->map + k * COPS_SNAP_HDR_STRIDE, sizeof(cand[n]));
+                if (cops_snap_hdr_ok(&cand[n], s->size))
+                        n++;
+        }
+        if (n == 2 && cand[1].gen > cand[0].gen) {
+                struct cops_snap_hdr tmp = cand[0];
+                cand[0] = cand[1];
+                cand[1] = tmp;
+        }
+
+        /* A checkpoint whose records do not match their checksum is skipped for the previous one. */
+        int k;
+        for (k = 0; k < n; k++) {
+                if (cops_snap_load(s, &cand[k], t) == 0)
+                        break;
+                if (errno != EINVAL) {
+                        err = errno;
+                        goto fail;
+                }
+        }
+        if (k == n)
+                goto fail;
+        s->hdr = cand[k];
+        s->stats.fallback = k > 0;
+        s->stats.records = s->hdr.count;
+
+        /* Replay up to the first entry that is stale (an older sequence number) or torn. */
+        uint32_t i;
+        for (i = 0; i < s->hdr.journal; i++) {
+                const struct cops_snap_entry* e = &s->journal[i];
+
+                if (e->seq != s->hdr.seq + i + 1 || e->sum != cops_snap_entry_sum(e))
+                        break;
+                if (e->op == COPS_SNAP_PUT && !cops_snap_apply(t, &e->rec)) {
+                        err = ENOMEM;
+                        goto fail_table;
+                }
+                if (e->op == COPS_SNAP_DEL)
+                        cops_gate_remove(t, e->rec.handle);
+        }
+        s->stats.replayed = i;
+        s->next = s->synced = i;
+
+        /*
+         * Entries past that point that are newer than the checkpoint follow a torn entry, or
+         * belong to a checkpoint that was lost. They must never be replayed once new entries
+         * are written around them.
+         */
+        for (uint32_t j = i; j < s->hdr.journal; j++)
+                s->stats.discarded += s->journal[j].seq > s->hdr.seq;
+        if (s->stats.discarded) {
+                size_t from = COPS_SNAP_HDR_SPACE + (size_t)i * sizeof(struct cops_snap_entry);
+                size_t page = from & ~(size_t)(COPS_SNAP_PAGE - 1);
+
+                memset(s->map + from, 0, cops_snap_data_start(&s->hdr) - from);
+                if (msync(s->map + page, cops_snap_data_start(&s->hdr) - page, MS_SYNC) < 0) {
+                        err = errno;
+                        goto fail_table;
+                }
+        }
+
+        return 0;
+
+fail_table:
+        cops_gate_table_free(t);
+fail:
+        cops_snap_close(s);
+        errno = err;
+        return -1;
+}
+
+void
+cops_snap_close(struct cops_snap* s) {
+        if (s->map)
+                munmap(s->map, s->size);
+        if (s->fd >= 0)
+                close(s->fd);
+        memset(s, 0, sizeof(*s));
+        s->fd = -1;
+}
+
+static int
+cops_snap_append(struct cops_snap* s, const struct cops_gate_table* t, uint32_t op, const struct cops_snap_rec* rec) {
+        struct cops_snap_entry e = {0};
+
+        /* A full journal is folded into a checkpoint, which already holds this change. */
+        if (s->next == s->hdr.journal)
+                return cops_snap_checkpoint(s, t);
+
+        e.seq = s->hdr.seq + s->next + 1;
+        e.op = op;
+        e.rec = *rec;
+        e.sum = cops_snap_entry_sum(&e);
+        memcpy(&s->journal[s->next++], &e, sizeof(e));
+
+        return 0;
+}
+
+int
+cops_snap_put(struct cops_snap* s, const struct cops_gate_table* t, const struct cops_gate* gate) {
+        struct cops_snap_rec rec;
+
+        cops_snap_to_rec(&rec, gate);
+        return cops_snap_append(s, t, COPS_SNAP_PUT, &rec);
+}
+
+int
+cops_snap_del(struct cops_snap* s, const struct cops_gate_table* t, uint32_t handle) {
+        struct cops_snap_rec rec = {0};
+
+        rec.handle = handle;
+        return cops_snap_append(s, t, COPS_SNAP_DEL, &rec);
+}
+
+int
+cops_snap_checkpoint(struct cops_snap* s, const struct cops_gate_table* t) {
+        struct cops_snap_hdr hdr = s->hdr;
+        size_t len = cops_gate_count(t) * sizeof(struct cops_snap_rec);
+        size_t start = cops_snap_data_start(&hdr);
+        size_t off;
+
+        /* Never over the current checkpoint: before it when there is room, else right after it. */
+        if (start + len <= hdr.region_off)
+                off = start;
+        else
+                off = cops_snap_page(hdr.region_off + hdr.count * sizeof(struct cops_snap_rec));
+
+        if (off + len > s->size) {
+                size_t size = cops_snap_page(off + len);
+
+                if (ftruncate(s->fd, (off_t)size) < 0 || cops_snap_map(s, size) < 0)
+                        return -1;
+        }
+
+        struct cops_snap_rec* rec = (struct cops_snap_rec*)(s->map + off);
+        const struct cops_gate* g;
+        struct cops_snap_sum c;
+        size_t iter = 0;
+        size_t n = 0;
+
+        cops_snap_sum_init(&c);
+        while ((g = cops_gate_next(t, &iter)) != NULL) {
+                cops_snap_to_rec(&rec[n], g);
+                cops_snap_sum_block(&c, &rec[n]);
+                n++;
+        }
+
+        /* The records reach the disk before the header that points to them. */
+        if (len && msync(s->map + off, len, MS_SYNC) < 0)
+                return -1;
+
+        hdr.gen++;
+        hdr.region_off = off;
+        hdr.count = n;
+        hdr.region_sum = cops_snap_sum_final(&c, len);
+        hdr.seq += s->next;
+        if (cops_snap_write_hdr(s, &hdr) < 0)
+                return -1;
+
+        s->hdr = hdr;
+        s->next = s->synced = 0;
+
+        return 0;
+}
+
+int
+cops_snap_sync(struct cops_snap* s) {
+        if (s->next <= s->synced)
+                return 0;
+
+        size_t from = COPS_SNAP_HDR_SPACE + (size_t)s->synced * sizeof(struct cops_snap_entry);
+        size_t to = COPS_SNAP_HDR_SPACE + (size_t)s->next * sizeof(struct cops_snap_entry);
+
+        from &= ~(size_t)(COPS_SNAP_PAGE - 1);
+        if (msync(s->map + from, to - from, MS_SYNC) < 0)
+                return -1;
+        s->synced = s->next;
+
+        return 0;
+}
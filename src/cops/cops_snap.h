@@ -0,0 +1,146 @@
+#ifndef COPS_SNAP_H
+#define COPS_SNAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cops_gate.h"
+
+#define COPS_SNAP_MAGIC   0x4E534743 /* "CGSN" */
+#define COPS_SNAP_VERSION 1
+
+/* The two header copies sit in different sectors of the first page, the journal starts after it. */
+#define COPS_SNAP_HDR_SPACE  4096
+#define COPS_SNAP_HDR_STRIDE 2048
+
+#define COPS_SNAP_DEFAULT_JOURNAL 65536
+
+/* Journal operations. */
+enum cops_snap_op {
+        COPS_SNAP_PUT = 1, /* Gate installed or changed, the record is its new state. */
+        COPS_SNAP_DEL,     /* Gate removed, only the handle of the record is set. */
+};
+
+/* One gate, the fixed-size record of checkpoints and journal entries. Host byte order. */
+struct cops_snap_rec {
+        uint32_t handle;
+        uint32_t gate_id;
+        uint16_t am_tag;
+        uint16_t app_type;
+        uint8_t family;
+        uint8_t decision;
+        uint8_t flags;
+        uint8_t reserved;
+        uint8_t subscriber[16];
+};
+
+/* Journal entry, one per change since the checkpoint. */
+struct cops_snap_entry {
+        uint64_t seq; /* Change number, the checkpoint's seq + index + 1. */
+        uint64_t sum; /* Checksum of the entry with this field zero. */
+        uint32_t op;  /* enum cops_snap_op */
+        uint32_t reserved[3];
+        struct cops_snap_rec rec;
+};
+
+/*
+ * File header. Each checkpoint writes the copy the previous one did not, the valid copy with
+ * the highest generation is current.
+ */
+struct cops_snap_hdr {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t reserved0;
+        uint64_t gen;        /* Checkpoint generation, 0 for a new file. */
+        uint64_t region_off; /* File offset of the checkpoint's records. */
+        uint64_t count;      /* Number of records. */
+        uint64_t region_sum; /* Checksum of the records. */
+        uint64_t seq;        /* Changes up to and including the checkpoint, the journal continues at seq + 1. */
+        uint32_t journal;    /* Journal capacity in entries. */
+        uint32_t reserved1;
+        uint64_t sum; /* Checksum of the header with this field zero. */
+};
+
+_Static_assert(sizeof(struct cops_snap_rec) == 32, "record layout is part of the file format");
+_Static_assert(sizeof(struct cops_snap_entry) == 64, "journal entries are one cache line");
+_Static_assert(sizeof(struct cops_snap_hdr) == 64, "header layout is part of the file format");
+
+/* What cops_snap_open found in the file. */
+struct cops_snap_stats {
+        uint64_t records;   /* Gates loaded from the checkpoint. */
+        uint64_t replayed;  /* Journal entries applied on top of it. */
+        uint64_t discarded; /* Entries dropped after a torn one, or after a checkpoint that was lost. */
+        bool fallback;      /* The newest checkpoint was damaged, the previous one was used. */
+};
+
+/*
+ * Persistent gate state: a memory mapped file holding the last checkpoint of a gate table and
+ * an append-only journal of every change made since.
+ *
+ * A change costs one 64-byte journal entry written through the mapping, so it is in the page
+ * cache, and survives a crash of the process, as soon as cops_snap_put or cops_snap_del
+ * returns. cops_snap_sync makes the entries written so far durable against a power loss as
+ * well, a caller that syncs once per event loop iteration commits them in groups. When the
+ * journal fills, the table is checkpointed: its records are written to a free area of the file
+ * and flushed, and only then the other header copy is switched to them. A crash at any point
+ * leaves either the old or the new checkpoint current, each with its journal, and checksums on
+ * the header, the records and every entry let cops_snap_open tell a torn write from data.
+ */
+struct cops_snap {
+        int fd;
+        uint8_t* map;
+        size_t size;
+        struct cops_snap_hdr hdr; /* Current header. */
+        struct cops_snap_entry* journal;
+        uint32_t next;   /* Next journal entry. */
+        uint32_t synced; /* Entries before this one were flushed by cops_snap_sync. */
+        struct cops_snap_stats stats;
+};
+
+/*
+ * Create (or truncate) a snapshot file holding an empty table.
+ *
+ * @s           Snapshot
+ * @path        File to map
+ * @journal     Journal capacity in entries, rounded up to a multiple of 64. 0 selects
+ *              COPS_SNAP_DEFAULT_JOURNAL
+ *
+ * Returns -1 on error (errno set).
+ */
+int cops_snap_create(struct cops_snap* s, const char* path, uint32_t journal);
+
+/*
+ * Map an existing snapshot file and rebuild the gate table it holds: the checkpoint, then every
+ * journal entry up to the first one that is missing or fails its checksum. Entries after a
+ * torn one are discarded from the file, so they can never be replayed later. s->stats tells
+ * what was found.
+ *
+ * @s           Snapshot
+ * @path        File to map
+ * @t           Table to initialise with the gates
+ *
+ * Returns -1 on error (errno set), EINVAL when neither header copy is valid.
+ */
+int cops_snap_open(struct cops_snap* s, const char* path, struct cops_gate_table* t);
+
+void cops_snap_close(struct cops_snap* s);
+
+/*
+ * Journal the new state of a gate. The change MUST already be made in t, which is
+ * checkpointed in place of the entry when the journal is full.
+ *
+ * Returns -1 when a checkpoint failed (errno set).
+ */
+int cops_snap_put(struct cops_snap* s, const struct cops_gate_table* t, const struct cops_gate* gate);
+
+/* Journal the removal of a gate, with the same contract as cops_snap_put. */
+int cops_snap_del(struct cops_snap* s, const struct cops_gate_table* t, uint32_t handle);
+
+/* Write every gate of t as the new checkpoint and start an empty journal. Returns -1 on error. */
+int cops_snap_checkpoint(struct cops_snap* s, const struct cops_gate_table* t);
+
+/* Flush the journal entries written since the last call to the disk. Returns -1 on error. */
+int cops_snap_sync(struct cops_snap* s);
+
+#endif
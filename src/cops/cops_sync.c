@@ -0,0 +1,111 @@
+#include "cops_sync.h"
+
+/* Header followed by an optional Handle object. */
+static size_t
+cops_sync_message(uint8_t* dst, uint8_t opcode, const char* handle) {
+        if (handle == NULL) {
+                cops_put_header(dst, opcode, COPS_HEADER_LEN);
+                return COPS_HEADER_LEN;
+        }
+
+        cops_put_header(dst, opcode, COPS_HEADER_LEN + 8);
+        cops_handle(dst + COPS_HEADER_LEN, handle);
+        return COPS_HEADER_LEN + 8;
+}
+
+static bool
+cops_sync_sweep_one(struct cops_gate* gate, void* arg) {
+        struct cops_sync* sync = arg;
+
+        return sync->on_missing(sync, gate);
+}
+
+/* Sweep of a request limited to one handle: only its gate can be missing. */
+static size_t
+cops_sync_sweep_handle(struct cops_sync* sync) {
+        struct cops_gate* gate = cops_gate_find(sync->gates, sync->handle);
+
+        if (sync->seen || gate == NULL || (sync->on_missing && !sync->on_missing(sync, gate)))
+                return 0;
+
+        return cops_gate_remove(sync->gates, sync->handle);
+}
+
+void
+cops_sync_init(struct cops_sync* sync, struct cops_gate_table* gates, cops_sync_missing_fn on_missing,
+               cops_sync_unknown_fn on_unknown, void* arg) {
+        memset(sync, 0, sizeof(*sync));
+        sync->gates = gates;
+        sync->on_missing = on_missing;
+        sync->on_unknown = on_unknown;
+        sync->arg = arg;
+}
+
+size_t
+cops_sync_begin(struct cops_sync* sync, uint8_t* dst, const char* handle) {
+        if (sync->active || (handle == NULL && cops_gate_mark_begin(sync->gates) < 0))
+                return 0;
+
+        sync->active = true;
+        sync->limited = handle != NULL;
+        sync->seen = false;
+        sync->handle = (handle) ? cops_handle_key(handle) : 0;
+        sync->reported = sync->unknown = sync->removed = 0;
+
+        return cops_sync_message(dst, COPS_OP_SSQ, handle);
+}
+
+bool
+cops_sync_input(struct cops_sync* sync, const struct cops_msg* msg) {
+        if (!sync->active)
+                return false;
+
+        if (msg->opcode == COPS_OP_SSC) {
+                cops_gate_sweep_fn fn = (sync->on_missing) ? cops_sync_sweep_one : NULL;
+
+                sync->removed = (sync->limited) ? cops_sync_sweep_handle(sync) : cops_gate_sweep(sync->gates, fn, sync);
+                sync->active = false;
+                return true;
+        }
+        if (msg->opcode != 1 && msg->opcode != 3)
+                return false;
+
+        const struct cops_obj* obj = cops_msg_find(msg, 1, 1);
+        if (obj == NULL || obj->length != COPS_OBJ_HEADER_LEN + 4)
+                return false;
+
+        uint32_t handle = cops_handle_key((const char*)cops_obj_data(msg, obj));
+        if (sync->limited && handle != sync->handle)
+                return false;
+
+        struct cops_gate* gate = cops_gate_find(sync->gates, handle);
+
+        if (gate) {
+                if (sync->limited)
+                        sync->seen = true;
+                else
+                        cops_gate_mark(sync->gates, gate);
+                sync->reported++;
+        } else {
+                sync->unknown++;
+                if (sync->on_unknown)
+                        sync->on_unknown(sync, msg, handle);
+        }
+
+        return false;
+}
+
+void
+cops_sync_abort(struct cops_sync* sync) {
+        if (!sync->active)
+                return;
+
+        if (!sync->limited)
+                cops_gate_mark_abort(sync->gates);
+        sync->active = false;
+}
+
+size_t
+cops_sync_complete(uint8_t* dst, const char* handle) {
+        return cops_sync_message(dst, COPS_OP_SSC, handle);
+}
@@ -0,0 +1,80 @@
+#ifndef COPS_SYNC_H
+#define COPS_SYNC_H
+
+#include "cops.h"
+#include "cops_decoder.h"
+#include "cops_gate.h"
+
+/* COPS Op Codes of the synchronize exchange (RFC 2748 sections 3.6 and 3.10). */
+#define COPS_OP_SSQ 5
+#define COPS_OP_SSC 10
+
+struct cops_sync;
+
+/*
+ * A gate the CMTS did not report. Return true to drop it from the table, false to keep it, e.g.
+ * after queueing a Gate-Set that reinstalls it. Gates of other sessions sharing the table are
+ * passed as well and are normally kept. The table must not be modified from the callback.
+ */
+typedef bool (*cops_sync_missing_fn)(struct cops_sync* sync, struct cops_gate* gate);
+
+/* A state reported by the CMTS whose handle is not in the table (msg is the REQ or RPT). */
+typedef void (*cops_sync_unknown_fn)(struct cops_sync* sync, const struct cops_msg* msg, uint32_t handle);
+
+/*
+ * Reconciliation of a gate table with the state a CMTS reports after a Synchronize State Req.
+ *
+ * The exchange is a mark and sweep over the table: cops_sync_begin unmarks every gate in O(1),
+ * each REQ or RPT streamed back by the CMTS marks its gate with one lookup as it is decoded, and
+ * the closing Synchronize Complete sweeps the gates left unmarked. Nothing of the reported state
+ * is buffered. Only one synchronization per table can run at a time.
+ *
+ * A request limited to one handle leaves the rest of the table alone, which may hold the gates
+ * of other handles and other sessions: only that handle is looked for in the reports, and only
+ * its gate is passed to on_missing when it was not reported.
+ */
+struct cops_sync {
+        struct cops_gate_table* gates;
+        cops_sync_missing_fn on_missing;
+        cops_sync_unknown_fn on_unknown;
+        void* arg;
+        bool active;
+        bool limited;    /* The request named a handle, see handle. */
+        bool seen;       /* limited: the handle was reported. */
+        uint32_t handle; /* limited: key of the requested handle. */
+        size_t reported; /* Reported states found in the table. */
+        size_t unknown;  /* Reported states missing from the table. */
+        size_t removed;  /* Unreported gates dropped by the sweep. */
+};
+
+/*
+ * @sync        Synchronization state
+ * @gates       Gate table to reconcile
+ * @on_missing  Called by the sweep for every unreported gate, NULL drops them all
+ * @on_unknown  Called for reported handles the table does not hold, may be NULL
+ * @arg         Passed through in sync->arg
+ */
+void cops_sync_init(struct cops_sync* sync, struct cops_gate_table* gates, cops_sync_missing_fn on_missing,
+                    cops_sync_unknown_fn on_unknown, void* arg);
+
+/*
+ * Start a synchronization and encode the Synchronize State Req to send to the CMTS. A handle
+ * limits the request, and the sweep, to that state. NULL asks for all of it. Returns the message
+ * length (8 or 16 bytes), or 0 when a synchronization is already running.
+ */
+size_t cops_sync_begin(struct cops_sync* sync, uint8_t* dst, const char* handle);
+
+/*
+ * Feed a message received during the synchronization. REQ and RPT mark their gate, SSC sweeps
+ * the table (or checks the one requested handle) and ends the synchronization. Returns true when
+ * msg was the closing SSC.
+ */
+bool cops_sync_input(struct cops_sync* sync, const struct cops_msg* msg);
+
+/* Give up on a synchronization (e.g. the connection closed), every gate is kept. */
+void cops_sync_abort(struct cops_sync* sync);
+
+/* Encode a Synchronize Complete as sent by the PEP, handle may be NULL. Returns its length. */
+size_t cops_sync_complete(uint8_t* dst, const char* handle);
+
+#endif
@@ -0,0 +1,110 @@
+#include "cops_template.h"
+
+int
+cops_dec_template_init(struct cops_dec_template* t, const struct cops_dec_layout* layout) {
+        uint8_t body[COPS_TEMPLATE_MAX];
+        size_t addr_len;
+        size_t i = 0;
+
+        if (layout->family == AF_INET)
+                addr_len = 4;
+        else if (layout->family == AF_INET6)
+                addr_len = 16;
+        else
+                return -1;
+
+        if (layout->gate_spec == NULL || (layout->profile_len & 3) != 0 ||
+            (layout->profile_len != 0 && layout->profile == NULL) ||
+            layout->nprofile_words > COPS_TEMPLATE_MAX_PROFILE_WORDS)
+                return -1;
+
+        for (size_t w = 0; w < layout->nprofile_words; w++) {
+                if ((size_t)layout->profile_words[w] * 4 >= layout->profile_len)
+                        return -1;
+        }
+
+        size_t pcmm_len = 8 + 8 + (4 + addr_len) + (layout->gate_id ? 8 : 0) + (4 + PCMM_GATE_SPEC_LEN) +
+                          (4 + layout->profile_len);
+        size_t total = COPS_HEADER_LEN + 3 * COPS_COMMON_OBJ_LEN + 4 + pcmm_len;
+
+        if (total > COPS_TEMPLATE_MAX)
+                return -1;
+
+        memset(t, 0, sizeof(*t));
+
+        /* COPS objects, the handle is a placeholder patched on render. */
+        cops_handle(body + i, "\0\0\0\0");
+        t->handle_off = COPS_HEADER_LEN + i + 4;
+        i += COPS_COMMON_OBJ_LEN;
+        cops_context(body + i);
+        i += COPS_COMMON_OBJ_LEN;
+        cops_decision(body + i);
+        i += COPS_COMMON_OBJ_LEN;
+
+        /* Client Specific Decision Data header. */
+        cops_put_objhdr(body + i, 4 + pcmm_len, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI);
+        i += 4;
+
+        /* Transaction ID: Transaction Identifier (patched) and Gate Command Type. */
+        cops_put_objhdr(body + i, 8, PCMM_SNUM_TRANSACTION_ID, 1);
+        t->trans_id_off = COPS_HEADER_LEN + i + 4;
+        cops_store16(body + i + 4, 0);
+        cops_store16(body + i + 6, layout->command);
+        i += 8;
+
+        /* AMID: Application Manager Tag and Application Type. */
+        cops_put_objhdr(body + i, 8, PCMM_SNUM_AMID, 1);
+        cops_store16(body + i + 4, layout->am_tag);
+        cops_store16(body + i + 6, layout->app_type);
+        i += 8;
+
+        /* Subscriber ID, address patched on render. */
+        cops_put_objhdr(body + i, 4 + addr_len, PCMM_SNUM_SUBSCRIBER_ID,
+                        addr_len == 4 ? PCMM_STYPE_SUBSCRIBER_IPV4 : PCMM_STYPE_SUBSCRIBER_IPV6);
+        t->subscriber_off = COPS_HEADER_LEN + i + 4;
+        t->subscriber_len = addr_len;
+        memset(body + i + 4, 0, addr_len);
+        i += 4 + addr_len;
+
+        if (layout->gate_id) {
+                cops_put_objhdr(body + i, 8, PCMM_SNUM_GATE_ID, 1);
+                t->gate_id_off = COPS_HEADER_LEN + i + 4;
+                cops_store32(body + i + 4, 0);
+                i += 8;
+        }
+
+        cops_put_objhdr(body + i, 4 + PCMM_GATE_SPEC_LEN, PCMM_SNUM_GATE_SPEC, 1);
+        memcpy(body + i + 4, layout->gate_spec, PCMM_GATE_SPEC_LEN);
+        i += 4 + PCMM_GATE_SPEC_LEN;
+
+        cops_put_objhdr(body + i, 4 + layout->profile_len, PCMM_SNUM_TRAFFIC_PROFILE, layout->profile_stype);
+        if (layout->profile_len)
+                memcpy(body + i + 4, layout->profile, layout->profile_len);
+        for (size_t w = 0; w < layout->nprofile_words; w++)
+                t->profile_off[w] = COPS_HEADER_LEN + i + 4 + layout->profile_words[w] * 4;
+        t->nprofile_words = layout->nprofile_words;
+        i += 4 + layout->profile_len;
+
+        /* Write the common header once, including the final message length. */
+        new_cops_message(t->skel, 2, body, (int)(COPS_HEADER_LEN + i));
+        t->length = COPS_HEADER_LEN + i;
+
+        return 0;
+}
+
+size_t
+cops_dec_template_render(const struct cops_dec_template* t, uint8_t* dst, const struct cops_dec_fields* fields) {
+        memcpy(dst, t->skel, t->length);
+
+        memcpy(dst + t->handle_off, fields->handle, 4);
+        cops_store16(dst + t->trans_id_off, fields->trans_id);
+        memcpy(dst + t->subscriber_off, fields->subscriber, t->subscriber_len);
+
+        if (t->gate_id_off)
+                cops_store32(dst + t->gate_id_off, fields->gate_id);
+
+        for (uint16_t w = 0; w < t->nprofile_words; w++)
+                cops_store32(dst + t->profile_off[w], fields->profile[w]);
+
+        return t->length;
+}
@@ -0,0 +1,90 @@
+#ifndef COPS_TEMPLATE_H
+#define COPS_TEMPLATE_H
+
+#include "cops.h"
+#include "pcmm.h"
+
+/* Largest Decision skeleton a template can hold. */
+#define COPS_TEMPLATE_MAX 256
+
+/* Maximum number of per-message Traffic Profile words. */
+#define COPS_TEMPLATE_MAX_PROFILE_WORDS 8
+
+/*
+ * The constant shape of a Gate Decision. Every message rendered from the resulting template
+ * carries the same objects in the same order, the per-message values are supplied at render
+ * time through struct cops_dec_fields.
+ *
+ * @command         Gate Command Type placed in the Transaction ID (e.g. PCMM_GATE_SET)
+ * @am_tag          Application Manager Tag (AMID)
+ * @app_type        Application Type (AMID)
+ * @family          Subscriber address family, AF_INET or AF_INET6
+ * @gate_id         Reserve a Gate ID object (modification of an installed gate)
+ * @gate_spec       PCMM_GATE_SPEC_LEN bytes of Gate Spec body, network byte order
+ * @profile         Traffic Profile body (everything after the object header), network byte order
+ * @profile_len     Traffic Profile body length, MUST be a multiple of four
+ * @profile_stype   Traffic Profile S-Type (e.g. PCMM_STYPE_SERVICE_CLASS_NAME)
+ * @profile_words   Indices of the 32-bit Traffic Profile words replaced on every render
+ * @nprofile_words  Number of entries in profile_words
+ */
+struct cops_dec_layout {
+        uint16_t command;
+        uint16_t am_tag;
+        uint16_t app_type;
+        int family;
+        bool gate_id;
+        const uint8_t* gate_spec;
+        const uint8_t* profile;
+        size_t profile_len;
+        uint8_t profile_stype;
+        const uint8_t* profile_words;
+        size_t nprofile_words;
+};
+
+/* Per-message values patched into a rendered Decision. */
+struct cops_dec_fields {
+        const char* handle;        /* 4-byte PEP client handle. */
+        uint16_t trans_id;         /* Transaction ID. */
+        uint32_t gate_id;          /* Gate ID, ignored unless the layout reserved one. */
+        const uint8_t* subscriber; /* 4 or 16 byte address, network byte order. */
+        const uint32_t* profile;   /* One host order word per layout profile word. */
+};
+
+/*
+ * A pre-built Decision message skeleton with the offsets of every per-message field. The
+ * skeleton already contains a complete COPS header (written by new_cops_message) so rendering
+ * is a copy of the skeleton followed by a fixed number of stores.
+ */
+struct cops_dec_template {
+        uint8_t skel[COPS_TEMPLATE_MAX];
+        uint16_t length;
+        uint16_t handle_off;
+        uint16_t trans_id_off;
+        uint16_t gate_id_off; /* 0 when the layout has no Gate ID object. */
+        uint16_t subscriber_off;
+        uint16_t subscriber_len;
+        uint16_t nprofile_words;
+        uint16_t profile_off[COPS_TEMPLATE_MAX_PROFILE_WORDS];
+};
+
+/*
+ * Lay out the Decision skeleton for the given shape. The object order matches pack_ctl_objs:
+ * Handle, Context, Decision Flags, Client Specific Decision Data (Transaction ID, AMID,
+ * Subscriber ID, Gate ID, Gate Spec, Traffic Profile).
+ *
+ * Returns 0 on success and -1 when the layout is invalid or does not fit COPS_TEMPLATE_MAX.
+ */
+int cops_dec_template_init(struct cops_dec_template* t, const struct cops_dec_layout* layout);
+
+/*
+ * Render one Decision into the destination buffer, which MUST hold at least t->length bytes.
+ *
+ * @t           Template built with cops_dec_template_init
+ * @dst         Destination buffer
+ * @fields      Per-message values
+ *
+ * Returns the number of bytes written (t->length).
+ */
+size_t cops_dec_template_render(const struct cops_dec_template* t, uint8_t* dst, const struct cops_dec_fields* fields);
+
+#endif
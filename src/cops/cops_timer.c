@@ -0,0 +1,149 @@
+#include <string.h>
+#include <time.h>
+
+#include "cops_timer.h"
+
+/* Longest delay the wheel can represent, in ticks. */
+#define COPS_TIMER_RANGE ((UINT64_C(1) << (COPS_TIMER_BITS * COPS_TIMER_LEVELS)) - 1)
+
+static inline void
+cops_timer_unlink(struct cops_timer* t) {
+        *t->pprev = t->next;
+        if (t->next)
+                t->next->pprev = t->pprev;
+        t->next = NULL;
+        t->pprev = NULL;
+}
+
+/* Place an armed timer in the slot matching its distance from the current tick. */
+static void
+cops_timer_place(struct cops_timer_wheel* w, struct cops_timer* t) {
+        uint64_t delta = t->expires - w->now;
+        int level = 0;
+
+        while (level < COPS_TIMER_LEVELS - 1 && delta >= (UINT64_C(1) << (COPS_TIMER_BITS * (level + 1))))
+                level++;
+
+        struct cops_timer** slot = &w->slots[level][(t->expires >> (COPS_TIMER_BITS * level)) & COPS_TIMER_MASK];
+
+        t->next = *slot;
+        if (t->next)
+                t->next->pprev = &t->next;
+        t->pprev = slot;
+        *slot = t;
+}
+
+/* Re-distribute a higher level slot into the lower levels. */
+static void
+cops_timer_cascade(struct cops_timer_wheel* w, int level, size_t idx) {
+        struct cops_timer* t = w->slots[level][idx];
+
+        w->slots[level][idx] = NULL;
+        while (t) {
+                struct cops_timer* next = t->next;
+                cops_timer_place(w, t);
+                t = next;
+        }
+}
+
+void
+cops_timer_wheel_init(struct cops_timer_wheel* w, uint32_t tick_ms, uint64_t now_ms) {
+        memset(w, 0, sizeof(*w));
+        w->tick_ms = tick_ms ? tick_ms : 1;
+        w->base_ms = now_ms;
+}
+
+void
+cops_timer_init(struct cops_timer* t, cops_timer_fn fn, void* arg) {
+        memset(t, 0, sizeof(*t));
+        t->fn = fn;
+        t->arg = arg;
+}
+
+void
+cops_timer_arm(struct cops_timer_wheel* w, struct cops_timer* t, uint64_t delay_ms) {
+        uint64_t ticks = (delay_ms + w->tick_ms - 1) / w->tick_ms;
+
+        if (cops_timer_pending(t))
+                cops_timer_unlink(t);
+        else
+                w->count++;
+
+        if (ticks == 0)
+                ticks = 1;
+        if (ticks > COPS_TIMER_RANGE)
+                ticks = COPS_TIMER_RANGE;
+
+        t->expires = w->now + ticks;
+        cops_timer_place(w, t);
+}
+
+void
+cops_timer_cancel(struct cops_timer_wheel* w, struct cops_timer* t) {
+        if (!cops_timer_pending(t))
+                return;
+
+        cops_timer_unlink(t);
+        w->count--;
+}
+
+size_t
+cops_timer_advance(struct cops_timer_wheel* w, uint64_t now_ms) {
+        uint64_t target = (now_ms > w->base_ms) ? (now_ms - w->base_ms) / w->tick_ms : 0;
+        size_t fired = 0;
+
+        while (w->now < target) {
+                w->now++;
+
+                /* Every COPS_TIMER_SLOTS ticks pull the next slot of each higher level down. */
+                for (int level = 1; level < COPS_TIMER_LEVELS; level++) {
+                        size_t idx = (w->now >> (COPS_TIMER_BITS * level)) & COPS_TIMER_MASK;
+
+                        if ((w->now & ((UINT64_C(1) << (COPS_TIMER_BITS * level)) - 1)) != 0)
+                                break;
+                        cops_timer_cascade(w, level, idx);
+                }
+
+                struct cops_timer** slot = &w->slots[0][w->now & COPS_TIMER_MASK];
+                while (*slot) {
+                        struct cops_timer* t = *slot;
+
+                        cops_timer_unlink(t);
+                        w->count--;
+                        fired++;
+                        t->fn(t, t->arg);
+                }
+
+                /* Nothing left to run, skip ahead over empty ticks of level 0. */
+                if (w->count == 0)
+                        w->now = target;
+        }
+
+        return fired;
+}
+
+int
+cops_timer_next_ms(const struct cops_timer_wheel* w, uint64_t now_ms) {
+        if (w->count == 0)
+                return -1;
+
+        /* First non-empty level 0 slot ahead of the current tick, or the next cascade. */
+        uint64_t ticks = COPS_TIMER_SLOTS - (w->now & COPS_TIMER_MASK);
+        for (uint64_t i = 1; i < ticks; i++) {
+                if (w->slots[0][(w->now + i) & COPS_TIMER_MASK]) {
+                        ticks = i;
+                        break;
+                }
+        }
+
+        uint64_t due = w->base_ms + (w->now + ticks) * w->tick_ms;
+        return (due > now_ms) ? (int)(due - now_ms) : 0;
+}
+
+uint64_t
+cops_monotonic_ms(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
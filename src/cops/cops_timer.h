@@ -0,0 +1,76 @@
+#ifndef COPS_TIMER_H
+#define COPS_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel. COPS_TIMER_LEVELS wheels of COPS_TIMER_SLOTS slots each cover
+ * 2^(COPS_TIMER_BITS * COPS_TIMER_LEVELS) ticks, longer delays are clamped to the range.
+ * Arming, re-arming and cancelling a timer are O(1), advancing the wheel costs one slot per
+ * tick plus an occasional cascade of a higher level slot.
+ */
+#define COPS_TIMER_BITS   6
+#define COPS_TIMER_SLOTS  (1 << COPS_TIMER_BITS)
+#define COPS_TIMER_MASK   (COPS_TIMER_SLOTS - 1)
+#define COPS_TIMER_LEVELS 4
+
+struct cops_timer;
+
+typedef void (*cops_timer_fn)(struct cops_timer* timer, void* arg);
+
+/* Intrusive timer, embed it in the object it supervises. */
+struct cops_timer {
+        struct cops_timer* next;
+        struct cops_timer** pprev; /* NULL when the timer is not armed. */
+        uint64_t expires;          /* Absolute tick. */
+        cops_timer_fn fn;
+        void* arg;
+};
+
+struct cops_timer_wheel {
+        uint64_t now; /* Last processed tick. */
+        uint64_t base_ms;
+        uint32_t tick_ms;
+        size_t count; /* Armed timers. */
+        struct cops_timer* slots[COPS_TIMER_LEVELS][COPS_TIMER_SLOTS];
+};
+
+/*
+ * Initialise a wheel.
+ *
+ * @w           Timer wheel
+ * @tick_ms     Resolution of the wheel in milliseconds
+ * @now_ms      Current monotonic time in milliseconds
+ */
+void cops_timer_wheel_init(struct cops_timer_wheel* w, uint32_t tick_ms, uint64_t now_ms);
+
+void cops_timer_init(struct cops_timer* t, cops_timer_fn fn, void* arg);
+
+/* Arm (or re-arm) a timer to fire delay_ms from the wheel's current time. */
+void cops_timer_arm(struct cops_timer_wheel* w, struct cops_timer* t, uint64_t delay_ms);
+
+void cops_timer_cancel(struct cops_timer_wheel* w, struct cops_timer* t);
+
+static inline bool
+cops_timer_pending(const struct cops_timer* t) {
+        return t->pprev != NULL;
+}
+
+/*
+ * Advance the wheel to now_ms and run every expired timer. Callbacks may arm or cancel any
+ * timer, including the one that fired. Returns the number of timers that fired.
+ */
+size_t cops_timer_advance(struct cops_timer_wheel* w, uint64_t now_ms);
+
+/*
+ * Milliseconds until the wheel next needs to be advanced, suitable as an epoll timeout. Returns
+ * -1 when no timer is armed.
+ */
+int cops_timer_next_ms(const struct cops_timer_wheel* w, uint64_t now_ms);
+
+/* Monotonic clock in milliseconds. */
+uint64_t cops_monotonic_ms(void);
+
+#endif
@@ -0,0 +1,252 @@
+#include "cops_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cops.h"
+
+static inline struct cops_trace_rec*
+cops_trace_slot(const struct cops_trace* t, uint16_t ring, uint64_t i) {
+        const struct cops_trace_file* f = t->file;
+        size_t ring_size = (size_t)f->records * f->record_size;
+
+        return (struct cops_trace_rec*)(t->data + ring * ring_size + (i & (f->records - 1)) * f->record_size);
+}
+
+/* Set up the ring views of a mapped file. */
+static int
+cops_trace_attach(struct cops_trace* t) {
+        struct cops_trace_file* f = t->file;
+
+        t->heads = (struct cops_trace_head*)(f + 1);
+        t->data = (uint8_t*)(t->heads + f->nrings);
+        t->rings = calloc(f->nrings, sizeof(*t->rings));
+        if (t->rings == NULL)
+                return -1;
+
+        for (uint16_t i = 0; i < f->nrings; i++) {
+                struct cops_trace_ring* r = &t->rings[i];
+
+                r->head = &t->heads[i];
+                r->slots = (uint8_t*)cops_trace_slot(t, i, 0);
+                r->next = r->head->head;
+                r->mask = f->records - 1;
+                r->record_size = f->record_size;
+                r->snaplen = f->snaplen;
+                r->index = (uint8_t)i;
+        }
+
+        return 0;
+}
+
+static size_t
+cops_trace_size(const struct cops_trace_file* f) {
+        size_t rings = (size_t)f->nrings * f->records * f->record_size;
+
+        return sizeof(*f) + f->nrings * sizeof(struct cops_trace_head) + rings;
+}
+
+int
+cops_trace_create(struct cops_trace* t, const char* path, uint16_t nrings, uint32_t records, uint32_t snaplen) {
+        struct cops_trace_file hdr = {0};
+        uint32_t n = 1;
+
+        memset(t, 0, sizeof(*t));
+        if (nrings == 0 || nrings > UINT8_MAX || records == 0 || records > (1u << 30) || snaplen > UINT16_MAX) {
+                errno = EINVAL;
+                return -1;
+        }
+        while (n < records)
+                n <<= 1;
+
+        hdr.magic = COPS_TRACE_MAGIC;
+        hdr.version = COPS_TRACE_VERSION;
+        hdr.nrings = nrings;
+        hdr.records = n;
+        hdr.snaplen = (snaplen) ? snaplen : COPS_TRACE_DEFAULT_SNAPLEN;
+        hdr.record_size = (uint32_t)(sizeof(struct cops_trace_rec) + hdr.snaplen + 63) & ~63u;
+
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+                return -1;
+
+        /* Sparse until written, the pages are only faulted in as the rings fill. */
+        t->size = cops_trace_size(&hdr);
+        if (ftruncate(fd, (off_t)t->size) < 0) {
+                close(fd);
+                return -1;
+        }
+
+        t->file = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (t->file == MAP_FAILED) {
+                t->file = NULL;
+                return -1;
+        }
+
+        *t->file = hdr;
+        t->writable = true;
+        if (cops_trace_attach(t) < 0) {
+                cops_trace_close(t);
+                return -1;
+        }
+
+        return 0;
+}
+
+int
+cops_trace_open(struct cops_trace* t, const char* path) {
+        struct cops_trace_file hdr;
+
+        memset(t, 0, sizeof(*t));
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return -1;
+
+        off_t end = lseek(fd, 0, SEEK_END);
+        if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != COPS_TRACE_MAGIC ||
+            hdr.version != COPS_TRACE_VERSION || hdr.nrings == 0 || hdr.records == 0 ||
+            (hdr.records & (hdr.records - 1)) != 0 || hdr.record_size < sizeof(struct cops_trace_rec) + hdr.snaplen ||
+            end < 0 || (size_t)end < cops_trace_size(&hdr)) {
+                close(fd);
+                errno = EINVAL;
+                return -1;
+        }
+
+        t->size = cops_trace_size(&hdr);
+        t->file = mmap(NULL, t->size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (t->file == MAP_FAILED) {
+                t->file = NULL;
+                return -1;
+        }
+
+        if (cops_trace_attach(t) < 0) {
+                cops_trace_close(t);
+                return -1;
+        }
+
+        return 0;
+}
+
+void
+cops_trace_close(struct cops_trace* t) {
+        if (t->file)
+                munmap(t->file, t->size);
+        free(t->rings);
+        memset(t, 0, sizeof(*t));
+}
+
+struct cops_trace_ring*
+cops_trace_ring(struct cops_trace* t) {
+        if (!t->writable)
+                return NULL;
+
+        unsigned int i = atomic_fetch_add(&t->used, 1);
+        return (i < t->file->nrings) ? &t->rings[i] : NULL;
+}
+
+void
+cops_trace_record(struct cops_trace_ring* r, enum cops_trace_dir dir, uint32_t conn_id, const uint8_t* msg,
+                  size_t len) {
+        struct cops_trace_rec* rec = (struct cops_trace_rec*)(r->slots + (r->next & r->mask) * r->record_size);
+        size_t caplen = (len < r->snaplen) ? len : r->snaplen;
+        struct timespec ts;
+
+        /* Invalidate first, a crash in between must not leave the old sequence on new bytes. */
+        __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        rec->ts_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+        rec->conn_id = conn_id;
+        rec->len = (uint32_t)len;
+        rec->caplen = (uint16_t)caplen;
+        rec->dir = (uint8_t)dir;
+        rec->ring = r->index;
+        memcpy(rec->data, msg, caplen);
+
+        r->next++;
+        __atomic_store_n(&rec->seq, r->next, __ATOMIC_RELEASE);
+        __atomic_store_n(&r->head->head, r->next, __ATOMIC_RELEASE);
+}
+
+static int
+cops_trace_cmp(const void* a, const void* b) {
+        const struct cops_trace_rec* x = *(const struct cops_trace_rec* const*)a;
+        const struct cops_trace_rec* y = *(const struct cops_trace_rec* const*)b;
+
+        if (x->ts_ns != y->ts_ns)
+                return (x->ts_ns < y->ts_ns) ? -1 : 1;
+        if (x->ring != y->ring)
+                return (x->ring < y->ring) ? -1 : 1;
+        return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+ssize_t
+cops_trace_records(const struct cops_trace* t, const struct cops_trace_rec*** recs) {
+        const struct cops_trace_file* f = t->file;
+        size_t n = 0;
+
+        *recs = malloc(((size_t)f->nrings * f->records + 1) * sizeof(**recs));
+        if (*recs == NULL)
+                return -1;
+
+        for (uint16_t i = 0; i < f->nrings; i++) {
+                uint64_t head = __atomic_load_n(&t->heads[i].head, __ATOMIC_ACQUIRE);
+                uint64_t first = (head > f->records) ? head - f->records : 0;
+
+                /* The head may lag one record behind a crash, the sequence numbers decide. */
+                for (uint64_t k = first; k <= head && k < first + f->records; k++) {
+                        const struct cops_trace_rec* rec = cops_trace_slot(t, i, k);
+
+                        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == k + 1 && rec->caplen <= f->snaplen)
+                                (*recs)[n++] = rec;
+                }
+        }
+
+        qsort(*recs, n, sizeof(**recs), cops_trace_cmp);
+        return (ssize_t)n;
+}
+
+void
+cops_trace_print(const struct cops_trace_rec* rec, FILE* out) {
+        time_t sec = (time_t)(rec->ts_ns / 1000000000);
+        struct tm tm;
+        char when[32];
+
+        gmtime_r(&sec, &tm);
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+        fprintf(out, "%s.%09luZ conn %u %s ", when, (unsigned long)(rec->ts_ns % 1000000000), rec->conn_id,
+                (rec->dir == COPS_TRACE_RX) ? "<-" : "->");
+
+        if (rec->caplen < COPS_HEADER_LEN) {
+                fprintf(out, "%u bytes, %u captured\n", rec->len, rec->caplen);
+                return;
+        }
+
+        const uint8_t* p = rec->data;
+        fprintf(out, "%s len %u client-type 0x%04x%s\n", cops_otoa(p[1]), rec->len, cops_load16(p + 2),
+                (rec->caplen < rec->len) ? " (truncated)" : "");
+
+        for (uint32_t off = COPS_HEADER_LEN; off + COPS_OBJ_HEADER_LEN <= rec->caplen;) {
+                uint16_t olen = cops_load16(p + off);
+                uint32_t end = off + olen;
+
+                fprintf(out, "    %-22s C-Type %u len %-4u", cops_otos(p[off + 2]), p[off + 3], olen);
+                if (olen < COPS_OBJ_HEADER_LEN) {
+                        fputs(" malformed\n", out);
+                        return;
+                }
+                for (uint32_t i = off + COPS_OBJ_HEADER_LEN; i < end && i < rec->caplen; i++)
+                        fprintf(out, "%s%02x", ((i - off) % 4 == 0) ? " " : "", p[i]);
+                fputc('\n', out);
+                off += COPS_ALIGN4(olen);
+        }
+}
@@ -0,0 +1,124 @@
+#ifndef COPS_TRACE_H
+#define COPS_TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define COPS_TRACE_MAGIC   0x43525443 /* "CTRC" */
+#define COPS_TRACE_VERSION 1
+
+/* Bytes captured per message by default: the common header, the Handle and the object after it. */
+#define COPS_TRACE_DEFAULT_SNAPLEN 24
+
+/* Direction of a traced message. */
+enum cops_trace_dir {
+        COPS_TRACE_RX = 0,
+        COPS_TRACE_TX,
+};
+
+/* File header, followed by one cops_trace_head per ring and then the rings themselves. */
+struct cops_trace_file {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t nrings;
+        uint32_t records;     /* Per ring, a power of two. */
+        uint32_t record_size; /* Header plus snaplen, rounded up to 64 bytes. */
+        uint32_t snaplen;
+        uint32_t reserved[11];
+};
+
+/* Write position of one ring, alone on its cache line. */
+struct cops_trace_head {
+        _Alignas(64) uint64_t head; /* Records ever written to the ring. */
+};
+
+/* One captured message. */
+struct cops_trace_rec {
+        uint64_t seq;     /* Record number + 1, 0 while the record is being written. */
+        uint64_t ts_ns;   /* CLOCK_REALTIME at capture. */
+        uint32_t conn_id; /* cops_conn.id of the session. */
+        uint32_t len;     /* Length of the whole message. */
+        uint16_t caplen;  /* Bytes of the message in data. */
+        uint8_t dir;      /* enum cops_trace_dir */
+        uint8_t ring;
+        uint32_t reserved;
+        uint8_t data[];
+};
+
+_Static_assert(sizeof(struct cops_trace_file) == 64, "file header is one cache line");
+_Static_assert(sizeof(struct cops_trace_rec) == 32, "record header layout is part of the file format");
+
+/* Writer side of one ring, owned by a single thread. */
+struct cops_trace_ring {
+        struct cops_trace_head* head;
+        uint8_t* slots;
+        uint64_t next;
+        uint32_t mask;
+        uint32_t record_size;
+        uint32_t snaplen;
+        uint8_t index;
+};
+
+/*
+ * Wire tracer backed by a memory mapped file.
+ *
+ * Every writing thread claims a ring of its own, so capture is a copy into the next slot and
+ * a few plain stores, no locks and no atomic read-modify-write. Old records are overwritten. The
+ * mapping is shared with the page cache, so the records written up to a crash are still in
+ * the file after it, cops_trace_open reads them back. A record that was being written at the
+ * time of the crash is recognised by its sequence number and skipped.
+ */
+struct cops_trace {
+        struct cops_trace_file* file;
+        size_t size;
+        bool writable;
+        struct cops_trace_head* heads;
+        uint8_t* data;
+        struct cops_trace_ring* rings;
+        atomic_uint used;
+};
+
+/*
+ * Create (or truncate) a trace file.
+ *
+ * @t           Trace
+ * @path        File to map
+ * @nrings      Number of rings, one per writing thread (at most 255)
+ * @records     Records per ring, rounded up to a power of two
+ * @snaplen     Bytes captured per message, 0 selects COPS_TRACE_DEFAULT_SNAPLEN. Messages are
+ *              at most COPS_MSG_MAX_LEN bytes plus an Integrity object unless the decoder limit
+ *              was raised, 1024 then captures the full body
+ *
+ * Returns -1 on error (errno set).
+ */
+int cops_trace_create(struct cops_trace* t, const char* path, uint16_t nrings, uint32_t records, uint32_t snaplen);
+
+/* Map an existing trace file read-only, e.g. after a crash. Returns -1 on error. */
+int cops_trace_open(struct cops_trace* t, const char* path);
+
+void cops_trace_close(struct cops_trace* t);
+
+/* Claim a ring for the calling thread. Returns NULL once all are taken or the trace is read-only. */
+struct cops_trace_ring* cops_trace_ring(struct cops_trace* t);
+
+/* Capture one message, at most snaplen bytes of it. Never blocks. */
+void cops_trace_record(struct cops_trace_ring* r, enum cops_trace_dir dir, uint32_t conn_id, const uint8_t* msg,
+                       size_t len);
+
+/*
+ * Collect every complete record of every ring, ordered by timestamp. Returns the number of
+ * records, *recs is allocated and must be freed by the caller, or -1 on ENOMEM.
+ */
+ssize_t cops_trace_records(const struct cops_trace* t, const struct cops_trace_rec*** recs);
+
+/*
+ * Pretty print a record: time, session, direction and Op Code (cops_otoa), then one line per
+ * captured object with its name (cops_otos) and contents in hex.
+ */
+void cops_trace_print(const struct cops_trace_rec* rec, FILE* out);
+
+#endif
@@ -0,0 +1,208 @@
+#include "cops_txn.h"
+#include "pcmm.h"
+
+static inline uint64_t
+cops_txn_key(uint32_t conn_id, uint16_t trans_id) {
+        return (uint64_t)conn_id << 16 | trans_id;
+}
+
+/* Fibonacci hashing, the top bits of the product are the best mixed. */
+static inline size_t
+cops_txn_bucket(const struct cops_txn_table* t, uint64_t key) {
+        return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & t->mask;
+}
+
+/* The -Ack and -Err responses answering a request, 0 (no response) for other commands. */
+static void
+cops_txn_replies(uint16_t command, uint16_t* ack, uint16_t* err) {
+        switch (command) {
+                case PCMM_GATE_SET:
+                        *ack = PCMM_GATE_SET_ACK;
+                        *err = PCMM_GATE_SET_ERR;
+                        break;
+                case PCMM_GATE_INFO:
+                        *ack = PCMM_GATE_INFO_ACK;
+                        *err = PCMM_GATE_INFO_ERR;
+                        break;
+                case PCMM_GATE_DELETE:
+                        *ack = PCMM_GATE_DELETE_ACK;
+                        *err = PCMM_GATE_DELETE_ERR;
+                        break;
+                default:
+                        *ack = 0;
+                        *err = 0;
+                        break;
+        }
+}
+
+static void
+cops_txn_expire(struct cops_timer* timer, void* arg) {
+        (void)timer;
+        cops_txn_end(arg, COPS_TXN_TIMEOUT, NULL);
+}
+
+int
+cops_txn_table_init(struct cops_txn_table* t, size_t cap, struct cops_timer_wheel* wheel) {
+        size_t nbuckets = 16;
+
+        memset(t, 0, sizeof(*t));
+        while (nbuckets < cap)
+                nbuckets <<= 1;
+
+        t->buckets = calloc(nbuckets, sizeof(*t->buckets));
+        t->txns = calloc(cap, sizeof(*t->txns));
+        if (t->buckets == NULL || t->txns == NULL) {
+                cops_txn_table_free(t);
+                return -1;
+        }
+
+        t->mask = nbuckets - 1;
+        t->cap = cap;
+        t->wheel = wheel;
+
+        for (size_t i = cap; i-- > 0;) {
+                t->txns[i].table = t;
+                t->txns[i].next = t->free;
+                t->free = &t->txns[i];
+        }
+
+        return 0;
+}
+
+void
+cops_txn_table_free(struct cops_txn_table* t) {
+        /* Pending deadlines live on the caller's wheel and must not fire into freed memory. */
+        for (size_t i = 0; t->txns && i < t->cap; i++)
+                if (t->txns[i].fn)
+                        cops_timer_cancel(t->wheel, &t->txns[i].timer);
+
+        free(t->buckets);
+        free(t->txns);
+        memset(t, 0, sizeof(*t));
+}
+
+struct cops_txn*
+cops_txn_find(const struct cops_txn_table* t, uint32_t conn_id, uint16_t trans_id) {
+        uint64_t key = cops_txn_key(conn_id, trans_id);
+        struct cops_txn* txn = t->buckets[cops_txn_bucket(t, key)];
+
+        while (txn && txn->key != key)
+                txn = txn->next;
+
+        return txn;
+}
+
+struct cops_txn*
+cops_txn_begin(struct cops_txn_table* t, uint32_t conn_id, uint16_t trans_id, uint16_t command,
+               uint64_t timeout_ms, cops_txn_fn fn, void* arg) {
+        struct cops_txn* txn = t->free;
+
+        if (txn == NULL || cops_txn_find(t, conn_id, trans_id))
+                return NULL;
+        t->free = txn->next;
+
+        struct cops_txn** head = &t->buckets[cops_txn_bucket(t, cops_txn_key(conn_id, trans_id))];
+        txn->key = cops_txn_key(conn_id, trans_id);
+        txn->next = *head;
+        *head = txn;
+        txn->fn = fn;
+        txn->arg = arg;
+        txn->command = command;
+        cops_txn_replies(command, &txn->ack, &txn->err);
+        t->count++;
+
+        cops_timer_init(&txn->timer, cops_txn_expire, txn);
+        if (timeout_ms)
+                cops_timer_arm(t->wheel, &txn->timer, timeout_ms);
+
+        return txn;
+}
+
+void
+cops_txn_end(struct cops_txn* txn, enum cops_txn_status status, const struct cops_msg* msg) {
+        struct cops_txn_table* t = txn->table;
+        struct cops_txn** pp = &t->buckets[cops_txn_bucket(t, txn->key)];
+
+        while (*pp != txn)
+                pp = &(*pp)->next;
+        *pp = txn->next;
+        t->count--;
+
+        cops_timer_cancel(t->wheel, &txn->timer);
+        txn->fn(txn, status, msg);
+
+        /* Released only now, the callback may start new transactions but never gets this one. */
+        txn->fn = NULL;
+        txn->next = t->free;
+        t->free = txn;
+}
+
+bool
+cops_txn_parse(const struct cops_msg* msg, uint16_t* trans_id, uint16_t* command) {
+        for (uint16_t i = 0; i < msg->nobjs; i++) {
+                const struct cops_obj* obj = &msg->objs[i];
+
+                if (obj->cnum != COPS_CNUM_CLIENT_SI)
+                        continue;
+
+                /* Walk the PCMM objects, the Transaction ID normally comes first. */
+                const uint8_t* p = msg->data + obj->offset + COPS_OBJ_HEADER_LEN;
+                const uint8_t* end = msg->data + obj->offset + obj->length;
+
+                while (end - p >= 4) {
+                        uint16_t len = cops_load16(p);
+
+                        if (len < 4 || len > end - p)
+                                break;
+                        if (p[2] == PCMM_SNUM_TRANSACTION_ID && p[3] == 1 && len == 8) {
+                                *trans_id = cops_load16(p + 4);
+                                *command = cops_load16(p + 6);
+                                return true;
+                        }
+                        p += (len + 3) & ~3u;
+                }
+        }
+
+        return false;
+}
+
+bool
+cops_txn_complete(struct cops_txn_table* t, uint32_t conn_id, const struct cops_msg* msg) {
+        enum cops_txn_status status;
+        uint16_t trans_id;
+        uint16_t command;
+
+        if (!cops_txn_parse(msg, &trans_id, &command))
+                return false;
+
+        struct cops_txn* txn = cops_txn_find(t, conn_id, trans_id);
+        if (txn == NULL)
+                return false;
+
+        /* Only the response to its own command ends a request, 0 never matches a real reply. */
+        if (command != 0 && command == txn->ack)
+                status = COPS_TXN_ACK;
+        else if (command != 0 && command == txn->err)
+                status = COPS_TXN_ERR;
+        else
+                return false;
+
+        cops_txn_end(txn, status, msg);
+        return true;
+}
+
+size_t
+cops_txn_cancel_conn(struct cops_txn_table* t, uint32_t conn_id) {
+        size_t n = 0;
+
+        for (size_t i = 0; i < t->cap; i++) {
+                struct cops_txn* txn = &t->txns[i];
+
+                if (txn->fn && (uint32_t)(txn->key >> 16) == conn_id) {
+                        cops_txn_end(txn, COPS_TXN_CANCELLED, NULL);
+                        n++;
+                }
+        }
+
+        return n;
+}
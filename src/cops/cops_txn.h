@@ -0,0 +1,110 @@
+#ifndef COPS_TXN_H
+#define COPS_TXN_H
+
+#include "cops.h"
+#include "cops_decoder.h"
+#include "cops_timer.h"
+
+/* How a pending transaction ended. */
+enum cops_txn_status {
+        COPS_TXN_ACK = 0,   /* Gate-Set-Ack, Gate-Info-Ack or Gate-Delete-Ack. */
+        COPS_TXN_ERR,       /* The matching -Err response, msg carries the PacketCable Error. */
+        COPS_TXN_TIMEOUT,   /* No response before the deadline. */
+        COPS_TXN_CANCELLED, /* Cancelled, e.g. because the connection closed. */
+};
+
+struct cops_txn;
+struct cops_txn_table;
+
+/*
+ * Completion callback. msg is the Report-State carrying the response for COPS_TXN_ACK and
+ * COPS_TXN_ERR and NULL otherwise. The transaction is released when the callback returns.
+ */
+typedef void (*cops_txn_fn)(struct cops_txn* txn, enum cops_txn_status status, const struct cops_msg* msg);
+
+/* An outstanding request, owned by the table from cops_txn_begin until its callback returned. */
+struct cops_txn {
+        uint64_t key;          /* Connection id << 16 | Transaction ID. */
+        struct cops_txn* next; /* Hash chain, free list link when unused. */
+        struct cops_txn_table* table;
+        struct cops_timer timer;
+        cops_txn_fn fn; /* NULL when unused. */
+        void* arg;
+        uint16_t command; /* Gate Command Type of the request, e.g. PCMM_GATE_SET. */
+        uint16_t ack;     /* Response completing it with COPS_TXN_ACK, e.g. PCMM_GATE_SET_ACK. */
+        uint16_t err;     /* Response completing it with COPS_TXN_ERR, e.g. PCMM_GATE_SET_ERR. */
+};
+
+/*
+ * Pending transactions keyed by (connection id, PCMM Transaction ID).
+ *
+ * Transactions come from a preallocated array through a free list and are indexed by a chained
+ * hash table with at least one bucket per transaction, so begin and complete are O(1) and never
+ * allocate. Deadlines are timers on the caller's wheel (usually the server's), they expire as
+ * the wheel is advanced by cops_server_poll.
+ */
+struct cops_txn_table {
+        struct cops_txn** buckets;
+        size_t mask;
+        struct cops_txn* txns;
+        struct cops_txn* free;
+        size_t cap;
+        size_t count;
+        struct cops_timer_wheel* wheel;
+        uint16_t next_id;
+};
+
+/* Allocate a table for up to cap outstanding transactions. Returns -1 on ENOMEM. */
+int cops_txn_table_init(struct cops_txn_table* t, size_t cap, struct cops_timer_wheel* wheel);
+
+/* Free the table, pending transactions are dropped without running their callbacks. */
+void cops_txn_table_free(struct cops_txn_table* t);
+
+/* Next Transaction ID to put into a request (wraps around, see cops_txn_begin). */
+static inline uint16_t
+cops_txn_id(struct cops_txn_table* t) {
+        return t->next_id++;
+}
+
+/*
+ * Record a request sent on a connection.
+ *
+ * @t           Transaction table
+ * @conn_id     Connection id (cops_conn.id) the request was sent on
+ * @trans_id    Transaction ID carried in the request
+ * @command     Gate Command Type of the request, Gate-Set, Gate-Info or Gate-Delete. Any other
+ *              command is only ended by its deadline or by cancellation
+ * @timeout_ms  Deadline relative to the wheel's current time, 0 for none
+ * @fn          Completion callback
+ * @arg         Passed through in txn->arg
+ *
+ * Returns NULL when the table is full or (conn_id, trans_id) is already pending.
+ */
+struct cops_txn* cops_txn_begin(struct cops_txn_table* t, uint32_t conn_id, uint16_t trans_id, uint16_t command,
+                                uint64_t timeout_ms, cops_txn_fn fn, void* arg);
+
+/* Return the pending transaction for (conn_id, trans_id), or NULL. */
+struct cops_txn* cops_txn_find(const struct cops_txn_table* t, uint32_t conn_id, uint16_t trans_id);
+
+/*
+ * Match a Report-State received on a connection to its request and complete it. Returns false
+ * when msg carries no Transaction ID, nothing is pending for it (e.g. an unsolicited
+ * Gate-Report-State, or a response that arrived after its deadline) or its command is not the
+ * -Ack/-Err of the pending request (e.g. a Gate-Delete-Ack reusing the ID of a Gate-Set), the
+ * transaction then stays pending.
+ */
+bool cops_txn_complete(struct cops_txn_table* t, uint32_t conn_id, const struct cops_msg* msg);
+
+/* End a transaction with the given status, e.g. COPS_TXN_CANCELLED. */
+void cops_txn_end(struct cops_txn* txn, enum cops_txn_status status, const struct cops_msg* msg);
+
+/* Cancel every transaction of a connection, O(cap). Returns the number cancelled. */
+size_t cops_txn_cancel_conn(struct cops_txn_table* t, uint32_t conn_id);
+
+/*
+ * Extract the PCMM Transaction ID object from the Client SI object of a Report-State. Returns
+ * false when msg carries none.
+ */
+bool cops_txn_parse(const struct cops_msg* msg, uint16_t* trans_id, uint16_t* command);
+
+#endif
@@ -0,0 +1,222 @@
+#ifdef __linux__
+
+#include "cops_uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static inline int
+cops_uring_enter(int fd, uint32_t submit, uint32_t min, uint32_t flags, void* arg, size_t argsz) {
+        return (int)syscall(__NR_io_uring_enter, fd, submit, min, flags, arg, argsz);
+}
+
+static inline int
+cops_uring_register(int fd, uint32_t op, void* arg, uint32_t nr) {
+        return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+/*
+ * Multishot receive and SEND_ZC were both introduced with Linux 6.0, the opcode stands in
+ * for the flags the probe cannot report.
+ */
+static bool
+cops_uring_supported(int fd) {
+        size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+        struct io_uring_probe* probe = calloc(1, size);
+        bool ok;
+
+        if (probe == NULL)
+                return false;
+
+        ok = cops_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0 && probe->last_op >= IORING_OP_SEND_ZC &&
+             (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+        free(probe);
+
+        return ok;
+}
+
+int
+cops_uring_init(struct cops_uring* u, uint32_t entries, uint32_t cq_entries) {
+        struct io_uring_params p = {0};
+
+        memset(u, 0, sizeof(*u));
+        u->fd = -1;
+
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+        p.cq_entries = cq_entries;
+        u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (u->fd < 0) {
+                if (errno == EINVAL)
+                        errno = EOPNOTSUPP; /* Kernel predates one of the setup flags. */
+                return -1;
+        }
+
+        uint32_t need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+        if ((p.features & need) != need || !cops_uring_supported(u->fd)) {
+                errno = EOPNOTSUPP;
+                goto fail;
+        }
+        u->features = p.features;
+
+        /* Both rings share one mapping (IORING_FEAT_SINGLE_MMAP). */
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        u->ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+        u->ring_map = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                           IORING_OFF_SQ_RING);
+        if (u->ring_map == MAP_FAILED) {
+                u->ring_map = NULL;
+                goto fail;
+        }
+
+        u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                       IORING_OFF_SQES);
+        if (u->sqes == MAP_FAILED) {
+                u->sqes = NULL;
+                goto fail;
+        }
+
+        uint8_t* ring = u->ring_map;
+        u->sq_head = (uint32_t*)(ring + p.sq_off.head);
+        u->sq_tail = (uint32_t*)(ring + p.sq_off.tail);
+        u->sq_mask = *(uint32_t*)(ring + p.sq_off.ring_mask);
+        u->sq_entries = p.sq_entries;
+        u->cq_head = (uint32_t*)(ring + p.cq_off.head);
+        u->cq_tail = (uint32_t*)(ring + p.cq_off.tail);
+        u->cq_mask = *(uint32_t*)(ring + p.cq_off.ring_mask);
+        u->cqes = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+
+        /* Slot i of the indirection array always names entry i. */
+        uint32_t* array = (uint32_t*)(ring + p.sq_off.array);
+        for (uint32_t i = 0; i < p.sq_entries; i++)
+                array[i] = i;
+
+        return 0;
+
+fail:
+        cops_uring_free(u);
+        return -1;
+}
+
+void
+cops_uring_free(struct cops_uring* u) {
+        if (u->fd >= 0)
+                close(u->fd);
+        if (u->sqes)
+                munmap(u->sqes, u->sqes_size);
+        if (u->ring_map)
+                munmap(u->ring_map, u->ring_size);
+        if (u->br)
+                munmap(u->br, u->br_size);
+
+        memset(u, 0, sizeof(*u));
+        u->fd = -1;
+}
+
+int
+cops_uring_bufs_init(struct cops_uring* u, uint32_t nbufs, uint32_t size) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t ring = (nbufs * sizeof(struct io_uring_buf) + page - 1) & ~(page - 1);
+
+        /* Ring and buffers in one anonymous mapping, the ring must be page aligned. */
+        u->br_size = ring + (size_t)nbufs * size;
+        u->br = mmap(NULL, u->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (u->br == MAP_FAILED) {
+                u->br = NULL;
+                return -1;
+        }
+        u->bufs = (uint8_t*)u->br + ring;
+        u->nbufs = nbufs;
+        u->buf_size = size;
+
+        struct io_uring_buf_reg reg = {.ring_addr = (uintptr_t)u->br, .ring_entries = nbufs, .bgid = COPS_URING_BGID};
+        if (cops_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+                return -1;
+
+        for (uint32_t i = 0; i < nbufs; i++)
+                cops_uring_buf_put(u, (uint16_t)i);
+
+        return 0;
+}
+
+void
+cops_uring_buf_put(struct cops_uring* u, uint16_t bid) {
+        uint16_t tail = u->br->tail;
+        struct io_uring_buf* buf = &u->br->bufs[tail & (u->nbufs - 1)];
+
+        /* The first entry overlays the tail, only addr, len and bid may be written. */
+        buf->addr = (uintptr_t)cops_uring_buf(u, bid);
+        buf->len = u->buf_size;
+        buf->bid = bid;
+        __atomic_store_n(&u->br->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+int
+cops_uring_fixed_init(struct cops_uring* u, uint32_t n) {
+        struct io_uring_rsrc_register reg = {.nr = n, .flags = IORING_RSRC_REGISTER_SPARSE};
+
+        return (cops_uring_register(u->fd, IORING_REGISTER_BUFFERS2, &reg, sizeof(reg)) < 0) ? -1 : 0;
+}
+
+int
+cops_uring_fixed_set(struct cops_uring* u, uint32_t index, void* addr, size_t len) {
+        struct iovec iov = {addr, len};
+        struct io_uring_rsrc_update2 up = {.offset = index, .data = (uintptr_t)&iov, .nr = 1};
+
+        return (cops_uring_register(u->fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up)) < 0) ? -1 : 0;
+}
+
+struct io_uring_sqe*
+cops_uring_sqe(struct cops_uring* u) {
+        uint32_t tail = *u->sq_tail;
+
+        if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+                if (cops_uring_wait(u, 0) < 0 || tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries)
+                        return NULL;
+        }
+
+        /* Without SQPOLL the kernel only reads entries inside io_uring_enter, publishing early is safe. */
+        struct io_uring_sqe* sqe = &u->sqes[tail & u->sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        u->sq_pending++;
+
+        return sqe;
+}
+
+int
+cops_uring_wait(struct cops_uring* u, int timeout_ms) {
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg = {0};
+        uint32_t flags = 0;
+        uint32_t min = 0;
+
+        /* Completions already queued are handled before blocking. */
+        if (timeout_ms != 0 && cops_uring_cqe_peek(u) == NULL) {
+                flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+                min = 1;
+                if (timeout_ms > 0) {
+                        ts.tv_sec = timeout_ms / 1000;
+                        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+                        arg.ts = (uintptr_t)&ts;
+                }
+        } else if (u->sq_pending == 0) {
+                return 0;
+        }
+
+        int ret = (flags) ? cops_uring_enter(u->fd, u->sq_pending, min, flags, &arg, sizeof(arg))
+                          : cops_uring_enter(u->fd, u->sq_pending, 0, 0, NULL, 0);
+        if (ret < 0)
+                return (errno == ETIME || errno == EINTR || errno == EBUSY) ? 0 : -1;
+
+        u->sq_pending -= (uint32_t)ret;
+        return 0;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef COPS_URING_H
+#define COPS_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+/* Buffer group of the provided receive buffers. */
+#define COPS_URING_BGID 0
+
+/*
+ * A minimal io_uring instance driven through the raw system calls (no liburing).
+ *
+ * The submission and completion rings are shared with the kernel, head and tail indices are
+ * accessed with acquire/release atomics. Received data lands in a ring of provided buffers
+ * (IORING_REGISTER_PBUF_RING) that the kernel picks from for every recv issued with
+ * IOSQE_BUFFER_SELECT, the caller hands a buffer back once it consumed its contents.
+ */
+struct cops_uring {
+        int fd;
+        uint32_t features;
+
+        /* Submission queue. */
+        uint32_t* sq_head;
+        uint32_t* sq_tail;
+        uint32_t sq_mask;
+        uint32_t sq_entries;
+        uint32_t sq_pending; /* Prepared but not yet submitted. */
+        struct io_uring_sqe* sqes;
+
+        /* Completion queue. */
+        uint32_t* cq_head;
+        uint32_t* cq_tail;
+        uint32_t cq_mask;
+        struct io_uring_cqe* cqes;
+
+        void* ring_map;
+        size_t ring_size;
+        size_t sqes_size;
+
+        /* Provided receive buffers. */
+        struct io_uring_buf_ring* br;
+        uint8_t* bufs;
+        uint32_t nbufs;
+        uint32_t buf_size;
+        size_t br_size;
+};
+
+/*
+ * Set up a ring of entries submission slots and a completion queue cq_entries deep. Only
+ * kernels with multishot accept and receive are accepted. Returns -1 with errno set to
+ * ENOSYS, EPERM or EOPNOTSUPP when io_uring is unavailable, the caller falls back to epoll.
+ */
+int cops_uring_init(struct cops_uring* u, uint32_t entries, uint32_t cq_entries);
+
+/* Tear the ring down, the kernel cancels every request still in flight. */
+void cops_uring_free(struct cops_uring* u);
+
+/*
+ * Register nbufs provided receive buffers of size bytes each (nbufs a power of two) in buffer
+ * group COPS_URING_BGID. Returns -1 on error.
+ */
+int cops_uring_bufs_init(struct cops_uring* u, uint32_t nbufs, uint32_t size);
+
+/* Return a provided buffer to the kernel. */
+void cops_uring_buf_put(struct cops_uring* u, uint16_t bid);
+
+/* Reserve an empty table of n fixed buffers, populated with cops_uring_fixed_set. */
+int cops_uring_fixed_init(struct cops_uring* u, uint32_t n);
+
+/* Register len bytes at addr as fixed buffer index. Returns -1 on error (e.g. RLIMIT_MEMLOCK). */
+int cops_uring_fixed_set(struct cops_uring* u, uint32_t index, void* addr, size_t len);
+
+/*
+ * Take a zeroed submission entry. When the queue is full the pending entries are submitted
+ * first. Returns NULL only when the kernel refuses the submission.
+ */
+struct io_uring_sqe* cops_uring_sqe(struct cops_uring* u);
+
+/*
+ * Submit pending entries and wait up to timeout_ms (-1 forever, 0 not at all) for at least
+ * one completion. Returns 0 or -1 on error, a timeout or signal is not an error.
+ */
+int cops_uring_wait(struct cops_uring* u, int timeout_ms);
+
+#ifdef __linux__
+
+/* Next unprocessed completion or NULL, call cops_uring_cqe_seen once it was handled. */
+static inline struct io_uring_cqe*
+cops_uring_cqe_peek(struct cops_uring* u) {
+        uint32_t head = *u->cq_head;
+
+        if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+                return NULL;
+
+        return &u->cqes[head & u->cq_mask];
+}
+
+static inline void
+cops_uring_cqe_seen(struct cops_uring* u) {
+        __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint8_t*
+cops_uring_buf(struct cops_uring* u, uint16_t bid) {
+        return u->bufs + (size_t)bid * u->buf_size;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,149 @@
+#include "cops_validate.h"
+
+/* Bit of a C-Num in the object masks below. */
+#define COPS_OBJ(cnum) (1u << (cnum))
+
+/* Rule flags. */
+#define COPS_OP_PCMM 0x01 /* Operation used by PacketCable Multimedia. */
+#define COPS_OP_KA   0x02 /* Client-Type MUST be 0 instead of PCMM_CLIENT_TYPE. */
+
+/* Objects every message may carry. */
+#define COPS_OBJ_ANY COPS_OBJ(16) /* Integrity */
+
+/*
+ * Per-opcode rules. The allowed mask includes the required objects, operations without the
+ * COPS_OP_PCMM flag (including SSQ and SSC) are rejected.
+ */
+struct cops_op_rule {
+        uint8_t flags;
+        uint32_t required;
+        uint32_t allowed;
+};
+
+static const struct cops_op_rule cops_op_rules[256] = {
+        /* REQ: <Handle> <Context> [<IN-Int>] [<OUT-Int>] *(<ClientSI>) *(<LPDPDecision>) */
+        [1] = {COPS_OP_PCMM, COPS_OBJ(1) | COPS_OBJ(2),
+               COPS_OBJ(1) | COPS_OBJ(2) | COPS_OBJ(3) | COPS_OBJ(4) | COPS_OBJ(7) | COPS_OBJ(9) | COPS_OBJ_ANY},
+        /* DEC: <Handle> *(<Context> <Decision>) | <Error> */
+        [2] = {COPS_OP_PCMM, COPS_OBJ(1), COPS_OBJ(1) | COPS_OBJ(2) | COPS_OBJ(6) | COPS_OBJ(8) | COPS_OBJ_ANY},
+        /* RPT: <Handle> <Report-Type> [<ClientSI>] */
+        [3] = {COPS_OP_PCMM, COPS_OBJ(1) | COPS_OBJ(12), COPS_OBJ(1) | COPS_OBJ(12) | COPS_OBJ(9) | COPS_OBJ_ANY},
+        /* DRQ: <Handle> <Reason> */
+        [4] = {COPS_OP_PCMM, COPS_OBJ(1) | COPS_OBJ(5), COPS_OBJ(1) | COPS_OBJ(5) | COPS_OBJ_ANY},
+        /* SSQ: [<Handle>] */
+        [5] = {0, 0, COPS_OBJ(1) | COPS_OBJ_ANY},
+        /* OPN: <PEPID> *(<ClientSI>) [<LastPDPAddr>] */
+        [6] = {COPS_OP_PCMM, COPS_OBJ(11), COPS_OBJ(11) | COPS_OBJ(9) | COPS_OBJ(14) | COPS_OBJ_ANY},
+        /* CAT: <KA Timer> [<ACCT Timer>] */
+        [7] = {COPS_OP_PCMM, COPS_OBJ(10), COPS_OBJ(10) | COPS_OBJ(15) | COPS_OBJ_ANY},
+        /* CC: <Error> [<PDPRedirAddr>] */
+        [8] = {COPS_OP_PCMM, COPS_OBJ(8), COPS_OBJ(8) | COPS_OBJ(13) | COPS_OBJ_ANY},
+        /* KA */
+        [9] = {COPS_OP_PCMM | COPS_OP_KA, 0, COPS_OBJ_ANY},
+        /* SSC: [<Handle>] */
+        [10] = {0, 0, COPS_OBJ(1) | COPS_OBJ_ANY},
+};
+
+/* Legal C-Types per C-Num, bit n set when C-Type n is defined (RFC 2748 section 2.2). */
+static const uint8_t cops_class_ctypes[256] = {
+        [1] = 0x02,  /* Handle */
+        [2] = 0x02,  /* Context */
+        [3] = 0x06,  /* IN-Int, IPv4 and IPv6 */
+        [4] = 0x06,  /* OUT-Int, IPv4 and IPv6 */
+        [5] = 0x02,  /* Reason */
+        [6] = 0x3E,  /* Decision, Flags through Client Specific Decision Data */
+        [7] = 0x3E,  /* LPDP Decision */
+        [8] = 0x02,  /* Error */
+        [9] = 0x06,  /* ClientSI, signaled and named */
+        [10] = 0x02, /* KA Timer */
+        [11] = 0x02, /* PEPID */
+        [12] = 0x02, /* Report-Type */
+        [13] = 0x06, /* PDPRedirAddr, IPv4 and IPv6 */
+        [14] = 0x06, /* LastPDPAddr, IPv4 and IPv6 */
+        [15] = 0x02, /* ACCT Timer */
+        [16] = 0x02, /* Integrity */
+};
+
+static inline enum cops_verr
+cops_verr_at(enum cops_verr err, uint32_t off, uint32_t* err_off) {
+        if (err_off)
+                *err_off = off;
+        return err;
+}
+
+enum cops_verr
+cops_validate(const uint8_t* buf, size_t len, uint32_t max_len, uint32_t* err_off) {
+        if (len < COPS_HEADER_LEN)
+                return cops_verr_at(COPS_VERR_SHORT, (uint32_t)len, err_off);
+
+        const struct cops_op_rule* rule = &cops_op_rules[buf[1]];
+        uint16_t client_type = cops_load16(buf + 2);
+        uint32_t mlen = cops_load32(buf + 4);
+
+        if (max_len == 0)
+                max_len = COPS_VALIDATE_DEFAULT_MAX;
+
+        if ((buf[0] >> 4) != 1)
+                return cops_verr_at(COPS_VERR_VERSION, 0, err_off);
+        if (!(rule->flags & COPS_OP_PCMM))
+                return cops_verr_at(COPS_VERR_OPCODE, 1, err_off);
+        if (client_type != ((rule->flags & COPS_OP_KA) ? 0 : PCMM_CLIENT_TYPE))
+                return cops_verr_at(COPS_VERR_CLIENT_TYPE, 2, err_off);
+        if (mlen < COPS_HEADER_LEN || (mlen & 3) != 0 || mlen > max_len)
+                return cops_verr_at(COPS_VERR_LENGTH, 4, err_off);
+        if (len < mlen)
+                return cops_verr_at(COPS_VERR_SHORT, (uint32_t)len, err_off);
+
+        /*
+         * The message length is word aligned and every step is a multiple of four, so an object
+         * header always fits once off < mlen. The three per-object checks are folded into one
+         * rarely taken branch, the error is only classified on the way out.
+         */
+        uint32_t seen = 0;
+        uint32_t off = COPS_HEADER_LEN;
+
+        while (off < mlen) {
+                uint32_t olen = cops_load16(buf + off);
+                uint8_t cnum = buf[off + 2];
+                uint8_t ctype = buf[off + 3];
+                uint32_t next = off + COPS_ALIGN4(olen);
+                uint32_t bit = 1u << (cnum & 31);
+
+                bool len_ok = (olen >= COPS_OBJ_HEADER_LEN) & (next <= mlen);
+                bool class_ok = (ctype < 8) & ((cops_class_ctypes[cnum] >> (ctype & 7)) & 1);
+                bool allowed = (rule->allowed & bit) != 0;
+
+                if (__builtin_expect(!(len_ok & class_ok & allowed), 0)) {
+                        if (!len_ok)
+                                return cops_verr_at(COPS_VERR_OBJ_LENGTH, off, err_off);
+                        if (!class_ok)
+                                return cops_verr_at(COPS_VERR_OBJ_CLASS, off, err_off);
+                        return cops_verr_at(COPS_VERR_OBJ_UNEXPECTED, off, err_off);
+                }
+
+                seen |= bit;
+                off = next;
+        }
+
+        if ((seen & rule->required) != rule->required)
+                return cops_verr_at(COPS_VERR_OBJ_MISSING, mlen, err_off);
+
+        return COPS_VERR_NONE;
+}
+
+const char*
+cops_verr_str(enum cops_verr err) {
+        switch (err) {
+                case COPS_VERR_NONE:           return "ok";
+                case COPS_VERR_SHORT:          return "truncated message";
+                case COPS_VERR_VERSION:        return "unsupported version";
+                case COPS_VERR_OPCODE:         return "invalid op code";
+                case COPS_VERR_CLIENT_TYPE:    return "invalid client type";
+                case COPS_VERR_LENGTH:         return "invalid message length";
+                case COPS_VERR_OBJ_LENGTH:     return "invalid object length";
+                case COPS_VERR_OBJ_CLASS:      return "unknown object class";
+                case COPS_VERR_OBJ_UNEXPECTED: return "object not allowed in message";
+                case COPS_VERR_OBJ_MISSING:    return "mandatory object missing";
+                default:                       return "unknown error";
+        }
+}
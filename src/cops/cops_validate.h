@@ -0,0 +1,45 @@
+#ifndef COPS_VALIDATE_H
+#define COPS_VALIDATE_H
+
+#include "cops.h"
+#include "pcmm.h"
+
+/* Length cap applied when none is given, the largest value representable in an object length. */
+#define COPS_VALIDATE_DEFAULT_MAX 65535
+
+/* Reasons a message is rejected by cops_validate, in the order the checks run. */
+enum cops_verr {
+        COPS_VERR_NONE = 0,
+        COPS_VERR_SHORT,          /* Buffer holds less than the header or the message length. */
+        COPS_VERR_VERSION,        /* Version field is not 1. */
+        COPS_VERR_OPCODE,         /* Op Code not used by PacketCable Multimedia. */
+        COPS_VERR_CLIENT_TYPE,    /* Not 0x800A, or not 0 for a Keep-Alive. */
+        COPS_VERR_LENGTH,         /* Message length below a header, not word aligned or above the cap. */
+        COPS_VERR_OBJ_LENGTH,     /* Object shorter than its header or overrunning the message. */
+        COPS_VERR_OBJ_CLASS,      /* Unknown C-Num or C-Type. */
+        COPS_VERR_OBJ_UNEXPECTED, /* Known object that is not allowed in this message. */
+        COPS_VERR_OBJ_MISSING,    /* A mandatory object is absent. */
+};
+
+/*
+ * Validate one complete message in a single pass over its object chain.
+ *
+ * The opcode and every (C-Num, C-Type) pair are checked against constant 256-entry tables, the
+ * objects present are collected in a bitmask that is compared with the allowed and required
+ * objects of the opcode (RFC 2748 section 3). Object lengths are checked to be at least a
+ * header and to add up, after padding to 32-bit words, to exactly the message length.
+ *
+ * @buf         Message, starting at the common header
+ * @len         Bytes available in buf
+ * @max_len     Largest acceptable message length, 0 selects COPS_VALIDATE_DEFAULT_MAX
+ * @err_off     Receives the offset of the offending field or object, may be NULL. For
+ *              COPS_VERR_OBJ_MISSING it is the message length.
+ *
+ * Returns COPS_VERR_NONE when the message is well formed.
+ */
+enum cops_verr cops_validate(const uint8_t* buf, size_t len, uint32_t max_len, uint32_t* err_off);
+
+/* Return a short description of a validation error. */
+const char* cops_verr_str(enum cops_verr err);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef COPS_WIRE_H
+#define COPS_WIRE_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Big-endian loads and stores of 16, 32 and 64-bit words at any alignment. Each one is a
+ * memcpy to or from a local plus a byte swap, which the compiler turns into a single
+ * (unaligned) move and a bswap or movbe, where shifting the value out byte by byte costs one
+ * store per byte.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define COPS_BE16(v) ((uint16_t)(v))
+#define COPS_BE32(v) ((uint32_t)(v))
+#define COPS_BE64(v) ((uint64_t)(v))
+#else
+#define COPS_BE16(v) __builtin_bswap16(v)
+#define COPS_BE32(v) __builtin_bswap32(v)
+#define COPS_BE64(v) __builtin_bswap64(v)
+#endif
+
+/* PacketCable Multimedia Client-Type. */
+#define COPS_CLIENT_TYPE_PCMM 0x800A
+
+/*
+ * First word of the common header (Version 1, no flags, Op Code and Client-Type) and word of
+ * an object header (Length, C-Num and C-Type, or S-Num and S-Type), in host byte order. Both
+ * fold to constants when their arguments do.
+ */
+#define COPS_HDR_WORD(opcode, client_type)                                                                             \
+        ((uint32_t)0x10 << 24 | (uint32_t)(uint8_t)(opcode) << 16 | (uint32_t)(uint16_t)(client_type))
+#define COPS_OBJ_WORD(len, num, type) ((uint32_t)(uint16_t)(len) << 16 | (uint32_t)(num) << 8 | (uint32_t)(type))
+
+/* The whole Keep-Alive message: Op Code 9, Client-Type 0, length 8. */
+#define COPS_KA_MESSAGE ((uint64_t)COPS_HDR_WORD(9, 0) << 32 | 8)
+
+static inline uint16_t
+cops_load16(const uint8_t* src) {
+        uint16_t v;
+
+        memcpy(&v, src, sizeof(v));
+        return COPS_BE16(v);
+}
+
+static inline uint32_t
+cops_load32(const uint8_t* src) {
+        uint32_t v;
+
+        memcpy(&v, src, sizeof(v));
+        return COPS_BE32(v);
+}
+
+static inline uint64_t
+cops_load64(const uint8_t* src) {
+        uint64_t v;
+
+        memcpy(&v, src, sizeof(v));
+        return COPS_BE64(v);
+}
+
+static inline void
+cops_store16(uint8_t* dst, uint16_t v) {
+        v = COPS_BE16(v);
+        memcpy(dst, &v, sizeof(v));
+}
+
+static inline void
+cops_store32(uint8_t* dst, uint32_t v) {
+        v = COPS_BE32(v);
+        memcpy(dst, &v, sizeof(v));
+}
+
+static inline void
+cops_store64(uint8_t* dst, uint64_t v) {
+        v = COPS_BE64(v);
+        memcpy(dst, &v, sizeof(v));
+}
+
+/* Common header of a PCMM message of len bytes: two word stores. */
+static inline void
+cops_put_header(uint8_t* dst, uint8_t opcode, uint32_t len) {
+        cops_store64(dst, (uint64_t)COPS_HDR_WORD(opcode, COPS_CLIENT_TYPE_PCMM) << 32 | len);
+}
+
+/* Object header of an object of len bytes, header included. */
+static inline void
+cops_put_objhdr(uint8_t* dst, uint16_t len, uint8_t num, uint8_t type) {
+        cops_store32(dst, COPS_OBJ_WORD(len, num, type));
+}
+
+#endif
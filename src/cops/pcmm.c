@@ -0,0 +1,198 @@
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "pcmm.h"
+
+/* Header word of an object whose length is the size of its wire struct. */
+#define PCMM_HDR(wire, snum, stype) htonl(PCMM_HDR_WORD(sizeof(wire), snum, stype))
+
+static inline uint32_t
+pcmm_float_bits(float f) {
+        uint32_t bits;
+
+        memcpy(&bits, &f, sizeof(bits));
+        return htonl(bits);
+}
+
+size_t
+pcmm_transaction_id(uint8_t* dst, uint16_t trans_id, uint16_t command) {
+        struct pcmm_wire_transaction_id w = {
+                .hdr = PCMM_HDR(w, PCMM_SNUM_TRANSACTION_ID, 1),
+                .trans_id = htons(trans_id),
+                .command = htons(command),
+        };
+
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_amid(uint8_t* dst, uint16_t am_tag, uint16_t app_type) {
+        struct pcmm_wire_amid w = {
+                .hdr = PCMM_HDR(w, PCMM_SNUM_AMID, 1),
+                .am_tag = htons(am_tag),
+                .app_type = htons(app_type),
+        };
+
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_subscriber_v4(uint8_t* dst, const uint8_t addr[4]) {
+        struct pcmm_wire_subscriber_v4 w = {.hdr = PCMM_HDR(w, PCMM_SNUM_SUBSCRIBER_ID, PCMM_STYPE_SUBSCRIBER_IPV4)};
+
+        memcpy(w.addr, addr, sizeof(w.addr));
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_subscriber_v6(uint8_t* dst, const uint8_t addr[16]) {
+        struct pcmm_wire_subscriber_v6 w = {.hdr = PCMM_HDR(w, PCMM_SNUM_SUBSCRIBER_ID, PCMM_STYPE_SUBSCRIBER_IPV6)};
+
+        memcpy(w.addr, addr, sizeof(w.addr));
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_gate_id(uint8_t* dst, uint32_t gate_id) {
+        struct pcmm_wire_gate_id w = {
+                .hdr = PCMM_HDR(w, PCMM_SNUM_GATE_ID, 1),
+                .gate_id = htonl(gate_id),
+        };
+
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_error(uint8_t* dst, uint16_t code, uint16_t subcode) {
+        struct pcmm_wire_error w = {
+                .hdr = PCMM_HDR(w, PCMM_SNUM_ERROR, 1),
+                .code = htons(code),
+                .subcode = htons(subcode),
+        };
+
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_gate_spec(uint8_t* dst, const struct pcmm_gate_spec* spec) {
+        struct pcmm_wire_gate_spec w = {
+                .hdr = PCMM_HDR(w, PCMM_SNUM_GATE_SPEC, 1),
+                .flags = spec->flags,
+                .tos = spec->tos,
+                .tos_mask = spec->tos_mask,
+                .session_class = spec->session_class,
+                .t1 = htons(spec->t1),
+                .t2 = htons(spec->t2),
+                .t3 = htons(spec->t3),
+                .t4 = htons(spec->t4),
+        };
+
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_classifier(uint8_t* dst, const struct pcmm_classifier* c) {
+        struct pcmm_wire_classifier w = {
+                .hdr = PCMM_HDR(w, PCMM_SNUM_CLASSIFIER, PCMM_STYPE_CLASSIFIER),
+                .protocol = htons(c->protocol),
+                .tos = c->tos,
+                .tos_mask = c->tos_mask,
+                .src_port = htons(c->src_port),
+                .dst_port = htons(c->dst_port),
+                .priority = c->priority,
+        };
+
+        memcpy(w.src, c->src, 4);
+        memcpy(w.dst, c->dst, 4);
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_ext_classifier(uint8_t* dst, const struct pcmm_ext_classifier* c) {
+        struct pcmm_wire_ext_classifier w = {
+                .hdr = PCMM_HDR(w, PCMM_SNUM_CLASSIFIER, PCMM_STYPE_EXTENDED_CLASSIFIER),
+                .protocol = htons(c->protocol),
+                .tos = c->tos,
+                .tos_mask = c->tos_mask,
+                .src_port_start = htons(c->src_port_start),
+                .src_port_end = htons(c->src_port_end),
+                .dst_port_start = htons(c->dst_port_start),
+                .dst_port_end = htons(c->dst_port_end),
+                .classifier_id = htons(c->classifier_id),
+                .priority = c->priority,
+                .state = c->state,
+                .action = c->action,
+        };
+
+        memcpy(w.src, c->src, 4);
+        memcpy(w.src_mask, c->src_mask, 4);
+        memcpy(w.dst, c->dst, 4);
+        memcpy(w.dst_mask, c->dst_mask, 4);
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_flow_spec(uint8_t* dst, const struct pcmm_flow_spec* fs) {
+        struct pcmm_wire_flow_spec w = {
+                .hdr = PCMM_HDR(w, PCMM_SNUM_TRAFFIC_PROFILE, PCMM_STYPE_FLOW_SPEC),
+                .envelope = fs->envelope,
+                .service = fs->service,
+                .rate = pcmm_float_bits(fs->rate),
+                .bucket_size = pcmm_float_bits(fs->bucket_size),
+                .peak_rate = pcmm_float_bits(fs->peak_rate),
+                .min_policed_unit = htonl(fs->min_policed_unit),
+                .max_packet_size = htonl(fs->max_packet_size),
+                .reserved_rate = pcmm_float_bits(fs->reserved_rate),
+                .slack_term = htonl(fs->slack_term),
+        };
+
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_best_effort(uint8_t* dst, const struct pcmm_best_effort* be) {
+        struct pcmm_wire_best_effort w = {
+                .hdr = PCMM_HDR(w, PCMM_SNUM_TRAFFIC_PROFILE, PCMM_STYPE_BEST_EFFORT),
+                .envelope = be->envelope,
+                .priority = be->priority,
+                .request_policy = htonl(be->request_policy),
+                .max_sustained_rate = htonl(be->max_sustained_rate),
+                .max_burst = htonl(be->max_burst),
+                .min_reserved_rate = htonl(be->min_reserved_rate),
+                .min_packet_size = htons(be->min_packet_size),
+                .max_concat_burst = htons(be->max_concat_burst),
+        };
+
+        memcpy(dst, &w, sizeof(w));
+        return sizeof(w);
+}
+
+size_t
+pcmm_service_class(uint8_t* dst, uint8_t envelope, const char* name) {
+        size_t n = strnlen(name, PCMM_SERVICE_CLASS_NAME_MAX + 1);
+
+        if (n == 0 || n > PCMM_SERVICE_CLASS_NAME_MAX)
+                return 0;
+
+        /* Envelope word, then the name with its NUL padded to a word. */
+        uint16_t len = (uint16_t)(8 + ((n + 1 + 3) & ~(size_t)3));
+        uint32_t hdr = htonl(PCMM_HDR_WORD(len, PCMM_SNUM_TRAFFIC_PROFILE, PCMM_STYPE_SERVICE_CLASS_NAME));
+        uint32_t env = htonl((uint32_t)envelope << 24);
+
+        memcpy(dst, &hdr, 4);
+        memcpy(dst + 4, &env, 4);
+        memset(dst + len - 4, 0, 4);
+        memcpy(dst + 8, name, n);
+
+        return len;
+}
@@ -0,0 +1,302 @@
+#ifndef PCMM_H
+#define PCMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * PacketCable Multimedia objects are carried inside the COPS Client Specific Decision Data
+ * object (C-Num = 6, C-Type = 4) of a Decision message and inside the Client SI object of a
+ * Report-State message. They are numbered in a client-specific space (S-Num and S-Type).
+ *
+ * +-----------------------------------+------------------+----------------------------+
+ * | Length  (2-bytes)                 | S-Num (1-byte)   | S-Type (1-byte)            |
+ * +-----------------------------------+------------------+----------------------------+
+ */
+#define PCMM_CLIENT_TYPE 0x800A
+
+/* Client Specific Decision Data (COPS C-Num/C-Type). */
+#define COPS_CNUM_DECISION    6
+#define COPS_CTYPE_CLIENT_SI  4
+#define COPS_CNUM_CLIENT_SI   9
+
+/* PCMM S-Num values. */
+#define PCMM_SNUM_TRANSACTION_ID  1
+#define PCMM_SNUM_AMID            2
+#define PCMM_SNUM_SUBSCRIBER_ID   3
+#define PCMM_SNUM_GATE_ID         4
+#define PCMM_SNUM_GATE_SPEC       5
+#define PCMM_SNUM_CLASSIFIER      6
+#define PCMM_SNUM_TRAFFIC_PROFILE 7
+#define PCMM_SNUM_ERROR           14
+#define PCMM_SNUM_GATE_STATE      15
+#define PCMM_SNUM_VERSION_INFO    16
+
+/* PacketCable Error-Code values. */
+#define PCMM_ERROR_RESOURCES 1 /* Insufficient Resources. */
+
+/* Subscriber ID S-Type values. */
+#define PCMM_STYPE_SUBSCRIBER_IPV4 1
+#define PCMM_STYPE_SUBSCRIBER_IPV6 2
+
+/* Traffic Profile S-Type values. */
+#define PCMM_STYPE_FLOW_SPEC          1
+#define PCMM_STYPE_SERVICE_CLASS_NAME 2
+#define PCMM_STYPE_BEST_EFFORT        3
+
+/* Gate Command Type carried in the Transaction ID object. */
+#define PCMM_GATE_SET         4
+#define PCMM_GATE_SET_ACK     5
+#define PCMM_GATE_SET_ERR     6
+#define PCMM_GATE_INFO        7
+#define PCMM_GATE_INFO_ACK    8
+#define PCMM_GATE_INFO_ERR    9
+#define PCMM_GATE_DELETE      10
+#define PCMM_GATE_DELETE_ACK  11
+#define PCMM_GATE_DELETE_ERR  12
+#define PCMM_GATE_OPEN        13
+#define PCMM_GATE_CLOSE       14
+
+/* Body length of the Gate Spec object (Flags, TOS, TOS mask, Session Class and timers T1-T4). */
+#define PCMM_GATE_SPEC_LEN 12
+
+/* Classifier S-Type values. */
+#define PCMM_STYPE_CLASSIFIER          1
+#define PCMM_STYPE_EXTENDED_CLASSIFIER 2
+
+/* Gate Spec flags. */
+#define PCMM_GATE_FLAG_UPSTREAM  0x01 /* Direction, downstream when clear. */
+#define PCMM_GATE_FLAG_DSCP_TOS  0x02 /* Enable DSCP/TOS overwrite. */
+
+/* Traffic Profile envelope bits. */
+#define PCMM_ENVELOPE_AUTHORIZED 0x01
+#define PCMM_ENVELOPE_RESERVED   0x02
+#define PCMM_ENVELOPE_COMMITTED  0x04
+
+/* Longest Service Class Name, excluding the terminating NUL. */
+#define PCMM_SERVICE_CLASS_NAME_MAX 15
+
+/* Object header word (Length, S-Num, S-Type) in host byte order. */
+#define PCMM_HDR_WORD(len, snum, stype) ((uint32_t)(len) << 16 | (uint32_t)(snum) << 8 | (uint32_t)(stype))
+
+/*
+ * Wire layouts of the PCMM objects. Every multi-byte field is big-endian and the structs are
+ * packed so their size is the object length on the wire, the encoders fill one on the stack
+ * and copy it out, which compiles to a few word stores.
+ */
+#define PCMM_PACKED __attribute__((packed))
+
+struct PCMM_PACKED pcmm_wire_transaction_id {
+        uint32_t hdr;
+        uint16_t trans_id;
+        uint16_t command;
+};
+
+struct PCMM_PACKED pcmm_wire_amid {
+        uint32_t hdr;
+        uint16_t am_tag;
+        uint16_t app_type;
+};
+
+struct PCMM_PACKED pcmm_wire_subscriber_v4 {
+        uint32_t hdr;
+        uint8_t addr[4];
+};
+
+struct PCMM_PACKED pcmm_wire_subscriber_v6 {
+        uint32_t hdr;
+        uint8_t addr[16];
+};
+
+struct PCMM_PACKED pcmm_wire_gate_id {
+        uint32_t hdr;
+        uint32_t gate_id;
+};
+
+struct PCMM_PACKED pcmm_wire_error {
+        uint32_t hdr;
+        uint16_t code;
+        uint16_t subcode;
+};
+
+struct PCMM_PACKED pcmm_wire_gate_spec {
+        uint32_t hdr;
+        uint8_t flags;
+        uint8_t tos;
+        uint8_t tos_mask;
+        uint8_t session_class;
+        uint16_t t1;
+        uint16_t t2;
+        uint16_t t3;
+        uint16_t t4;
+};
+
+struct PCMM_PACKED pcmm_wire_classifier {
+        uint32_t hdr;
+        uint16_t protocol;
+        uint8_t tos;
+        uint8_t tos_mask;
+        uint8_t src[4];
+        uint8_t dst[4];
+        uint16_t src_port;
+        uint16_t dst_port;
+        uint8_t priority;
+        uint8_t reserved[3];
+};
+
+struct PCMM_PACKED pcmm_wire_ext_classifier {
+        uint32_t hdr;
+        uint16_t protocol;
+        uint8_t tos;
+        uint8_t tos_mask;
+        uint8_t src[4];
+        uint8_t src_mask[4];
+        uint8_t dst[4];
+        uint8_t dst_mask[4];
+        uint16_t src_port_start;
+        uint16_t src_port_end;
+        uint16_t dst_port_start;
+        uint16_t dst_port_end;
+        uint16_t classifier_id;
+        uint8_t priority;
+        uint8_t state;
+        uint8_t action;
+        uint8_t reserved[3];
+};
+
+struct PCMM_PACKED pcmm_wire_flow_spec {
+        uint32_t hdr;
+        uint8_t envelope;
+        uint8_t service;
+        uint16_t reserved;
+        uint32_t rate;        /* IEEE 754 single precision. */
+        uint32_t bucket_size; /* IEEE 754 single precision. */
+        uint32_t peak_rate;   /* IEEE 754 single precision. */
+        uint32_t min_policed_unit;
+        uint32_t max_packet_size;
+        uint32_t reserved_rate; /* IEEE 754 single precision. */
+        uint32_t slack_term;
+};
+
+struct PCMM_PACKED pcmm_wire_best_effort {
+        uint32_t hdr;
+        uint8_t envelope;
+        uint8_t reserved0[3];
+        uint8_t priority;
+        uint8_t reserved1[3];
+        uint32_t request_policy;
+        uint32_t max_sustained_rate;
+        uint32_t max_burst;
+        uint32_t min_reserved_rate;
+        uint16_t min_packet_size;
+        uint16_t max_concat_burst;
+};
+
+_Static_assert(sizeof(struct pcmm_wire_transaction_id) == 8, "Transaction ID is 8 bytes");
+_Static_assert(sizeof(struct pcmm_wire_amid) == 8, "AMID is 8 bytes");
+_Static_assert(sizeof(struct pcmm_wire_subscriber_v4) == 8, "IPv4 Subscriber ID is 8 bytes");
+_Static_assert(sizeof(struct pcmm_wire_subscriber_v6) == 20, "IPv6 Subscriber ID is 20 bytes");
+_Static_assert(sizeof(struct pcmm_wire_gate_id) == 8, "Gate ID is 8 bytes");
+_Static_assert(sizeof(struct pcmm_wire_error) == 8, "PacketCable Error is 8 bytes");
+_Static_assert(sizeof(struct pcmm_wire_gate_spec) == 4 + PCMM_GATE_SPEC_LEN, "Gate Spec is 16 bytes");
+_Static_assert(offsetof(struct pcmm_wire_gate_spec, t1) == 8, "Gate Spec timers start at the second word");
+_Static_assert(sizeof(struct pcmm_wire_classifier) == 24, "Classifier is 24 bytes");
+_Static_assert(offsetof(struct pcmm_wire_classifier, src_port) == 16, "Classifier ports at word 4");
+_Static_assert(sizeof(struct pcmm_wire_ext_classifier) == 40, "Extended Classifier is 40 bytes");
+_Static_assert(offsetof(struct pcmm_wire_ext_classifier, classifier_id) == 32, "Classifier ID at word 8");
+_Static_assert(sizeof(struct pcmm_wire_flow_spec) == 36, "Flow Spec with one envelope is 36 bytes");
+_Static_assert(offsetof(struct pcmm_wire_flow_spec, slack_term) == 32, "Slack Term is the last word");
+_Static_assert(sizeof(struct pcmm_wire_best_effort) == 32, "Best Effort with one envelope is 32 bytes");
+
+/* Gate Spec in host byte order. Timers are in seconds, 0 selects the CMTS default. */
+struct pcmm_gate_spec {
+        uint8_t flags; /* PCMM_GATE_FLAG_* */
+        uint8_t tos;
+        uint8_t tos_mask;
+        uint8_t session_class;
+        uint16_t t1; /* Authorized */
+        uint16_t t2; /* Reserved */
+        uint16_t t3; /* Committed */
+        uint16_t t4; /* Committed-Recovery */
+};
+
+/* Classifier (S-Type 1) in host byte order, addresses in network byte order. */
+struct pcmm_classifier {
+        uint16_t protocol;
+        uint8_t tos;
+        uint8_t tos_mask;
+        uint8_t src[4];
+        uint8_t dst[4];
+        uint16_t src_port;
+        uint16_t dst_port;
+        uint8_t priority;
+};
+
+/* Extended Classifier (S-Type 2) in host byte order, addresses and masks in network byte order. */
+struct pcmm_ext_classifier {
+        uint16_t protocol;
+        uint8_t tos;
+        uint8_t tos_mask;
+        uint8_t src[4];
+        uint8_t src_mask[4];
+        uint8_t dst[4];
+        uint8_t dst_mask[4];
+        uint16_t src_port_start;
+        uint16_t src_port_end;
+        uint16_t dst_port_start;
+        uint16_t dst_port_end;
+        uint16_t classifier_id;
+        uint8_t priority;
+        uint8_t state; /* 1 = active */
+        uint8_t action;
+};
+
+/* RSVP style Flow Spec (Traffic Profile S-Type 1), one envelope. */
+struct pcmm_flow_spec {
+        uint8_t envelope; /* PCMM_ENVELOPE_* */
+        uint8_t service;  /* 2 = Guaranteed, 5 = Controlled Load */
+        float rate;
+        float bucket_size;
+        float peak_rate;
+        uint32_t min_policed_unit;
+        uint32_t max_packet_size;
+        float reserved_rate;
+        uint32_t slack_term;
+};
+
+/* DOCSIS Best Effort service (Traffic Profile S-Type 3), authorized envelope. */
+struct pcmm_best_effort {
+        uint8_t envelope;
+        uint8_t priority;
+        uint32_t request_policy;
+        uint32_t max_sustained_rate;
+        uint32_t max_burst;
+        uint32_t min_reserved_rate;
+        uint16_t min_packet_size;
+        uint16_t max_concat_burst;
+};
+
+/*
+ * Encoders. Each writes one complete object (header included) to dst, which MUST have room
+ * for the matching wire struct, and returns the object length.
+ */
+size_t pcmm_transaction_id(uint8_t* dst, uint16_t trans_id, uint16_t command);
+size_t pcmm_amid(uint8_t* dst, uint16_t am_tag, uint16_t app_type);
+size_t pcmm_subscriber_v4(uint8_t* dst, const uint8_t addr[4]);
+size_t pcmm_subscriber_v6(uint8_t* dst, const uint8_t addr[16]);
+size_t pcmm_gate_id(uint8_t* dst, uint32_t gate_id);
+size_t pcmm_error(uint8_t* dst, uint16_t code, uint16_t subcode);
+size_t pcmm_gate_spec(uint8_t* dst, const struct pcmm_gate_spec* spec);
+size_t pcmm_classifier(uint8_t* dst, const struct pcmm_classifier* c);
+size_t pcmm_ext_classifier(uint8_t* dst, const struct pcmm_ext_classifier* c);
+size_t pcmm_flow_spec(uint8_t* dst, const struct pcmm_flow_spec* fs);
+size_t pcmm_best_effort(uint8_t* dst, const struct pcmm_best_effort* be);
+
+/*
+ * Service Class Name Traffic Profile (S-Type 2). The name is NUL terminated and padded to a
+ * word, dst MUST hold 8 + 16 bytes. Returns 0 when the name is empty or longer than
+ * PCMM_SERVICE_CLASS_NAME_MAX.
+ */
+size_t pcmm_service_class(uint8_t* dst, uint8_t envelope, const char* name);
+
+#endif
@@ -0,0 +1,95 @@
+#include "cops_admit.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+static void
+tp_cops_bucket_refill(void) {
+        info();
+
+        struct cops_bucket b;
+        uint64_t now = 1000;
+        int taken = 0;
+
+        /* 100 per second with the default burst of 10: the burst goes at once, then one per 10 ms. */
+        cops_bucket_init(&b, 100, 0, now);
+        while (cops_bucket_wait(&b, now) == 0) {
+                cops_bucket_take(&b);
+                taken++;
+        }
+        TP_ASSERT(taken == 10);
+        TP_ASSERT(cops_bucket_wait(&b, now) == 10);
+        TP_ASSERT(cops_bucket_wait(&b, now + 4) == 6);
+        TP_ASSERT(cops_bucket_wait(&b, now + 10) == 0);
+        cops_bucket_take(&b);
+        TP_ASSERT(cops_bucket_wait(&b, now + 10) == 10);
+
+        /* Tokens earned in part carry over, the clock never runs backwards. */
+        TP_ASSERT(cops_bucket_wait(&b, now + 15) == 5);
+        TP_ASSERT(cops_bucket_wait(&b, now + 5) == 5);
+
+        /* A long idle period only fills the bucket up to its burst. */
+        now += 3600 * 1000;
+        taken = 0;
+        while (cops_bucket_wait(&b, now) == 0) {
+                cops_bucket_take(&b);
+                taken++;
+        }
+        TP_ASSERT(taken == 10);
+
+        /* Rates below one per millisecond round the wait up, an explicit burst is kept. */
+        cops_bucket_init(&b, 3, 2, 0);
+        cops_bucket_take(&b);
+        cops_bucket_take(&b);
+        TP_ASSERT(cops_bucket_wait(&b, 0) == 334);
+        TP_ASSERT(cops_bucket_wait(&b, 333) == 1 && cops_bucket_wait(&b, 334) == 0);
+
+        /* Rate 0 is no limit. */
+        cops_bucket_init(&b, 0, 0, 0);
+        for (int i = 0; i < 1000; i++)
+                cops_bucket_take(&b);
+        TP_ASSERT(cops_bucket_wait(&b, 0) == 0);
+}
+
+static void
+tp_cops_admit_take(void) {
+        info();
+
+        struct cops_admit_config cfg = {
+            .session_rate = 1000,
+            .session_burst = 5,
+            .global_rate = 1000,
+            .global_burst = 8,
+        };
+        struct cops_admit a;
+        struct cops_bucket s1;
+        struct cops_bucket s2;
+        int admitted = 0;
+
+        cops_admit_init(&a, &cfg, 0);
+        cops_admit_session(&a, &s1, 0);
+        cops_admit_session(&a, &s2, 0);
+
+        /* A session cannot use more than its own burst, the rest of the global one is left to others. */
+        while (cops_admit_take(&a, &s1, 0) == 0)
+                admitted++;
+        TP_ASSERT(admitted == 5);
+        TP_ASSERT(cops_admit_take(&a, &s1, 0) == 1);
+
+        /* The second session runs into the global limit, a refusal costs its own bucket nothing. */
+        for (admitted = 0; cops_admit_take(&a, &s2, 0) == 0;)
+                admitted++;
+        TP_ASSERT(admitted == 3);
+        TP_ASSERT(s2.tokens == 2 * COPS_BUCKET_SCALE);
+
+        /* Both buckets refill lazily from the caller's clock. */
+        TP_ASSERT(cops_admit_take(&a, &s2, 2) == 0 && cops_admit_take(&a, &s2, 2) == 0);
+        TP_ASSERT(cops_admit_take(&a, &s2, 2) == 1);
+        TP_ASSERT(cops_admit_take(&a, &s1, 3) == 0);
+}
+
+void
+test_admit(void) {
+        tp_cops_bucket_refill();
+        tp_cops_admit_take();
+}
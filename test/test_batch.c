@@ -0,0 +1,208 @@
+#include "cops_batch.h"
+#include "cops_decoder.h"
+#include "cops_template.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+static const uint8_t profile[8] = {0, 0, 0, 0, 0x11, 0x22, 0x33, 0x44};
+
+static void
+gate_op(struct cops_gate_op* op, const char* handle, uint16_t trans_id, uint8_t family, bool has_gate_id) {
+        memset(op, 0, sizeof(*op));
+        memcpy(op->handle, handle, 4);
+        op->trans_id = trans_id;
+        op->command = PCMM_GATE_SET;
+        op->am_tag = 0x1234;
+        op->app_type = 1;
+        op->family = family;
+        op->has_gate_id = has_gate_id;
+        op->gate_id = 0x01020304;
+        for (int i = 0; i < 16; i++)
+                op->subscriber[i] = (uint8_t)(i + 1);
+        op->gate_spec[5] = 200;
+}
+
+static void
+tp_cops_batch_matches_template(void) {
+        info();
+
+        struct cops_gate_op ops[3];
+        uint32_t offsets[4];
+        uint8_t buf[512];
+        uint8_t ref[COPS_TEMPLATE_MAX];
+
+        gate_op(&ops[0], "aaaa", 1, AF_INET, false);
+        gate_op(&ops[1], "bbbb", 2, AF_INET6, false);
+        gate_op(&ops[2], "cccc", 3, AF_INET, true);
+
+        size_t total = cops_batch_encode(buf, sizeof(buf), ops, 3, profile, sizeof(profile), PCMM_STYPE_BEST_EFFORT,
+                                         offsets);
+        TP_ASSERT(total == offsets[3]);
+        TP_ASSERT(offsets[0] == 0);
+
+        /* Every message must be byte identical to the equivalent template render. */
+        for (int i = 0; i < 3; i++) {
+                struct cops_dec_template t;
+                struct cops_dec_layout l = {0};
+                const uint32_t words[1] = {0x11223344};
+                const uint8_t w[1] = {1};
+
+                l.command = ops[i].command;
+                l.am_tag = ops[i].am_tag;
+                l.app_type = ops[i].app_type;
+                l.family = ops[i].family;
+                l.gate_id = ops[i].has_gate_id;
+                l.gate_spec = ops[i].gate_spec;
+                l.profile = profile;
+                l.profile_len = sizeof(profile);
+                l.profile_stype = PCMM_STYPE_BEST_EFFORT;
+                l.profile_words = w;
+                l.nprofile_words = 1;
+                TP_ASSERT(cops_dec_template_init(&t, &l) == 0);
+
+                struct cops_dec_fields f = {ops[i].handle, ops[i].trans_id, ops[i].gate_id, ops[i].subscriber, words};
+                size_t len = cops_dec_template_render(&t, ref, &f);
+
+                TP_ASSERT(offsets[i + 1] - offsets[i] == len);
+                TP_ASSERT(memcmp(buf + offsets[i], ref, len) == 0);
+        }
+
+        /* The batch is one stream of back to back messages. */
+        const struct cops_msg* m = NULL;
+        struct cops_decoder dec;
+        size_t off = 0;
+        int count = 0;
+        int ret;
+
+        cops_decoder_init(&dec);
+        while ((ret = cops_decode(&dec, buf + off, total - off, &m)) > 0) {
+                off += ret;
+                count++;
+        }
+        TP_ASSERT(count == 3);
+        TP_ASSERT(off == total);
+}
+
+static void
+tp_cops_batch_large(void) {
+        info();
+
+        static struct cops_gate_op ops[200];
+        static uint32_t offsets[201];
+        static uint8_t buf[200 * 128];
+
+        for (int i = 0; i < 200; i++)
+                gate_op(&ops[i], "hdl0", (uint16_t)i, (i % 3) ? AF_INET : AF_INET6, (i % 2) == 0);
+
+        size_t total = cops_batch_encode(buf, sizeof(buf), ops, 200, profile, sizeof(profile), 3, offsets);
+        TP_ASSERT(total != 0);
+
+        /* Spot check the Transaction ID of messages spanning several chunks. */
+        for (int i = 0; i < 200; i += 37) {
+                uint8_t* tid = buf + offsets[i] + 8 + 24 + 4 + 4;
+                TP_ASSERT(tid[0] == 0 && tid[1] == (uint8_t)i);
+        }
+}
+
+static void
+tp_cops_batch_rejects(void) {
+        info();
+
+        struct cops_gate_op ops[2];
+        uint32_t offsets[3];
+        uint8_t buf[256];
+
+        gate_op(&ops[0], "aaaa", 1, AF_INET, false);
+        gate_op(&ops[1], "bbbb", 2, AF_INET, false);
+
+        /* Too small for the second message, nothing is written. */
+        memset(buf, 0xEE, sizeof(buf));
+        TP_ASSERT(cops_batch_encode(buf, 100, ops, 2, profile, sizeof(profile), 3, offsets) == 0);
+        TP_ASSERT(buf[0] == 0xEE);
+
+        ops[1].family = 0;
+        TP_ASSERT(cops_batch_encode(buf, sizeof(buf), ops, 2, profile, sizeof(profile), 3, offsets) == 0);
+        TP_ASSERT(cops_batch_encode(buf, sizeof(buf), ops, 1, profile, 6, 3, offsets) == 0);
+}
+
+/* The reference encoding of a Gate-Info or Gate-Delete: pack_ctl_objs plus the Gate ID. */
+static size_t
+control_ref(uint8_t* dst, const struct cops_gate* g, uint16_t trans_id, uint16_t command) {
+        uint8_t body[128];
+        uint8_t handle[8], context[8], decision[8], tid[8], amid[8], sub[20];
+        char h[4];
+        size_t sub_len;
+
+        memcpy(h, &g->handle, 4);
+        cops_handle(handle, h);
+        cops_context(context);
+        cops_decision(decision);
+        pcmm_transaction_id(tid, trans_id, command);
+        pcmm_amid(amid, g->am_tag, g->app_type);
+        if (g->family == AF_INET6)
+                sub_len = pcmm_subscriber_v6(sub, g->subscriber);
+        else
+                sub_len = pcmm_subscriber_v4(sub, g->subscriber);
+
+        size_t len = pack_ctl_objs(body, handle, context, decision, tid, amid, sub, 4 + 8 + 8 + sub_len + 8, sub_len);
+        len += pcmm_gate_id(body + len, g->gate_id);
+        new_cops_message(dst, 2, body, (int)(COPS_HEADER_LEN + len));
+        return COPS_HEADER_LEN + len;
+}
+
+static void
+tp_cops_batch_control(void) {
+        info();
+
+        struct cops_gate_table t;
+        uint32_t handles[4] = {cops_handle_key("aaaa"), cops_handle_key("bbbb"), cops_handle_key("none"),
+                               cops_handle_key("cccc")};
+        uint32_t offsets[5];
+        uint8_t buf[512];
+        uint8_t ref[128];
+
+        TP_ASSERT(cops_gate_table_init(&t, 8) == 0);
+        for (int i = 0; i < 4; i++) {
+                if (i == 2)
+                        continue;
+                struct cops_gate* g = cops_gate_insert(&t, handles[i]);
+                g->gate_id = 0x01020300 + i;
+                g->am_tag = 0x1234;
+                g->app_type = (uint16_t)i;
+                g->family = (i == 1) ? AF_INET6 : AF_INET;
+                for (int j = 0; j < 16; j++)
+                        g->subscriber[j] = (uint8_t)(16 * i + j);
+        }
+
+        /* The handle without a gate gets an empty span, the others match the reference. */
+        TP_ASSERT(cops_batch_control(buf, sizeof(buf), &t, handles, 4, PCMM_GATE_DELETE, 100, offsets) == 4);
+        TP_ASSERT(offsets[0] == 0 && offsets[2] == offsets[3]);
+        for (int i = 0; i < 4; i++) {
+                if (i == 2)
+                        continue;
+                size_t len = control_ref(ref, cops_gate_find(&t, handles[i]), (uint16_t)(100 + i), PCMM_GATE_DELETE);
+                TP_ASSERT(offsets[i + 1] - offsets[i] == len);
+                TP_ASSERT(memcmp(buf + offsets[i], ref, len) == 0);
+        }
+        TP_ASSERT(offsets[4] == 68 + 80 + 68);
+
+        /* Encoding stops before the first message that does not fit, the caller sends and goes on. */
+        TP_ASSERT(cops_batch_control(buf, 68 + 79, &t, handles, 4, PCMM_GATE_INFO, 1, offsets) == 1);
+        TP_ASSERT(offsets[1] == 68);
+        TP_ASSERT(cops_batch_control(buf, 80, &t, handles + 1, 3, PCMM_GATE_INFO, 2, offsets) == 2);
+        TP_ASSERT(offsets[2] == 80);
+        TP_ASSERT(cops_batch_control(buf, 68, &t, handles + 3, 1, PCMM_GATE_INFO, 4, offsets) == 1);
+        control_ref(ref, cops_gate_find(&t, handles[3]), 4, PCMM_GATE_INFO);
+        TP_ASSERT(memcmp(buf, ref, 68) == 0);
+
+        cops_gate_table_free(&t);
+}
+
+void
+test_batch(void) {
+        tp_cops_batch_matches_template();
+        tp_cops_batch_large();
+        tp_cops_batch_rejects();
+        tp_cops_batch_control();
+}
@@ -0,0 +1,158 @@
+#include <unistd.h>
+
+#include "cops_builder.h"
+#include "cops_decoder.h"
+#include "pcmm.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+static const uint8_t command[8] = {0, 8, PCMM_SNUM_TRANSACTION_ID, 1, 0, 7, 0, PCMM_GATE_SET};
+static const uint8_t application[8] = {0, 8, PCMM_SNUM_AMID, 1, 0x12, 0x34, 0x00, 0x01};
+static const uint8_t subscriber[8] = {0, 8, PCMM_SNUM_SUBSCRIBER_ID, 1, 10, 1, 2, 3};
+
+/* Build the pack_ctl_objs object sequence, referencing the PCMM objects when zero_copy is set. */
+static size_t
+build_dec(struct cops_builder* b, uint8_t* buf, size_t cap, bool zero_copy) {
+        uint8_t handle[8], context[8], decision[8];
+        struct cops_builder_mark csi;
+
+        cops_handle(handle, "abcd");
+        cops_context(context);
+        cops_decision(decision);
+
+        cops_builder_init(b, buf, cap, 2);
+        cops_builder_append(b, handle, sizeof(handle));
+        cops_builder_append(b, context, sizeof(context));
+        cops_builder_append(b, decision, sizeof(decision));
+        cops_builder_begin(b, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI, &csi);
+        if (zero_copy) {
+                cops_builder_ref(b, command, sizeof(command));
+                cops_builder_ref(b, application, sizeof(application));
+                cops_builder_ref(b, subscriber, sizeof(subscriber));
+        } else {
+                cops_builder_append(b, command, sizeof(command));
+                cops_builder_append(b, application, sizeof(application));
+                cops_builder_append(b, subscriber, sizeof(subscriber));
+        }
+        cops_builder_end(b, &csi);
+
+        return cops_builder_finish(b);
+}
+
+static void
+tp_cops_builder_matches_pack_ctl_objs(void) {
+        info();
+
+        struct cops_builder b;
+        uint8_t buf[128];
+        uint8_t ref[128];
+        uint8_t handle[8], context[8], decision[8];
+
+        size_t len = build_dec(&b, buf, sizeof(buf), false);
+        TP_ASSERT(len == 8 + 24 + 4 + 24);
+        TP_ASSERT(b.iovcnt == 1);
+
+        cops_handle(handle, "abcd");
+        cops_context(context);
+        cops_decision(decision);
+
+        /* pack_ctl_objs must not write past the bytes it reports. */
+        memset(ref, 0xAA, sizeof(ref));
+        size_t n = pack_ctl_objs(ref, handle, context, decision, (uint8_t*)command, (uint8_t*)application,
+                                 (uint8_t*)subscriber, 28, 8);
+        TP_ASSERT(n == len - 8);
+        TP_ASSERT(ref[n] == 0xAA);
+        TP_ASSERT(memcmp(buf + 8, ref, n) == 0);
+
+        /* Header length fixed up at finish. */
+        const struct cops_msg* m = NULL;
+        struct cops_decoder dec;
+        cops_decoder_init(&dec);
+        TP_ASSERT(cops_decode(&dec, buf, len, &m) == (int)len);
+        TP_ASSERT(m->nobjs == 4);
+}
+
+static void
+tp_cops_builder_zero_copy_iov(void) {
+        info();
+
+        struct cops_builder b;
+        uint8_t buf[64];
+        uint8_t flat[128];
+        uint8_t contig_buf[128];
+        struct cops_builder contig;
+        int iovcnt = 0;
+
+        size_t len = build_dec(&b, buf, sizeof(buf), true);
+        size_t contig_len = build_dec(&contig, contig_buf, sizeof(contig_buf), false);
+        TP_ASSERT(len == contig_len);
+
+        /* Copied prefix, then one segment per referenced object. */
+        const struct iovec* iov = cops_builder_iov(&b, &iovcnt);
+        TP_ASSERT(iovcnt == 4);
+        TP_ASSERT(iov[1].iov_base == (void*)command);
+        TP_ASSERT(iov[3].iov_base == (void*)subscriber);
+        TP_ASSERT(b.len == 36);
+
+        TP_ASSERT(cops_builder_copy(&b, flat, sizeof(flat)) == len);
+        TP_ASSERT(memcmp(flat, contig_buf, len) == 0);
+
+        /* The iovec list goes straight to writev(). */
+        int fds[2];
+        TP_ASSERT(pipe(fds) == 0);
+        TP_ASSERT(writev(fds[1], iov, iovcnt) == (ssize_t)len);
+        TP_ASSERT(read(fds[0], flat, sizeof(flat)) == (ssize_t)len);
+        TP_ASSERT(memcmp(flat, contig_buf, len) == 0);
+        close(fds[0]);
+        close(fds[1]);
+}
+
+static void
+tp_cops_builder_padding(void) {
+        info();
+
+        struct cops_builder b;
+        uint8_t buf[32];
+        const char id[5] = {'p', 'e', 'p', '0', '1'};
+
+        memset(buf, 0xFF, sizeof(buf));
+        cops_builder_init(&b, buf, sizeof(buf), 6);
+        TP_ASSERT(cops_builder_object(&b, 11, 1, id, sizeof(id)) == 0);
+        TP_ASSERT(cops_builder_finish(&b) == 20);
+
+        /* Length is the unpadded object length, padding bytes are zero. */
+        TP_ASSERT(buf[8] == 0 && buf[9] == 9);
+        TP_ASSERT(buf[17] == 0 && buf[18] == 0 && buf[19] == 0);
+        TP_ASSERT(buf[20] == 0xFF);
+}
+
+static void
+tp_cops_builder_overflow(void) {
+        info();
+
+        struct cops_builder b;
+        uint8_t buf[40];
+        uint8_t obj[8] = {0, 8, 1, 1, 0, 0, 0, 0};
+
+        memset(buf, 0xEE, sizeof(buf));
+        cops_builder_init(&b, buf, 20, 2);
+        TP_ASSERT(cops_builder_append(&b, obj, 8) == 0);
+        TP_ASSERT(cops_builder_append(&b, obj, 8) == -1);
+        TP_ASSERT(cops_builder_append(&b, obj, 4) == -1);
+        TP_ASSERT(cops_builder_finish(&b) == 0);
+        TP_ASSERT(buf[20] == 0xEE);
+
+        memset(buf, 0xEE, sizeof(buf));
+        cops_builder_init(&b, buf, 4, 2);
+        TP_ASSERT(b.overflow);
+        TP_ASSERT(buf[0] == 0xEE);
+}
+
+void
+test_builder(void) {
+        tp_cops_builder_matches_pack_ctl_objs();
+        tp_cops_builder_zero_copy_iov();
+        tp_cops_builder_padding();
+        tp_cops_builder_overflow();
+}
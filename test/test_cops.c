@@ -222,6 +222,81 @@ tp_cops_keepalive_message(void) {
         TP_ASSERT(ka[1] == 9);  /* Keep-Alive Opcode. */
         TP_ASSERT(ka[0] == 16); /* Keep-Alive flags. */
         TP_ASSERT(val == 8);    /* Keep-Alive data. */
+
+        /* Keep-Alives carry Client-Type 0. */
+        TP_ASSERT(ka[2] == 0 && ka[3] == 0);
+}
+
+void
+tp_cops_client_close_message(void) {
+        info();
+
+        uint8_t msg[32];
+        uint8_t handle[8];
+
+        /* Client-Close with only an Error object. */
+        cops_client_close(msg, COPS_ERROR_UNABLE, 7);
+        TP_ASSERT(msg[0] == 16 && msg[1] == 8 && cops_load16(msg + 2) == 32778);
+        TP_ASSERT(cops_load32(msg + 4) == COPS_ERROR_MSG_LEN);
+        TP_ASSERT(cops_load16(msg + 8) == 8 && msg[10] == 8 && msg[11] == 1);
+        TP_ASSERT(cops_load16(msg + 12) == COPS_ERROR_UNABLE && cops_load16(msg + 14) == 7);
+
+        /* A solicited Decision echoing the handle, the Error object in place of decisions. */
+        cops_handle(handle, "abcd");
+        TP_ASSERT(cops_decision_error(msg, handle, COPS_ERROR_UNABLE, 0) == 24);
+        TP_ASSERT(msg[0] == 17 && msg[1] == 2 && cops_load32(msg + 4) == 24);
+        TP_ASSERT(memcmp(msg + 8, handle, 8) == 0);
+        TP_ASSERT(cops_load16(msg + 16) == 8 && msg[18] == 8 && msg[19] == 1);
+        TP_ASSERT(cops_load16(msg + 20) == COPS_ERROR_UNABLE && cops_load16(msg + 22) == 0);
+}
+
+void
+tp_cops_wire_load_store(void) {
+        info();
+
+        uint8_t buf[12] = {0};
+
+        /* Stores are big-endian at any alignment and leave the neighbouring bytes alone. */
+        cops_store16(buf + 1, 0x800A);
+        TP_ASSERT(buf[0] == 0 && buf[1] == 0x80 && buf[2] == 0x0A && buf[3] == 0);
+        TP_ASSERT(cops_load16(buf + 1) == 0x800A);
+
+        cops_store32(buf + 3, 0x01020304);
+        TP_ASSERT(buf[3] == 1 && buf[4] == 2 && buf[5] == 3 && buf[6] == 4 && buf[7] == 0);
+        TP_ASSERT(cops_load32(buf + 3) == 0x01020304);
+
+        cops_store64(buf + 1, 0x1122334455667788ULL);
+        TP_ASSERT(buf[1] == 0x11 && buf[8] == 0x88 && buf[9] == 0);
+        TP_ASSERT(cops_load64(buf + 1) == 0x1122334455667788ULL);
+
+        /* Header and object header words. */
+        cops_put_header(buf, 2, 0x01020304);
+        TP_ASSERT(buf[0] == 16 && buf[1] == 2 && cops_load16(buf + 2) == COPS_CLIENT_TYPE_PCMM);
+        TP_ASSERT(cops_load32(buf + 4) == 0x01020304);
+
+        cops_put_objhdr(buf + 8, 260, 9, 4);
+        TP_ASSERT(cops_load16(buf + 8) == 260 && buf[10] == 9 && buf[11] == 4);
+
+        /* The constant Keep-Alive is the message cops_keepalive writes. */
+        cops_store64(buf, COPS_KA_MESSAGE);
+        TP_ASSERT(buf[0] == 16 && buf[1] == 9 && cops_load16(buf + 2) == 0 && cops_load32(buf + 4) == 8);
+}
+
+void
+tp_cops_new_message_header(void) {
+        info();
+
+        uint8_t objs[8];
+        uint8_t msg[16];
+
+        cops_handle(objs, "abcd");
+        new_cops_message(msg, 3, objs, 16);
+
+        TP_ASSERT(msg[0] == 16);
+        TP_ASSERT(msg[1] == 3);
+        TP_ASSERT(cops_load16(msg + 2) == 32778);
+        TP_ASSERT(cops_load32(msg + 4) == 16);
+        TP_ASSERT(memcmp(msg + 8, objs, 8) == 0);
 }
 
 int
@@ -231,9 +306,33 @@ test_runner(void) {
         tp_cops_common_decision_object();
         tp_cops_client_accept_message();
         tp_cops_keepalive_message();
+        tp_cops_client_close_message();
+        tp_cops_wire_load_store();
+        tp_cops_new_message_header();
         tp_cops_report_state_opcode_ok();
         tp_cops_report_state_opcode_to_acronym();
         tp_cops_report_state_opcode_to_string();
 
+        test_decoder();
+        test_template();
+        test_builder();
+        test_batch();
+        test_timer();
+        test_gate();
+        test_server();
+        test_shard();
+        test_validate();
+        test_pcmm();
+        test_pool();
+        test_txn();
+        test_sync();
+        test_metrics();
+        test_trace();
+        test_pepsim();
+        test_integrity();
+        test_radix();
+        test_snap();
+        test_admit();
+
         return EXIT_SUCCESS;
 }
@@ -16,4 +16,26 @@
 
 int test_runner(void);
 
+/* Per-module suites, called from test_runner(). */
+void test_decoder(void);
+void test_template(void);
+void test_builder(void);
+void test_batch(void);
+void test_timer(void);
+void test_gate(void);
+void test_server(void);
+void test_shard(void);
+void test_validate(void);
+void test_pcmm(void);
+void test_pool(void);
+void test_txn(void);
+void test_sync(void);
+void test_metrics(void);
+void test_trace(void);
+void test_pepsim(void);
+void test_integrity(void);
+void test_radix(void);
+void test_snap(void);
+void test_admit(void);
+
 #endif /* ifndef TEST_COPS_H */
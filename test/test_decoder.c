@@ -0,0 +1,190 @@
+#include "cops_decoder.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+/* Build a Report-State message carrying a Handle and a Context object. */
+static size_t
+build_rpt(uint8_t* dst, const char* handle) {
+        uint8_t objs[16];
+
+        cops_handle(objs, handle);
+        cops_context(objs + 8);
+        new_cops_message(dst, 3, objs, 8 + sizeof(objs));
+
+        return 8 + sizeof(objs);
+}
+
+static void
+tp_cops_decode_single_message(void) {
+        info();
+
+        uint8_t buf[64];
+        const struct cops_msg* msg = NULL;
+        struct cops_decoder dec;
+        size_t len = build_rpt(buf, "abcd");
+
+        cops_decoder_init(&dec);
+        TP_ASSERT(cops_decode(&dec, buf, len, &msg) == (int)len);
+        TP_ASSERT(msg->data == buf);
+        TP_ASSERT(msg->version == 1);
+        TP_ASSERT(msg->opcode == 3);
+        TP_ASSERT(msg->client_type == 32778);
+        TP_ASSERT(msg->length == 24);
+        TP_ASSERT(msg->nobjs == 2);
+        TP_ASSERT(msg->objs[0].cnum == 1 && msg->objs[0].ctype == 1);
+        TP_ASSERT(msg->objs[0].offset == 8 && msg->objs[0].length == 8);
+        TP_ASSERT(msg->objs[1].cnum == 2 && msg->objs[1].offset == 16);
+
+        const struct cops_obj* h = cops_msg_find(msg, 1, 1);
+        TP_ASSERT(h != NULL);
+        TP_ASSERT(memcmp(cops_obj_data(msg, h), "abcd", 4) == 0);
+        TP_ASSERT(cops_msg_find(msg, 16, 1) == NULL);
+}
+
+static void
+tp_cops_decode_byte_at_a_time(void) {
+        info();
+
+        uint8_t buf[64];
+        const struct cops_msg* msg = NULL;
+        struct cops_decoder dec;
+        size_t len = build_rpt(buf, "wxyz");
+        int ret = 0;
+
+        cops_decoder_init(&dec);
+
+        /* Deliver the stream one byte per read, every partial call must ask for more. */
+        size_t avail;
+        for (avail = 1; avail < len; avail++) {
+                ret = cops_decode(&dec, buf, avail, &msg);
+                TP_ASSERT(ret == 0);
+                TP_ASSERT(cops_decoder_want(&dec, avail) == ((avail < 8) ? 8 - avail : len - avail));
+        }
+
+        ret = cops_decode(&dec, buf, avail, &msg);
+        TP_ASSERT(ret == (int)len);
+        TP_ASSERT(msg->nobjs == 2);
+        TP_ASSERT(memcmp(cops_obj_data(msg, &msg->objs[0]), "wxyz", 4) == 0);
+}
+
+static void
+tp_cops_decode_back_to_back(void) {
+        info();
+
+        uint8_t buf[128];
+        const struct cops_msg* msg = NULL;
+        struct cops_decoder dec;
+        size_t len = build_rpt(buf, "aaaa");
+
+        len += build_rpt(buf + len, "bbbb");
+        cops_keepalive(buf + len);
+        buf[len + 2] = 0;
+        buf[len + 3] = 0;
+        len += 8;
+
+        cops_decoder_init(&dec);
+
+        size_t off = 0;
+        int ret = cops_decode(&dec, buf + off, len - off, &msg);
+        TP_ASSERT(ret == 24);
+        TP_ASSERT(memcmp(cops_obj_data(msg, &msg->objs[0]), "aaaa", 4) == 0);
+        off += ret;
+
+        ret = cops_decode(&dec, buf + off, len - off, &msg);
+        TP_ASSERT(ret == 24);
+        TP_ASSERT(memcmp(cops_obj_data(msg, &msg->objs[0]), "bbbb", 4) == 0);
+        off += ret;
+
+        ret = cops_decode(&dec, buf + off, len - off, &msg);
+        TP_ASSERT(ret == 8);
+        TP_ASSERT(msg->opcode == 9);
+        TP_ASSERT(msg->nobjs == 0);
+        off += ret;
+
+        TP_ASSERT(cops_decode(&dec, buf + off, len - off, &msg) == 0);
+}
+
+static void
+tp_cops_decode_malformed(void) {
+        info();
+
+        uint8_t buf[64];
+        const struct cops_msg* msg = NULL;
+        struct cops_decoder dec;
+        size_t len = build_rpt(buf, "abcd");
+
+        /* Unknown opcode. */
+        cops_decoder_init(&dec);
+        buf[1] = 5;
+        TP_ASSERT(cops_decode(&dec, buf, len, &msg) == -1);
+        TP_ASSERT(dec.err == COPS_DECODE_ERR_HEADER);
+        TP_ASSERT(cops_decode(&dec, buf, len, &msg) == -1);
+
+        /* Object overruns the message. */
+        cops_decoder_init(&dec);
+        buf[1] = 3;
+        buf[17] = 20;
+        TP_ASSERT(cops_decode(&dec, buf, len, &msg) == -1);
+        TP_ASSERT(dec.err == COPS_DECODE_ERR_OBJ_LEN);
+
+        /* Version other than 1. */
+        cops_decoder_init(&dec);
+        buf[17] = 8;
+        buf[0] = 0x20;
+        TP_ASSERT(cops_decode(&dec, buf, len, &msg) == -1);
+        TP_ASSERT(dec.err == COPS_DECODE_ERR_VERSION);
+}
+
+static void
+tp_cops_decode_max_len(void) {
+        info();
+
+        uint8_t buf[64];
+        const struct cops_msg* msg = NULL;
+        struct cops_decoder dec;
+        struct cops_integrity_key key;
+
+        /* Only the header has arrived, the announced length alone decides. */
+        build_rpt(buf, "abcd");
+        cops_store32(buf + 4, 1000);
+        cops_decoder_init(&dec);
+        TP_ASSERT(cops_decode(&dec, buf, 8, &msg) == -1);
+        TP_ASSERT(dec.err == COPS_DECODE_ERR_HEADER);
+
+        cops_decoder_init(&dec);
+        dec.max_len = 4096;
+        TP_ASSERT(cops_decode(&dec, buf, 8, &msg) == 0);
+
+        /* The Integrity object comes on top of the default. */
+        cops_integrity_key_init(&key, 1, "Jefe", 4);
+        cops_store32(buf + 4, COPS_MSG_MAX_LEN + COPS_INTEGRITY_LEN - 3);
+        cops_decoder_init(&dec);
+        dec.key = &key;
+        TP_ASSERT(cops_decode(&dec, buf, 8, &msg) == 0);
+        cops_store32(buf + 4, COPS_MSG_MAX_LEN + COPS_INTEGRITY_LEN + 1);
+        cops_decoder_init(&dec);
+        dec.key = &key;
+        TP_ASSERT(cops_decode(&dec, buf, 8, &msg) == -1);
+
+        /* A lower limit applies to SSC as well. */
+        build_rpt(buf, "abcd");
+        buf[1] = 10;
+        cops_decoder_init(&dec);
+        dec.sync = true;
+        dec.max_len = 16;
+        TP_ASSERT(cops_decode(&dec, buf, 24, &msg) == -1);
+        TP_ASSERT(dec.err == COPS_DECODE_ERR_HEADER);
+        cops_decoder_init(&dec);
+        dec.sync = true;
+        TP_ASSERT(cops_decode(&dec, buf, 24, &msg) == 24);
+}
+
+void
+test_decoder(void) {
+        tp_cops_decode_single_message();
+        tp_cops_decode_byte_at_a_time();
+        tp_cops_decode_back_to_back();
+        tp_cops_decode_malformed();
+        tp_cops_decode_max_len();
+}
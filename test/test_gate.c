@@ -0,0 +1,144 @@
+#include "cops_gate.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+static void
+tp_cops_gate_insert_find_remove(void) {
+        info();
+
+        struct cops_gate_table t;
+        TP_ASSERT(cops_gate_table_init(&t, 4) == 0);
+
+        struct cops_gate* g = cops_gate_insert(&t, cops_handle_key("abcd"));
+        TP_ASSERT(g != NULL);
+        TP_ASSERT(g->gate_id == 0);
+        g->gate_id = 0x1234;
+        g->decision = 4;
+
+        /* Inserting an existing handle returns the stored state. */
+        g = cops_gate_insert(&t, cops_handle_key("abcd"));
+        TP_ASSERT(g->gate_id == 0x1234);
+        TP_ASSERT(cops_gate_count(&t) == 1);
+
+        TP_ASSERT(cops_gate_find(&t, cops_handle_key("abce")) == NULL);
+        TP_ASSERT(cops_gate_remove(&t, cops_handle_key("abcd")));
+        TP_ASSERT(!cops_gate_remove(&t, cops_handle_key("abcd")));
+        TP_ASSERT(cops_gate_find(&t, cops_handle_key("abcd")) == NULL);
+        TP_ASSERT(cops_gate_count(&t) == 0);
+
+        cops_gate_table_free(&t);
+}
+
+static void
+tp_cops_gate_incremental_resize(void) {
+        info();
+
+        struct cops_gate_table t;
+        const uint32_t n = 100000;
+        bool resized = false;
+        bool ok = true;
+
+        TP_ASSERT(cops_gate_table_init(&t, 16) == 0);
+
+        for (uint32_t i = 0; i < n; i++) {
+                struct cops_gate* g = cops_gate_insert(&t, i * 7919);
+                g->gate_id = i;
+                resized |= t.old.slots != NULL;
+
+                /* Every key stays reachable while entries move between tables. */
+                if (t.old.slots && cops_gate_find(&t, (i / 2) * 7919) == NULL)
+                        ok = false;
+        }
+        TP_ASSERT(resized);
+        TP_ASSERT(ok);
+        TP_ASSERT(cops_gate_count(&t) == n);
+
+        for (uint32_t i = 0; i < n; i++) {
+                struct cops_gate* g = cops_gate_find(&t, i * 7919);
+                if (g == NULL || g->gate_id != i)
+                        ok = false;
+        }
+        TP_ASSERT(ok);
+
+        /* Remove every other handle, the rest must survive the backward shifts. */
+        for (uint32_t i = 0; i < n; i += 2)
+                cops_gate_remove(&t, i * 7919);
+        for (uint32_t i = 0; i < n; i++) {
+                struct cops_gate* g = cops_gate_find(&t, i * 7919);
+                if ((i % 2 == 0) != (g == NULL))
+                        ok = false;
+        }
+        TP_ASSERT(ok);
+        TP_ASSERT(cops_gate_count(&t) == n / 2);
+
+        size_t iter = 0;
+        size_t seen = 0;
+        while (cops_gate_next(&t, &iter))
+                seen++;
+        TP_ASSERT(seen == n / 2);
+
+        cops_gate_table_free(&t);
+}
+
+static bool
+sweep_odd(struct cops_gate* gate, void* arg) {
+        ++*(int*)arg;
+        return gate->gate_id & 1;
+}
+
+static void
+tp_cops_gate_mark_sweep(void) {
+        info();
+
+        struct cops_gate_table t;
+        const uint32_t n = 50000;
+        int calls = 0;
+        bool ok = true;
+
+        TP_ASSERT(cops_gate_table_init(&t, 16) == 0);
+        for (uint32_t i = 0; i < n; i++)
+                cops_gate_insert(&t, i * 7919)->gate_id = i;
+
+        /* Mark every third gate, a gate created during the phase is born marked. */
+        TP_ASSERT(cops_gate_mark_begin(&t) == 0);
+        TP_ASSERT(cops_gate_mark_begin(&t) < 0);
+        for (uint32_t i = 0; i < n; i += 3)
+                cops_gate_mark(&t, cops_gate_find(&t, i * 7919));
+        cops_gate_insert(&t, 0xFFFFFFFF)->gate_id = 1;
+
+        /* Unmarked odd gates go, unmarked even gates stay. */
+        size_t unmarked = 0;
+        size_t odd = 0;
+        for (uint32_t i = 0; i < n; i++) {
+                unmarked += i % 3 != 0;
+                odd += i % 3 != 0 && (i & 1);
+        }
+        TP_ASSERT(cops_gate_sweep(&t, sweep_odd, &calls) == odd);
+        TP_ASSERT((size_t)calls == unmarked);
+        for (uint32_t i = 0; i < n; i++) {
+                bool gone = (i % 3 != 0) && (i & 1);
+                if ((cops_gate_find(&t, i * 7919) == NULL) != gone)
+                        ok = false;
+        }
+        TP_ASSERT(ok);
+        TP_ASSERT(cops_gate_find(&t, 0xFFFFFFFF) != NULL);
+
+        /* Nothing is swept outside a mark phase, an aborted phase keeps every gate. */
+        size_t left = cops_gate_count(&t);
+        TP_ASSERT(cops_gate_sweep(&t, sweep_odd, &calls) == 0);
+        TP_ASSERT(cops_gate_mark_begin(&t) == 0);
+        cops_gate_mark_abort(&t);
+        TP_ASSERT(cops_gate_mark_begin(&t) == 0);
+        TP_ASSERT(cops_gate_sweep(&t, NULL, NULL) == left);
+        TP_ASSERT(cops_gate_count(&t) == 0);
+
+        cops_gate_table_free(&t);
+}
+
+void
+test_gate(void) {
+        tp_cops_gate_insert_find_remove();
+        tp_cops_gate_incremental_resize();
+        tp_cops_gate_mark_sweep();
+}
@@ -0,0 +1,242 @@
+#include "cops_builder.h"
+#include "cops_decoder.h"
+#include "cops_integrity.h"
+#include "cops_validate.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+static void
+hmac(const struct cops_integrity_key* key, const char* data, size_t piece, uint8_t* digest) {
+        struct cops_hmac h;
+        size_t len = strlen(data);
+
+        cops_hmac_init(&h, key);
+        for (size_t off = 0; off < len; off += piece)
+                cops_hmac_update(&h, data + off, (len - off < piece) ? len - off : piece);
+        cops_hmac_final(&h, digest);
+}
+
+/* HMAC-MD5 test cases of RFC 2202, truncated to 96 bits. */
+static void
+tp_cops_integrity_hmac_md5(void) {
+        info();
+
+        static const uint8_t digest1[] = {0x92, 0x94, 0x72, 0x7a, 0x36, 0x38, 0xbb, 0x1c, 0x13, 0xf4, 0x8e, 0xf8};
+        static const uint8_t digest2[] = {0x75, 0x0c, 0x78, 0x3e, 0x6a, 0xb0, 0xb5, 0x03, 0xea, 0xa8, 0x6e, 0x31};
+        static const uint8_t digest7[] = {0x6f, 0x63, 0x0f, 0xad, 0x67, 0xcd, 0xa0, 0xee, 0x1f, 0xb1, 0xf5, 0x62};
+        const char* data7 = "Test Using Larger Than Block-Size Key and Larger Than One Block-Size Data";
+        struct cops_integrity_key key;
+        uint8_t secret[80];
+        uint8_t digest[COPS_INTEGRITY_DIGEST_LEN];
+
+        memset(secret, 0x0b, 16);
+        cops_integrity_key_init(&key, 1, secret, 16);
+        hmac(&key, "Hi There", 64, digest);
+        TP_ASSERT(memcmp(digest, digest1, sizeof(digest)) == 0);
+
+        cops_integrity_key_init(&key, 1, "Jefe", 4);
+        hmac(&key, "what do ya want for nothing?", 64, digest);
+        TP_ASSERT(memcmp(digest, digest2, sizeof(digest)) == 0);
+
+        /* A key longer than a block is hashed first. Any split of the data gives the same digest. */
+        memset(secret, 0xaa, 80);
+        cops_integrity_key_init(&key, 1, secret, 80);
+        for (size_t piece = 1; piece <= 80; piece += 7) {
+                hmac(&key, data7, piece, digest);
+                TP_ASSERT(memcmp(digest, digest7, sizeof(digest)) == 0);
+        }
+}
+
+static size_t
+build_req(uint8_t* dst, size_t cap) {
+        struct cops_builder b;
+
+        cops_builder_init(&b, dst, cap, 1);
+        cops_builder_object(&b, 1, 1, "abcd", 4);
+        cops_builder_object(&b, 2, 1, "\0\1\0\0", 4);
+        return cops_builder_finish(&b);
+}
+
+static void
+tp_cops_integrity_sign_verify(void) {
+        info();
+
+        struct cops_integrity_key key;
+        struct cops_integrity_key other;
+        struct cops_integrity pep;
+        struct cops_integrity pdp;
+        uint8_t msg[128];
+        size_t len;
+
+        cops_integrity_key_init(&key, 7, "secret", 6);
+        cops_integrity_key_init(&other, 7, "Secret", 6);
+        cops_integrity_init(&pep, &key, 1000);
+        cops_integrity_init(&pdp, &key, 0);
+
+        /* The object is appended last and counted in the message length. */
+        len = cops_integrity_sign(&pep, msg, build_req(msg, sizeof(msg)));
+        TP_ASSERT(len == 24 + COPS_INTEGRITY_LEN);
+        TP_ASSERT(cops_load32(msg + 4) == len);
+        TP_ASSERT(msg[24 + 2] == COPS_CNUM_INTEGRITY && msg[24 + 3] == COPS_CTYPE_INTEGRITY_HMAC);
+        TP_ASSERT(cops_load32(msg + 28) == 7);
+        TP_ASSERT(cops_load32(msg + 32) == 1000);
+        TP_ASSERT(cops_validate(msg, len, 0, NULL) == COPS_VERR_NONE);
+
+        /* The first message sets the peer's sequence number. */
+        TP_ASSERT(cops_integrity_verify(&pdp, msg, len) == COPS_IERR_NONE);
+        TP_ASSERT(pdp.rx_synced && pdp.rx_seq == 1001);
+
+        /* A replay is out of sequence, the next message is accepted. */
+        TP_ASSERT(cops_integrity_verify(&pdp, msg, len) == COPS_IERR_SEQUENCE);
+        len = cops_integrity_sign(&pep, msg, build_req(msg, sizeof(msg)));
+        TP_ASSERT(cops_integrity_verify(&pdp, msg, len) == COPS_IERR_NONE);
+
+        /* Any altered byte, the digest included, is detected and leaves the sequence alone. */
+        for (size_t i = 0; i < len; i++) {
+                if ((i >= 4 && i < 8) || (i >= 24 && i < 36))
+                        continue; /* Length, object header, Key ID and sequence fail their own checks. */
+                len = cops_integrity_sign(&pep, msg, build_req(msg, sizeof(msg)));
+                pdp.rx_seq = pep.tx_seq - 1;
+                msg[i] ^= 0x10;
+                TP_ASSERT(cops_integrity_verify(&pdp, msg, len) == COPS_IERR_DIGEST);
+                TP_ASSERT(pdp.rx_seq == pep.tx_seq - 1);
+        }
+
+        len = cops_integrity_sign(&pep, msg, build_req(msg, sizeof(msg)));
+        pdp.rx_seq = pep.tx_seq - 1;
+        msg[31] ^= 1;
+        TP_ASSERT(cops_integrity_verify(&pdp, msg, len) == COPS_IERR_KEY_ID);
+
+        /* Same Key ID, different secret. */
+        struct cops_integrity wrong;
+        cops_integrity_init(&wrong, &other, 0);
+        len = cops_integrity_sign(&pep, msg, build_req(msg, sizeof(msg)));
+        TP_ASSERT(cops_integrity_verify(&wrong, msg, len) == COPS_IERR_DIGEST);
+
+        /* Unsigned messages, or a length that does not match, have no Integrity object. */
+        len = build_req(msg, sizeof(msg));
+        TP_ASSERT(cops_integrity_verify(&pdp, msg, len) == COPS_IERR_MISSING);
+        len = cops_integrity_sign(&pep, msg, len);
+        TP_ASSERT(cops_integrity_verify(&pdp, msg, len - 4) == COPS_IERR_MISSING);
+}
+
+/* A signature computed while the message is written matches the one-shot signature. */
+static void
+tp_cops_integrity_stream(void) {
+        info();
+
+        struct cops_integrity_key key;
+        struct cops_integrity pep;
+        struct cops_integrity pdp;
+        struct cops_hmac h;
+        uint8_t one[256];
+        uint8_t msg[256];
+        uint8_t body[200];
+
+        for (size_t i = 0; i < sizeof(body); i++)
+                body[i] = (uint8_t)i;
+
+        cops_integrity_key_init(&key, 1, "secret", 6);
+        cops_integrity_init(&pep, &key, 5);
+
+        /* Header with the final length, then each object hashed right after it is written. */
+        size_t len = COPS_HEADER_LEN + 8 + 4 + sizeof(body) + COPS_INTEGRITY_LEN;
+        cops_hmac_init(&h, &key);
+        new_cops_message(msg, 1, NULL, (int)len);
+        cops_hmac_update(&h, msg, COPS_HEADER_LEN);
+        cops_handle(msg + 8, "abcd");
+        cops_hmac_update(&h, msg + 8, 8);
+        cops_put_objhdr(msg + 16, 4 + sizeof(body), 9, 1);
+        memcpy(msg + 20, body, sizeof(body));
+        cops_hmac_update(&h, msg + 16, 4 + sizeof(body));
+        cops_integrity_seal(&h, msg + 20 + sizeof(body), 5);
+
+        new_cops_message(one, 1, msg + 8, (int)(len - COPS_INTEGRITY_LEN));
+        TP_ASSERT(cops_integrity_sign(&pep, one, len - COPS_INTEGRITY_LEN) == len);
+        TP_ASSERT(memcmp(one, msg, len) == 0);
+
+        /* And it verifies streaming as well. */
+        cops_integrity_init(&pdp, &key, 0);
+        cops_hmac_init(&h, &key);
+        cops_hmac_update(&h, msg, 100);
+        cops_hmac_update(&h, msg + 100, len - COPS_INTEGRITY_LEN - 100);
+        TP_ASSERT(cops_integrity_check(&pdp, &h, msg + len - COPS_INTEGRITY_LEN) == COPS_IERR_NONE);
+        TP_ASSERT(pdp.rx_seq == 6);
+}
+
+/* A builder signs while finishing, the decoder digests while framing: no pass of its own on either side. */
+static void
+tp_cops_integrity_seal_frame(void) {
+        info();
+
+        struct cops_integrity_key key;
+        struct cops_integrity pep;
+        struct cops_integrity pdp;
+        struct cops_builder b;
+        struct cops_decoder dec;
+        const struct cops_msg* msg;
+        uint8_t buf[256];
+        uint8_t wire[512];
+        uint8_t ref[48];
+
+        cops_integrity_key_init(&key, 3, "secret", 6);
+        cops_integrity_init(&pep, &key, 10);
+        cops_integrity_init(&pdp, &key, 0);
+        cops_put_objhdr(ref, sizeof(ref), 9, 1);
+        for (size_t i = 4; i < sizeof(ref); i++)
+                ref[i] = (uint8_t)i;
+
+        /* The referenced object is hashed where it is, the copy verifies as one message. */
+        cops_builder_init(&b, buf, sizeof(buf), 3);
+        cops_builder_object(&b, 1, 1, "abcd", 4);
+        cops_builder_ref(&b, ref, sizeof(ref));
+        size_t len = cops_builder_seal(&b, &pep);
+        TP_ASSERT(len == COPS_HEADER_LEN + 8 + sizeof(ref) + COPS_INTEGRITY_LEN && pep.tx_seq == 11);
+        TP_ASSERT(cops_builder_copy(&b, wire, sizeof(wire)) == len);
+        TP_ASSERT(cops_integrity_verify(&pdp, wire, len) == COPS_IERR_NONE);
+
+        /* No room left for the Integrity object: nothing is signed. */
+        cops_builder_init(&b, buf, COPS_HEADER_LEN + 8 + COPS_INTEGRITY_LEN - 4, 3);
+        cops_builder_object(&b, 1, 1, "abcd", 4);
+        TP_ASSERT(cops_builder_seal(&b, &pep) == 0 && pep.tx_seq == 11);
+
+        /* Two messages arriving a few bytes at a time are digested as they are framed. */
+        cops_builder_init(&b, wire + len, sizeof(wire) - len, 3);
+        cops_builder_object(&b, 1, 1, "efgh", 4);
+        size_t len2 = cops_builder_seal(&b, &pep);
+        TP_ASSERT(len2 == COPS_HEADER_LEN + 8 + COPS_INTEGRITY_LEN);
+
+        cops_integrity_init(&pdp, &key, 0);
+        cops_decoder_init(&dec);
+        dec.key = &key;
+        size_t off = 0;
+        int framed = 0;
+        for (size_t avail = 0; avail < len + len2;) {
+                avail += (avail + 7 < len + len2) ? 7 : len + len2 - avail;
+                int ret = cops_decode(&dec, wire + off, avail - off, &msg);
+                TP_ASSERT(ret >= 0);
+                if (ret > 0) {
+                        TP_ASSERT(cops_decoder_verify(&dec, &pdp) == COPS_IERR_NONE);
+                        off += ret;
+                        framed++;
+                }
+        }
+        TP_ASSERT(framed == 2 && pdp.rx_seq == 12);
+
+        /* A flipped bit or a missing Integrity object is caught the same way. */
+        wire[20] ^= 1;
+        cops_integrity_init(&pdp, &key, 0);
+        TP_ASSERT(cops_decode(&dec, wire, len, &msg) == (int)len);
+        TP_ASSERT(cops_decoder_verify(&dec, &pdp) == COPS_IERR_DIGEST);
+        TP_ASSERT(cops_decode(&dec, wire, build_req(wire, sizeof(wire)), &msg) == 24);
+        TP_ASSERT(cops_decoder_verify(&dec, &pdp) == COPS_IERR_MISSING);
+}
+
+void
+test_integrity(void) {
+        tp_cops_integrity_hmac_md5();
+        tp_cops_integrity_sign_verify();
+        tp_cops_integrity_stream();
+        tp_cops_integrity_seal_frame();
+}
@@ -0,0 +1,134 @@
+#include <pthread.h>
+
+#include "cops_metrics.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+#define METRICS_THREADS 4
+#define METRICS_EVENTS  1000000
+
+static void
+tp_cops_hist_buckets(void) {
+        info();
+
+        static struct cops_hist h;
+
+        /* Exact below COPS_HIST_SUB, 16 linear buckets per power of two above. */
+        TP_ASSERT(cops_hist_bucket(0) == 0 && cops_hist_bucket(15) == 15);
+        TP_ASSERT(cops_hist_bucket(16) == 16 && cops_hist_bucket(31) == 31);
+        TP_ASSERT(cops_hist_bucket(32) == 32 && cops_hist_bucket(33) == 32 && cops_hist_bucket(34) == 33);
+        TP_ASSERT(cops_hist_bucket(UINT64_MAX) == COPS_HIST_BUCKETS - 1);
+        for (uint32_t b = 1; b < COPS_HIST_BUCKETS; b++) {
+                TP_ASSERT(cops_hist_bucket(cops_hist_bucket_min(b)) == b);
+                TP_ASSERT(cops_hist_bucket(cops_hist_bucket_min(b) - 1) == b - 1);
+        }
+
+        for (uint64_t v = 1; v <= 10000; v++)
+                cops_hist_record(&h, v);
+        TP_ASSERT(h.count == 10000 && h.max == 10000 && h.sum == 10000 * 10001 / 2);
+
+        /* Within the 1/16 bucket width of the exact quantiles. */
+        uint64_t p50 = cops_hist_quantile(&h, 0.5);
+        uint64_t p99 = cops_hist_quantile(&h, 0.99);
+        TP_ASSERT(p50 >= 5000 && p50 <= 5000 + 5000 / 16);
+        TP_ASSERT(p99 >= 9900 && p99 <= 9900 + 9900 / 16);
+        TP_ASSERT(cops_hist_quantile(&h, 1) == 10000);
+}
+
+struct metrics_writer {
+        struct cops_metrics* m;
+        int n;
+};
+
+static void*
+metrics_writer(void* arg) {
+        struct metrics_writer* w = arg;
+        struct cops_metrics_slot* slot = cops_metrics_slot(w->m);
+
+        for (int i = 0; i < METRICS_EVENTS; i++) {
+                cops_metrics_add(&slot->rx_ops[9], 1);
+                cops_metrics_add(&slot->rx_bytes, 8);
+                cops_hist_record(&slot->hist[COPS_HIST_DECODE], (uint64_t)w->n * 100);
+        }
+
+        return NULL;
+}
+
+static void
+tp_cops_metrics_threads(void) {
+        info();
+
+        struct cops_metrics m;
+        struct metrics_writer w[METRICS_THREADS];
+        pthread_t threads[METRICS_THREADS];
+        static struct cops_metrics_snapshot snap;
+
+        TP_ASSERT(cops_metrics_init(&m, METRICS_THREADS) == 0);
+        TP_ASSERT(((uintptr_t)m.slots & 63) == 0);
+
+        for (int i = 0; i < METRICS_THREADS; i++) {
+                w[i].m = &m;
+                w[i].n = i + 1;
+                TP_ASSERT(pthread_create(&threads[i], NULL, metrics_writer, &w[i]) == 0);
+        }
+        for (int i = 0; i < METRICS_THREADS; i++)
+                pthread_join(threads[i], NULL);
+        TP_ASSERT(cops_metrics_slot(&m) == NULL);
+
+        /* Readers see every event once the writers are done. */
+        cops_metrics_snapshot(&m, &snap);
+        TP_ASSERT(snap.total.rx_ops[9] == (uint64_t)METRICS_THREADS * METRICS_EVENTS);
+        TP_ASSERT(snap.total.rx_bytes == (uint64_t)METRICS_THREADS * METRICS_EVENTS * 8);
+        TP_ASSERT(snap.total.hist[COPS_HIST_DECODE].count == (uint64_t)METRICS_THREADS * METRICS_EVENTS);
+        TP_ASSERT(snap.total.hist[COPS_HIST_DECODE].max == METRICS_THREADS * 100);
+
+        cops_metrics_free(&m);
+}
+
+static void
+tp_cops_metrics_write(void) {
+        info();
+
+        struct cops_metrics m;
+        static struct cops_metrics_snapshot snap;
+        char* text = NULL;
+        size_t len = 0;
+
+        TP_ASSERT(cops_metrics_init(&m, 1) == 0);
+        struct cops_metrics_slot* slot = cops_metrics_slot(&m);
+        cops_metrics_add(&slot->rx_ops[1], 3);
+        cops_metrics_add(&slot->tx_ops[2], 2);
+        cops_metrics_add(&slot->rx_objs[11], 1);
+        cops_hist_record(&slot->hist[COPS_HIST_ENCODE], 40);
+        cops_metrics_snapshot(&m, &snap);
+        snap.ns_per_tick = 1;
+
+        FILE* out = open_memstream(&text, &len);
+        TP_ASSERT(cops_metrics_write_text(&snap, out) == 0);
+        fclose(out);
+        TP_ASSERT(strstr(text, "cops_rx_messages{op=\"REQ\"} 3\n") != NULL);
+        TP_ASSERT(strstr(text, "cops_tx_messages{op=\"DEC\"} 2\n") != NULL);
+        TP_ASSERT(strstr(text, "cops_rx_objects{object=\"PEP Identification\"} 1\n") != NULL);
+        TP_ASSERT(strstr(text, "cops_encode_ns_count 1\n") != NULL);
+        TP_ASSERT(strstr(text, "cops_encode_ns{quantile=\"0.99\"} 40.0\n") != NULL);
+        TP_ASSERT(strstr(text, "KA") == NULL);
+        free(text);
+
+        out = open_memstream(&text, &len);
+        TP_ASSERT(cops_metrics_write_json(&snap, out) == 0);
+        fclose(out);
+        TP_ASSERT(strncmp(text, "{\"rx_messages\":{\"REQ\":3},\"tx_messages\":{\"DEC\":2},", 49) == 0);
+        TP_ASSERT(strstr(text, "\"encode\":{\"count\":1,\"mean\":40.0,\"p50\":40.0,") != NULL);
+        TP_ASSERT(strstr(text, "}}\n") == text + len - 3);
+        free(text);
+
+        cops_metrics_free(&m);
+}
+
+void
+test_metrics(void) {
+        tp_cops_hist_buckets();
+        tp_cops_metrics_threads();
+        tp_cops_metrics_write();
+}
@@ -0,0 +1,135 @@
+#include "cops_builder.h"
+#include "cops_validate.h"
+#include "pcmm.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+static void
+tp_pcmm_fixed_objects(void) {
+        info();
+
+        uint8_t buf[64];
+        const uint8_t v4[4] = {10, 1, 2, 3};
+        const uint8_t v6[16] = {0x20, 0x01, 0x0d, 0xb8, [15] = 1};
+
+        TP_ASSERT(pcmm_transaction_id(buf, 0x0102, PCMM_GATE_SET) == 8);
+        TP_ASSERT(memcmp(buf, "\0\10\1\1\1\2\0\4", 8) == 0);
+
+        TP_ASSERT(pcmm_amid(buf, 0x1234, 0x0001) == 8);
+        TP_ASSERT(memcmp(buf, "\0\10\2\1\x12\x34\0\1", 8) == 0);
+
+        TP_ASSERT(pcmm_subscriber_v4(buf, v4) == 8);
+        TP_ASSERT(memcmp(buf, "\0\10\3\1", 4) == 0 && memcmp(buf + 4, v4, 4) == 0);
+
+        TP_ASSERT(pcmm_subscriber_v6(buf, v6) == 20);
+        TP_ASSERT(memcmp(buf, "\0\24\3\2", 4) == 0 && memcmp(buf + 4, v6, 16) == 0);
+
+        TP_ASSERT(pcmm_gate_id(buf, 0xCAFEF00D) == 8);
+        TP_ASSERT(memcmp(buf, "\0\10\4\1\xCA\xFE\xF0\x0D", 8) == 0);
+
+        /* PacketCable Error is S-Num 14, S-Type 1: Gate State (15) and Version Info (16) follow it. */
+        TP_ASSERT(pcmm_error(buf, PCMM_ERROR_RESOURCES, 0x0203) == 8);
+        TP_ASSERT(buf[2] == 14 && buf[3] == 1);
+        TP_ASSERT(memcmp(buf, "\0\10\16\1\0\1\2\3", 8) == 0);
+        TP_ASSERT(PCMM_SNUM_GATE_STATE == 15 && PCMM_SNUM_VERSION_INFO == 16);
+
+        struct pcmm_gate_spec spec = {PCMM_GATE_FLAG_UPSTREAM, 0xB8, 0xFC, 1, 200, 300, 400, 500};
+        TP_ASSERT(pcmm_gate_spec(buf, &spec) == 4 + PCMM_GATE_SPEC_LEN);
+        TP_ASSERT(memcmp(buf, "\0\20\5\1\1\xB8\xFC\1\0\xC8\1\x2C\1\x90\1\xF4", 16) == 0);
+}
+
+static void
+tp_pcmm_classifiers(void) {
+        info();
+
+        uint8_t buf[64];
+        struct pcmm_classifier c = {17, 0xB8, 0xFC, {10, 0, 0, 1}, {10, 0, 0, 2}, 5060, 5061, 64};
+
+        TP_ASSERT(pcmm_classifier(buf, &c) == 24);
+        TP_ASSERT(memcmp(buf, "\0\30\6\1\0\21\xB8\xFC", 8) == 0);
+        TP_ASSERT(memcmp(buf + 8, "\12\0\0\1\12\0\0\2", 8) == 0);
+        TP_ASSERT(memcmp(buf + 16, "\x13\xC4\x13\xC5\x40\0\0\0", 8) == 0);
+
+        struct pcmm_ext_classifier e = {0};
+        e.protocol = 6;
+        memcpy(e.src_mask, "\xFF\xFF\xFF\0", 4);
+        e.src_port_start = 1000;
+        e.src_port_end = 2000;
+        e.dst_port_end = 0xFFFF;
+        e.classifier_id = 7;
+        e.priority = 64;
+        e.state = 1;
+        e.action = 0;
+
+        TP_ASSERT(pcmm_ext_classifier(buf, &e) == 40);
+        TP_ASSERT(memcmp(buf, "\0\50\6\2\0\6\0\0", 8) == 0);
+        TP_ASSERT(memcmp(buf + 12, "\xFF\xFF\xFF\0", 4) == 0);
+        TP_ASSERT(memcmp(buf + 24, "\x03\xE8\x07\xD0\0\0\xFF\xFF", 8) == 0);
+        TP_ASSERT(memcmp(buf + 32, "\0\7\x40\1\0\0\0\0", 8) == 0);
+}
+
+static void
+tp_pcmm_traffic_profiles(void) {
+        info();
+
+        uint8_t buf[64];
+
+        struct pcmm_flow_spec fs = {PCMM_ENVELOPE_AUTHORIZED, 2, 1.0f, 2.0f, 0.0f, 64, 1500, 1.0f, 0};
+        TP_ASSERT(pcmm_flow_spec(buf, &fs) == 36);
+        TP_ASSERT(memcmp(buf, "\0\44\7\1\1\2\0\0", 8) == 0);
+        TP_ASSERT(memcmp(buf + 8, "\x3F\x80\0\0\x40\0\0\0", 8) == 0);
+        TP_ASSERT(memcmp(buf + 20, "\0\0\0\x40\0\0\x05\xDC\x3F\x80\0\0", 12) == 0);
+
+        struct pcmm_best_effort be = {PCMM_ENVELOPE_AUTHORIZED, 3, 0, 1000000, 3044, 0, 0, 0};
+        TP_ASSERT(pcmm_best_effort(buf, &be) == 32);
+        TP_ASSERT(memcmp(buf, "\0\40\7\3\1\0\0\0\3\0\0\0", 12) == 0);
+        TP_ASSERT(memcmp(buf + 16, "\0\x0F\x42\x40\0\0\x0B\xE4", 8) == 0);
+
+        /* The name and its NUL are padded to a word. */
+        memset(buf, 0xAA, sizeof(buf));
+        TP_ASSERT(pcmm_service_class(buf, PCMM_ENVELOPE_AUTHORIZED, "voice") == 16);
+        TP_ASSERT(memcmp(buf, "\0\20\7\2\1\0\0\0voice\0\0\0", 16) == 0);
+        TP_ASSERT(pcmm_service_class(buf, 1, "abc") == 12);
+        TP_ASSERT(pcmm_service_class(buf, 1, "") == 0);
+        TP_ASSERT(pcmm_service_class(buf, 1, "0123456789abcdef") == 0);
+        TP_ASSERT(pcmm_service_class(buf, 1, "0123456789abcde") == 24);
+}
+
+/* A complete Gate-Set assembled from the typed encoders passes validation. */
+static void
+tp_pcmm_gate_set(void) {
+        info();
+
+        uint8_t buf[256];
+        uint8_t obj[64];
+        struct cops_builder b;
+        struct cops_builder_mark csi;
+        struct pcmm_gate_spec spec = {0};
+        struct pcmm_classifier c = {17, 0, 0, {10, 0, 0, 1}, {10, 0, 0, 2}, 5060, 5061, 64};
+
+        cops_builder_init(&b, buf, sizeof(buf), 2);
+        cops_builder_object(&b, 1, 1, "hdl1", 4);
+        cops_builder_object(&b, 2, 1, "\0\10\0\0", 4);
+        cops_builder_object(&b, 6, 1, "\0\1\0\1", 4);
+        cops_builder_begin(&b, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI, &csi);
+        cops_builder_append(&b, obj, pcmm_transaction_id(obj, 1, PCMM_GATE_SET));
+        cops_builder_append(&b, obj, pcmm_amid(obj, 0x1234, 1));
+        cops_builder_append(&b, obj, pcmm_subscriber_v4(obj, (const uint8_t*)"\12\0\0\1"));
+        cops_builder_append(&b, obj, pcmm_gate_spec(obj, &spec));
+        cops_builder_append(&b, obj, pcmm_service_class(obj, PCMM_ENVELOPE_AUTHORIZED, "voice"));
+        cops_builder_append(&b, obj, pcmm_classifier(obj, &c));
+        cops_builder_end(&b, &csi);
+        size_t len = cops_builder_finish(&b);
+
+        TP_ASSERT(len == 32 + 4 + 8 + 8 + 8 + 16 + 16 + 24);
+        TP_ASSERT(cops_validate(buf, len, 0, NULL) == COPS_VERR_NONE);
+}
+
+void
+test_pcmm(void) {
+        tp_pcmm_fixed_objects();
+        tp_pcmm_classifiers();
+        tp_pcmm_traffic_profiles();
+        tp_pcmm_gate_set();
+}
@@ -0,0 +1,247 @@
+#include "cops_pepsim.h"
+#include "cops_server.h"
+#include "cops_template.h"
+#include "pcmm.h"
+#include "test_cops.h"
+
+#ifdef __linux__
+
+#include <netinet/in.h>
+
+#define info() printf("TEST: %s\n", __func__)
+
+/* The PDP side: every REQ is answered with a Gate-Set, the reports are counted. */
+struct pdp_counts {
+        struct cops_dec_template dec;
+        int acks;
+        int errs;
+        int accounting;
+        int drqs;
+        uint8_t err_si[64]; /* ClientSI body of the first Gate-Set-Err. */
+        uint16_t err_si_len;
+};
+
+static void
+pdp_message(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* msg) {
+        static const uint8_t subscriber[4] = {10, 0, 0, 1};
+        struct pdp_counts* counts = srv->cfg.user;
+        const struct cops_obj* handle = cops_msg_find(msg, 1, 1);
+
+        if (msg->opcode == 1) {
+                struct cops_dec_fields f = {(const char*)cops_obj_data(msg, handle), (uint16_t)conn->rx_msgs, 0,
+                                            subscriber, NULL};
+                uint8_t* dst = cops_server_reserve(srv, conn, counts->dec.length);
+
+                TP_ASSERT(dst != NULL);
+                cops_server_commit(srv, conn, cops_dec_template_render(&counts->dec, dst, &f));
+        } else if (msg->opcode == 3) {
+                const struct cops_obj* si = cops_msg_find(msg, COPS_CNUM_CLIENT_SI, 1);
+
+                if (si == NULL)
+                        counts->accounting++;
+                else if (cops_obj_data(msg, si)[7] == PCMM_GATE_SET_ACK)
+                        counts->acks++;
+                else if (cops_obj_data(msg, si)[7] == PCMM_GATE_SET_ERR && counts->errs++ == 0 &&
+                         si->length <= sizeof(counts->err_si) + COPS_OBJ_HEADER_LEN) {
+                        counts->err_si_len = si->length - COPS_OBJ_HEADER_LEN;
+                        memcpy(counts->err_si, cops_obj_data(msg, si), counts->err_si_len);
+                }
+        } else if (msg->opcode == 4) {
+                counts->drqs++;
+        }
+}
+
+static void
+pdp_init(struct cops_server* srv, struct pdp_counts* counts, uint32_t ka_timer, const struct cops_integrity_key* key) {
+        static const uint8_t gate_spec[PCMM_GATE_SPEC_LEN] = {0};
+        static const uint8_t profile[8] = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_dec_layout l = {0};
+
+        l.command = PCMM_GATE_SET;
+        l.family = AF_INET;
+        l.gate_spec = gate_spec;
+        l.profile = profile;
+        l.profile_len = sizeof(profile);
+        l.profile_stype = PCMM_STYPE_BEST_EFFORT;
+        TP_ASSERT(cops_dec_template_init(&counts->dec, &l) == 0);
+
+        cfg.addr = "127.0.0.1";
+        cfg.ka_timer = ka_timer;
+        cfg.validate = true;
+        cfg.integrity = key;
+        cfg.cb.on_message = pdp_message;
+        cfg.user = counts;
+        TP_ASSERT(cops_server_init(srv, &cfg) == 0);
+}
+
+static void
+tp_cops_pepsim_closed_loop(void) {
+        info();
+
+        static struct pdp_counts counts;
+        static struct cops_pepsim sim;
+        static struct cops_pepsim_stats merged;
+        struct cops_pepsim_config cfg = {0};
+        struct cops_server srv;
+
+        pdp_init(&srv, &counts, 30, NULL);
+        cfg.port = cops_server_port(&srv);
+        cfg.sessions = 4;
+        cfg.window = 2;
+        cfg.err_every = 4;
+        TP_ASSERT(cops_pepsim_start(&sim, &cfg) == 0);
+
+        for (int i = 0; i < 5000 && sim.stats.dec < 400; i++) {
+                cops_pepsim_poll(&sim, 1);
+                cops_server_poll(&srv, 0);
+        }
+
+        /* Every session is open and keeps its window full, the validating PDP closed none. */
+        TP_ASSERT(cops_pepsim_ready(&sim) && sim.stats.accepted == 4);
+        TP_ASSERT(sim.stats.closed == 0 && srv.nconns == 4);
+        TP_ASSERT(sim.stats.dec >= 400 && sim.stats.req - sim.stats.dec <= 4 * 2);
+        TP_ASSERT(sim.stats.req_ns.count == sim.stats.dec && sim.stats.open_ns.count == 4);
+        TP_ASSERT(cops_hist_quantile(&sim.stats.req_ns, 0.5) > 0);
+
+        /* Each Gate-Set is reported, every fourth of a session with Gate-Set-Err. */
+        TP_ASSERT(sim.stats.gate_set == sim.stats.dec && sim.stats.rpt == sim.stats.gate_set);
+        TP_ASSERT(sim.stats.gate_err <= sim.stats.gate_set / 4 && sim.stats.gate_err + 4 > sim.stats.gate_set / 4);
+        TP_ASSERT(counts.errs > 0 && counts.acks >= 3 * counts.errs - 4);
+        TP_ASSERT((uint64_t)(counts.acks + counts.errs) <= sim.stats.rpt);
+
+        /* The Gate-Set-Err carries a PacketCable Error object: S-Num 14, S-Type 1, Insufficient Resources. */
+        const uint8_t* error = NULL;
+        for (uint16_t off = 0; off + 4 <= counts.err_si_len; off += COPS_ALIGN4(cops_load16(counts.err_si + off))) {
+                if (cops_load16(counts.err_si + off) < 4)
+                        break;
+                if (counts.err_si[off + 2] == PCMM_SNUM_ERROR)
+                        error = counts.err_si + off;
+                TP_ASSERT(counts.err_si[off + 2] != PCMM_SNUM_GATE_STATE);
+        }
+        TP_ASSERT(error != NULL && cops_load16(error) == 8);
+        TP_ASSERT(error[2] == 14 && error[3] == 1 && cops_load16(error + 4) == 1);
+
+        cops_pepsim_merge(&merged, &sim.stats);
+        cops_pepsim_merge(&merged, &sim.stats);
+        TP_ASSERT(merged.dec == 2 * sim.stats.dec && merged.req_ns.count == 2 * sim.stats.dec);
+
+        char* text;
+        size_t len;
+        FILE* out = open_memstream(&text, &len);
+        cops_pepsim_report(&sim.stats, 1000000000, out);
+        fclose(out);
+        TP_ASSERT(strstr(text, "sessions accepted=4 closed=0\n") != NULL);
+        TP_ASSERT(strstr(text, "req-dec  n=") != NULL);
+        free(text);
+
+        cops_pepsim_stop(&sim);
+        for (int i = 0; i < 10 && srv.nconns; i++)
+                cops_server_poll(&srv, 1);
+        TP_ASSERT(srv.nconns == 0);
+        cops_server_destroy(&srv);
+}
+
+static void
+tp_cops_pepsim_paced(void) {
+        info();
+
+        static struct pdp_counts counts;
+        static struct cops_pepsim sim;
+        struct cops_pepsim_config cfg = {0};
+        struct cops_server srv;
+
+        pdp_init(&srv, &counts, 1, NULL);
+        cfg.port = cops_server_port(&srv);
+        cfg.sessions = 2;
+        cfg.window = 4;
+        cfg.req_rate = 200;
+        cfg.rpt_rate = 100;
+        cfg.drq_rate = 50;
+        TP_ASSERT(cops_pepsim_start(&sim, &cfg) == 0);
+
+        for (int i = 0; i < 1000 && !cops_pepsim_ready(&sim); i++) {
+                cops_pepsim_poll(&sim, 1);
+                cops_server_poll(&srv, 0);
+        }
+        TP_ASSERT(cops_pepsim_ready(&sim));
+
+        /* 600 ms at the configured rates, one Keep-Alive per session at half the 1 s timer. */
+        while (sim.now_ns - sim.t_ready < 600000000) {
+                cops_pepsim_poll(&sim, 1);
+                cops_server_poll(&srv, 0);
+        }
+        /* The PDP saw everything sent so far, the DECs to the latest REQs may still be on the way. */
+        for (int i = 0; i < 10; i++) {
+                cops_pepsim_poll(&sim, 0);
+                cops_server_poll(&srv, 1);
+        }
+
+        TP_ASSERT(sim.stats.closed == 0);
+        TP_ASSERT(sim.stats.req >= 2 * 110 && sim.stats.req <= 2 * 130);
+        TP_ASSERT(sim.stats.req - sim.stats.dec <= 2 * 4);
+        TP_ASSERT(sim.stats.drq >= 2 * 25 && sim.stats.drq <= 2 * 32 && (uint64_t)counts.drqs == sim.stats.drq);
+        TP_ASSERT((uint64_t)counts.accounting + counts.acks == sim.stats.rpt && counts.errs == 0);
+        TP_ASSERT(counts.accounting >= 2 * 50 && counts.accounting <= 2 * 61);
+        TP_ASSERT(sim.stats.ka_tx == 2 && sim.stats.ka_rx == 2);
+
+        cops_pepsim_stop(&sim);
+        cops_server_destroy(&srv);
+}
+
+static void
+tp_cops_pepsim_integrity(void) {
+        info();
+
+        static struct pdp_counts counts;
+        static struct cops_pepsim sim;
+        struct cops_pepsim_config cfg = {0};
+        struct cops_integrity_key key;
+        struct cops_integrity_key wrong;
+        struct cops_server srv;
+
+        cops_integrity_key_init(&key, 1, "cmts secret", 11);
+        cops_integrity_key_init(&wrong, 1, "cmts secreT", 11);
+        pdp_init(&srv, &counts, 30, &key);
+        cfg.port = cops_server_port(&srv);
+        cfg.sessions = 2;
+        cfg.window = 2;
+        cfg.integrity = &key;
+        TP_ASSERT(cops_pepsim_start(&sim, &cfg) == 0);
+
+        for (int i = 0; i < 5000 && sim.stats.dec < 200; i++) {
+                cops_pepsim_poll(&sim, 1);
+                cops_server_poll(&srv, 0);
+        }
+
+        /* Both ends sign and verify every message, none fails. */
+        TP_ASSERT(sim.stats.accepted == 2 && sim.stats.closed == 0 && sim.stats.integrity_err == 0);
+        TP_ASSERT(sim.stats.dec >= 200 && counts.acks > 0);
+        cops_pepsim_stop(&sim);
+
+        /* With the wrong key the PDP refuses the Client-Open. */
+        cfg.integrity = &wrong;
+        TP_ASSERT(cops_pepsim_start(&sim, &cfg) == 0);
+        for (int i = 0; i < 100 && sim.stats.closed < 2; i++) {
+                cops_pepsim_poll(&sim, 1);
+                cops_server_poll(&srv, 0);
+        }
+        TP_ASSERT(sim.stats.accepted == 0 && sim.stats.closed == 2);
+
+        cops_pepsim_stop(&sim);
+        cops_server_destroy(&srv);
+}
+
+void
+test_pepsim(void) {
+        tp_cops_pepsim_closed_loop();
+        tp_cops_pepsim_paced();
+        tp_cops_pepsim_integrity();
+}
+
+#else
+
+void
+test_pepsim(void) {}
+
+#endif
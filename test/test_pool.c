@@ -0,0 +1,164 @@
+#include <pthread.h>
+
+#include "cops_pool.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+static void
+tp_cops_pool_classes(void) {
+        info();
+
+        struct cops_pool pool;
+        struct cops_buf* b;
+
+        cops_pool_init(&pool);
+        cops_pool_bind(&pool);
+
+        /* Keep-Alive and Client-Accept share the smallest class. */
+        b = cops_buf_alloc(&pool, 8);
+        TP_ASSERT(b != NULL && b->cap == 32 && b->len == 0);
+        TP_ASSERT(((uintptr_t)b->data & 15) == 0);
+        cops_keepalive(b->data);
+        b->len = 8;
+        cops_buf_release(b);
+
+        TP_ASSERT(cops_buf_alloc(&pool, 24)->cap == 32);
+        TP_ASSERT(cops_buf_alloc(&pool, 100)->cap == 128);
+        TP_ASSERT(cops_buf_alloc(&pool, 129)->cap == 256);
+        TP_ASSERT(cops_buf_alloc(&pool, COPS_POOL_MAX_SIZE)->cap == COPS_POOL_MAX_SIZE);
+        TP_ASSERT(cops_buf_alloc(&pool, COPS_POOL_MAX_SIZE + 1) == NULL);
+        TP_ASSERT(pool.nslabs == 4);
+
+        cops_pool_destroy(&pool);
+        TP_ASSERT(pool.slabs == NULL);
+}
+
+static void
+tp_cops_pool_reuse(void) {
+        info();
+
+        struct cops_pool pool;
+        struct cops_buf* bufs[4096];
+
+        cops_pool_init(&pool);
+        cops_pool_bind(&pool);
+
+        /* A released buffer is the next one handed out, no slab is added. */
+        struct cops_buf* b = cops_buf_alloc(&pool, 64);
+        cops_buf_release(b);
+        TP_ASSERT(cops_buf_alloc(&pool, 64) == b);
+        TP_ASSERT(pool.nslabs == 1);
+
+        /* Extra references keep the buffer out of the free list. */
+        uint32_t nfree = pool.cls[1].nfree;
+        cops_buf_ref(b);
+        cops_buf_ref(b);
+        cops_buf_release(b);
+        cops_buf_release(b);
+        TP_ASSERT(pool.cls[1].nfree == nfree);
+        cops_buf_release(b);
+        TP_ASSERT(pool.cls[1].nfree == nfree + 1);
+
+        /* Running a class dry adds slabs, releasing everything restores the free count. */
+        for (int i = 0; i < 4096; i++) {
+                bufs[i] = cops_buf_alloc(&pool, 128);
+                TP_ASSERT(bufs[i] != NULL);
+        }
+        TP_ASSERT(pool.nslabs > 1);
+        TP_ASSERT(pool.cls[1].total - pool.cls[1].nfree == 4096);
+        for (int i = 0; i < 4096; i++)
+                cops_buf_release(bufs[i]);
+        TP_ASSERT(pool.cls[1].nfree == pool.cls[1].total);
+
+        cops_pool_destroy(&pool);
+}
+
+static void*
+release_remote(void* arg) {
+        struct cops_buf** bufs = arg;
+
+        for (int i = 0; i < 64; i++)
+                cops_buf_release(bufs[i]);
+
+        return NULL;
+}
+
+static void
+tp_cops_pool_remote_release(void) {
+        info();
+
+        struct cops_pool pool;
+        struct cops_buf* bufs[64];
+        pthread_t thread;
+
+        cops_pool_init(&pool);
+        cops_pool_bind(&pool);
+        for (int i = 0; i < 64; i++)
+                bufs[i] = cops_buf_alloc(&pool, 32);
+        uint32_t total = pool.cls[0].total;
+
+        /* Buffers released by another thread wait on the remote list. */
+        TP_ASSERT(pthread_create(&thread, NULL, release_remote, bufs) == 0);
+        pthread_join(thread, NULL);
+        TP_ASSERT(atomic_load(&pool.remote) != NULL);
+
+        /* The owner picks them up once the class runs dry instead of growing. */
+        for (uint32_t i = 0; i < total; i++) {
+                TP_ASSERT(cops_buf_alloc(&pool, 32) != NULL);
+        }
+        TP_ASSERT(pool.cls[0].total == total);
+        TP_ASSERT(atomic_load(&pool.remote) == NULL);
+
+        /* Initialising another pool, e.g. for a shard started from here, leaves the owner as it is. */
+        struct cops_pool other;
+        struct cops_buf* b = cops_buf_alloc(&pool, 32);
+        uint32_t nfree = pool.cls[0].nfree;
+
+        cops_pool_init(&other);
+        cops_buf_release(b);
+        TP_ASSERT(pool.cls[0].nfree == nfree + 1);
+        TP_ASSERT(atomic_load(&pool.remote) == NULL);
+        cops_pool_destroy(&other);
+
+        cops_pool_destroy(&pool);
+}
+
+static void
+tp_cops_arena(void) {
+        info();
+
+        struct cops_pool pool;
+        struct cops_arena arena;
+
+        cops_pool_init(&pool);
+        cops_pool_bind(&pool);
+        cops_arena_init(&arena, &pool);
+
+        uint8_t* a = cops_arena_alloc(&arena, 3);
+        uint8_t* b = cops_arena_alloc(&arena, 16);
+        TP_ASSERT(a != NULL && b == a + 8);
+        TP_ASSERT(((uintptr_t)b & 7) == 0);
+        TP_ASSERT(cops_arena_alloc(&arena, COPS_ARENA_CHUNK + 1) == NULL);
+
+        /* Allocations spill into new chunks, a reset returns all of them at once. */
+        for (int i = 0; i < 10; i++) {
+                TP_ASSERT(cops_arena_alloc(&arena, 1000) != NULL);
+        }
+        uint32_t nfree = pool.cls[4].nfree;
+        TP_ASSERT(pool.cls[4].total - nfree == 3);
+
+        cops_arena_reset(&arena);
+        TP_ASSERT(arena.chunks == NULL);
+        TP_ASSERT(pool.cls[4].nfree == pool.cls[4].total);
+
+        cops_pool_destroy(&pool);
+}
+
+void
+test_pool(void) {
+        tp_cops_pool_classes();
+        tp_cops_pool_reuse();
+        tp_cops_pool_remote_release();
+        tp_cops_arena();
+}
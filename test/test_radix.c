@@ -0,0 +1,161 @@
+#include <errno.h>
+
+#include "cops_radix.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+static void
+v4(uint8_t* addr, uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+        addr[0] = a;
+        addr[1] = b;
+        addr[2] = c;
+        addr[3] = d;
+}
+
+static void
+tp_cops_radix_exact_prefix(void) {
+        info();
+
+        struct cops_radix r;
+        uint32_t handles[8];
+        uint8_t addr[4] = {0};
+
+        TP_ASSERT(cops_radix_init(&r, 4) == 0);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 0, handles, 8) == 0);
+
+        v4(addr, 10, 0, 1, 5);
+        TP_ASSERT(cops_radix_insert(&r, AF_INET, addr, 1) == 0);
+        TP_ASSERT(cops_radix_insert(&r, AF_INET, addr, 2) == 0);
+        TP_ASSERT(cops_radix_insert(&r, AF_INET, addr, 2) == 0); /* Already indexed. */
+        v4(addr, 10, 0, 1, 200);
+        TP_ASSERT(cops_radix_insert(&r, AF_INET, addr, 3) == 0);
+        v4(addr, 10, 0, 2, 5);
+        TP_ASSERT(cops_radix_insert(&r, AF_INET, addr, 4) == 0);
+        v4(addr, 192, 168, 0, 1);
+        TP_ASSERT(cops_radix_insert(&r, AF_INET, addr, 5) == 0);
+        TP_ASSERT(cops_radix_count(&r) == 5);
+        TP_ASSERT(cops_radix_insert(&r, 0, addr, 6) == -1 && errno == EINVAL);
+
+        /* Exact match: both gates of the subscriber, none of its neighbours. */
+        v4(addr, 10, 0, 1, 5);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 32, handles, 8) == 2);
+        TP_ASSERT(handles[0] == 1 && handles[1] == 2);
+        v4(addr, 10, 0, 1, 6);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 32, handles, 8) == 0);
+
+        /* Prefixes, in address order. Bits past the prefix length do not matter. */
+        v4(addr, 10, 0, 1, 99);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 24, handles, 8) == 3);
+        TP_ASSERT(handles[0] == 1 && handles[1] == 2 && handles[2] == 3);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 16, handles, 8) == 4);
+        TP_ASSERT(handles[3] == 4);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 0, handles, 8) == 5);
+        TP_ASSERT(handles[4] == 5);
+        v4(addr, 10, 0, 0, 0);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 23, handles, 8) == 3);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 24, handles, 8) == 0);
+        v4(addr, 11, 0, 0, 0);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 8, handles, 8) == 0);
+
+        /* The total is returned even when the handles do not all fit. */
+        handles[1] = 0;
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 0, handles, 1) == 5);
+        TP_ASSERT(handles[0] == 1 && handles[1] == 0);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 33, handles, 8) == 0);
+
+        /* The families are separate trees. */
+        uint8_t addr6[16] = {0x20, 0x01, 0x0d, 0xb8};
+        TP_ASSERT(cops_radix_find(&r, AF_INET6, addr6, 0, handles, 8) == 0);
+        addr6[15] = 1;
+        TP_ASSERT(cops_radix_insert(&r, AF_INET6, addr6, 7) == 0);
+        addr6[6] = 0x80;
+        TP_ASSERT(cops_radix_insert(&r, AF_INET6, addr6, 8) == 0);
+        TP_ASSERT(cops_radix_find(&r, AF_INET6, addr6, 56, handles, 8) == 1 && handles[0] == 8);
+        TP_ASSERT(cops_radix_find(&r, AF_INET6, addr6, 48, handles, 8) == 2 && handles[0] == 7);
+        TP_ASSERT(cops_radix_find(&r, AF_INET6, addr6, 128, handles, 8) == 1);
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr6, 0, handles, 8) == 5);
+
+        /* Removal needs both the address and the handle. */
+        v4(addr, 10, 0, 1, 5);
+        TP_ASSERT(!cops_radix_remove(&r, AF_INET, addr, 3));
+        TP_ASSERT(cops_radix_remove(&r, AF_INET, addr, 1));
+        TP_ASSERT(!cops_radix_remove(&r, AF_INET, addr, 1));
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 32, handles, 8) == 1 && handles[0] == 2);
+        TP_ASSERT(cops_radix_remove(&r, AF_INET, addr, 2));
+        TP_ASSERT(cops_radix_find(&r, AF_INET, addr, 24, handles, 8) == 1 && handles[0] == 3);
+        TP_ASSERT(cops_radix_remove(&r, AF_INET6, addr6, 8));
+        TP_ASSERT(!cops_radix_remove(&r, AF_INET, addr6, 8));
+        TP_ASSERT(cops_radix_count(&r) == 4);
+
+        cops_radix_free(&r);
+}
+
+/* Random churn against a linear scan of the same gates. */
+static void
+tp_cops_radix_churn(void) {
+        info();
+
+        enum { N = 2000 };
+        static uint8_t addrs[N][4];
+        static bool live[N];
+        static uint32_t handles[N];
+        struct cops_radix r;
+        uint32_t seed = 12345;
+        bool ok = true;
+
+        TP_ASSERT(cops_radix_init(&r, 16) == 0);
+
+        /* Subscribers crowd into a few /24s so that prefixes and duplicates both occur. */
+        for (uint32_t i = 0; i < N; i++) {
+                seed = seed * 1103515245 + 12345;
+                v4(addrs[i], 10, (uint8_t)(seed >> 28), (uint8_t)(seed >> 20 & 3), (uint8_t)(seed >> 12 & 0x3F));
+        }
+
+        for (uint32_t round = 0; round < 4 * N; round++) {
+                seed = seed * 1103515245 + 12345;
+                uint32_t i = (seed >> 8) % N;
+
+                if (live[i])
+                        ok &= cops_radix_remove(&r, AF_INET, addrs[i], i);
+                else
+                        ok &= cops_radix_insert(&r, AF_INET, addrs[i], i) == 0;
+                live[i] = !live[i];
+
+                if (round % 97 != 0)
+                        continue;
+
+                unsigned plen = (seed >> 4) % 33;
+                const uint8_t* q = addrs[(seed >> 12) % N];
+                size_t expect = 0;
+
+                for (uint32_t j = 0; j < N; j++) {
+                        uint32_t a = cops_load32(addrs[j]);
+                        uint32_t b = cops_load32(q);
+
+                        if (live[j] && (plen == 0 || (a ^ b) >> (32 - plen) == 0))
+                                expect++;
+                }
+
+                size_t found = cops_radix_find(&r, AF_INET, q, plen, handles, N);
+                ok &= found == expect;
+                for (size_t j = 0; j < found && j < N; j++)
+                        ok &= live[handles[j]];
+                for (size_t j = 1; j < found && j < N; j++)
+                        ok &= cops_load32(addrs[handles[j - 1]]) <= cops_load32(addrs[handles[j]]);
+        }
+        TP_ASSERT(ok);
+
+        size_t n = 0;
+        for (uint32_t i = 0; i < N; i++)
+                n += live[i];
+        TP_ASSERT(cops_radix_count(&r) == n);
+
+        cops_radix_free(&r);
+}
+
+void
+test_radix(void) {
+        tp_cops_radix_exact_prefix();
+        tp_cops_radix_churn();
+}
@@ -0,0 +1,951 @@
+#include "cops_builder.h"
+#include "cops_server.h"
+#include "cops_sync.h"
+#include "test_cops.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define info() printf("TEST: %s\n", __func__)
+
+struct server_counts {
+        int acct;
+        int drained;
+        int opened;
+        int messages;
+        int closed;
+        uint8_t last_opcode;
+        uint32_t last_id;
+};
+
+static void
+on_open(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* opn) {
+        struct server_counts* counts = srv->cfg.user;
+
+        counts->opened++;
+        counts->last_id = conn->id;
+}
+
+static void
+on_message(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* msg) {
+        struct server_counts* counts = srv->cfg.user;
+
+        counts->messages++;
+        counts->last_opcode = msg->opcode;
+}
+
+static void
+on_close(struct cops_server* srv, struct cops_conn* conn) {
+        ((struct server_counts*)srv->cfg.user)->closed++;
+}
+
+static void
+on_acct(struct cops_server* srv, struct cops_conn* conn) {
+        ((struct server_counts*)srv->cfg.user)->acct++;
+}
+
+static void
+on_drain(struct cops_server* srv, struct cops_conn* conn) {
+        ((struct server_counts*)srv->cfg.user)->drained++;
+}
+
+static int
+pep_connect(uint16_t port) {
+        struct sockaddr_in sa = {0};
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+
+        /* Small partial writes must not wait for a delayed ACK. */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+/* Client-Open carrying a PEP Identification object. */
+static size_t
+pep_open(uint8_t* buf, size_t cap) {
+        struct cops_builder b;
+
+        cops_builder_init(&b, buf, cap, 6);
+        cops_builder_object(&b, 11, 1, "cmts-1", 6);
+
+        return cops_builder_finish(&b);
+}
+
+/* Run a few rounds of the event loop. */
+static void
+pump(struct cops_server* srv, int rounds) {
+        for (int i = 0; i < rounds; i++)
+                cops_server_poll(srv, 10);
+}
+
+static void
+tp_cops_server_handshake(enum cops_backend backend) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_server srv;
+        struct cops_metrics metrics;
+        static struct cops_metrics_snapshot snap;
+        struct cops_trace trace;
+        const struct cops_trace_rec** recs;
+        uint8_t buf[64];
+
+        TP_ASSERT(cops_metrics_init(&metrics, 1) == 0);
+        TP_ASSERT(cops_trace_create(&trace, "/tmp/test_server.trace", 1, 16, 1024) == 0);
+        cfg.addr = "127.0.0.1";
+        cfg.backend = backend;
+        cfg.metrics = &metrics;
+        cfg.trace = &trace;
+        cfg.ka_timer = 30;
+        cfg.acct_timer = 15;
+        cfg.sync = true;
+        cfg.cb.on_open = on_open;
+        cfg.cb.on_message = on_message;
+        cfg.cb.on_close = on_close;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+
+        int fd = pep_connect(cops_server_port(&srv));
+        TP_ASSERT(fd >= 0);
+        pump(&srv, 2);
+        TP_ASSERT(srv.nconns == 1);
+
+        /* Client-Open, answered by a Client-Accept with the configured timers. */
+        size_t len = pep_open(buf, sizeof(buf));
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(counts.opened == 1);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 24);
+        TP_ASSERT(buf[1] == 7);
+        TP_ASSERT(buf[15] == 30);
+        TP_ASSERT(buf[23] == 15);
+
+        /* Keep-Alive is echoed. */
+        cops_keepalive(buf);
+        buf[2] = buf[3] = 0;
+        TP_ASSERT(send(fd, buf, 8, 0) == 8);
+        pump(&srv, 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 8);
+        TP_ASSERT(buf[1] == 9);
+
+        /* Report-State split across two writes reaches the callback once. */
+        uint8_t objs[16];
+        cops_handle(objs, "abcd");
+        new_cops_message(buf, 3, objs, 16);
+        TP_ASSERT(send(fd, buf, 5, 0) == 5);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 0);
+        TP_ASSERT(send(fd, buf + 5, 11, 0) == 11);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 1);
+        TP_ASSERT(counts.last_opcode == 3);
+
+        /* Synchronize Complete reaches the application when synchronization is enabled. */
+        len = cops_sync_complete(buf, NULL);
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 2);
+        TP_ASSERT(counts.last_opcode == COPS_OP_SSC);
+
+        /* A Request answered by a Decision. */
+        cops_context(objs + 8);
+        new_cops_message(buf, 1, objs, 24);
+        TP_ASSERT(send(fd, buf, 24, 0) == 24);
+        pump(&srv, 2);
+        new_cops_message(buf, 2, objs, 16);
+        TP_ASSERT(cops_server_send(&srv, srv.active, buf, 16) == 0);
+        pump(&srv, 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 16);
+
+        struct cops_conn* conn = srv.active;
+        TP_ASSERT(conn->rx_msgs == 5 && conn->tx_msgs == 3);
+        TP_ASSERT(conn->rx_bytes == pep_open(buf, sizeof(buf)) + 8 + 16 + 8 + 24);
+
+        cops_metrics_snapshot(&metrics, &snap);
+        TP_ASSERT(snap.total.opened == 1);
+        TP_ASSERT(snap.total.rx_ops[6] == 1 && snap.total.rx_ops[9] == 1 && snap.total.rx_ops[1] == 1);
+        TP_ASSERT(snap.total.tx_ops[7] == 1 && snap.total.tx_ops[9] == 1 && snap.total.tx_ops[2] == 1);
+        TP_ASSERT(snap.total.rx_objs[11] == 1 && snap.total.rx_objs[1] == 2 && snap.total.rx_objs[2] == 1);
+        TP_ASSERT(snap.total.hist[COPS_HIST_DECODE].count == 5);
+        TP_ASSERT(snap.total.hist[COPS_HIST_ENCODE].count == 3);
+        TP_ASSERT(snap.total.hist[COPS_HIST_DECISION].count == 1);
+
+        /* Every message in and out was traced in full, the Decision last. */
+        TP_ASSERT(cops_trace_records(&trace, &recs) == 8);
+        TP_ASSERT(recs[0]->dir == COPS_TRACE_RX && recs[0]->data[1] == 6 && recs[0]->conn_id == conn->id);
+        TP_ASSERT(recs[7]->dir == COPS_TRACE_TX && recs[7]->data[1] == 2 && recs[7]->caplen == 16);
+        free(recs);
+
+        close(fd);
+        pump(&srv, 2);
+        TP_ASSERT(counts.closed == 1);
+        TP_ASSERT(srv.nconns == 0);
+        cops_metrics_snapshot(&metrics, &snap);
+        TP_ASSERT(snap.total.closed == 1);
+
+        cops_server_destroy(&srv);
+        cops_metrics_free(&metrics);
+        cops_trace_close(&trace);
+        unlink("/tmp/test_server.trace");
+}
+
+static void
+tp_cops_server_protocol_errors(enum cops_backend backend) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_server srv;
+        uint8_t buf[64];
+
+        cfg.addr = "127.0.0.1";
+        cfg.backend = backend;
+        cfg.ka_timer = 30;
+        cfg.cb.on_message = on_message;
+        cfg.cb.on_close = on_close;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+
+        /* A Report-State before Client-Open closes the connection. */
+        int fd = pep_connect(cops_server_port(&srv));
+        uint8_t objs[8];
+        cops_handle(objs, "abcd");
+        new_cops_message(buf, 3, objs, 16);
+        TP_ASSERT(send(fd, buf, 16, 0) == 16);
+        pump(&srv, 3);
+        TP_ASSERT(counts.messages == 0);
+        TP_ASSERT(counts.closed == 1);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 0);
+        close(fd);
+
+        /* Connection slots are recycled. */
+        fd = pep_connect(cops_server_port(&srv));
+        size_t len = pep_open(buf, sizeof(buf));
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 3);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 16);
+        TP_ASSERT(srv.free == NULL);
+        TP_ASSERT(srv.nconns == 1);
+        close(fd);
+
+        cops_server_destroy(&srv);
+}
+
+static void
+tp_cops_server_validate(void) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_server srv;
+        struct cops_builder b;
+        uint8_t buf[64];
+
+        cfg.addr = "127.0.0.1";
+        cfg.validate = true;
+        cfg.cb.on_message = on_message;
+        cfg.cb.on_close = on_close;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+
+        int fd = pep_connect(cops_server_port(&srv));
+        size_t len = pep_open(buf, sizeof(buf));
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 16);
+
+        /* A complete Report-State is delivered. */
+        cops_builder_init(&b, buf, sizeof(buf), 3);
+        cops_builder_object(&b, 1, 1, "abcd", 4);
+        cops_builder_object(&b, 12, 1, "\0\1\0\0", 4);
+        len = cops_builder_finish(&b);
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 1);
+
+        /* One without its Report-Type closes the connection. */
+        uint8_t objs[8];
+        cops_handle(objs, "abcd");
+        new_cops_message(buf, 3, objs, 16);
+        TP_ASSERT(send(fd, buf, 16, 0) == 16);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 1);
+        TP_ASSERT(counts.closed == 1);
+        close(fd);
+
+        cops_server_destroy(&srv);
+}
+
+static void
+tp_cops_server_max_msg_len(void) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_server srv;
+        struct cops_builder b;
+        static uint8_t body[1200];
+        static uint8_t buf[1400];
+
+        /* A limit the receive buffer cannot hold is refused. */
+        cfg.addr = "127.0.0.1";
+        cfg.rbuf_size = 1024;
+        cfg.max_msg_len = 2048;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == -1 && errno == EINVAL);
+
+        cops_builder_init(&b, buf, sizeof(buf), 3);
+        cops_builder_object(&b, 1, 1, "abcd", 4);
+        cops_builder_object(&b, 12, 1, "\0\1\0\0", 4);
+        cops_builder_object(&b, 9, 1, body, sizeof(body));
+        size_t rpt = cops_builder_finish(&b);
+        TP_ASSERT(rpt > COPS_MSG_MAX_LEN);
+
+        /* A Report-State past the default limit closes the connection, a raised limit lets it through. */
+        for (int i = 0; i < 2; i++) {
+                cfg.rbuf_size = 0;
+                cfg.max_msg_len = (i == 0) ? 0 : 2048;
+                cfg.validate = true;
+                cfg.cb.on_message = on_message;
+                cfg.cb.on_close = on_close;
+                cfg.user = &counts;
+                memset(&counts, 0, sizeof(counts));
+                TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+
+                int fd = pep_connect(cops_server_port(&srv));
+                size_t len = pep_open(buf + rpt, sizeof(buf) - rpt);
+                TP_ASSERT(send(fd, buf + rpt, len, 0) == (ssize_t)len);
+                pump(&srv, 2);
+                TP_ASSERT(recv(fd, buf + rpt, 16, MSG_WAITALL) == 16);
+
+                TP_ASSERT(send(fd, buf, rpt, 0) == (ssize_t)rpt);
+                pump(&srv, 2);
+                TP_ASSERT(counts.messages == i && counts.closed == 1 - i);
+                close(fd);
+
+                cops_server_destroy(&srv);
+        }
+}
+
+static void
+tp_cops_server_integrity(void) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_server srv;
+        struct cops_integrity_key key;
+        struct cops_integrity pep;
+        struct cops_builder b;
+        uint8_t buf[256];
+
+        cops_integrity_key_init(&key, 42, "shared secret", 13);
+        cops_integrity_init(&pep, &key, 77);
+        cfg.addr = "127.0.0.1";
+        cfg.wbuf_size = 128;
+        cfg.validate = true;
+        cfg.integrity = &key;
+        cfg.cb.on_message = on_message;
+        cfg.cb.on_close = on_close;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+
+        /* Signed Client-Open, the Client-Accept comes back signed. */
+        int fd = pep_connect(cops_server_port(&srv));
+        size_t len = cops_integrity_sign(&pep, buf, pep_open(buf, sizeof(buf)));
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 16 + COPS_INTEGRITY_LEN);
+        TP_ASSERT(buf[1] == 7 && cops_load32(buf + 4) == 16 + COPS_INTEGRITY_LEN);
+        TP_ASSERT(cops_integrity_verify(&pep, buf, 16 + COPS_INTEGRITY_LEN) == COPS_IERR_NONE);
+
+        /* The server's sequence continues on the Keep-Alive echo. */
+        cops_keepalive(buf);
+        len = cops_integrity_sign(&pep, buf, 8);
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 8 + COPS_INTEGRITY_LEN);
+        TP_ASSERT(buf[1] == 9 && cops_integrity_verify(&pep, buf, 8 + COPS_INTEGRITY_LEN) == COPS_IERR_NONE);
+
+        /* Two messages committed together are signed one by one. */
+        struct cops_conn* conn = srv.active;
+        uint8_t* dst = cops_server_reserve_span(&srv, conn, 32, 2);
+        uint8_t objs[16] = {0};
+        cops_handle(objs, "abcd");
+        new_cops_message(dst, 2, objs, 16);
+        cops_handle(objs, "efgh");
+        new_cops_message(dst + 16, 2, objs, 16);
+        TP_ASSERT(cops_server_commit(&srv, conn, 32) == 0);
+        TP_ASSERT(cops_server_flush(&srv, conn) == 0);
+        TP_ASSERT(recv(fd, buf, 2 * (16 + COPS_INTEGRITY_LEN), MSG_WAITALL) == 2 * (16 + COPS_INTEGRITY_LEN));
+        TP_ASSERT(memcmp(buf + 12, "abcd", 4) == 0 && memcmp(buf + 16 + COPS_INTEGRITY_LEN + 12, "efgh", 4) == 0);
+        TP_ASSERT(cops_integrity_verify(&pep, buf, 16 + COPS_INTEGRITY_LEN) == COPS_IERR_NONE);
+        TP_ASSERT(cops_integrity_verify(&pep, buf + 16 + COPS_INTEGRITY_LEN, 16 + COPS_INTEGRITY_LEN) ==
+                  COPS_IERR_NONE);
+
+        /* A span reserved per message may fill the whole transmit buffer once signed. */
+        size_t span = srv.cfg.wbuf_size - 3 * COPS_INTEGRITY_LEN;
+        TP_ASSERT(cops_server_reserve_span(&srv, conn, span + 1, 3) == NULL);
+        dst = cops_server_reserve_span(&srv, conn, span, 3);
+        TP_ASSERT(dst != NULL);
+        cops_handle(objs, "ijkl");
+        new_cops_message(dst, 2, objs, 16);
+        new_cops_message(dst + 16, 2, objs, 16);
+        cops_builder_init(&b, dst + 32, span - 32, 2);
+        cops_builder_object(&b, 1, 1, "mnop", 4);
+        cops_builder_object(&b, 9, 1, objs, span - 32 - 16 - 4);
+        TP_ASSERT(cops_builder_finish(&b) == span - 32);
+        TP_ASSERT(cops_server_commit(&srv, conn, span) == 0);
+        TP_ASSERT(conn->wlen == srv.cfg.wbuf_size);
+        TP_ASSERT(cops_server_flush(&srv, conn) == 0);
+        TP_ASSERT(recv(fd, buf, srv.cfg.wbuf_size, MSG_WAITALL) == (ssize_t)srv.cfg.wbuf_size);
+        for (size_t off = 0; off < srv.cfg.wbuf_size; off += cops_load32(buf + off + 4)) {
+                TP_ASSERT(cops_integrity_verify(&pep, buf + off, cops_load32(buf + off + 4)) == COPS_IERR_NONE);
+        }
+
+        /* A signed Report-State is delivered, a replay of it closes the connection. */
+        cops_builder_init(&b, buf, sizeof(buf), 3);
+        cops_builder_object(&b, 1, 1, "abcd", 4);
+        cops_builder_object(&b, 12, 1, "\0\1\0\0", 4);
+        len = cops_integrity_sign(&pep, buf, cops_builder_finish(&b));
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 1);
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 1 && counts.closed == 1);
+        close(fd);
+
+        /* So does an unsigned message. */
+        fd = pep_connect(cops_server_port(&srv));
+        len = pep_open(buf, sizeof(buf));
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(counts.closed == 2 && srv.nconns == 0);
+        close(fd);
+
+        cops_server_destroy(&srv);
+}
+
+static void
+tp_cops_server_keepalive_timers(enum cops_backend backend) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_server srv;
+        uint8_t buf[64];
+
+        cfg.addr = "127.0.0.1";
+        cfg.backend = backend;
+        cfg.ka_timer = 2;
+        cfg.acct_timer = 1;
+        cfg.tick_ms = 10;
+        cfg.cb.on_close = on_close;
+        cfg.cb.on_acct = on_acct;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+
+        int fd = pep_connect(cops_server_port(&srv));
+        size_t len = pep_open(buf, sizeof(buf));
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 24);
+
+        /* The PEP stays silent: accounting fires every second, the Keep-Alive timer closes it. */
+        uint64_t start = cops_monotonic_ms();
+        while (counts.closed == 0 && cops_monotonic_ms() - start < 4000)
+                cops_server_poll(&srv, 100);
+
+        uint64_t elapsed = cops_monotonic_ms() - start;
+        TP_ASSERT(counts.closed == 1);
+        TP_ASSERT(counts.acct >= 1);
+        TP_ASSERT(elapsed >= 1800 && elapsed < 3000);
+        TP_ASSERT(srv.wheel.count == 0);
+        close(fd);
+
+        cops_server_destroy(&srv);
+}
+
+/* io_uring only: coalesced sends, and messages spanning several provided receive buffers. */
+static void
+tp_cops_server_uring(void) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_server srv;
+        struct cops_builder b;
+        static uint8_t buf[8192];
+        uint8_t data[90] = {0};
+
+        cfg.addr = "127.0.0.1";
+        cfg.backend = COPS_BACKEND_URING;
+        cfg.cb.on_message = on_message;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+        if (srv.backend != COPS_BACKEND_URING) {
+                printf("io_uring unavailable, skipped\n");
+                cops_server_destroy(&srv);
+                return;
+        }
+
+        int fd = pep_connect(cops_server_port(&srv));
+        size_t len = pep_open(buf, sizeof(buf));
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 16);
+        TP_ASSERT(srv.nconns == 1);
+
+        /* Messages queued in one batch leave together from the registered transmit buffer. */
+        struct cops_conn* conn = srv.active;
+        pump(&srv, 1);
+        TP_ASSERT(conn->wlen == 0 && conn->inflight == 1);
+        TP_ASSERT(srv.maxfixed == 0 || conn->wfixed >= 0);
+        for (int i = 0; i < 32; i++) {
+                cops_keepalive(buf);
+                TP_ASSERT(cops_server_send(&srv, conn, buf, 8) == 0);
+        }
+        TP_ASSERT(conn->wlen == 256);
+        pump(&srv, 2);
+        TP_ASSERT(conn->wlen == 0 && conn->inflight == 1);
+
+        size_t got = 0;
+        while (got < 256) {
+                ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+                TP_ASSERT(n > 0);
+                got += n;
+        }
+        TP_ASSERT(got == 256 && buf[249] == 9);
+
+        /* A batch past COPS_SERVER_URING_ZC_MIN goes zero-copy, the buffer is free after the notification. */
+        for (int i = 0; i < 600; i++) {
+                cops_keepalive(buf);
+                TP_ASSERT(cops_server_send(&srv, conn, buf, 8) == 0);
+        }
+        for (got = 0; got < 4800;) {
+                pump(&srv, 1);
+                ssize_t n = recv(fd, buf + got, sizeof(buf) - got, MSG_DONTWAIT);
+                if (n > 0)
+                        got += n;
+        }
+        TP_ASSERT(got == 4800 && buf[4793] == 9);
+        pump(&srv, 2);
+        TP_ASSERT(conn->wlen == 0 && conn->wbusy == 0 && conn->inflight == 1);
+
+        /* Report-States spanning provided buffer boundaries, followed by a Keep-Alive. */
+        len = 0;
+        for (int i = 0; i < 40; i++) {
+                cops_builder_init(&b, buf + len, sizeof(buf) - len, 3);
+                cops_builder_object(&b, 1, 1, "abcd", 4);
+                cops_builder_object(&b, 12, 1, "\0\1\0\0", 4);
+                cops_builder_object(&b, 9, 1, data, sizeof(data));
+                len += cops_builder_finish(&b);
+        }
+        TP_ASSERT(len == 40 * 120);
+        cops_keepalive(buf + len);
+        TP_ASSERT(send(fd, buf, len + 8, 0) == (ssize_t)len + 8);
+        pump(&srv, 3);
+        TP_ASSERT(counts.messages == 40);
+        TP_ASSERT(counts.last_opcode == 3);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 8);
+        TP_ASSERT(conn->rlen == 0);
+
+        /* The slot is recycled only after the kernel finished the receive. */
+        close(fd);
+        pump(&srv, 3);
+        TP_ASSERT(srv.nconns == 0);
+        TP_ASSERT(srv.released == NULL && srv.free == conn);
+
+        cops_server_destroy(&srv);
+}
+
+static void
+tp_cops_server_coalesce(enum cops_backend backend) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_server srv;
+        uint8_t buf[4096];
+
+        cfg.addr = "127.0.0.1";
+        cfg.backend = backend;
+        cfg.cb.on_drain = on_drain;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+        TP_ASSERT(srv.cfg.wbuf_high == COPS_SERVER_DEFAULT_BUF / 4 * 3);
+        TP_ASSERT(srv.cfg.flush_bytes == COPS_SERVER_DEFAULT_FLUSH);
+
+        int fd = pep_connect(cops_server_port(&srv));
+        size_t len = pep_open(buf, sizeof(buf));
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        pump(&srv, 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 16);
+        pump(&srv, 1);
+
+        /* Messages queued outside the event loop leave together with the next poll. */
+        struct cops_conn* conn = srv.active;
+        for (int i = 0; i < 10; i++) {
+                cops_keepalive(buf);
+                TP_ASSERT(cops_server_send(&srv, conn, buf, 8) == 0);
+        }
+        TP_ASSERT(cops_server_pending(conn) == 80);
+        pump(&srv, 1);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 80);
+        pump(&srv, 1);
+        TP_ASSERT(cops_server_pending(conn) == 0);
+
+        /* Built in place and flushed explicitly. */
+        for (int i = 0; i < 2; i++) {
+                uint8_t* dst = cops_server_reserve(&srv, conn, 8);
+                TP_ASSERT(dst != NULL);
+                cops_keepalive(dst);
+                TP_ASSERT(cops_server_commit(&srv, conn, 8) == 0);
+        }
+        TP_ASSERT(cops_server_flush(&srv, conn) == 0);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 16);
+        pump(&srv, 1);
+
+        /* Reaching flush_bytes sends without waiting for the batch to end. */
+        srv.cfg.flush_bytes = 64;
+        for (int i = 0; i < 8; i++) {
+                cops_keepalive(buf);
+                TP_ASSERT(cops_server_send(&srv, conn, buf, 8) == 0);
+        }
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 64);
+        pump(&srv, 1);
+        TP_ASSERT(cops_server_pending(conn) == 0);
+
+        /* With flush_ms a message waits for company across batches. */
+        srv.cfg.flush_bytes = COPS_SERVER_DEFAULT_FLUSH;
+        srv.cfg.flush_ms = 300;
+        cops_keepalive(buf);
+        TP_ASSERT(cops_server_send(&srv, conn, buf, 8) == 0);
+        TP_ASSERT(cops_timer_pending(&conn->flush));
+        pump(&srv, 1);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), MSG_DONTWAIT) < 0);
+        TP_ASSERT(cops_server_send(&srv, conn, buf, 8) == 0);
+        ssize_t got = -1;
+        for (int i = 0; i < 100 && got < 0; i++) {
+                pump(&srv, 1);
+                got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        }
+        TP_ASSERT(got == 16);
+        TP_ASSERT(!cops_timer_pending(&conn->flush));
+        srv.cfg.flush_ms = 0;
+        pump(&srv, 1);
+        TP_ASSERT(cops_server_pending(conn) == 0);
+
+        /* Queueing past wbuf_high marks the connection congested until the backlog drained. */
+        srv.cfg.flush_bytes = COPS_SERVER_DEFAULT_BUF;
+        size_t queued = 0;
+        while (!cops_server_congested(conn)) {
+                cops_keepalive(buf);
+                TP_ASSERT(cops_server_send(&srv, conn, buf, 8) == 0);
+                queued += 8;
+        }
+        TP_ASSERT(queued == srv.cfg.wbuf_high);
+        TP_ASSERT(counts.drained == 0);
+        size_t total = 0;
+        for (int i = 0; i < 100 && total < queued; i++) {
+                pump(&srv, 1);
+                ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+                if (n > 0)
+                        total += n;
+        }
+        pump(&srv, 2);
+        TP_ASSERT(total == queued);
+        TP_ASSERT(counts.drained == 1);
+        TP_ASSERT(!cops_server_congested(conn));
+
+        close(fd);
+        pump(&srv, 2);
+        TP_ASSERT(srv.nconns == 0);
+
+        cops_server_destroy(&srv);
+}
+
+/* Open a session on a server with admission control and read the Client-Accept. */
+static int
+admit_session(struct cops_server* srv) {
+        uint8_t buf[64];
+        int fd = pep_connect(cops_server_port(srv));
+        size_t len = pep_open(buf, sizeof(buf));
+
+        if (send(fd, buf, len, 0) != (ssize_t)len)
+                return -1;
+        pump(srv, 2);
+        if (recv(fd, buf, sizeof(buf), 0) != 16)
+                return -1;
+
+        return fd;
+}
+
+/* n Requests with handles 0 to n - 1, sent with a single write. */
+static void
+admit_burst(int fd, uint8_t opcode, int n) {
+        uint8_t buf[8 * 24];
+        uint8_t objs[16];
+
+        for (int i = 0; i < n; i++) {
+                char handle[4] = {0, 0, 0, (char)i};
+
+                cops_handle(objs, handle);
+                cops_context(objs + 8);
+                new_cops_message(buf + i * 24, opcode, objs, 24);
+        }
+        if (send(fd, buf, n * 24, 0) != n * 24)
+                printf("short send\n");
+}
+
+static void
+tp_cops_server_admission(enum cops_backend backend) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_admit_config admit = {.session_rate = 20, .session_burst = 2, .policy = COPS_ADMIT_SHED};
+        struct cops_server srv;
+        struct cops_metrics metrics;
+        static struct cops_metrics_snapshot snap;
+        uint8_t buf[128];
+
+        TP_ASSERT(cops_metrics_init(&metrics, 3) == 0); /* A slot for each of the servers. */
+        cfg.addr = "127.0.0.1";
+        cfg.backend = backend;
+        cfg.tick_ms = 5;
+        cfg.metrics = &metrics;
+        cfg.admit = &admit;
+        cfg.cb.on_message = on_message;
+        cfg.cb.on_close = on_close;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+
+        /* Shed: two Requests use up the burst, the other two are answered with an Error. */
+        int fd = admit_session(&srv);
+        TP_ASSERT(fd >= 0);
+        admit_burst(fd, 1, 4);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 48);
+        TP_ASSERT(buf[0] == 17 && buf[1] == 2 && buf[15] == 2);
+        TP_ASSERT(buf[18] == 8 && cops_load16(buf + 20) == COPS_ERROR_UNABLE);
+        TP_ASSERT(buf[24 + 1] == 2 && buf[24 + 15] == 3);
+
+        /* Reports are dropped without a reply, Keep-Alives always pass. */
+        admit_burst(fd, 3, 1);
+        cops_keepalive(buf);
+        buf[2] = buf[3] = 0;
+        TP_ASSERT(send(fd, buf, 8, 0) == 8);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 8 && buf[1] == 9);
+        cops_metrics_snapshot(&metrics, &snap);
+        TP_ASSERT(snap.total.shed == 3 && snap.total.delayed == 0);
+        close(fd);
+        pump(&srv, 2);
+        cops_server_destroy(&srv);
+
+        /* Delay: the messages a token is not due for wait in the receive buffer, in order. */
+        admit.policy = COPS_ADMIT_DELAY;
+        admit.session_burst = 1;
+        admit.max_delay_ms = 1000;
+        counts.messages = 0;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+        fd = admit_session(&srv);
+        TP_ASSERT(fd >= 0);
+
+        /* Tokens are due 50 and 100 ms after the first message. */
+        uint64_t t0 = cops_monotonic_ms();
+        admit_burst(fd, 3, 3);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 1);
+        TP_ASSERT(srv.active->delayed);
+
+        for (int i = 0; i < 200 && counts.messages < 3; i++)
+                pump(&srv, 1);
+        TP_ASSERT(counts.messages == 3 && !srv.active->delayed);
+        TP_ASSERT(cops_monotonic_ms() - t0 >= 90);
+        cops_metrics_snapshot(&metrics, &snap);
+        TP_ASSERT(snap.total.shed == 3 && snap.total.delayed == 2);
+
+        /* A token due later than max_delay_ms sheds the message instead. */
+        admit_burst(fd, 1, 2);
+        pump(&srv, 2);
+        srv.admit.cfg.max_delay_ms = 10;
+        for (int i = 0; i < 200 && counts.messages < 4; i++)
+                pump(&srv, 1);
+        pump(&srv, 10);
+        TP_ASSERT(counts.messages == 4);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 24 && buf[1] == 2 && buf[18] == 8);
+        cops_metrics_snapshot(&metrics, &snap);
+        TP_ASSERT(snap.total.shed == 4);
+        close(fd);
+        pump(&srv, 2);
+        cops_server_destroy(&srv);
+
+        /* Close: the first message over the limit ends the session with a Client-Close. */
+        admit.policy = COPS_ADMIT_CLOSE;
+        counts.messages = counts.closed = 0;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+        fd = admit_session(&srv);
+        TP_ASSERT(fd >= 0);
+        admit_burst(fd, 1, 2);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages == 1 && counts.closed == 1 && srv.nconns == 0);
+        if (backend == COPS_BACKEND_EPOLL) {
+                TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == COPS_ERROR_MSG_LEN);
+                TP_ASSERT(buf[1] == 8 && buf[10] == 8 && cops_load16(buf + 12) == COPS_ERROR_UNABLE);
+        }
+        close(fd);
+
+        cops_server_destroy(&srv);
+        cops_metrics_free(&metrics);
+}
+
+/*
+ * A PEP that keeps sending while its messages are held back is not dropped. epoll leaves the
+ * socket alone, io_uring cancels its receive and sheds held messages for the bytes it already
+ * took: every Report is delivered or shed, none is lost.
+ */
+static void
+tp_cops_server_admission_backlog(enum cops_backend backend) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_admit_config admit = {
+            .session_rate = 500,
+            .session_burst = 1,
+            .max_delay_ms = 2000,
+            .policy = COPS_ADMIT_DELAY,
+        };
+        struct cops_server srv;
+        struct cops_metrics metrics;
+        static struct cops_metrics_snapshot snap;
+        uint8_t buf[8];
+
+        TP_ASSERT(cops_metrics_init(&metrics, 1) == 0);
+        cfg.addr = "127.0.0.1";
+        cfg.backend = backend;
+        cfg.tick_ms = 1;
+        cfg.rbuf_size = 128;
+        cfg.metrics = &metrics;
+        cfg.admit = &admit;
+        cfg.cb.on_message = on_message;
+        cfg.cb.on_close = on_close;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+
+        /* Ten receive buffers worth of Reports, the first burst is already held when the rest arrive. */
+        int fd = admit_session(&srv);
+        TP_ASSERT(fd >= 0);
+        admit_burst(fd, 3, 4);
+        pump(&srv, 2);
+        TP_ASSERT(counts.messages >= 1 && srv.nconns == 1);
+        for (int i = 0; i < 13; i++)
+                admit_burst(fd, 3, 4);
+
+        for (int i = 0; i < 2000; i++) {
+                cops_metrics_snapshot(&metrics, &snap);
+                if (counts.messages + snap.total.shed == 56)
+                        break;
+                pump(&srv, 1);
+        }
+        TP_ASSERT(counts.closed == 0 && srv.nconns == 1);
+        TP_ASSERT(counts.messages + snap.total.shed == 56 && counts.messages > 4);
+        if (backend == COPS_BACKEND_EPOLL) {
+                TP_ASSERT(snap.total.shed == 0);
+        }
+
+        /* The session goes on as before. */
+        cops_keepalive(buf);
+        buf[2] = buf[3] = 0;
+        TP_ASSERT(send(fd, buf, 8, 0) == 8);
+        pump(&srv, 2);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 8 && buf[1] == 9);
+        close(fd);
+
+        cops_server_destroy(&srv);
+        cops_metrics_free(&metrics);
+}
+
+/* The connection number wraps below the fixed high bits of the id, never reaching 0. */
+static void
+tp_cops_server_conn_ids(void) {
+        info();
+
+        struct server_counts counts = {0};
+        struct cops_server_config cfg = {0};
+        struct cops_server srv;
+        uint8_t buf[64];
+        int fds[3];
+
+        cfg.addr = "127.0.0.1";
+        cfg.ka_timer = 30;
+        cfg.cb.on_open = on_open;
+        cfg.user = &counts;
+        TP_ASSERT(cops_server_init(&srv, &cfg) == 0);
+        srv.id_base = 5u << 24;
+        srv.id_mask = 0xFFFFFF;
+        srv.next_id = 0xFFFFFE;
+
+        const uint32_t ids[3] = {0x05FFFFFF, 0x05000001, 0x05000002};
+
+        for (int i = 0; i < 3; i++) {
+                fds[i] = pep_connect(cops_server_port(&srv));
+                TP_ASSERT(fds[i] >= 0);
+                size_t len = pep_open(buf, sizeof(buf));
+                TP_ASSERT(send(fds[i], buf, len, 0) == (ssize_t)len);
+                pump(&srv, 2);
+                TP_ASSERT(counts.opened == i + 1);
+                TP_ASSERT(counts.last_id == ids[i]);
+        }
+
+        for (int i = 0; i < 3; i++)
+                close(fds[i]);
+        cops_server_destroy(&srv);
+}
+
+void
+test_server(void) {
+        tp_cops_server_handshake(COPS_BACKEND_EPOLL);
+        tp_cops_server_handshake(COPS_BACKEND_URING);
+        tp_cops_server_protocol_errors(COPS_BACKEND_EPOLL);
+        tp_cops_server_protocol_errors(COPS_BACKEND_URING);
+        tp_cops_server_validate();
+        tp_cops_server_max_msg_len();
+        tp_cops_server_conn_ids();
+        tp_cops_server_integrity();
+        tp_cops_server_keepalive_timers(COPS_BACKEND_EPOLL);
+        tp_cops_server_keepalive_timers(COPS_BACKEND_URING);
+        tp_cops_server_uring();
+        tp_cops_server_coalesce(COPS_BACKEND_EPOLL);
+        tp_cops_server_coalesce(COPS_BACKEND_URING);
+        tp_cops_server_admission(COPS_BACKEND_EPOLL);
+        tp_cops_server_admission(COPS_BACKEND_URING);
+        tp_cops_server_admission_backlog(COPS_BACKEND_EPOLL);
+        tp_cops_server_admission_backlog(COPS_BACKEND_URING);
+}
+
+#else
+
+void
+test_server(void) {}
+
+#endif
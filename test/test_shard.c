@@ -0,0 +1,275 @@
+#include "cops_builder.h"
+#include "cops_shard.h"
+#include "test_cops.h"
+
+#ifdef __linux__
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define info() printf("TEST: %s\n", __func__)
+
+#define RING_PRODUCERS 4
+#define RING_ITEMS     50000
+
+struct shard_state {
+        atomic_int started;
+        atomic_int opened;
+        atomic_int closed;
+        atomic_int ran;
+        atomic_int wrong_thread;
+        atomic_int sent;
+        atomic_int stale;
+        atomic_int gates;
+        struct cops_conn_ref ref;
+};
+
+static struct shard_state state;
+
+static void
+sleep_ms(long ms) {
+        struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+        nanosleep(&ts, NULL);
+}
+
+/* Wait up to two seconds for a counter written by a shard thread. */
+static bool
+wait_for(atomic_int* v, int expect) {
+        for (int i = 0; i < 2000 && atomic_load(v) < expect; i++)
+                sleep_ms(1);
+        return atomic_load(v) >= expect;
+}
+
+static void
+on_start(struct cops_shard* shard) {
+        atomic_fetch_add(&state.started, 1);
+}
+
+static void
+on_open(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* opn) {
+        state.ref = cops_conn_ref(conn);
+        atomic_fetch_add(&state.opened, 1);
+}
+
+static void
+on_close(struct cops_server* srv, struct cops_conn* conn) {
+        atomic_fetch_add(&state.closed, 1);
+}
+
+static void
+work_count(struct cops_shard* shard, void* arg) {
+        if (!pthread_equal(pthread_self(), shard->thread) || shard->index != (uintptr_t)arg)
+                atomic_fetch_add(&state.wrong_thread, 1);
+        atomic_fetch_add(&state.ran, 1);
+}
+
+/* Runs on the owning shard: record a gate and send a Keep-Alive on the session. */
+static void
+work_send(struct cops_shard* shard, void* arg) {
+        struct cops_conn* conn = cops_conn_deref(state.ref);
+        uint8_t ka[8];
+
+        if (conn == NULL)
+                return;
+
+        cops_gate_insert(&shard->gates, cops_handle_key("abcd"))->gate_id = 42;
+        atomic_store(&state.gates, (int)cops_gate_count(&shard->gates));
+        cops_keepalive(ka);
+        if (cops_server_send(&shard->srv, conn, ka, sizeof(ka)) == 0)
+                atomic_fetch_add(&state.sent, 1);
+}
+
+static void
+work_stale(struct cops_shard* shard, void* arg) {
+        if (cops_conn_deref(state.ref) == NULL)
+                atomic_fetch_add(&state.stale, 1);
+}
+
+static void
+tp_cops_ring_single(void) {
+        info();
+
+        struct cops_ring ring;
+        struct cops_work w = {0};
+
+        TP_ASSERT(cops_ring_init(&ring, 5) == 0);
+        TP_ASSERT(ring.mask == 7);
+        TP_ASSERT(cops_ring_pop(&ring, &w) == false);
+
+        for (uintptr_t i = 0; i < 8; i++) {
+                w.arg = (void*)i;
+                TP_ASSERT(cops_ring_push(&ring, &w));
+        }
+        TP_ASSERT(cops_ring_push(&ring, &w) == false);
+
+        /* FIFO, and a freed cell can be reused on the next lap. */
+        TP_ASSERT(cops_ring_pop(&ring, &w) && w.arg == (void*)0);
+        TP_ASSERT(cops_ring_push(&ring, &w));
+        for (uintptr_t i = 1; i < 8; i++) {
+                TP_ASSERT(cops_ring_pop(&ring, &w) && w.arg == (void*)i);
+        }
+        TP_ASSERT(cops_ring_pop(&ring, &w) && w.arg == (void*)0);
+        TP_ASSERT(cops_ring_pop(&ring, &w) == false);
+
+        cops_ring_free(&ring);
+}
+
+struct producer {
+        struct cops_ring* ring;
+        uintptr_t id;
+};
+
+static void*
+ring_producer(void* arg) {
+        struct producer* p = arg;
+
+        for (uintptr_t i = 0; i < RING_ITEMS; i++) {
+                struct cops_work w = {NULL, (void*)((p->id << 24) | i)};
+
+                while (!cops_ring_push(p->ring, &w))
+                        sched_yield();
+        }
+
+        return NULL;
+}
+
+static void
+tp_cops_ring_producers(void) {
+        info();
+
+        struct cops_ring ring;
+        struct producer producers[RING_PRODUCERS];
+        pthread_t threads[RING_PRODUCERS];
+        uintptr_t next[RING_PRODUCERS] = {0};
+        bool ordered = true;
+
+        TP_ASSERT(cops_ring_init(&ring, 256) == 0);
+        for (uintptr_t i = 0; i < RING_PRODUCERS; i++) {
+                producers[i] = (struct producer){&ring, i};
+                TP_ASSERT(pthread_create(&threads[i], NULL, ring_producer, &producers[i]) == 0);
+        }
+
+        /* Every item arrives exactly once, in order per producer. */
+        for (int got = 0; got < RING_PRODUCERS * RING_ITEMS;) {
+                struct cops_work w;
+
+                if (!cops_ring_pop(&ring, &w))
+                        continue;
+
+                uintptr_t v = (uintptr_t)w.arg;
+                uintptr_t id = v >> 24;
+
+                if (id >= RING_PRODUCERS || (v & 0xFFFFFF) != next[id]++)
+                        ordered = false;
+                got++;
+        }
+
+        for (int i = 0; i < RING_PRODUCERS; i++)
+                pthread_join(threads[i], NULL);
+
+        struct cops_work w;
+        TP_ASSERT(ordered);
+        TP_ASSERT(cops_ring_pop(&ring, &w) == false);
+
+        cops_ring_free(&ring);
+}
+
+static int
+pep_connect(uint16_t port) {
+        struct sockaddr_in sa = {0};
+        struct timeval tv = {2, 0};
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+static void
+tp_cops_runtime(enum cops_backend backend) {
+        info();
+
+        struct cops_runtime_config cfg = {0};
+        struct cops_runtime rt;
+        struct cops_builder b;
+        uint8_t buf[64];
+
+        cfg.server.addr = "127.0.0.1";
+        cfg.server.ka_timer = 30;
+        cfg.server.cb.on_open = on_open;
+        cfg.server.cb.on_close = on_close;
+        cfg.server.backend = backend;
+        cfg.nshards = 2;
+        cfg.ring_size = 64;
+        cfg.on_start = on_start;
+        TP_ASSERT(cops_runtime_start(&rt, &cfg) == 0);
+        TP_ASSERT(rt.nshards == 2);
+        TP_ASSERT(wait_for(&state.started, 2));
+
+        /* Every listener shares the port. */
+        TP_ASSERT(cops_runtime_port(&rt) != 0);
+        TP_ASSERT(cops_server_port(&rt.shards[1].srv) == cops_runtime_port(&rt));
+
+        /* Work runs on the thread of the shard it was submitted to. */
+        for (uintptr_t i = 0; i < 20; i++) {
+                TP_ASSERT(cops_runtime_submit(&rt, i % 2, work_count, (void*)(i % 2)) == 0);
+        }
+        TP_ASSERT(wait_for(&state.ran, 20));
+        TP_ASSERT(atomic_load(&state.wrong_thread) == 0);
+        TP_ASSERT(cops_runtime_submit(&rt, 2, work_count, NULL) == -1);
+
+        /* A PEP lands on one of the shards and is accepted there. */
+        int fd = pep_connect(cops_runtime_port(&rt));
+        TP_ASSERT(fd >= 0);
+        cops_builder_init(&b, buf, sizeof(buf), 6);
+        cops_builder_object(&b, 11, 1, "cmts-1", 6);
+        size_t len = cops_builder_finish(&b);
+        TP_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 16);
+        TP_ASSERT(buf[1] == 7);
+        TP_ASSERT(wait_for(&state.opened, 1));
+
+        /* A message produced on this thread is sent by the owning shard. */
+        uint16_t owner = cops_shard_index(state.ref.id);
+        TP_ASSERT(owner < 2);
+        TP_ASSERT(cops_runtime_submit_conn(&rt, state.ref, work_send, NULL) == 0);
+        TP_ASSERT(recv(fd, buf, sizeof(buf), 0) == 8);
+        TP_ASSERT(buf[1] == 9);
+        TP_ASSERT(wait_for(&state.sent, 1));
+        TP_ASSERT(atomic_load(&state.gates) == 1);
+
+        /* Once the session is gone the reference no longer resolves. */
+        close(fd);
+        TP_ASSERT(wait_for(&state.closed, 1));
+        TP_ASSERT(cops_runtime_submit_conn(&rt, state.ref, work_stale, NULL) == 0);
+        TP_ASSERT(wait_for(&state.stale, 1));
+
+        cops_runtime_stop(&rt);
+        TP_ASSERT(rt.shards == NULL);
+        cops_runtime_stop(&rt);
+}
+
+void
+test_shard(void) {
+        tp_cops_ring_single();
+        tp_cops_ring_producers();
+        tp_cops_runtime(COPS_BACKEND_EPOLL);
+        tp_cops_runtime(COPS_BACKEND_URING);
+}
+
+#else
+
+void
+test_shard(void) {}
+
+#endif
@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cops_snap.h"
+#include "pcmm.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+#define SNAP_PATH "/tmp/test_snap.gates"
+
+/* Install or update a gate in the table and journal it. */
+static void
+put(struct cops_snap* s, struct cops_gate_table* t, uint32_t handle, uint32_t gate_id) {
+        struct cops_gate* g = cops_gate_insert(t, handle);
+
+        g->gate_id = gate_id;
+        g->am_tag = (uint16_t)handle;
+        g->app_type = 7;
+        g->family = (handle & 1) ? AF_INET6 : AF_INET;
+        g->decision = PCMM_GATE_SET;
+        memset(g->subscriber, (int)(handle & 0xFF), sizeof(g->subscriber));
+        cops_snap_put(s, t, g);
+}
+
+static void
+del(struct cops_snap* s, struct cops_gate_table* t, uint32_t handle) {
+        cops_gate_remove(t, handle);
+        cops_snap_del(s, t, handle);
+}
+
+static bool
+same(const struct cops_gate_table* a, const struct cops_gate_table* b) {
+        const struct cops_gate* g;
+        size_t iter = 0;
+
+        if (cops_gate_count(a) != cops_gate_count(b))
+                return false;
+
+        while ((g = cops_gate_next(a, &iter)) != NULL) {
+                const struct cops_gate* h = cops_gate_find(b, g->handle);
+
+                if (h == NULL || h->gate_id != g->gate_id || h->am_tag != g->am_tag || h->app_type != g->app_type ||
+                    h->family != g->family || h->decision != g->decision || h->flags != g->flags ||
+                    memcmp(h->subscriber, g->subscriber, sizeof(g->subscriber)) != 0)
+                        return false;
+        }
+        return true;
+}
+
+static void
+flip(off_t off) {
+        int fd = open(SNAP_PATH, O_RDWR);
+        uint8_t b;
+
+        if (pread(fd, &b, 1, off) == 1) {
+                b ^= 0x40;
+                if (pwrite(fd, &b, 1, off) != 1)
+                        printf("pwrite failed\n");
+        }
+        close(fd);
+}
+
+static void
+tp_cops_snap_journal_replay(void) {
+        info();
+
+        struct cops_snap s;
+        struct cops_gate_table t;
+        struct cops_gate_table r;
+
+        TP_ASSERT(cops_snap_create(&s, SNAP_PATH, 100) == 0);
+        TP_ASSERT(s.hdr.journal == 128);
+        TP_ASSERT(cops_gate_table_init(&t, 16) == 0);
+
+        /* An empty file opens to an empty table. */
+        cops_snap_close(&s);
+        TP_ASSERT(cops_snap_open(&s, SNAP_PATH, &r) == 0);
+        TP_ASSERT(cops_gate_count(&r) == 0 && s.stats.records == 0 && s.stats.replayed == 0);
+        cops_gate_table_free(&r);
+
+        /* Installs, an update and removals, with no checkpoint: everything comes from the journal. */
+        for (uint32_t h = 1; h <= 50; h++)
+                put(&s, &t, h, 1000 + h);
+        put(&s, &t, 10, 4242);
+        del(&s, &t, 20);
+        del(&s, &t, 21);
+        TP_ASSERT(cops_snap_sync(&s) == 0);
+        cops_snap_close(&s);
+
+        TP_ASSERT(cops_snap_open(&s, SNAP_PATH, &r) == 0);
+        TP_ASSERT(s.stats.records == 0 && s.stats.replayed == 53 && s.stats.discarded == 0 && !s.stats.fallback);
+        TP_ASSERT(same(&t, &r));
+        TP_ASSERT(cops_gate_find(&r, 10)->gate_id == 4242);
+        cops_gate_table_free(&r);
+
+        /* The journal continues after a restart, then a checkpoint takes over its content. */
+        put(&s, &t, 60, 1);
+        TP_ASSERT(cops_snap_checkpoint(&s, &t) == 0);
+        TP_ASSERT(s.hdr.gen == 1 && s.hdr.count == 49 && s.hdr.seq == 54 && s.next == 0);
+        del(&s, &t, 1);
+        cops_snap_close(&s);
+
+        TP_ASSERT(cops_snap_open(&s, SNAP_PATH, &r) == 0);
+        TP_ASSERT(s.stats.records == 49 && s.stats.replayed == 1);
+        TP_ASSERT(same(&t, &r));
+
+        cops_snap_close(&s);
+        cops_gate_table_free(&r);
+        cops_gate_table_free(&t);
+        unlink(SNAP_PATH);
+}
+
+/* A full journal is checkpointed, checkpoints alternate between areas that never overlap. */
+static void
+tp_cops_snap_auto_checkpoint(void) {
+        info();
+
+        struct cops_snap s;
+        struct cops_gate_table t;
+        struct cops_gate_table r;
+        uint64_t prev = 0;
+        bool ok = true;
+
+        TP_ASSERT(cops_snap_create(&s, SNAP_PATH, 64) == 0);
+        TP_ASSERT(cops_gate_table_init(&t, 16) == 0);
+
+        for (uint32_t i = 0; i < 2000; i++) {
+                uint64_t gen = s.hdr.gen;
+                size_t len = s.hdr.count * sizeof(struct cops_snap_rec);
+                uint64_t off = s.hdr.region_off;
+
+                if (i % 3 == 2)
+                        del(&s, &t, i / 2);
+                else
+                        put(&s, &t, i, i);
+
+                if (s.hdr.gen != gen) {
+                        ok &= s.hdr.gen == gen + 1 && s.hdr.count == cops_gate_count(&t);
+                        ok &= s.hdr.region_off >= off + len || s.hdr.region_off + s.hdr.count * 32 <= off;
+                        prev++;
+                }
+        }
+        TP_ASSERT(ok);
+        TP_ASSERT(prev == s.hdr.gen && prev >= 2000 / 65);
+        cops_snap_close(&s);
+
+        TP_ASSERT(cops_snap_open(&s, SNAP_PATH, &r) == 0);
+        TP_ASSERT(same(&t, &r));
+
+        cops_snap_close(&s);
+        cops_gate_table_free(&r);
+        cops_gate_table_free(&t);
+        unlink(SNAP_PATH);
+}
+
+static void
+tp_cops_snap_torn_entry(void) {
+        info();
+
+        struct cops_snap s;
+        struct cops_gate_table t;
+        struct cops_gate_table r;
+
+        TP_ASSERT(cops_snap_create(&s, SNAP_PATH, 64) == 0);
+        TP_ASSERT(cops_gate_table_init(&t, 16) == 0);
+        for (uint32_t h = 1; h <= 10; h++)
+                put(&s, &t, h, h);
+        cops_snap_close(&s);
+
+        /* Entry 6 (gate 7) was half written when the power went: gates 1 to 6 survive, 7 to 10 are dropped. */
+        flip(COPS_SNAP_HDR_SPACE + 6 * sizeof(struct cops_snap_entry) + 40);
+        TP_ASSERT(cops_snap_open(&s, SNAP_PATH, &r) == 0);
+        TP_ASSERT(s.stats.replayed == 6 && s.stats.discarded == 4);
+        TP_ASSERT(cops_gate_count(&r) == 6 && cops_gate_find(&r, 7) == NULL);
+
+        /* A new entry takes the torn one's place, the dropped ones never come back. */
+        put(&s, &r, 100, 100);
+        cops_snap_close(&s);
+        cops_gate_table_free(&r);
+
+        TP_ASSERT(cops_snap_open(&s, SNAP_PATH, &r) == 0);
+        TP_ASSERT(s.stats.replayed == 7 && s.stats.discarded == 0);
+        TP_ASSERT(cops_gate_count(&r) == 7 && cops_gate_find(&r, 100) && cops_gate_find(&r, 8) == NULL);
+
+        cops_snap_close(&s);
+        cops_gate_table_free(&r);
+        cops_gate_table_free(&t);
+        unlink(SNAP_PATH);
+}
+
+static void
+tp_cops_snap_torn_checkpoint(void) {
+        info();
+
+        struct cops_snap s;
+        struct cops_gate_table t;
+        struct cops_gate_table r;
+
+        TP_ASSERT(cops_snap_create(&s, SNAP_PATH, 64) == 0);
+        TP_ASSERT(cops_gate_table_init(&t, 16) == 0);
+        for (uint32_t h = 1; h <= 20; h++)
+                put(&s, &t, h, h);
+        TP_ASSERT(cops_snap_checkpoint(&s, &t) == 0);
+        for (uint32_t h = 21; h <= 30; h++)
+                put(&s, &t, h, h);
+        del(&s, &t, 5);
+        TP_ASSERT(cops_snap_checkpoint(&s, &t) == 0);
+        off_t region = (off_t)s.hdr.region_off;
+        cops_snap_close(&s);
+
+        /*
+         * The newest records are damaged: the previous checkpoint plus the journal it was followed
+         * by, still in the file, give the same gates.
+         */
+        flip(region + 33);
+        TP_ASSERT(cops_snap_open(&s, SNAP_PATH, &r) == 0);
+        TP_ASSERT(s.stats.fallback && s.stats.records == 20 && s.stats.replayed == 11);
+        TP_ASSERT(same(&t, &r));
+        cops_snap_close(&s);
+        cops_gate_table_free(&r);
+
+        /* A damaged header copy is ignored the same way, with both gone the file is rejected. */
+        flip(region + 33);
+        flip(8);
+        TP_ASSERT(cops_snap_open(&s, SNAP_PATH, &r) == 0);
+        TP_ASSERT(same(&t, &r));
+        cops_snap_close(&s);
+        cops_gate_table_free(&r);
+
+        flip(COPS_SNAP_HDR_STRIDE + 8);
+        TP_ASSERT(cops_snap_open(&s, SNAP_PATH, &r) == -1 && errno == EINVAL);
+
+        cops_gate_table_free(&t);
+        unlink(SNAP_PATH);
+}
+
+void
+test_snap(void) {
+        tp_cops_snap_journal_replay();
+        tp_cops_snap_auto_checkpoint();
+        tp_cops_snap_torn_entry();
+        tp_cops_snap_torn_checkpoint();
+}
@@ -0,0 +1,201 @@
+#include "cops_sync.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+struct sync_log {
+        size_t missing;
+        size_t unknown;
+        uint32_t last_unknown;
+};
+
+/* Even gate ids are reinstalled by the application, odd ones are dropped. */
+static bool
+on_missing(struct cops_sync* sync, struct cops_gate* gate) {
+        ((struct sync_log*)sync->arg)->missing++;
+        return gate->gate_id & 1;
+}
+
+static void
+on_unknown(struct cops_sync* sync, const struct cops_msg* msg, uint32_t handle) {
+        struct sync_log* log = sync->arg;
+
+        TP_ASSERT(msg->opcode == 3);
+        log->unknown++;
+        log->last_unknown = handle;
+}
+
+/* Report-State for a handle, as the CMTS streams it back after an SSQ. */
+static size_t
+sync_report(uint8_t* buf, uint32_t key) {
+        uint8_t objs[16];
+        char handle[4];
+
+        memcpy(handle, &key, 4);
+        cops_handle(objs, handle);
+        memcpy(objs + 8, "\0\10\14\1\0\1\0\0", 8);
+        new_cops_message(buf, 3, objs, 24);
+
+        return 24;
+}
+
+static void
+tp_cops_sync_messages(void) {
+        info();
+
+        struct cops_decoder dec;
+        const struct cops_msg* msg;
+        uint8_t buf[16];
+
+        /* SSQ without and with a handle. */
+        struct cops_gate_table t;
+        struct cops_sync sync;
+        TP_ASSERT(cops_gate_table_init(&t, 16) == 0);
+        cops_sync_init(&sync, &t, NULL, NULL, NULL);
+        TP_ASSERT(cops_sync_begin(&sync, buf, NULL) == 8);
+        TP_ASSERT(buf[1] == COPS_OP_SSQ && buf[7] == 8);
+        TP_ASSERT(cops_sync_begin(&sync, buf, NULL) == 0);
+        cops_sync_abort(&sync);
+        TP_ASSERT(cops_sync_begin(&sync, buf, "abcd") == 16);
+        TP_ASSERT(buf[7] == 16 && buf[10] == 1 && buf[11] == 1);
+        TP_ASSERT(memcmp(buf + 12, "abcd", 4) == 0);
+        cops_sync_abort(&sync);
+        cops_gate_table_free(&t);
+
+        /* SSC is only framed by a decoder with synchronization enabled. */
+        size_t len = cops_sync_complete(buf, NULL);
+        TP_ASSERT(len == 8 && buf[1] == COPS_OP_SSC);
+        cops_decoder_init(&dec);
+        TP_ASSERT(cops_decode(&dec, buf, len, &msg) < 0);
+        TP_ASSERT(dec.err == COPS_DECODE_ERR_HEADER);
+        cops_decoder_init(&dec);
+        dec.sync = true;
+        TP_ASSERT(cops_decode(&dec, buf, len, &msg) == 8);
+        TP_ASSERT(msg->opcode == COPS_OP_SSC);
+
+        /* cops_opcode_ok keeps following the PCMM specification. */
+        TP_ASSERT(!cops_opcode_ok(COPS_OP_SSQ) && !cops_opcode_ok(COPS_OP_SSC));
+        TP_ASSERT(!cops_sync_header_ok(9, 32778, 8));
+}
+
+static void
+tp_cops_sync_resync(void) {
+        info();
+
+        struct sync_log log = {0};
+        struct cops_gate_table t;
+        struct cops_sync sync;
+        struct cops_decoder dec;
+        const struct cops_msg* msg;
+        static uint8_t stream[4096];
+        uint8_t buf[16];
+        const uint32_t n = 100000;
+
+        TP_ASSERT(cops_gate_table_init(&t, n) == 0);
+        for (uint32_t i = 0; i < n; i++)
+                cops_gate_insert(&t, i)->gate_id = i;
+
+        cops_sync_init(&sync, &t, on_missing, on_unknown, &log);
+        TP_ASSERT(cops_sync_begin(&sync, buf, NULL) == 8);
+
+        /* The CMTS reports every gate except the last 1000 and one gate the PDP never knew. */
+        cops_decoder_init(&dec);
+        dec.sync = true;
+        for (uint32_t i = 0; i < n - 1000; i += 100) {
+                size_t len = 0;
+                for (uint32_t k = i; k < i + 100 && k < n - 1000; k++)
+                        len += sync_report(stream + len, k);
+                if (i + 100 >= n - 1000)
+                        len += sync_report(stream + len, 0xDEADBEEF);
+
+                for (size_t off = 0; off < len;) {
+                        int ret = cops_decode(&dec, stream + off, len - off, &msg);
+                        TP_ASSERT(ret > 0);
+                        TP_ASSERT(!cops_sync_input(&sync, msg));
+                        off += ret;
+                }
+        }
+        TP_ASSERT(sync.reported == n - 1000);
+        TP_ASSERT(sync.unknown == 1 && log.unknown == 1 && log.last_unknown == 0xDEADBEEF);
+
+        size_t len = cops_sync_complete(stream, NULL);
+        TP_ASSERT(cops_decode(&dec, stream, len, &msg) == (int)len);
+        TP_ASSERT(cops_sync_input(&sync, msg));
+        TP_ASSERT(!sync.active);
+        TP_ASSERT(log.missing == 1000);
+        TP_ASSERT(sync.removed == 500);
+        TP_ASSERT(cops_gate_count(&t) == n - 500);
+        TP_ASSERT(cops_gate_find(&t, n - 2) != NULL && cops_gate_find(&t, n - 1) == NULL);
+
+        /* A second synchronization starts from a clean slate. */
+        log.missing = 0;
+        TP_ASSERT(cops_sync_begin(&sync, buf, NULL) == 8);
+        TP_ASSERT(cops_sync_input(&sync, msg));
+        TP_ASSERT(log.missing == n - 500 && sync.removed == (n - 1000) / 2);
+
+        cops_gate_table_free(&t);
+}
+
+/* An SSQ for one handle only reconciles that handle, the gates of every other one are kept. */
+static void
+tp_cops_sync_handle(void) {
+        info();
+
+        struct sync_log log = {0};
+        struct cops_gate_table t;
+        struct cops_sync sync;
+        struct cops_decoder dec;
+        const struct cops_msg* msg;
+        uint8_t buf[32];
+        const char* handle = "abcd";
+        uint32_t key = cops_handle_key(handle);
+
+        TP_ASSERT(cops_gate_table_init(&t, 16) == 0);
+        for (uint32_t i = 1; i <= 10; i++)
+                cops_gate_insert(&t, i)->gate_id = i;
+        cops_gate_insert(&t, key)->gate_id = 1;
+        cops_decoder_init(&dec);
+        dec.sync = true;
+
+        /* The CMTS reports the handle, and another one, which is not part of this request. */
+        cops_sync_init(&sync, &t, NULL, on_unknown, &log);
+        TP_ASSERT(cops_sync_begin(&sync, buf, handle) == 16);
+        TP_ASSERT(cops_decode(&dec, buf, sync_report(buf, key), &msg) == 24);
+        TP_ASSERT(!cops_sync_input(&sync, msg));
+        TP_ASSERT(cops_decode(&dec, buf, sync_report(buf, 0xDEADBEEF), &msg) == 24);
+        TP_ASSERT(!cops_sync_input(&sync, msg));
+        TP_ASSERT(cops_decode(&dec, buf, cops_sync_complete(buf, handle), &msg) == 16);
+        TP_ASSERT(cops_sync_input(&sync, msg));
+        TP_ASSERT(sync.reported == 1 && sync.unknown == 0 && sync.removed == 0);
+        TP_ASSERT(cops_gate_count(&t) == 11);
+
+        /* Not reported: its gate goes (on_missing NULL drops it), the other handles' gates stay. */
+        TP_ASSERT(cops_sync_begin(&sync, buf, handle) == 16);
+        TP_ASSERT(cops_decode(&dec, buf, cops_sync_complete(buf, NULL), &msg) == 8);
+        TP_ASSERT(cops_sync_input(&sync, msg));
+        TP_ASSERT(sync.removed == 1 && cops_gate_find(&t, key) == NULL);
+        TP_ASSERT(cops_gate_count(&t) == 10);
+        for (uint32_t i = 1; i <= 10; i++) {
+                TP_ASSERT(cops_gate_find(&t, i) != NULL);
+        }
+
+        /* With on_missing, only the requested gate is offered. */
+        cops_gate_insert(&t, key)->gate_id = 2;
+        cops_sync_init(&sync, &t, on_missing, on_unknown, &log);
+        TP_ASSERT(cops_sync_begin(&sync, buf, handle) == 16);
+        TP_ASSERT(cops_sync_input(&sync, msg));
+        TP_ASSERT(log.missing == 1 && sync.removed == 0 && cops_gate_count(&t) == 11);
+
+        /* A full synchronization can follow, the table was never left in a mark phase. */
+        TP_ASSERT(cops_sync_begin(&sync, buf, NULL) == 8);
+        cops_sync_abort(&sync);
+
+        cops_gate_table_free(&t);
+}
+
+void
+test_sync(void) {
+        tp_cops_sync_messages();
+        tp_cops_sync_resync();
+        tp_cops_sync_handle();
+}
@@ -0,0 +1,125 @@
+#include "cops_decoder.h"
+#include "cops_template.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+static const uint8_t gate_spec[PCMM_GATE_SPEC_LEN] = {0, 0, 0, 0, 0, 200, 0, 0, 0, 0, 0, 0};
+static const uint8_t profile[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t profile_words[1] = {1};
+
+static void
+layout_v4(struct cops_dec_layout* l) {
+        memset(l, 0, sizeof(*l));
+        l->command = PCMM_GATE_SET;
+        l->am_tag = 0x1234;
+        l->app_type = 0x0001;
+        l->family = AF_INET;
+        l->gate_id = true;
+        l->gate_spec = gate_spec;
+        l->profile = profile;
+        l->profile_len = sizeof(profile);
+        l->profile_stype = PCMM_STYPE_BEST_EFFORT;
+        l->profile_words = profile_words;
+        l->nprofile_words = 1;
+}
+
+static void
+tp_cops_template_render(void) {
+        info();
+
+        struct cops_dec_template t;
+        struct cops_dec_layout l;
+        uint8_t msg[COPS_TEMPLATE_MAX];
+        const uint8_t addr[4] = {10, 0, 0, 1};
+        const uint32_t words[1] = {0xDEADBEEF};
+
+        layout_v4(&l);
+        TP_ASSERT(cops_dec_template_init(&t, &l) == 0);
+
+        struct cops_dec_fields f = {"hdl1", 0x0102, 0xCAFEF00D, addr, words};
+        size_t len = cops_dec_template_render(&t, msg, &f);
+        TP_ASSERT(len == t.length);
+
+        /* The rendered message must frame and validate like any other. */
+        const struct cops_msg* m = NULL;
+        struct cops_decoder dec;
+        cops_decoder_init(&dec);
+        TP_ASSERT(cops_decode(&dec, msg, len, &m) == (int)len);
+        TP_ASSERT(m->opcode == 2);
+        TP_ASSERT(m->nobjs == 4);
+        TP_ASSERT(memcmp(cops_obj_data(m, cops_msg_find(m, 1, 1)), "hdl1", 4) == 0);
+
+        const struct cops_obj* csi = cops_msg_find(m, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI);
+        TP_ASSERT(csi != NULL);
+        TP_ASSERT(csi->offset + csi->length == len);
+
+        TP_ASSERT(msg[t.trans_id_off] == 0x01 && msg[t.trans_id_off + 1] == 0x02);
+        TP_ASSERT(msg[t.trans_id_off + 3] == PCMM_GATE_SET);
+        TP_ASSERT(memcmp(msg + t.subscriber_off, addr, 4) == 0);
+        TP_ASSERT(msg[t.gate_id_off] == 0xCA && msg[t.gate_id_off + 3] == 0x0D);
+        TP_ASSERT(msg[len - 4] == 0xDE && msg[len - 1] == 0xEF);
+        TP_ASSERT(msg[len - 5] == 0);
+}
+
+static void
+tp_cops_template_matches_pack_ctl_objs(void) {
+        info();
+
+        struct cops_dec_template t;
+        struct cops_dec_layout l;
+        uint8_t msg[COPS_TEMPLATE_MAX];
+        uint8_t ref[COPS_TEMPLATE_MAX];
+        const uint8_t addr[4] = {192, 168, 1, 7};
+        const uint32_t words[1] = {0};
+
+        layout_v4(&l);
+        l.gate_id = false;
+        TP_ASSERT(cops_dec_template_init(&t, &l) == 0);
+
+        struct cops_dec_fields f = {"abcd", 7, 0, addr, words};
+        cops_dec_template_render(&t, msg, &f);
+
+        /* Same prefix built the original way, one object at a time. */
+        uint8_t handle[8], context[8], decision[8];
+        uint8_t command[8] = {0, 8, PCMM_SNUM_TRANSACTION_ID, 1, 0, 7, 0, PCMM_GATE_SET};
+        uint8_t application[8] = {0, 8, PCMM_SNUM_AMID, 1, 0x12, 0x34, 0x00, 0x01};
+        uint8_t subscriber[8] = {0, 8, PCMM_SNUM_SUBSCRIBER_ID, 1, 192, 168, 1, 7};
+
+        cops_handle(handle, "abcd");
+        cops_context(context);
+        cops_decision(decision);
+        size_t csi_len = t.length - COPS_HEADER_LEN - 3 * COPS_COMMON_OBJ_LEN;
+        size_t n = pack_ctl_objs(ref, handle, context, decision, command, application, subscriber, csi_len, 8);
+
+        TP_ASSERT(memcmp(msg + COPS_HEADER_LEN, ref, n) == 0);
+}
+
+static void
+tp_cops_template_invalid_layout(void) {
+        info();
+
+        struct cops_dec_template t;
+        struct cops_dec_layout l;
+        const uint8_t bad_words[1] = {2};
+
+        layout_v4(&l);
+        l.family = 0;
+        TP_ASSERT(cops_dec_template_init(&t, &l) == -1);
+
+        layout_v4(&l);
+        l.profile_words = bad_words;
+        TP_ASSERT(cops_dec_template_init(&t, &l) == -1);
+
+        layout_v4(&l);
+        l.family = AF_INET6;
+        TP_ASSERT(cops_dec_template_init(&t, &l) == 0);
+        TP_ASSERT(t.subscriber_len == 16);
+}
+
+void
+test_template(void) {
+        tp_cops_template_render();
+        tp_cops_template_matches_pack_ctl_objs();
+        tp_cops_template_invalid_layout();
+}
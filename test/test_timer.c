@@ -0,0 +1,111 @@
+#include "cops_timer.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+struct fired {
+        int count;
+        uint64_t at;
+        struct cops_timer_wheel* w;
+};
+
+static void
+on_fire(struct cops_timer* t, void* arg) {
+        struct fired* f = arg;
+
+        f->count++;
+        f->at = f->w->now;
+}
+
+static void
+tp_cops_timer_fires_on_time(void) {
+        info();
+
+        struct cops_timer_wheel w;
+        const uint64_t delays[] = {1, 5, 63, 64, 65, 1000, 4095, 4096, 5000, 300000};
+        struct cops_timer t[10];
+        struct fired f[10];
+
+        cops_timer_wheel_init(&w, 1, 0);
+        for (int i = 0; i < 10; i++) {
+                f[i] = (struct fired){0, 0, &w};
+                cops_timer_init(&t[i], on_fire, &f[i]);
+                cops_timer_arm(&w, &t[i], delays[i]);
+        }
+        TP_ASSERT(w.count == 10);
+
+        /* Advance in uneven steps, each timer fires exactly once on its own tick. */
+        for (uint64_t now = 0; now <= 300000; now += 7)
+                cops_timer_advance(&w, now);
+        cops_timer_advance(&w, 300001);
+
+        for (int i = 0; i < 10; i++) {
+                TP_ASSERT(f[i].count == 1);
+                TP_ASSERT(f[i].at == delays[i]);
+        }
+        TP_ASSERT(w.count == 0);
+}
+
+static void
+tp_cops_timer_cancel_and_rearm(void) {
+        info();
+
+        struct cops_timer_wheel w;
+        struct cops_timer a, b;
+        struct fired fa = {0, 0, &w};
+        struct fired fb = {0, 0, &w};
+
+        cops_timer_wheel_init(&w, 10, 1000);
+        cops_timer_init(&a, on_fire, &fa);
+        cops_timer_init(&b, on_fire, &fb);
+
+        cops_timer_arm(&w, &a, 100);
+        cops_timer_arm(&w, &b, 100);
+        TP_ASSERT(cops_timer_pending(&a));
+        TP_ASSERT(cops_timer_next_ms(&w, 1000) == 100);
+
+        /* Re-arming moves the timer, cancelling removes it. */
+        cops_timer_arm(&w, &a, 500);
+        cops_timer_cancel(&w, &b);
+        TP_ASSERT(!cops_timer_pending(&b));
+        TP_ASSERT(w.count == 1);
+
+        TP_ASSERT(cops_timer_advance(&w, 1200) == 0);
+        TP_ASSERT(cops_timer_advance(&w, 1500) == 1);
+        TP_ASSERT(fa.count == 1 && fb.count == 0);
+        TP_ASSERT(cops_timer_next_ms(&w, 1500) == -1);
+}
+
+static void
+rearm_self(struct cops_timer* t, void* arg) {
+        struct fired* f = arg;
+
+        f->count++;
+        if (f->count < 3)
+                cops_timer_arm(f->w, t, 50);
+}
+
+static void
+tp_cops_timer_periodic(void) {
+        info();
+
+        struct cops_timer_wheel w;
+        struct cops_timer t;
+        struct fired f = {0, 0, &w};
+
+        cops_timer_wheel_init(&w, 10, 0);
+        cops_timer_init(&t, rearm_self, &f);
+        cops_timer_arm(&w, &t, 50);
+
+        for (uint64_t now = 0; now <= 1000; now += 10)
+                cops_timer_advance(&w, now);
+        TP_ASSERT(f.count == 3);
+        TP_ASSERT(!cops_timer_pending(&t));
+}
+
+void
+test_timer(void) {
+        tp_cops_timer_fires_on_time();
+        tp_cops_timer_cancel_and_rearm();
+        tp_cops_timer_periodic();
+}
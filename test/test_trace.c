@@ -0,0 +1,109 @@
+#include <unistd.h>
+
+#include "cops.h"
+#include "cops_trace.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+#define TRACE_PATH "/tmp/test_trace.trace"
+
+static void
+tp_cops_trace_roundtrip(void) {
+        info();
+
+        struct cops_trace trace;
+        const struct cops_trace_rec** recs;
+        uint8_t objs[24];
+        uint8_t msg[32];
+        uint8_t ka[8];
+        char* text;
+        size_t len;
+
+        TP_ASSERT(cops_trace_create(&trace, TRACE_PATH, 2, 3, 0) == 0);
+        TP_ASSERT(trace.file->records == 4 && trace.file->record_size == 64);
+
+        struct cops_trace_ring* r0 = cops_trace_ring(&trace);
+        struct cops_trace_ring* r1 = cops_trace_ring(&trace);
+        TP_ASSERT(r0 && r1 && r0 != r1);
+        TP_ASSERT(cops_trace_ring(&trace) == NULL);
+
+        /* A Request on one ring, more Keep-Alives than fit on the other. */
+        cops_handle(objs, "abcd");
+        cops_context(objs + 8);
+        cops_handle(objs + 16, "efgh");
+        new_cops_message(msg, 1, objs, 32);
+        cops_trace_record(r0, COPS_TRACE_RX, 7, msg, 32);
+        cops_keepalive(ka);
+        for (uint32_t i = 0; i < 6; i++)
+                cops_trace_record(r1, COPS_TRACE_TX, 100 + i, ka, 8);
+        cops_trace_close(&trace);
+
+        TP_ASSERT(cops_trace_open(&trace, TRACE_PATH) == 0);
+        TP_ASSERT(cops_trace_ring(&trace) == NULL);
+        TP_ASSERT(cops_trace_records(&trace, &recs) == 5);
+        for (int i = 1; i < 5; i++) {
+                TP_ASSERT(recs[i - 1]->ts_ns <= recs[i]->ts_ns);
+        }
+
+        /* The oldest two Keep-Alives were overwritten. */
+        for (int i = 1; i < 5; i++) {
+                TP_ASSERT(recs[i]->dir == COPS_TRACE_TX && recs[i]->conn_id == 101 + (uint32_t)i);
+                TP_ASSERT(recs[i]->len == 8 && recs[i]->caplen == 8 && recs[i]->data[1] == 9);
+        }
+
+        /* The default snaplen keeps the header, the Handle and the Context, the last object is cut off. */
+        TP_ASSERT(recs[0]->conn_id == 7 && recs[0]->len == 32 && recs[0]->caplen == COPS_TRACE_DEFAULT_SNAPLEN);
+        FILE* out = open_memstream(&text, &len);
+        cops_trace_print(recs[0], out);
+        fclose(out);
+        TP_ASSERT(strstr(text, "Z conn 7 <- REQ len 32 client-type 0x800a (truncated)\n") != NULL);
+        TP_ASSERT(strstr(text, "    Handle                 C-Type 1 len 8    61626364\n") != NULL);
+        TP_ASSERT(strstr(text, "Context") != NULL && strstr(text, "65666768") == NULL);
+        free(text);
+
+        free(recs);
+        cops_trace_close(&trace);
+        unlink(TRACE_PATH);
+}
+
+static void
+tp_cops_trace_torn(void) {
+        info();
+
+        struct cops_trace trace;
+        const struct cops_trace_rec** recs;
+        uint8_t ka[8];
+
+        TP_ASSERT(cops_trace_create(&trace, TRACE_PATH, 1, 8, 1024) == 0);
+
+        struct cops_trace_ring* r = cops_trace_ring(&trace);
+        cops_keepalive(ka);
+        for (uint32_t i = 0; i < 3; i++)
+                cops_trace_record(r, COPS_TRACE_RX, i, ka, 8);
+
+        /* A writer stopped in the middle of the third record: invalidated, head not advanced. */
+        struct cops_trace_rec* rec = (struct cops_trace_rec*)(r->slots + 2 * r->record_size);
+        rec->seq = 0;
+        r->head->head = 2;
+        cops_trace_close(&trace);
+
+        TP_ASSERT(cops_trace_open(&trace, TRACE_PATH) == 0);
+        TP_ASSERT(cops_trace_records(&trace, &recs) == 2);
+        TP_ASSERT(recs[0]->conn_id == 0 && recs[1]->conn_id == 1);
+        free(recs);
+        cops_trace_close(&trace);
+
+        /* Not a trace file. */
+        FILE* f = fopen(TRACE_PATH, "w");
+        fputs("not a trace", f);
+        fclose(f);
+        TP_ASSERT(cops_trace_open(&trace, TRACE_PATH) < 0);
+        unlink(TRACE_PATH);
+}
+
+void
+test_trace(void) {
+        tp_cops_trace_roundtrip();
+        tp_cops_trace_torn();
+}
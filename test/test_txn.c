@@ -0,0 +1,174 @@
+#include "cops_builder.h"
+#include "cops_txn.h"
+#include "pcmm.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+struct txn_log {
+        int calls;
+        enum cops_txn_status status;
+        uint16_t command;
+        void* arg;
+};
+
+static struct txn_log txn_log;
+
+static void
+on_txn(struct cops_txn* txn, enum cops_txn_status status, const struct cops_msg* msg) {
+        txn_log.calls++;
+        txn_log.status = status;
+        txn_log.command = txn->command;
+        txn_log.arg = txn->arg;
+        TP_ASSERT((msg != NULL) == (status == COPS_TXN_ACK || status == COPS_TXN_ERR));
+}
+
+/* Report-State answering a request, as sent by the CMTS. */
+static const struct cops_msg*
+txn_report(struct cops_decoder* dec, uint8_t* buf, size_t cap, uint16_t trans_id, uint16_t command) {
+        const struct cops_msg* msg;
+        struct cops_builder b;
+        struct cops_builder_mark csi;
+        uint8_t obj[16];
+
+        cops_builder_init(&b, buf, cap, 3);
+        cops_builder_object(&b, 1, 1, "hdl1", 4);
+        cops_builder_object(&b, 12, 1, "\0\1\0\0", 4);
+        cops_builder_begin(&b, COPS_CNUM_CLIENT_SI, 1, &csi);
+        cops_builder_append(&b, obj, pcmm_transaction_id(obj, trans_id, command));
+        cops_builder_append(&b, obj, pcmm_gate_id(obj, 0x1234));
+        cops_builder_end(&b, &csi);
+        size_t len = cops_builder_finish(&b);
+
+        cops_decoder_init(dec);
+        TP_ASSERT(cops_decode(dec, buf, len, &msg) == (int)len);
+        return msg;
+}
+
+static void
+tp_cops_txn_pipeline(void) {
+        info();
+
+        struct cops_timer_wheel wheel;
+        struct cops_txn_table t;
+        struct cops_decoder dec;
+        uint8_t buf[128];
+        uint16_t trans_id;
+        uint16_t command;
+
+        cops_timer_wheel_init(&wheel, 10, 0);
+        TP_ASSERT(cops_txn_table_init(&t, 2048, &wheel) == 0);
+
+        /* 1000 Gate-Sets outstanding on each of two connections, answered out of order. */
+        for (int i = 0; i < 1000; i++) {
+                uint16_t id = cops_txn_id(&t);
+                TP_ASSERT(cops_txn_begin(&t, 1, id, PCMM_GATE_SET, 0, on_txn, NULL) != NULL);
+                TP_ASSERT(cops_txn_begin(&t, 2, id, PCMM_GATE_SET, 0, on_txn, NULL) != NULL);
+        }
+        TP_ASSERT(t.count == 2000);
+        TP_ASSERT(cops_txn_begin(&t, 1, 5, PCMM_GATE_SET, 0, on_txn, NULL) == NULL);
+
+        const struct cops_msg* msg = txn_report(&dec, buf, sizeof(buf), 999, PCMM_GATE_SET_ACK);
+        TP_ASSERT(cops_txn_parse(msg, &trans_id, &command));
+        TP_ASSERT(trans_id == 999 && command == PCMM_GATE_SET_ACK);
+
+        for (int i = 999; i >= 0; i--) {
+                msg = txn_report(&dec, buf, sizeof(buf), (uint16_t)i, PCMM_GATE_SET_ACK);
+                TP_ASSERT(cops_txn_complete(&t, 2, msg));
+                TP_ASSERT(cops_txn_find(&t, 2, (uint16_t)i) == NULL);
+                TP_ASSERT(cops_txn_find(&t, 1, (uint16_t)i) != NULL);
+        }
+        TP_ASSERT(txn_log.calls == 1000 && txn_log.status == COPS_TXN_ACK);
+        TP_ASSERT(t.count == 1000);
+
+        /* A response nobody waits for, or no response at all, is not matched. */
+        TP_ASSERT(!cops_txn_complete(&t, 2, msg));
+        msg = txn_report(&dec, buf, sizeof(buf), 1, PCMM_GATE_OPEN);
+        TP_ASSERT(!cops_txn_complete(&t, 1, msg));
+
+        /* Error responses complete with COPS_TXN_ERR. */
+        txn_log.calls = 0;
+        msg = txn_report(&dec, buf, sizeof(buf), 7, PCMM_GATE_SET_ERR);
+        TP_ASSERT(cops_txn_complete(&t, 1, msg));
+        TP_ASSERT(txn_log.calls == 1 && txn_log.status == COPS_TXN_ERR);
+        TP_ASSERT(txn_log.command == PCMM_GATE_SET);
+
+        /* A response to another command carrying the same Transaction ID leaves the request pending. */
+        txn_log.calls = 0;
+        msg = txn_report(&dec, buf, sizeof(buf), 8, PCMM_GATE_DELETE_ACK);
+        TP_ASSERT(!cops_txn_complete(&t, 1, msg));
+        msg = txn_report(&dec, buf, sizeof(buf), 8, PCMM_GATE_INFO_ERR);
+        TP_ASSERT(!cops_txn_complete(&t, 1, msg));
+        TP_ASSERT(txn_log.calls == 0 && cops_txn_find(&t, 1, 8) != NULL);
+        msg = txn_report(&dec, buf, sizeof(buf), 8, PCMM_GATE_SET_ACK);
+        TP_ASSERT(cops_txn_complete(&t, 1, msg));
+        TP_ASSERT(txn_log.calls == 1 && txn_log.status == COPS_TXN_ACK);
+
+        TP_ASSERT(cops_txn_cancel_conn(&t, 1) == 998);
+        TP_ASSERT(txn_log.status == COPS_TXN_CANCELLED);
+        TP_ASSERT(t.count == 0);
+
+        cops_txn_table_free(&t);
+}
+
+static void
+tp_cops_txn_full(void) {
+        info();
+
+        struct cops_txn_table t;
+
+        TP_ASSERT(cops_txn_table_init(&t, 4, NULL) == 0);
+        for (uint16_t i = 0; i < 4; i++) {
+                TP_ASSERT(cops_txn_begin(&t, 1, i, PCMM_GATE_INFO, 0, on_txn, NULL) != NULL);
+        }
+        TP_ASSERT(cops_txn_begin(&t, 1, 4, PCMM_GATE_INFO, 0, on_txn, NULL) == NULL);
+
+        /* A completed slot is handed out again. */
+        txn_log.calls = 0;
+        cops_txn_end(cops_txn_find(&t, 1, 2), COPS_TXN_CANCELLED, NULL);
+        TP_ASSERT(txn_log.calls == 1);
+        TP_ASSERT(cops_txn_begin(&t, 1, 4, PCMM_GATE_INFO, 0, on_txn, NULL) != NULL);
+
+        cops_txn_table_free(&t);
+}
+
+static void
+tp_cops_txn_timeout(void) {
+        info();
+
+        struct cops_timer_wheel wheel;
+        struct cops_txn_table t;
+        struct cops_decoder dec;
+        uint8_t buf[128];
+        int tag;
+
+        cops_timer_wheel_init(&wheel, 10, 1000);
+        TP_ASSERT(cops_txn_table_init(&t, 16, &wheel) == 0);
+
+        TP_ASSERT(cops_txn_begin(&t, 3, 1, PCMM_GATE_DELETE, 50, on_txn, &tag) != NULL);
+        TP_ASSERT(cops_txn_begin(&t, 3, 2, PCMM_GATE_DELETE, 500, on_txn, NULL) != NULL);
+        TP_ASSERT(wheel.count == 2);
+
+        txn_log.calls = 0;
+        cops_timer_advance(&wheel, 1030);
+        TP_ASSERT(txn_log.calls == 0);
+        cops_timer_advance(&wheel, 1100);
+        TP_ASSERT(txn_log.calls == 1 && txn_log.status == COPS_TXN_TIMEOUT);
+        TP_ASSERT(txn_log.arg == &tag);
+
+        /* The late response is ignored, an answered request no longer holds a timer. */
+        const struct cops_msg* msg = txn_report(&dec, buf, sizeof(buf), 1, PCMM_GATE_DELETE_ACK);
+        TP_ASSERT(!cops_txn_complete(&t, 3, msg));
+        msg = txn_report(&dec, buf, sizeof(buf), 2, PCMM_GATE_DELETE_ACK);
+        TP_ASSERT(cops_txn_complete(&t, 3, msg));
+        TP_ASSERT(wheel.count == 0 && t.count == 0);
+
+        cops_txn_table_free(&t);
+}
+
+void
+test_txn(void) {
+        tp_cops_txn_pipeline();
+        tp_cops_txn_full();
+        tp_cops_txn_timeout();
+}
@@ -0,0 +1,158 @@
+#include "cops_builder.h"
+#include "cops_validate.h"
+#include "test_cops.h"
+
+#define info() printf("TEST: %s\n", __func__)
+
+/* Report-State with a Handle, a Report-Type and an optional extra object. */
+static size_t
+build_rpt(uint8_t* dst, size_t cap, uint8_t cnum, uint8_t ctype) {
+        const uint8_t report_type[4] = {0, 1, 0, 0};
+        struct cops_builder b;
+
+        cops_builder_init(&b, dst, cap, 3);
+        cops_builder_object(&b, 1, 1, "abcd", 4);
+        cops_builder_object(&b, 12, 1, report_type, sizeof(report_type));
+        if (cnum)
+                cops_builder_object(&b, cnum, ctype, report_type, sizeof(report_type));
+
+        return cops_builder_finish(&b);
+}
+
+static void
+tp_cops_validate_messages(void) {
+        info();
+
+        uint8_t buf[128];
+        struct cops_builder b;
+        size_t len;
+
+        /* Client-Open with PEP Identification and a padded ClientSI. */
+        cops_builder_init(&b, buf, sizeof(buf), 6);
+        cops_builder_object(&b, 11, 1, "cmts-1", 6);
+        cops_builder_object(&b, 9, 1, "x", 1);
+        len = cops_builder_finish(&b);
+        TP_ASSERT(cops_validate(buf, len, 0, NULL) == COPS_VERR_NONE);
+
+        /* Client-Accept with and without an Accounting Timer. */
+        cops_client_accept(buf, 30, 15);
+        TP_ASSERT(cops_validate(buf, 24, 0, NULL) == COPS_VERR_NONE);
+        cops_client_accept(buf, 30, 0);
+        TP_ASSERT(cops_validate(buf, 16, 0, NULL) == COPS_VERR_NONE);
+
+        cops_keepalive(buf);
+        TP_ASSERT(cops_validate(buf, 8, 0, NULL) == COPS_VERR_NONE);
+
+        /* Decision carrying Client Specific Decision Data. */
+        cops_builder_init(&b, buf, sizeof(buf), 2);
+        cops_builder_object(&b, 1, 1, "abcd", 4);
+        cops_builder_object(&b, 2, 1, "\0\10\0\0", 4);
+        cops_builder_object(&b, 6, 1, "\0\1\0\1", 4);
+        cops_builder_object(&b, COPS_CNUM_DECISION, COPS_CTYPE_CLIENT_SI, "\0\10\1\1\0\0\0\4", 8);
+        len = cops_builder_finish(&b);
+        TP_ASSERT(cops_validate(buf, len, 0, NULL) == COPS_VERR_NONE);
+
+        len = build_rpt(buf, sizeof(buf), 9, 1);
+        TP_ASSERT(cops_validate(buf, len, 0, NULL) == COPS_VERR_NONE);
+
+        /* A longer buffer holding the next message is fine. */
+        TP_ASSERT(cops_validate(buf, sizeof(buf), 0, NULL) == COPS_VERR_NONE);
+}
+
+static void
+tp_cops_validate_header_errors(void) {
+        info();
+
+        uint8_t buf[128];
+        uint32_t off = 0;
+        size_t len = build_rpt(buf, sizeof(buf), 0, 0);
+
+        TP_ASSERT(cops_validate(buf, 4, 0, &off) == COPS_VERR_SHORT);
+        TP_ASSERT(cops_validate(buf, len - 4, 0, &off) == COPS_VERR_SHORT);
+        TP_ASSERT(off == len - 4);
+
+        buf[0] = 0x20;
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_VERSION);
+        TP_ASSERT(off == 0);
+        buf[0] = 0x10;
+
+        /* SSQ and SSC are not PacketCable Multimedia operations. */
+        buf[1] = 5;
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_OPCODE);
+        TP_ASSERT(off == 1);
+        buf[1] = 0;
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_OPCODE);
+        buf[1] = 3;
+
+        buf[3] = 0x0B;
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_CLIENT_TYPE);
+        TP_ASSERT(off == 2);
+        buf[3] = 0x0A;
+
+        /* Keep-Alive MUST carry client type 0. */
+        cops_keepalive(buf);
+        buf[3] = 0x0A;
+        TP_ASSERT(cops_validate(buf, 8, 0, &off) == COPS_VERR_CLIENT_TYPE);
+
+        len = build_rpt(buf, sizeof(buf), 0, 0);
+        buf[7] = (uint8_t)(len + 2);
+        TP_ASSERT(cops_validate(buf, sizeof(buf), 0, &off) == COPS_VERR_LENGTH);
+        TP_ASSERT(off == 4);
+        buf[7] = 4;
+        TP_ASSERT(cops_validate(buf, sizeof(buf), 0, &off) == COPS_VERR_LENGTH);
+        buf[7] = (uint8_t)len;
+
+        /* The length cap is configurable. */
+        TP_ASSERT(cops_validate(buf, len, len, &off) == COPS_VERR_NONE);
+        TP_ASSERT(cops_validate(buf, len, len - 4, &off) == COPS_VERR_LENGTH);
+}
+
+static void
+tp_cops_validate_object_errors(void) {
+        info();
+
+        uint8_t buf[128];
+        uint32_t off = 0;
+        size_t len = build_rpt(buf, sizeof(buf), 9, 1);
+
+        /* Object shorter than its own header. */
+        buf[9] = 2;
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_OBJ_LENGTH);
+        TP_ASSERT(off == 8);
+        buf[9] = 8;
+
+        /* Last object overruns the message. */
+        buf[25] = 12;
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_OBJ_LENGTH);
+        TP_ASSERT(off == 24);
+
+        /* Unknown C-Num, then a C-Type not defined for a known C-Num. */
+        len = build_rpt(buf, sizeof(buf), 17, 1);
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_OBJ_CLASS);
+        TP_ASSERT(off == 24);
+        len = build_rpt(buf, sizeof(buf), 9, 3);
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_OBJ_CLASS);
+        len = build_rpt(buf, sizeof(buf), 0xFF, 0xFF);
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_OBJ_CLASS);
+
+        /* A Keep-Alive Timer belongs in a Client-Accept, not a Report-State. */
+        len = build_rpt(buf, sizeof(buf), 10, 1);
+        TP_ASSERT(cops_validate(buf, len, 0, &off) == COPS_VERR_OBJ_UNEXPECTED);
+        TP_ASSERT(off == 24);
+
+        /* Report-State without its Report-Type. */
+        uint8_t objs[8];
+        cops_handle(objs, "abcd");
+        new_cops_message(buf, 3, objs, 16);
+        TP_ASSERT(cops_validate(buf, 16, 0, &off) == COPS_VERR_OBJ_MISSING);
+        TP_ASSERT(off == 16);
+
+        TP_ASSERT(MATCHES(cops_verr_str(COPS_VERR_OBJ_MISSING), "mandatory object missing"));
+}
+
+void
+test_validate(void) {
+        tp_cops_validate_messages();
+        tp_cops_validate_header_errors();
+        tp_cops_validate_object_errors();
+}
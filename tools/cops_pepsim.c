@@ -0,0 +1,203 @@
+/*
+ * CMTS (PEP) simulator and closed-loop load generator.
+ *
+ * Opens the requested number of COPS sessions to a PDP, spread over one simulator per thread,
+ * and drives REQ, RPT and DRQ traffic for the given duration. Gate-Set decisions are answered
+ * with Gate-Set-Ack (or Gate-Set-Err, see -e) reports. Throughput and REQ to DEC latencies are
+ * reported once every session is open and the run is over.
+ *
+ * With -l the PDP runs in the same process: a sharded runtime (cops_shard.h) on the loopback
+ * interface that answers every REQ with a Gate-Set rendered from a cops_dec_template, so both
+ * ends of the measurement use the library's own encoders.
+ *
+ * With -i every message is signed with a Message Integrity object keyed with the given secret,
+ * Key ID 1, and the PDP's messages must be signed the same way (the loopback PDP is).
+ *
+ * usage: cops_pepsim [-l] [-a addr] [-p port] [-n sessions] [-t threads] [-w window] [-r req/s]
+ *                    [-R rpt/s] [-D drq/s] [-e err_every] [-k ka_timer] [-i secret] [-d seconds]
+ */
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cops_pepsim.h"
+#include "cops_shard.h"
+#include "cops_template.h"
+#include "pcmm.h"
+
+struct pepsim_thread {
+        pthread_t thread;
+        struct cops_pepsim sim;
+        struct cops_pepsim_config cfg;
+        uint64_t duration_ns;
+        uint64_t elapsed_ns;
+        int err;
+};
+
+static struct cops_dec_template pdp_template;
+static struct cops_integrity_key key;
+
+static void
+pdp_on_message(struct cops_server* srv, struct cops_conn* conn, const struct cops_msg* msg) {
+        static const uint8_t subscriber[4] = {10, 0, 0, 1};
+        const struct cops_obj* handle = cops_msg_find(msg, 1, 1);
+
+        if (msg->opcode != 1 || handle == NULL || handle->length != 8)
+                return;
+
+        struct cops_dec_fields f = {(const char*)cops_obj_data(msg, handle), (uint16_t)conn->rx_msgs, 0, subscriber,
+                                    NULL};
+        uint8_t* dst = cops_server_reserve(srv, conn, pdp_template.length);
+
+        if (dst)
+                cops_server_commit(srv, conn, cops_dec_template_render(&pdp_template, dst, &f));
+}
+
+static int
+pdp_start(struct cops_runtime* rt, uint16_t nshards, uint32_t ka_timer, const struct cops_integrity_key* integrity) {
+        static const uint8_t gate_spec[PCMM_GATE_SPEC_LEN] = {0};
+        struct cops_runtime_config cfg = {0};
+        struct cops_dec_layout l = {0};
+        uint8_t profile[24];
+
+        l.command = PCMM_GATE_SET;
+        l.am_tag = 0x1234;
+        l.app_type = 1;
+        l.family = AF_INET;
+        l.gate_spec = gate_spec;
+        l.profile = profile + 4;
+        l.profile_len = pcmm_service_class(profile, PCMM_ENVELOPE_AUTHORIZED, "pepsim") - 4;
+        l.profile_stype = PCMM_STYPE_SERVICE_CLASS_NAME;
+        if (cops_dec_template_init(&pdp_template, &l) < 0)
+                return -1;
+
+        cfg.server.addr = "127.0.0.1";
+        cfg.server.ka_timer = ka_timer;
+        cfg.server.max_conns = 65536;
+        cfg.server.integrity = integrity;
+        cfg.server.cb.on_message = pdp_on_message;
+        cfg.nshards = nshards;
+        return cops_runtime_start(rt, &cfg);
+}
+
+static void*
+pepsim_run(void* arg) {
+        struct pepsim_thread* t = arg;
+        struct cops_pepsim* sim = &t->sim;
+
+        if (cops_pepsim_start(sim, &t->cfg) < 0) {
+                t->err = errno;
+                return NULL;
+        }
+
+        /* The clock starts once every session is open, the handshakes are reported on their own. */
+        while (!cops_pepsim_ready(sim) && sim->stats.closed == 0)
+                if (cops_pepsim_poll(sim, 100) < 0)
+                        break;
+
+        struct cops_pepsim_stats open = sim->stats;
+        memset(&sim->stats, 0, sizeof(sim->stats));
+        sim->stats.open_ns = open.open_ns;
+        sim->stats.accepted = open.accepted;
+        sim->stats.closed = open.closed;
+
+        uint64_t t0 = sim->now_ns;
+        while (sim->now_ns - t0 < t->duration_ns)
+                if (cops_pepsim_poll(sim, 10) < 0)
+                        break;
+
+        t->elapsed_ns = sim->now_ns - t0;
+        cops_pepsim_stop(sim);
+        return NULL;
+}
+
+static void
+usage(const char* name) {
+        fprintf(stderr,
+                "usage: %s [-l] [-a addr] [-p port] [-n sessions] [-t threads] [-w window] [-r req/s]\n"
+                "       [-R rpt/s] [-D drq/s] [-e err_every] [-k ka_timer] [-i secret] [-d seconds]\n",
+                name);
+        exit(2);
+}
+
+int
+main(int argc, char** argv) {
+        struct cops_pepsim_config cfg = {.sessions = 100, .window = 1};
+        static struct cops_pepsim_stats total;
+        struct cops_runtime rt;
+        uint32_t threads = 1;
+        uint32_t duration = 10;
+        uint32_t ka_timer = 30;
+        bool loopback = false;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "la:p:n:t:w:r:R:D:e:k:i:d:")) != -1) {
+                switch (opt) {
+                        case 'l': loopback = true; break;
+                        case 'a': cfg.addr = optarg; break;
+                        case 'p': cfg.port = (uint16_t)atoi(optarg); break;
+                        case 'n': cfg.sessions = (uint32_t)atoi(optarg); break;
+                        case 't': threads = (uint32_t)atoi(optarg); break;
+                        case 'w': cfg.window = (uint32_t)atoi(optarg); break;
+                        case 'r': cfg.req_rate = (uint32_t)atoi(optarg); break;
+                        case 'R': cfg.rpt_rate = (uint32_t)atoi(optarg); break;
+                        case 'D': cfg.drq_rate = (uint32_t)atoi(optarg); break;
+                        case 'e': cfg.err_every = (uint32_t)atoi(optarg); break;
+                        case 'k': ka_timer = (uint32_t)atoi(optarg); break;
+                        case 'i':
+                                cops_integrity_key_init(&key, 1, optarg, strlen(optarg));
+                                cfg.integrity = &key;
+                                break;
+                        case 'd': duration = (uint32_t)atoi(optarg); break;
+                        default:  usage(argv[0]);
+                }
+        }
+        if (optind != argc || threads == 0 || cfg.sessions < threads || (!loopback && cfg.port == 0))
+                usage(argv[0]);
+
+        if (loopback) {
+                if (pdp_start(&rt, (uint16_t)threads, ka_timer, cfg.integrity) < 0) {
+                        perror("cops_runtime_start");
+                        return 1;
+                }
+                cfg.addr = "127.0.0.1";
+                cfg.port = cops_runtime_port(&rt);
+        }
+
+        struct pepsim_thread* t = calloc(threads, sizeof(*t));
+        if (t == NULL) {
+                perror("calloc");
+                return 1;
+        }
+
+        for (uint32_t i = 0; i < threads; i++) {
+                t[i].cfg = cfg;
+                t[i].cfg.sessions = cfg.sessions / threads + (i < cfg.sessions % threads);
+                t[i].duration_ns = (uint64_t)duration * 1000000000;
+                pthread_create(&t[i].thread, NULL, pepsim_run, &t[i]);
+        }
+
+        uint64_t elapsed = 0;
+        int ret = 0;
+        for (uint32_t i = 0; i < threads; i++) {
+                pthread_join(t[i].thread, NULL);
+                if (t[i].err) {
+                        fprintf(stderr, "thread %u: %s\n", i, strerror(t[i].err));
+                        ret = 1;
+                }
+                cops_pepsim_merge(&total, &t[i].sim.stats);
+                if (t[i].elapsed_ns > elapsed)
+                        elapsed = t[i].elapsed_ns;
+        }
+
+        printf("%u sessions on %u threads, window %u, %.1f s\n", cfg.sessions, threads, cfg.window, elapsed / 1e9);
+        cops_pepsim_report(&total, elapsed, stdout);
+
+        if (loopback)
+                cops_runtime_stop(&rt);
+        free(t);
+        return ret;
+}
@@ -0,0 +1,61 @@
+/*
+ * Offline decoder of wire trace files (cops_trace.h).
+ *
+ * Prints every complete record of every ring in timestamp order, optionally only those of one
+ * session. The file is mapped read-only, so it can be read while a server keeps writing to it
+ * or after the server crashed.
+ *
+ * usage: cops_trace [-c conn_id] trace-file
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cops_trace.h"
+
+static void
+usage(const char* name) {
+        fprintf(stderr, "usage: %s [-c conn_id] trace-file\n", name);
+        exit(2);
+}
+
+int
+main(int argc, char** argv) {
+        const struct cops_trace_rec** recs;
+        struct cops_trace trace;
+        long conn_id = -1;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "c:")) != -1) {
+                switch (opt) {
+                        case 'c': conn_id = strtol(optarg, NULL, 10); break;
+                        default: usage(argv[0]);
+                }
+        }
+        if (optind + 1 != argc)
+                usage(argv[0]);
+
+        if (cops_trace_open(&trace, argv[optind]) < 0) {
+                fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+                return 1;
+        }
+
+        ssize_t n = cops_trace_records(&trace, &recs);
+        if (n < 0) {
+                perror("cops_trace_records");
+                cops_trace_close(&trace);
+                return 1;
+        }
+
+        fprintf(stderr, "%u rings, %u records each, %u bytes captured per message, %zd records\n",
+                trace.file->nrings, trace.file->records, trace.file->snaplen, n);
+        for (ssize_t i = 0; i < n; i++)
+                if (conn_id < 0 || recs[i]->conn_id == (uint32_t)conn_id)
+                        cops_trace_print(recs[i], stdout);
+
+        free(recs);
+        cops_trace_close(&trace);
+        return 0;
+}